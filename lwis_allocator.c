@@ -11,105 +11,169 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME "-allocator: " fmt
 
+#include <linux/cpumask.h>
+#include <linux/irqflags.h>
 #include <linux/mm.h>
 #include <linux/mutex.h>
 #include <linux/preempt.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include "lwis_allocator.h"
 #include "lwis_commands.h"
 
-static void allocator_block_pool_free_locked(struct lwis_device *lwis_dev,
-					     struct lwis_allocator_block_pool *block_pool)
+/* Size classes served by the recycling block pools, as log2 of the block size */
+#define MIN_POOL_IDX 13
+#define MAX_POOL_IDX 19
+
+/*
+ * Pool blocks come straight from the page allocator as compound pages, so that
+ * free can tell their size class from the page order without any header and
+ * a block holds exactly its class size.
+ */
+static struct lwis_allocator_block *allocator_block_pages_alloc(int idx)
+{
+	struct page *page;
+
+	/* The smallest class needs pages of at least order 1 to be told from slab */
+	BUILD_BUG_ON(PAGE_SHIFT >= MIN_POOL_IDX);
+	page = alloc_pages(GFP_KERNEL | __GFP_COMP | __GFP_NOWARN, idx - PAGE_SHIFT);
+	if (page == NULL) {
+		return NULL;
+	}
+	return page_address(page);
+}
+
+static void allocator_block_pages_free(struct lwis_allocator_block *block)
 {
-	struct lwis_allocator_block_mgr *block_mgr = lwis_dev->block_mgr;
+	struct page *page = virt_to_page(block);
+
+	__free_pages(page, compound_order(page));
+}
+
+static void allocator_block_pool_free(struct lwis_device *lwis_dev,
+				      struct lwis_allocator_block_pool *block_pool)
+{
+	struct lwis_allocator_magazine *magazine;
+	int cpu;
 
 	if (block_pool == NULL) {
 		dev_err(lwis_dev->dev, "block_pool is NULL\n");
 		return;
 	}
-	if (block_pool->in_use_count != 0 || block_pool->in_use != NULL) {
+	if (atomic_read(&block_pool->in_use_count) != 0) {
 		dev_err(lwis_dev->dev, "block_pool %s still has %d block(s) in use\n",
-			block_pool->name, block_pool->in_use_count);
+			block_pool->name, atomic_read(&block_pool->in_use_count));
+	}
+
+	if (block_pool->magazines != NULL) {
+		for_each_possible_cpu (cpu) {
+			magazine = per_cpu_ptr(block_pool->magazines, cpu);
+			while (magazine->count > 0) {
+				allocator_block_pages_free(magazine->blocks[--magazine->count]);
+			}
+		}
+		free_percpu(block_pool->magazines);
+		block_pool->magazines = NULL;
 	}
 
 	while (block_pool->free != NULL) {
 		struct lwis_allocator_block *curr;
-		struct lwis_allocator_block *block;
-		struct hlist_node *n;
-		int i;
 
 		curr = block_pool->free;
-		hash_for_each_safe (block_mgr->allocated_blocks, i, n, block, node) {
-			if (block->ptr == curr->ptr) {
-				hash_del(&block->node);
-			}
-		}
 		block_pool->free = curr->next;
 		block_pool->free_count--;
-		kvfree(curr->ptr);
-		kfree(curr);
+		allocator_block_pages_free(curr);
 	}
 }
 
+/*
+ * Takes a free block from the magazine of the current CPU, refilling the
+ * magazine from the shared free list when it is empty.
+ */
 static struct lwis_allocator_block *
-allocator_free_block_get_locked(struct lwis_allocator_block_pool *block_pool)
+allocator_free_block_get(struct lwis_allocator_block_mgr *block_mgr,
+			 struct lwis_allocator_block_pool *block_pool)
 {
-	struct lwis_allocator_block *head;
-
-	if (block_pool == NULL) {
-		pr_err("block_pool is NULL\n");
-		return NULL;
-	}
-	if (block_pool->free == NULL) {
-		return NULL;
-	}
+	struct lwis_allocator_magazine *magazine;
+	struct lwis_allocator_block *block = NULL;
+	unsigned long flags;
 
-	head = block_pool->free;
-	block_pool->free = head->next;
-	if (block_pool->free != NULL) {
-		block_pool->free->prev = NULL;
+	local_irq_save(flags);
+	magazine = this_cpu_ptr(block_pool->magazines);
+	if (magazine->count == 0 && READ_ONCE(block_pool->free) != NULL) {
+		spin_lock(&block_mgr->lock);
+		while (magazine->count < LWIS_ALLOCATOR_MAGAZINE_SIZE / 2 &&
+		       block_pool->free != NULL) {
+			block = block_pool->free;
+			block_pool->free = block->next;
+			block_pool->free_count--;
+			magazine->blocks[magazine->count++] = block;
+		}
+		spin_unlock(&block_mgr->lock);
 	}
-	block_pool->free_count--;
-
-	head->next = block_pool->in_use;
-	if (head->next != NULL) {
-		head->next->prev = head;
+	block = NULL;
+	if (magazine->count > 0) {
+		block = magazine->blocks[--magazine->count];
 	}
-	block_pool->in_use = head;
-	block_pool->in_use_count++;
+	local_irq_restore(flags);
 
-	return head;
+	return block;
 }
 
-static void allocator_free_block_put_locked(struct lwis_allocator_block_pool *block_pool,
-					    struct lwis_allocator_block *block)
+/* Counts a block handed out by the pool, recycled or not */
+static void allocator_block_pool_account(struct lwis_allocator_block_pool *block_pool, bool hit)
 {
-	if (block_pool == NULL) {
-		pr_err("block_pool is NULL\n");
-		return;
-	}
-	if (block == NULL) {
-		pr_err("block is NULL\n");
-		return;
-	}
+	int in_use = atomic_inc_return(&block_pool->in_use_count);
+	int high_water = atomic_read(&block_pool->high_water);
 
-	if (block->next != NULL) {
-		block->next->prev = block->prev;
+	while (in_use > high_water) {
+		int old = atomic_cmpxchg(&block_pool->high_water, high_water, in_use);
+		if (old == high_water) {
+			break;
+		}
+		high_water = old;
 	}
-	if (block->prev != NULL) {
-		block->prev->next = block->next;
+
+	if (hit) {
+		atomic64_inc(&block_pool->hits);
 	} else {
-		block_pool->in_use = block->next;
+		atomic64_inc(&block_pool->misses);
 	}
-	block_pool->in_use_count--;
+}
 
-	if (block_pool->free != NULL) {
-		block_pool->free->prev = block;
-	}
-	block->next = block_pool->free;
-	block->prev = NULL;
-	block_pool->free = block;
-	block_pool->free_count++;
+/*
+ * Puts a block back into the magazine of the current CPU. A full magazine
+ * hands its older half over to the shared free list first.
+ */
+static void allocator_free_block_put(struct lwis_allocator_block_mgr *block_mgr,
+				     struct lwis_allocator_block_pool *block_pool,
+				     struct lwis_allocator_block *block)
+{
+	struct lwis_allocator_magazine *magazine;
+	struct lwis_allocator_block *curr;
+	unsigned long flags;
+	int i;
+
+	atomic_dec(&block_pool->in_use_count);
+
+	local_irq_save(flags);
+	magazine = this_cpu_ptr(block_pool->magazines);
+	if (magazine->count == LWIS_ALLOCATOR_MAGAZINE_SIZE) {
+		spin_lock(&block_mgr->lock);
+		for (i = 0; i < LWIS_ALLOCATOR_MAGAZINE_SIZE / 2; i++) {
+			curr = magazine->blocks[i];
+			curr->next = block_pool->free;
+			block_pool->free = curr;
+			block_pool->free_count++;
+		}
+		spin_unlock(&block_mgr->lock);
+		memmove(magazine->blocks, magazine->blocks + LWIS_ALLOCATOR_MAGAZINE_SIZE / 2,
+			(LWIS_ALLOCATOR_MAGAZINE_SIZE - LWIS_ALLOCATOR_MAGAZINE_SIZE / 2) *
+				sizeof(magazine->blocks[0]));
+		magazine->count -= LWIS_ALLOCATOR_MAGAZINE_SIZE / 2;
+	}
+	magazine->blocks[magazine->count++] = block;
+	local_irq_restore(flags);
 }
 
 static struct lwis_allocator_block_pool *
@@ -147,10 +211,99 @@ allocator_get_block_pool(struct lwis_allocator_block_mgr *block_mgr, int idx)
 	return block_pool;
 }
 
+static void allocator_block_pools_free(struct lwis_device *lwis_dev,
+				       struct lwis_allocator_block_mgr *block_mgr)
+{
+	int idx;
+
+	for (idx = MIN_POOL_IDX; idx <= MAX_POOL_IDX; idx++) {
+		allocator_block_pool_free(lwis_dev, allocator_get_block_pool(block_mgr, idx));
+	}
+}
+
+/* Fills the shared free list of the pool up to its reserve */
+static void allocator_block_pool_prewarm(struct lwis_device *lwis_dev,
+					 struct lwis_allocator_block_pool *block_pool, int idx)
+{
+	struct lwis_allocator_block *block;
+
+	while (block_pool->free_count < block_pool->reserve) {
+		block = allocator_block_pages_alloc(idx);
+		if (block == NULL) {
+			dev_warn(lwis_dev->dev, "Prewarm %s stopped at %u/%u blocks\n",
+				 block_pool->name, block_pool->free_count, block_pool->reserve);
+			return;
+		}
+		block->next = block_pool->free;
+		block_pool->free = block;
+		block_pool->free_count++;
+	}
+}
+
+static unsigned long allocator_shrinker_count(struct shrinker *shrinker,
+					      struct shrink_control *sc)
+{
+	struct lwis_allocator_block_mgr *block_mgr =
+		container_of(shrinker, struct lwis_allocator_block_mgr, shrinker);
+	struct lwis_allocator_block_pool *block_pool;
+	unsigned long count = 0;
+	int idx;
+
+	for (idx = MIN_POOL_IDX; idx <= MAX_POOL_IDX; idx++) {
+		block_pool = allocator_get_block_pool(block_mgr, idx);
+		if (READ_ONCE(block_pool->free_count) > block_pool->reserve) {
+			count += READ_ONCE(block_pool->free_count) - block_pool->reserve;
+		}
+	}
+
+	return count ? count : SHRINK_EMPTY;
+}
+
+/*
+ * Frees the blocks of the shared free lists beyond the reserves, largest
+ * blocks first. Blocks cached in the per-CPU magazines are left alone.
+ */
+static unsigned long allocator_shrinker_scan(struct shrinker *shrinker,
+					     struct shrink_control *sc)
+{
+	struct lwis_allocator_block_mgr *block_mgr =
+		container_of(shrinker, struct lwis_allocator_block_mgr, shrinker);
+	struct lwis_allocator_block_pool *block_pool;
+	struct lwis_allocator_block *reclaimed = NULL;
+	struct lwis_allocator_block *block;
+	unsigned long freed = 0;
+	unsigned long flags;
+	int idx;
+
+	spin_lock_irqsave(&block_mgr->lock, flags);
+	for (idx = MAX_POOL_IDX; idx >= MIN_POOL_IDX && freed < sc->nr_to_scan; idx--) {
+		block_pool = allocator_get_block_pool(block_mgr, idx);
+		while (block_pool->free_count > block_pool->reserve && freed < sc->nr_to_scan) {
+			block = block_pool->free;
+			block_pool->free = block->next;
+			block_pool->free_count--;
+			block->next = reclaimed;
+			reclaimed = block;
+			freed++;
+		}
+	}
+	spin_unlock_irqrestore(&block_mgr->lock, flags);
+
+	while (reclaimed != NULL) {
+		block = reclaimed;
+		reclaimed = block->next;
+		allocator_block_pages_free(block);
+	}
+
+	return freed ? freed : SHRINK_STOP;
+}
+
 int lwis_allocator_init(struct lwis_device *lwis_dev)
 {
 	struct lwis_allocator_block_mgr *block_mgr;
+	struct lwis_allocator_block_pool *block_pool;
 	unsigned long flags;
+	int idx;
 
 	if (lwis_dev == NULL) {
 		dev_err(lwis_dev->dev, "lwis_dev is NULL\n");
@@ -174,9 +327,6 @@ int lwis_allocator_init(struct lwis_device *lwis_dev)
 	/* Initialize mutex */
 	spin_lock_init(&block_mgr->lock);
 
-	/* Empty hash table for allocated blocks */
-	hash_init(block_mgr->allocated_blocks);
-
 	/* Initialize block pools */
 	strlcpy(block_mgr->pool_8k.name, "lwis-block-8k", LWIS_MAX_NAME_STRING_LEN);
 	strlcpy(block_mgr->pool_16k.name, "lwis-block-16k", LWIS_MAX_NAME_STRING_LEN);
@@ -187,6 +337,28 @@ int lwis_allocator_init(struct lwis_device *lwis_dev)
 	strlcpy(block_mgr->pool_512k.name, "lwis-block-512k", LWIS_MAX_NAME_STRING_LEN);
 	strlcpy(block_mgr->pool_large.name, "lwis-block-large", LWIS_MAX_NAME_STRING_LEN);
 
+	for (idx = MIN_POOL_IDX; idx <= MAX_POOL_IDX; idx++) {
+		block_pool = allocator_get_block_pool(block_mgr, idx);
+		block_pool->magazines = alloc_percpu(struct lwis_allocator_magazine);
+		if (block_pool->magazines == NULL) {
+			dev_err(lwis_dev->dev, "Allocate %s magazines failed\n", block_pool->name);
+			allocator_block_pools_free(lwis_dev, block_mgr);
+			kfree(block_mgr);
+			return -ENOMEM;
+		}
+		block_pool->reserve = lwis_dev->allocator_reserve[idx - MIN_POOL_IDX];
+		allocator_block_pool_prewarm(lwis_dev, block_pool, idx);
+	}
+
+	block_mgr->shrinker.count_objects = allocator_shrinker_count;
+	block_mgr->shrinker.scan_objects = allocator_shrinker_scan;
+	block_mgr->shrinker.seeks = DEFAULT_SEEKS;
+	if (register_shrinker(&block_mgr->shrinker)) {
+		/* Not fatal, the pools are only trimmed on release then */
+		dev_warn(lwis_dev->dev, "Failed to register allocator shrinker\n");
+		block_mgr->shrinker.scan_objects = NULL;
+	}
+
 	/* Initialize reference count */
 	block_mgr->ref_count = 1;
 
@@ -216,16 +388,20 @@ void lwis_allocator_release(struct lwis_device *lwis_dev)
 		spin_unlock_irqrestore(&block_mgr->lock, flags);
 		return;
 	}
-
-	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_8k);
-	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_16k);
-	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_32k);
-	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_64k);
-	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_128k);
-	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_256k);
-	allocator_block_pool_free_locked(lwis_dev, &block_mgr->pool_512k);
 	spin_unlock_irqrestore(&block_mgr->lock, flags);
 
+	if (block_mgr->shrinker.scan_objects != NULL) {
+		unregister_shrinker(&block_mgr->shrinker);
+	}
+
+	/* No more users, the pools can be torn down without the lock */
+	allocator_block_pools_free(lwis_dev, block_mgr);
+	if (atomic_read(&block_mgr->pool_large.in_use_count) != 0) {
+		dev_err(lwis_dev->dev, "block_pool %s still has %d block(s) in use\n",
+			block_mgr->pool_large.name,
+			atomic_read(&block_mgr->pool_large.in_use_count));
+	}
+
 	kfree(block_mgr);
 	lwis_dev->block_mgr = NULL;
 }
@@ -236,8 +412,6 @@ void *lwis_allocator_allocate(struct lwis_device *lwis_dev, size_t size)
 	struct lwis_allocator_block_pool *block_pool;
 	struct lwis_allocator_block *block;
 	uint32_t idx;
-	size_t block_size;
-	unsigned long flags;
 
 	if (lwis_dev == NULL) {
 		dev_err(lwis_dev->dev, "lwis_dev is NULL\n");
@@ -297,26 +471,14 @@ void *lwis_allocator_allocate(struct lwis_device *lwis_dev, size_t size)
 	 * implementation, I do not cache it due to prevent keeping too much unused
 	 * memory on hand.
 	 */
-	if (idx > 19) {
-		block = kmalloc(sizeof(struct lwis_allocator_block), GFP_KERNEL);
+	if (idx > MAX_POOL_IDX) {
+		block = kvmalloc(size, GFP_KERNEL);
 		if (block == NULL) {
 			dev_err(lwis_dev->dev, "Allocate failed\n");
 			return NULL;
 		}
-		block->type = idx;
-		block->next = NULL;
-		block->prev = NULL;
-		block->ptr = kvmalloc(size, GFP_KERNEL);
-		if (block->ptr == NULL) {
-			dev_err(lwis_dev->dev, "Allocate failed\n");
-			kfree(block);
-			return NULL;
-		}
-		spin_lock_irqsave(&block_mgr->lock, flags);
-		block_mgr->pool_large.in_use_count++;
-		hash_add(block_mgr->allocated_blocks, &block->node, (unsigned long long)block->ptr);
-		spin_unlock_irqrestore(&block_mgr->lock, flags);
-		return block->ptr;
+		atomic_inc(&block_mgr->pool_large.in_use_count);
+		return block;
 	}
 
 	block_pool = allocator_get_block_pool(block_mgr, idx);
@@ -325,50 +487,38 @@ void *lwis_allocator_allocate(struct lwis_device *lwis_dev, size_t size)
 	}
 
 	/* Try to get free block from recycling block pool */
-	spin_lock_irqsave(&block_mgr->lock, flags);
-	block = allocator_free_block_get_locked(block_pool);
-	spin_unlock_irqrestore(&block_mgr->lock, flags);
+	block = allocator_free_block_get(block_mgr, block_pool);
 	if (block != NULL) {
-		return block->ptr;
+		allocator_block_pool_account(block_pool, /*hit=*/true);
+		return block;
 	}
 
 	/* Allocate new block */
-	block = kmalloc(sizeof(struct lwis_allocator_block), GFP_KERNEL);
+	block = allocator_block_pages_alloc(idx);
 	if (block == NULL) {
-		dev_err(lwis_dev->dev, "Allocate failed\n");
-		return NULL;
-	}
-	block->type = idx;
-	block->next = NULL;
-	block->prev = NULL;
-	block_size = 1 << idx;
-	block->ptr = kvmalloc(block_size, GFP_KERNEL);
-	if (block->ptr == NULL) {
-		dev_err(lwis_dev->dev, "Allocate failed\n");
-		kfree(block);
-		return NULL;
-	}
-
-	spin_lock_irqsave(&block_mgr->lock, flags);
-	block->next = block_pool->in_use;
-	if (block->next != NULL) {
-		block->next->prev = block;
+		/*
+		 * Out of contiguous pages, fall back to vmalloc. Such a block is
+		 * freed like a large one instead of being recycled.
+		 */
+		block = vmalloc(1 << idx);
+		if (block == NULL) {
+			dev_err(lwis_dev->dev, "Allocate failed\n");
+			return NULL;
+		}
+		atomic_inc(&block_mgr->pool_large.in_use_count);
+		return block;
 	}
-	block_pool->in_use = block;
-	block_pool->in_use_count++;
-	hash_add(block_mgr->allocated_blocks, &block->node, (unsigned long long)block->ptr);
-	spin_unlock_irqrestore(&block_mgr->lock, flags);
+	allocator_block_pool_account(block_pool, /*hit=*/false);
 
-	return block->ptr;
+	return block;
 }
 
 void lwis_allocator_free(struct lwis_device *lwis_dev, void *ptr)
 {
 	struct lwis_allocator_block_mgr *block_mgr;
 	struct lwis_allocator_block_pool *block_pool;
-	struct lwis_allocator_block *block = NULL;
-	struct lwis_allocator_block *blk;
-	unsigned long flags;
+	struct page *page;
+	int idx;
 
 	if (lwis_dev == NULL || ptr == NULL) {
 		dev_err(lwis_dev->dev, "input is NULL\n");
@@ -379,45 +529,37 @@ void lwis_allocator_free(struct lwis_device *lwis_dev, void *ptr)
 		dev_err(lwis_dev->dev, "block_mgr is NULL\n");
 		return;
 	}
-	hash_for_each_possible (block_mgr->allocated_blocks, blk, node, (unsigned long long)ptr) {
-		if (blk->ptr == ptr) {
-			block = blk;
-			break;
-		}
+
+	/* Allocations of size zero get ZERO_SIZE_PTR from kmalloc */
+	if (ptr == ZERO_SIZE_PTR) {
+		return;
 	}
 
-	if (block == NULL) {
+	if (is_vmalloc_addr(ptr)) {
+		vfree(ptr);
+		atomic_dec(&block_mgr->pool_large.in_use_count);
+		return;
+	}
+
+	/* The kind of allocation and its size class follow from the backing pages */
+	page = virt_to_head_page(ptr);
+	if (PageSlab(page)) {
 		kfree(ptr);
 		return;
 	}
 
-	if (block->type > 19) {
-		struct lwis_allocator_block *b;
-		struct hlist_node *n;
-		spin_lock_irqsave(&block_mgr->lock, flags);
-		hash_for_each_possible_safe (block_mgr->allocated_blocks, b, n, node,
-					     (unsigned long long)ptr) {
-			if (b->ptr == block->ptr) {
-				hash_del(&b->node);
-				break;
-			}
-		}
-		kvfree(block->ptr);
-		kfree(block);
-		block_mgr->pool_large.in_use_count--;
-		spin_unlock_irqrestore(&block_mgr->lock, flags);
+	idx = PAGE_SHIFT + compound_order(page);
+	if (idx > MAX_POOL_IDX) {
+		kfree(ptr);
+		atomic_dec(&block_mgr->pool_large.in_use_count);
 		return;
 	}
 
-	block_pool = allocator_get_block_pool(block_mgr, block->type);
+	block_pool = allocator_get_block_pool(block_mgr, idx);
 	if (block_pool == NULL) {
 		dev_err(lwis_dev->dev, "block type is invalid\n");
 		return;
 	}
 
-	spin_lock_irqsave(&block_mgr->lock, flags);
-	allocator_free_block_put_locked(block_pool, block);
-	spin_unlock_irqrestore(&block_mgr->lock, flags);
-
-	return;
+	allocator_free_block_put(block_mgr, block_pool, ptr);
 }
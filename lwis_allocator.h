@@ -12,24 +12,47 @@
 #ifndef LWIS_ALLOCATOR_H_
 #define LWIS_ALLOCATOR_H_
 
+#include <linux/atomic.h>
 #include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/shrinker.h>
 #include "lwis_commands.h"
 #include "lwis_device.h"
 
+/* Blocks held by a CPU before they go back to the shared free list */
+#define LWIS_ALLOCATOR_MAGAZINE_SIZE 8
+
+/*
+ * Free pool block, overlaid on the start of the block while it sits in a free
+ * list. Blocks in use carry no header, free derives the size class from the
+ * backing pages.
+ */
 struct lwis_allocator_block {
-	int type;
-	void *ptr;
+	/* Next block in the shared free list */
 	struct lwis_allocator_block *next;
-	struct lwis_allocator_block *prev;
-	struct hlist_node node;
+};
+
+/* Per-CPU stack of free blocks, accessed with local interrupts disabled */
+struct lwis_allocator_magazine {
+	int count;
+	struct lwis_allocator_block *blocks[LWIS_ALLOCATOR_MAGAZINE_SIZE];
 };
 
 struct lwis_allocator_block_pool {
 	char name[LWIS_MAX_NAME_STRING_LEN];
+	/* Shared free list, protected by block_mgr->lock */
 	struct lwis_allocator_block *free;
 	uint32_t free_count;
-	struct lwis_allocator_block *in_use;
-	uint32_t in_use_count;
+	atomic_t in_use_count;
+	struct lwis_allocator_magazine __percpu *magazines;
+	/* Free blocks allocated up front and kept through memory pressure */
+	uint32_t reserve;
+	/* Allocations served from recycled blocks */
+	atomic64_t hits;
+	/* Allocations that needed a new block */
+	atomic64_t misses;
+	/* Highest number of blocks in use at once */
+	atomic_t high_water;
 };
 
 struct lwis_allocator_block_mgr {
@@ -42,19 +65,24 @@ struct lwis_allocator_block_mgr {
 	struct lwis_allocator_block_pool pool_256k;
 	struct lwis_allocator_block_pool pool_512k;
 	struct lwis_allocator_block_pool pool_large;
-	/* Hash table of allocated buffers keyed by allocated addresses */
-	DECLARE_HASHTABLE(allocated_blocks, BUFFER_HASH_BITS);
+	/* Returns free blocks beyond the reserves under memory pressure */
+	struct shrinker shrinker;
 	int ref_count;
 };
 
 /*
- *  lwis_allocator_init: Initialize the recycling memory allocator
+ *  lwis_allocator_init: Initialize the recycling memory allocator, and fill
+ *  the block pools with the reserves set in lwis_dev->allocator_reserve
+ *
+ *  Assumes: lwis_dev->client_lock is locked
  */
 int lwis_allocator_init(struct lwis_device *lwis_dev);
 
 /*
  *  lwis_allocator_release: Release the recycling memory allocator
  *  and its resources
+ *
+ *  Assumes: lwis_dev->client_lock is locked
  */
 void lwis_allocator_release(struct lwis_device *lwis_dev);
 
@@ -0,0 +1,132 @@
+/*
+ * Google LWIS In-Kernel Microbenchmarks
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-benchmark: " fmt
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/slab.h>
+
+#include "lwis_allocator.h"
+#include "lwis_benchmark.h"
+#include "lwis_commands.h"
+#include "lwis_event.h"
+
+/* Bumped whenever the output format changes */
+#define BENCHMARK_FORMAT_VERSION 1
+#define BENCHMARK_ITERATIONS 1000
+/* Untimed runs filling the caches and the allocator pools first */
+#define BENCHMARK_WARMUP_ITERATIONS 16
+
+/* Covers the slab path and every block pool of the allocator */
+static const size_t allocator_sizes[] = { 2 * 1024,   4 * 1024,   8 * 1024,   16 * 1024,
+					  32 * 1024,  64 * 1024,  128 * 1024, 256 * 1024,
+					  512 * 1024, 1024 * 1024 };
+
+static int bench_allocator(struct lwis_device *lwis_dev, size_t size, bool use_kmalloc,
+			   int64_t *ns_per_op)
+{
+	int i;
+	void *ptr;
+	int64_t start_ns = 0;
+
+	for (i = -BENCHMARK_WARMUP_ITERATIONS; i < BENCHMARK_ITERATIONS; ++i) {
+		if (i == 0) {
+			start_ns = ktime_get_ns();
+		}
+		ptr = use_kmalloc ? kmalloc(size, GFP_KERNEL) :
+				    lwis_allocator_allocate(lwis_dev, size);
+		if (!ptr) {
+			return -ENOMEM;
+		}
+		if (use_kmalloc) {
+			kfree(ptr);
+		} else {
+			lwis_allocator_free(lwis_dev, ptr);
+		}
+	}
+	*ns_per_op = div_s64(ktime_get_ns() - start_ns, BENCHMARK_ITERATIONS);
+	return 0;
+}
+
+static void bench_event_emit(struct lwis_device *lwis_dev, int64_t *ns_per_op)
+{
+	int i;
+	int64_t start_ns = 0;
+	int64_t event_id =
+		LWIS_EVENT_ID_HEARTBEAT | (int64_t)lwis_dev->id << LWIS_EVENT_ID_EVENT_CODE_LEN;
+
+	for (i = -BENCHMARK_WARMUP_ITERATIONS; i < BENCHMARK_ITERATIONS; ++i) {
+		if (i == 0) {
+			start_ns = ktime_get_ns();
+		}
+		lwis_device_event_emit(lwis_dev, event_id, /*payload=*/NULL, /*payload_size=*/0,
+				       /*in_irq=*/false);
+	}
+	*ns_per_op = div_s64(ktime_get_ns() - start_ns, BENCHMARK_ITERATIONS);
+}
+
+int lwis_benchmark_run(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+{
+	int i;
+	int ret = 0;
+	size_t len;
+	int64_t kmalloc_ns;
+	int64_t allocator_ns;
+	int64_t emit_ns;
+
+	mutex_lock(&lwis_dev->client_lock);
+	/* Emitting events or draining the pools would disturb running clients */
+	if (lwis_dev->enabled > 0 || !list_empty(&lwis_dev->clients)) {
+		mutex_unlock(&lwis_dev->client_lock);
+		dev_err(lwis_dev->dev, "Benchmark needs the device to have no client\n");
+		return -EBUSY;
+	}
+
+	len = scnprintf(buffer, buffer_size, "lwis_benchmark version=%d device=%s iterations=%d\n",
+			BENCHMARK_FORMAT_VERSION, lwis_dev->name, BENCHMARK_ITERATIONS);
+
+	ret = lwis_allocator_init(lwis_dev);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to initialize the allocator (%d)\n", ret);
+		goto exit;
+	}
+	for (i = 0; i < ARRAY_SIZE(allocator_sizes); ++i) {
+		ret = bench_allocator(lwis_dev, allocator_sizes[i], /*use_kmalloc=*/true,
+				      &kmalloc_ns);
+		if (!ret) {
+			ret = bench_allocator(lwis_dev, allocator_sizes[i], /*use_kmalloc=*/false,
+					      &allocator_ns);
+		}
+		if (ret) {
+			dev_err(lwis_dev->dev, "Allocation of %zu bytes failed\n",
+				allocator_sizes[i]);
+			break;
+		}
+		len += scnprintf(buffer + len, buffer_size - len,
+				 "allocator_alloc_free size=%zu ns_per_op=%lld kmalloc_ns_per_op=%lld\n",
+				 allocator_sizes[i], allocator_ns, kmalloc_ns);
+	}
+	lwis_allocator_release(lwis_dev);
+	if (ret) {
+		goto exit;
+	}
+
+	bench_event_emit(lwis_dev, &emit_ns);
+	len += scnprintf(buffer + len, buffer_size - len,
+			 "device_event_emit clients=0 ns_per_op=%lld\n", emit_ns);
+	/* Leave no trace of the emitted events, as the last close would */
+	lwis_device_event_states_clear_locked(lwis_dev);
+
+exit:
+	mutex_unlock(&lwis_dev->client_lock);
+	return ret;
+}
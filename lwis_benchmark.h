@@ -0,0 +1,27 @@
+/*
+ * Google LWIS In-Kernel Microbenchmarks
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_BENCHMARK_H_
+#define LWIS_BENCHMARK_H_
+
+#include "lwis_device.h"
+
+/*
+ * lwis_benchmark_run: Times allocator alloc/free against kmalloc, and event
+ * emission with no client subscribed, on an idle device. Prints one
+ * "<name> <key>=<value>..." line per result into buffer.
+ *
+ * Locks: lwis_dev->client_lock
+ * Alloc: Yes
+ * Returns: 0 on success, -EBUSY if the device has clients
+ */
+int lwis_benchmark_run(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size);
+
+#endif /* LWIS_BENCHMARK_H_ */
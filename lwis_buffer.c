@@ -11,12 +11,14 @@
 #define pr_fmt(fmt) KBUILD_MODNAME "-buffer: " fmt
 
 #include <linux/fs.h>
+#include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <soc/google/pt.h>
 
 #include "lwis_buffer.h"
 #include "lwis_device.h"
 #include "lwis_device_slc.h"
+#include "lwis_dma_pool.h"
 #include "lwis_platform_dma.h"
 
 static struct lwis_buffer_enrollment_list *enrollment_list_find(struct lwis_client *client,
@@ -110,9 +112,10 @@ int lwis_buffer_alloc(struct lwis_client *lwis_client, struct lwis_alloc_buffer_
 		}
 	} else {
 		alloc_info->size = PAGE_ALIGN(alloc_info->size);
-		dma_buf = lwis_platform_dma_buffer_alloc(alloc_info->size, alloc_info->flags);
+		dma_buf = lwis_dma_pool_alloc(lwis_client->lwis_dev, alloc_info->size,
+					      alloc_info->flags);
 		if (IS_ERR_OR_NULL(dma_buf)) {
-			pr_err("lwis_platform_dma_buffer_alloc failed (%ld)\n", PTR_ERR(dma_buf));
+			pr_err("lwis_dma_pool_alloc failed (%ld)\n", PTR_ERR(dma_buf));
 			return -ENOMEM;
 		}
 
@@ -138,6 +141,8 @@ int lwis_buffer_alloc(struct lwis_client *lwis_client, struct lwis_alloc_buffer_
 	buffer->fd = alloc_info->dma_fd;
 	buffer->size = alloc_info->size;
 	buffer->dma_buf = dma_buf;
+	buffer->flags = alloc_info->flags;
+	buffer->cached = dma_buf && (alloc_info->flags & LWIS_DMA_BUFFER_CACHED);
 	hash_add(lwis_client->allocated_buffers, &buffer->node, buffer->fd);
 
 	return 0;
@@ -162,17 +167,233 @@ int lwis_buffer_free(struct lwis_client *lwis_client, struct lwis_allocated_buff
 			return -EINVAL;
 		}
 	} else {
-		dma_buf_put(buffer->dma_buf);
+		lwis_buffer_kernel_map_drop(lwis_client, buffer->dma_buf);
+		/* Kept for the next allocation of the same size and flags */
+		lwis_dma_pool_free(lwis_client->lwis_dev, buffer->dma_buf, buffer->flags);
 	}
 	hash_del(&buffer->node);
 	return 0;
 }
 
+static void enroll_cache_entry_release(struct lwis_device *lwis_dev,
+				       struct lwis_buffer_enroll_cache_entry *entry)
+{
+	lwis_platform_dma_buffer_unmap(lwis_dev, entry->dma_buf_attachment, entry->dma_vaddr);
+	dma_buf_unmap_attachment(entry->dma_buf_attachment, entry->sg_table,
+				 entry->dma_direction);
+	dma_buf_detach(entry->dma_buf, entry->dma_buf_attachment);
+	dma_buf_put(entry->dma_buf);
+	kfree(entry);
+}
+
+static void enroll_cache_entries_release(struct lwis_device *lwis_dev, struct list_head *entries)
+{
+	struct lwis_buffer_enroll_cache_entry *entry, *tmp;
+
+	list_for_each_entry_safe (entry, tmp, entries, node) {
+		list_del(&entry->node);
+		enroll_cache_entry_release(lwis_dev, entry);
+	}
+}
+
+/*
+ * Hands the cached mapping of the dma-buf over to the buffer, if there is one
+ * with the same direction. Returns true if the buffer got a mapping.
+ */
+static bool enroll_cache_take(struct lwis_device *lwis_dev, struct lwis_enrolled_buffer *buffer)
+{
+	struct lwis_buffer_enroll_cache *cache = lwis_dev->enroll_cache;
+	struct lwis_buffer_enroll_cache_entry *entry;
+	struct lwis_buffer_enroll_cache_entry *found = NULL;
+
+	if (!cache) {
+		return false;
+	}
+
+	mutex_lock(&cache->lock);
+	list_for_each_entry (entry, &cache->lru, node) {
+		if (entry->dma_buf == buffer->dma_buf &&
+		    entry->dma_direction == buffer->dma_direction) {
+			list_del(&entry->node);
+			cache->count--;
+			found = entry;
+			break;
+		}
+	}
+	mutex_unlock(&cache->lock);
+
+	if (!found) {
+		return false;
+	}
+	buffer->dma_buf_attachment = found->dma_buf_attachment;
+	buffer->sg_table = found->sg_table;
+	/* The buffer already holds its own reference to the dma-buf */
+	dma_buf_put(found->dma_buf);
+	kfree(found);
+	return true;
+}
+
+/*
+ * Keeps the mapping of a disenrolled buffer in the cache, evicting the least
+ * recently disenrolled entry if the cache is full. Returns true if the cache
+ * took over the mapping and the buffer's reference to the dma-buf.
+ */
+static bool enroll_cache_put(struct lwis_device *lwis_dev, struct lwis_enrolled_buffer *buffer)
+{
+	struct lwis_buffer_enroll_cache *cache = lwis_dev->enroll_cache;
+	struct lwis_buffer_enroll_cache_entry *entry;
+	struct lwis_buffer_enroll_cache_entry *evicted = NULL;
+
+	if (!cache) {
+		return false;
+	}
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (!entry) {
+		return false;
+	}
+	entry->dma_buf = buffer->dma_buf;
+	entry->dma_buf_attachment = buffer->dma_buf_attachment;
+	entry->sg_table = buffer->sg_table;
+	entry->dma_direction = buffer->dma_direction;
+	entry->dma_vaddr = buffer->info.dma_vaddr;
+
+	mutex_lock(&cache->lock);
+	if (cache->count == cache->capacity) {
+		evicted = list_first_entry(&cache->lru, struct lwis_buffer_enroll_cache_entry,
+					   node);
+		list_del(&evicted->node);
+		cache->count--;
+	}
+	list_add_tail(&entry->node, &cache->lru);
+	cache->count++;
+	mutex_unlock(&cache->lock);
+
+	if (evicted) {
+		enroll_cache_entry_release(lwis_dev, evicted);
+	}
+	return true;
+}
+
+static unsigned long enroll_cache_shrinker_count(struct shrinker *shrinker,
+						 struct shrink_control *sc)
+{
+	struct lwis_buffer_enroll_cache *cache =
+		container_of(shrinker, struct lwis_buffer_enroll_cache, shrinker);
+	int count = READ_ONCE(cache->count);
+
+	return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long enroll_cache_shrinker_scan(struct shrinker *shrinker,
+						struct shrink_control *sc)
+{
+	struct lwis_buffer_enroll_cache *cache =
+		container_of(shrinker, struct lwis_buffer_enroll_cache, shrinker);
+	struct lwis_buffer_enroll_cache_entry *entry;
+	struct list_head evicted;
+	unsigned long freed = 0;
+
+	/* Enrolling may be reclaiming memory with the lock held */
+	if (!mutex_trylock(&cache->lock)) {
+		return SHRINK_STOP;
+	}
+	INIT_LIST_HEAD(&evicted);
+	while (!list_empty(&cache->lru) && freed < sc->nr_to_scan) {
+		entry = list_first_entry(&cache->lru, struct lwis_buffer_enroll_cache_entry, node);
+		list_move_tail(&entry->node, &evicted);
+		cache->count--;
+		freed++;
+	}
+	mutex_unlock(&cache->lock);
+
+	enroll_cache_entries_release(cache->lwis_dev, &evicted);
+	return freed ? freed : SHRINK_STOP;
+}
+
+int lwis_buffer_enroll_cache_create(struct lwis_device *lwis_dev, int capacity)
+{
+	struct lwis_buffer_enroll_cache *cache;
+
+	if (capacity <= 0) {
+		pr_err("Invalid enroll cache capacity %d\n", capacity);
+		return -EINVAL;
+	}
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		pr_err("Failed to allocate enroll cache\n");
+		return -ENOMEM;
+	}
+	cache->lwis_dev = lwis_dev;
+	mutex_init(&cache->lock);
+	INIT_LIST_HEAD(&cache->lru);
+	cache->capacity = capacity;
+
+	cache->shrinker.count_objects = enroll_cache_shrinker_count;
+	cache->shrinker.scan_objects = enroll_cache_shrinker_scan;
+	cache->shrinker.seeks = DEFAULT_SEEKS;
+	/* Not fatal, the cache is then only bounded by its capacity */
+	cache->shrinker_registered = (register_shrinker(&cache->shrinker) == 0);
+	if (!cache->shrinker_registered) {
+		pr_warn("Failed to register enroll cache shrinker\n");
+	}
+
+	lwis_dev->enroll_cache = cache;
+	return 0;
+}
+
+void lwis_buffer_enroll_cache_destroy(struct lwis_device *lwis_dev)
+{
+	struct lwis_buffer_enroll_cache *cache = lwis_dev->enroll_cache;
+
+	if (!cache) {
+		return;
+	}
+	if (cache->shrinker_registered) {
+		unregister_shrinker(&cache->shrinker);
+	}
+	enroll_cache_entries_release(lwis_dev, &cache->lru);
+	kfree(cache);
+	lwis_dev->enroll_cache = NULL;
+}
+
+static int enrolled_buffer_map(struct lwis_client *lwis_client,
+			       struct lwis_enrolled_buffer *buffer)
+{
+	buffer->dma_buf_attachment =
+		dma_buf_attach(buffer->dma_buf, &lwis_client->lwis_dev->plat_dev->dev);
+	if (IS_ERR_OR_NULL(buffer->dma_buf_attachment)) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"Could not attach dma buffer for fd: %d (errno: %ld)", buffer->info.fd,
+			PTR_ERR(buffer->dma_buf_attachment));
+		return PTR_ERR(buffer->dma_buf_attachment);
+	}
+
+	buffer->sg_table =
+		dma_buf_map_attachment(buffer->dma_buf_attachment, buffer->dma_direction);
+	if (IS_ERR_OR_NULL(buffer->sg_table)) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"Could not map dma attachment for fd: %d (errno: %ld)", buffer->info.fd,
+			PTR_ERR(buffer->sg_table));
+		if (PTR_ERR(buffer->sg_table) == -ENOMEM) {
+			lwis_device_info_dump("Enroll buffer sizes",
+					      dump_total_enrolled_buffer_size);
+		}
+		dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
+		return PTR_ERR(buffer->sg_table);
+	}
+
+	return 0;
+}
+
 int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer)
 {
 	struct lwis_buffer_enrollment_list *enrollment_list;
 	struct list_head *it_enrollment;
 	struct lwis_enrolled_buffer *old_buffer;
+	unsigned long flags;
+	int ret;
 
 	if (!lwis_client) {
 		pr_err("Enroll: LWIS client is NULL\n");
@@ -206,29 +427,13 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
 		return PTR_ERR(buffer->dma_buf);
 	}
 
-	buffer->dma_buf_attachment =
-		dma_buf_attach(buffer->dma_buf, &lwis_client->lwis_dev->plat_dev->dev);
-	if (IS_ERR_OR_NULL(buffer->dma_buf_attachment)) {
-		dev_err(lwis_client->lwis_dev->dev,
-			"Could not attach dma buffer for fd: %d (errno: %ld)", buffer->info.fd,
-			PTR_ERR(buffer->dma_buf_attachment));
-		dma_buf_put(buffer->dma_buf);
-		return PTR_ERR(buffer->dma_buf_attachment);
-	}
-
-	buffer->sg_table =
-		dma_buf_map_attachment(buffer->dma_buf_attachment, buffer->dma_direction);
-	if (IS_ERR_OR_NULL(buffer->sg_table)) {
-		dev_err(lwis_client->lwis_dev->dev,
-			"Could not map dma attachment for fd: %d (errno: %ld)", buffer->info.fd,
-			PTR_ERR(buffer->sg_table));
-		if (PTR_ERR(buffer->sg_table) == -ENOMEM) {
-			lwis_device_info_dump("Enroll buffer sizes",
-					      dump_total_enrolled_buffer_size);
+	/* Reuse the mapping kept from an earlier enrollment of the same buffer */
+	if (!enroll_cache_take(lwis_client->lwis_dev, buffer)) {
+		ret = enrolled_buffer_map(lwis_client, buffer);
+		if (ret) {
+			dma_buf_put(buffer->dma_buf);
+			return ret;
 		}
-		dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
-		dma_buf_put(buffer->dma_buf);
-		return PTR_ERR(buffer->sg_table);
 	}
 
 	buffer->info.dma_vaddr = sg_dma_address(buffer->sg_table->sgl);
@@ -259,6 +464,12 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
 	list_add_tail(&buffer->list_node, &enrollment_list->list);
 	buffer->enrollment_list = enrollment_list;
 
+	buffer->range_node.start = buffer->info.dma_vaddr;
+	buffer->range_node.last = buffer->info.dma_vaddr + buffer->dma_buf->size - 1;
+	spin_lock_irqsave(&lwis_client->lwis_dev->lock, flags);
+	interval_tree_insert(&buffer->range_node, &lwis_client->enrolled_buffer_tree);
+	spin_unlock_irqrestore(&lwis_client->lwis_dev->lock, flags);
+
 	return 0;
 err:
 	dma_buf_unmap_attachment(buffer->dma_buf_attachment, buffer->sg_table,
@@ -270,6 +481,8 @@ err:
 
 int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer)
 {
+	unsigned long flags;
+
 	if (!lwis_client) {
 		pr_err("Disenroll: LWIS client is NULL\n");
 		return -ENODEV;
@@ -279,12 +492,22 @@ int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_
 		return -EINVAL;
 	}
 
-	lwis_platform_dma_buffer_unmap(lwis_client->lwis_dev, buffer->dma_buf_attachment,
-				       buffer->info.dma_vaddr);
-	dma_buf_unmap_attachment(buffer->dma_buf_attachment, buffer->sg_table,
-				 buffer->dma_direction);
-	dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
-	dma_buf_put(buffer->dma_buf);
+	spin_lock_irqsave(&lwis_client->lwis_dev->lock, flags);
+	interval_tree_remove(&buffer->range_node, &lwis_client->enrolled_buffer_tree);
+	spin_unlock_irqrestore(&lwis_client->lwis_dev->lock, flags);
+
+	lwis_buffer_kernel_map_drop(lwis_client, buffer->dma_buf);
+
+	/* Keep the mapping around for the next enrollment, if the device caches
+	 * them. Otherwise tear it down. */
+	if (!enroll_cache_put(lwis_client->lwis_dev, buffer)) {
+		lwis_platform_dma_buffer_unmap(lwis_client->lwis_dev, buffer->dma_buf_attachment,
+					       buffer->info.dma_vaddr);
+		dma_buf_unmap_attachment(buffer->dma_buf_attachment, buffer->sg_table,
+					 buffer->dma_direction);
+		dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
+		dma_buf_put(buffer->dma_buf);
+	}
 	/* Delete the node from the hash table */
 	list_del(&buffer->list_node);
 	if (list_empty(&buffer->enrollment_list->list)) {
@@ -321,9 +544,38 @@ struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find(struct lwis_client
 	return NULL;
 }
 
+struct lwis_enrolled_buffer *
+lwis_client_enrolled_buffer_find_range(struct lwis_client *lwis_client, dma_addr_t dma_vaddr,
+				       size_t size)
+{
+	struct interval_tree_node *node;
+	dma_addr_t last;
+
+	if (!lwis_client) {
+		pr_err("lwis_client_enrolled_buffer_find_range: LWIS client is NULL\n");
+		return NULL;
+	}
+	if (size == 0 || dma_vaddr + size - 1 < dma_vaddr) {
+		return NULL;
+	}
+
+	/* Any buffer containing the range overlaps its first byte */
+	last = dma_vaddr + size - 1;
+	for (node = interval_tree_iter_first(&lwis_client->enrolled_buffer_tree, dma_vaddr,
+					     dma_vaddr);
+	     node; node = interval_tree_iter_next(node, dma_vaddr, dma_vaddr)) {
+		if (node->last >= last) {
+			return container_of(node, struct lwis_enrolled_buffer, range_node);
+		}
+	}
+
+	return NULL;
+}
+
 int lwis_buffer_cpu_access(struct lwis_client *lwis_client, struct lwis_buffer_cpu_access_op *op)
 {
 	struct dma_buf *dma_buf;
+	struct lwis_allocated_buffer *allocated_buffer;
 	enum dma_data_direction dma_direction;
 	int ret = 0;
 
@@ -352,6 +604,14 @@ int lwis_buffer_cpu_access(struct lwis_client *lwis_client, struct lwis_buffer_c
 		return -EINVAL;
 	}
 
+	/* Uncached buffers are coherent for the CPU, there is nothing to
+	 * maintain. Buffers from elsewhere are assumed to be cached. */
+	allocated_buffer = lwis_client_allocated_buffer_find(lwis_client, op->fd);
+	if (allocated_buffer && allocated_buffer->dma_buf == dma_buf && !allocated_buffer->cached) {
+		dma_buf_put(dma_buf);
+		return 0;
+	}
+
 	if (op->start) {
 		ret = dma_buf_begin_cpu_access_partial(dma_buf, dma_direction, op->offset, op->len);
 	} else {
@@ -430,3 +690,227 @@ int lwis_client_allocated_buffers_clear(struct lwis_client *lwis_client)
 	}
 	return 0;
 }
+
+/* Checks that dma_buf is allocated or enrolled by this client */
+static bool is_client_buffer(struct lwis_client *lwis_client, int fd, struct dma_buf *dma_buf)
+{
+	struct lwis_allocated_buffer *allocated_buffer;
+	struct lwis_buffer_enrollment_list *enrollment_list;
+	struct lwis_enrolled_buffer *buffer;
+	struct list_head *it_enrollment;
+	int i;
+
+	allocated_buffer = lwis_client_allocated_buffer_find(lwis_client, fd);
+	if (allocated_buffer && allocated_buffer->dma_buf == dma_buf) {
+		return true;
+	}
+
+	hash_for_each (lwis_client->enrolled_buffers, i, enrollment_list, node) {
+		list_for_each (it_enrollment, &enrollment_list->list) {
+			buffer = list_entry(it_enrollment, struct lwis_enrolled_buffer, list_node);
+			if (buffer->dma_buf == dma_buf) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void kernel_map_vunmap(struct lwis_buffer_kernel_map *map)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+	dma_buf_vunmap_unlocked(map->dma_buf, &map->map);
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+	dma_buf_vunmap(map->dma_buf, &map->map);
+#else
+	dma_buf_vunmap(map->dma_buf, map->vaddr);
+#endif
+}
+
+/* Maps the buffer through its exporter, which knows how its memory may be
+ * mapped, rather than vmapping the pages behind the importer's sg_table */
+static int kernel_map_vmap(struct lwis_buffer_kernel_map *map)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+	int ret;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 2, 0)
+	ret = dma_buf_vmap_unlocked(map->dma_buf, &map->map);
+#else
+	ret = dma_buf_vmap(map->dma_buf, &map->map);
+#endif
+	if (ret) {
+		return ret;
+	}
+	/* Register values are copied with memcpy, not with io accessors */
+	if (map->map.is_iomem) {
+		kernel_map_vunmap(map);
+		return -EOPNOTSUPP;
+	}
+	map->vaddr = map->map.vaddr;
+#else
+	map->vaddr = dma_buf_vmap(map->dma_buf);
+	if (!map->vaddr) {
+		return -ENOMEM;
+	}
+#endif
+	return 0;
+}
+
+static void kernel_map_release_work(struct work_struct *work)
+{
+	struct lwis_buffer_kernel_map *map =
+		container_of(work, struct lwis_buffer_kernel_map, release_work);
+
+	kernel_map_vunmap(map);
+	dma_buf_unmap_attachment(map->dma_buf_attachment, map->sg_table, DMA_BIDIRECTIONAL);
+	dma_buf_detach(map->dma_buf, map->dma_buf_attachment);
+	dma_buf_put(map->dma_buf);
+	kfree(map);
+}
+
+static void kernel_map_release(struct kref *kref)
+{
+	struct lwis_buffer_kernel_map *map =
+		container_of(kref, struct lwis_buffer_kernel_map, refcount);
+
+	/* Unmapping sleeps, and transactions are freed in event context too */
+	schedule_work(&map->release_work);
+}
+
+struct lwis_buffer_kernel_map *lwis_buffer_kernel_map_get(struct lwis_client *lwis_client,
+							  int fd)
+{
+	int ret = 0;
+	struct dma_buf *dma_buf;
+	struct lwis_buffer_kernel_map *map;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	dma_buf = dma_buf_get(fd);
+	if (IS_ERR_OR_NULL(dma_buf)) {
+		dev_err(lwis_dev->dev, "Could not get dma buffer for fd: %d\n", fd);
+		return ERR_PTR(-EINVAL);
+	}
+
+	hash_for_each_possible (lwis_client->kernel_mapped_buffers, map, node,
+				(unsigned long)dma_buf) {
+		if (map->dma_buf == dma_buf) {
+			dma_buf_put(dma_buf);
+			kref_get(&map->refcount);
+			return map;
+		}
+	}
+
+	if (!is_client_buffer(lwis_client, fd, dma_buf)) {
+		dev_err(lwis_dev->dev, "fd %d is not an allocated or enrolled buffer\n", fd);
+		ret = -EINVAL;
+		goto error_put;
+	}
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map) {
+		dev_err(lwis_dev->dev, "Failed to allocate buffer kernel map\n");
+		ret = -ENOMEM;
+		goto error_put;
+	}
+	map->dma_buf = dma_buf;
+
+	map->dma_buf_attachment = dma_buf_attach(dma_buf, &lwis_dev->plat_dev->dev);
+	if (IS_ERR_OR_NULL(map->dma_buf_attachment)) {
+		dev_err(lwis_dev->dev, "Could not attach dma buffer for fd: %d\n", fd);
+		ret = -EINVAL;
+		goto error_attach;
+	}
+
+	/* Bidirectional, so that syncing for the device cleans rather than
+	 * invalidates the CPU caches */
+	map->sg_table = dma_buf_map_attachment(map->dma_buf_attachment, DMA_BIDIRECTIONAL);
+	if (IS_ERR_OR_NULL(map->sg_table)) {
+		dev_err(lwis_dev->dev, "Could not map dma attachment for fd: %d\n", fd);
+		ret = -EINVAL;
+		goto error_map_attachment;
+	}
+
+	ret = kernel_map_vmap(map);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Could not map fd %d into the kernel (%d)\n", fd, ret);
+		goto error_vmap;
+	}
+
+	/* One reference for the client, one for the caller */
+	kref_init(&map->refcount);
+	kref_get(&map->refcount);
+	INIT_WORK(&map->release_work, kernel_map_release_work);
+	hash_add(lwis_client->kernel_mapped_buffers, &map->node, (unsigned long)dma_buf);
+	return map;
+
+error_vmap:
+	dma_buf_unmap_attachment(map->dma_buf_attachment, map->sg_table, DMA_BIDIRECTIONAL);
+error_map_attachment:
+	dma_buf_detach(dma_buf, map->dma_buf_attachment);
+error_attach:
+	kfree(map);
+error_put:
+	dma_buf_put(dma_buf);
+	return ERR_PTR(ret);
+}
+
+void lwis_buffer_kernel_map_put(struct lwis_buffer_kernel_map *map)
+{
+	kref_put(&map->refcount, kernel_map_release);
+}
+
+void lwis_buffer_kernel_map_drop(struct lwis_client *lwis_client, struct dma_buf *dma_buf)
+{
+	struct lwis_buffer_kernel_map *map;
+	struct hlist_node *n;
+
+	hash_for_each_possible_safe (lwis_client->kernel_mapped_buffers, map, n, node,
+				     (unsigned long)dma_buf) {
+		if (map->dma_buf == dma_buf) {
+			hash_del(&map->node);
+			lwis_buffer_kernel_map_put(map);
+			return;
+		}
+	}
+}
+
+void lwis_buffer_kernel_map_sync(struct lwis_buffer_kernel_map *map, size_t offset, size_t size)
+{
+	struct scatterlist *sg;
+	size_t len;
+	int i;
+
+	for_each_sgtable_dma_sg (map->sg_table, sg, i) {
+		if (size == 0) {
+			break;
+		}
+		if (offset >= sg_dma_len(sg)) {
+			offset -= sg_dma_len(sg);
+			continue;
+		}
+		len = min_t(size_t, size, sg_dma_len(sg) - offset);
+		dma_sync_single_range_for_device(map->dma_buf_attachment->dev, sg_dma_address(sg),
+						 offset, len, DMA_BIDIRECTIONAL);
+		offset = 0;
+		size -= len;
+	}
+}
+
+int lwis_client_kernel_mapped_buffers_clear(struct lwis_client *lwis_client)
+{
+	struct lwis_buffer_kernel_map *map;
+	struct hlist_node *n;
+	int i;
+
+	if (!lwis_client) {
+		pr_err("lwis_client_kernel_mapped_buffers_clear: LWIS client is NULL\n");
+		return -ENODEV;
+	}
+
+	hash_for_each_safe (lwis_client->kernel_mapped_buffers, i, n, map, node) {
+		hash_del(&map->node);
+		lwis_buffer_kernel_map_put(map);
+	}
+	return 0;
+}
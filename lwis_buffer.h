@@ -14,7 +14,13 @@
 
 #include <linux/dma-buf.h>
 #include <linux/dma-direction.h>
+#include <linux/interval_tree.h>
+#include <linux/kref.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/shrinker.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
 
 #include "lwis_commands.h"
 #include "lwis_device.h"
@@ -27,12 +33,41 @@ struct lwis_enrolled_buffer {
 	struct sg_table *sg_table;
 	struct list_head list_node;
 	struct lwis_buffer_enrollment_list *enrollment_list;
+	/* [dma_vaddr, dma_vaddr + size - 1] in lwis_client->enrolled_buffer_tree */
+	struct interval_tree_node range_node;
 };
 
 struct lwis_allocated_buffer {
 	int fd;
 	size_t size;
 	struct dma_buf *dma_buf;
+	/* lwis_dma_alloc_flags of the allocation */
+	unsigned int flags;
+	/* Allocated with LWIS_DMA_BUFFER_CACHED, so CPU access needs cache
+	 * maintenance */
+	bool cached;
+	struct hlist_node node;
+};
+
+/*
+ * Kernel mapping of an allocated or enrolled buffer, so that register reads
+ * can deliver their values straight into it. The client holds a reference
+ * until the buffer is freed or disenrolled, and so does every transaction
+ * reading into it. The vaddr comes from the exporter's dma_buf_vmap.
+ */
+struct lwis_buffer_kernel_map {
+	struct dma_buf *dma_buf;
+	struct dma_buf_attachment *dma_buf_attachment;
+	struct sg_table *sg_table;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 18, 0)
+	struct iosys_map map;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5, 11, 0)
+	struct dma_buf_map map;
+#endif
+	void *vaddr;
+	struct kref refcount;
+	/* The last reference may be dropped in event context */
+	struct work_struct release_work;
 	struct hlist_node node;
 };
 
@@ -42,6 +77,32 @@ struct lwis_buffer_enrollment_list {
 	struct hlist_node node;
 };
 
+/*
+ * Device mapping of a disenrolled dma-buf, kept so that enrolling the same
+ * buffer again skips attaching and mapping it, and gets the same dma_vaddr.
+ * Holds a reference to the dma-buf.
+ */
+struct lwis_buffer_enroll_cache_entry {
+	struct dma_buf *dma_buf;
+	struct dma_buf_attachment *dma_buf_attachment;
+	struct sg_table *sg_table;
+	enum dma_data_direction dma_direction;
+	dma_addr_t dma_vaddr;
+	struct list_head node;
+};
+
+struct lwis_buffer_enroll_cache {
+	struct lwis_device *lwis_dev;
+	struct mutex lock;
+	/* Least recently disenrolled entries first */
+	struct list_head lru;
+	int count;
+	int capacity;
+	/* Evicts entries under memory pressure */
+	struct shrinker shrinker;
+	bool shrinker_registered;
+};
+
 /*
  * lwis_buffer_alloc: Allocates a DMA buffer represented by alloc_info.
  *
@@ -83,7 +144,26 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
 int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer);
 
 /*
- * lwis_buffer_cpu_access: Invalidate/flush the cache for CPU access to the dma buffers
+ * lwis_buffer_enroll_cache_create: Sets up the enroll cache of the device,
+ * keeping the mappings of up to capacity disenrolled buffers.
+ *
+ * Alloc: Yes
+ * Returns: 0 on success
+ */
+int lwis_buffer_enroll_cache_create(struct lwis_device *lwis_dev, int capacity);
+
+/*
+ * lwis_buffer_enroll_cache_destroy: Unmaps every cached buffer and frees the
+ * enroll cache of the device, if any.
+ *
+ * Alloc: Free only
+ * Returns: None
+ */
+void lwis_buffer_enroll_cache_destroy(struct lwis_device *lwis_dev);
+
+/*
+ * lwis_buffer_cpu_access: Invalidate/flush the cache for CPU access to the dma buffers.
+ * Nothing is done for uncached buffers allocated by this client.
  *
  * Assumes: lwisclient->lock is locked
  * Alloc: Yes
@@ -102,6 +182,18 @@ int lwis_buffer_cpu_access(struct lwis_client *lwis_client, struct lwis_buffer_c
 struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find(struct lwis_client *lwis_client,
 							      int fd, dma_addr_t dma_vaddr);
 
+/*
+ * lwis_client_enrolled_buffer_find_range: Finds an enrolled buffer whose
+ * mapping contains all of [dma_vaddr, dma_vaddr + size), and returns it
+ *
+ * Assumes: lwisclient->lock or lwis_dev->lock is locked
+ * Alloc: No
+ * Returns: Pointer on success, NULL otherwise
+ */
+struct lwis_enrolled_buffer *
+lwis_client_enrolled_buffer_find_range(struct lwis_client *lwis_client, dma_addr_t dma_vaddr,
+				       size_t size);
+
 /*
  * lwis_client_enrolled_buffers_clear: Frees all items in
  * lwisclient->enrolled_buffers and clears the hash table. Used for client
@@ -135,4 +227,61 @@ struct lwis_allocated_buffer *lwis_client_allocated_buffer_find(struct lwis_clie
  */
 int lwis_client_allocated_buffers_clear(struct lwis_client *lwis_client);
 
+/*
+ * lwis_buffer_kernel_map_get: Maps the allocated or enrolled buffer
+ * represented by fd into the kernel, or returns its existing mapping. The
+ * caller owns a reference to the mapping, dropped with
+ * lwis_buffer_kernel_map_put.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Yes
+ * Returns: Pointer on success, ERR_PTR otherwise
+ */
+struct lwis_buffer_kernel_map *lwis_buffer_kernel_map_get(struct lwis_client *lwis_client,
+							  int fd);
+
+/*
+ * lwis_buffer_kernel_map_put: Drops a reference obtained from
+ * lwis_buffer_kernel_map_get. The mapping is torn down from a work item once
+ * the last reference is gone.
+ *
+ * Assumes: Can be called in any context
+ * Alloc: No
+ * Returns: None
+ */
+void lwis_buffer_kernel_map_put(struct lwis_buffer_kernel_map *map);
+
+/*
+ * lwis_buffer_kernel_map_drop: Drops the client's reference to the kernel
+ * mapping of dma_buf, if there is one, so that freeing or disenrolling the
+ * buffer does not keep it mapped.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Free only
+ * Returns: None
+ */
+void lwis_buffer_kernel_map_drop(struct lwis_client *lwis_client, struct dma_buf *dma_buf);
+
+/*
+ * lwis_buffer_kernel_map_sync: Writes back CPU caches of a range of the
+ * mapping after the kernel wrote to it, so that the data is visible through
+ * every other mapping of the buffer.
+ *
+ * Assumes: Can be called in any context
+ * Alloc: No
+ * Returns: None
+ */
+void lwis_buffer_kernel_map_sync(struct lwis_buffer_kernel_map *map, size_t offset, size_t size);
+
+/*
+ * lwis_client_kernel_mapped_buffers_clear: Drops the client's references to
+ * all items in lwisclient->kernel_mapped_buffers. Used for client shutdown
+ * only.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Free only
+ * Returns: 0 on success
+ */
+int lwis_client_kernel_mapped_buffers_clear(struct lwis_client *lwis_client);
+
 #endif /* LWIS_BUFFER_H_ */
@@ -0,0 +1,146 @@
+/*
+ * Google LWIS Registered Command Buffers
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-cmd-buffer: " fmt
+
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#include "lwis_cmd_buffer.h"
+
+/* Upper bound of a single registered command buffer */
+#define CMD_BUFFER_MAX_SIZE (4 * 1024 * 1024)
+
+static void cmd_buffer_release(struct lwis_cmd_buffer *cmd_buffer)
+{
+	vunmap(cmd_buffer->vaddr);
+	unpin_user_pages_dirty_lock(cmd_buffer->pages, cmd_buffer->num_pages,
+				    /*make_dirty=*/true);
+	kvfree(cmd_buffer->pages);
+	kfree(cmd_buffer);
+}
+
+int lwis_cmd_buffer_register(struct lwis_client *lwis_client, struct lwis_cmd_buffer_info *info)
+{
+	int ret = 0;
+	int pinned;
+	unsigned long start;
+	unsigned long page_offset;
+	struct lwis_cmd_buffer *cmd_buffer;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (info->size == 0 || info->size > CMD_BUFFER_MAX_SIZE) {
+		dev_err(lwis_dev->dev, "Invalid command buffer size %zu\n", info->size);
+		return -EINVAL;
+	}
+
+	start = (unsigned long)info->buf;
+	page_offset = offset_in_page(start);
+	if (start + info->size < start || !access_ok((void __user *)info->buf, info->size)) {
+		dev_err(lwis_dev->dev, "Invalid command buffer address\n");
+		return -EFAULT;
+	}
+
+	cmd_buffer = kzalloc(sizeof(*cmd_buffer), GFP_KERNEL);
+	if (!cmd_buffer) {
+		dev_err(lwis_dev->dev, "Failed to allocate command buffer\n");
+		return -ENOMEM;
+	}
+
+	cmd_buffer->num_pages = DIV_ROUND_UP(page_offset + info->size, PAGE_SIZE);
+	cmd_buffer->pages =
+		kvmalloc_array(cmd_buffer->num_pages, sizeof(*cmd_buffer->pages), GFP_KERNEL);
+	if (!cmd_buffer->pages) {
+		dev_err(lwis_dev->dev, "Failed to allocate command buffer page array\n");
+		ret = -ENOMEM;
+		goto error_pages;
+	}
+
+	pinned = pin_user_pages_fast(start - page_offset, cmd_buffer->num_pages,
+				     FOLL_WRITE | FOLL_LONGTERM, cmd_buffer->pages);
+	if (pinned != cmd_buffer->num_pages) {
+		dev_err(lwis_dev->dev, "Failed to pin command buffer pages (%d/%d)\n", pinned,
+			cmd_buffer->num_pages);
+		ret = (pinned < 0) ? pinned : -EFAULT;
+		if (pinned > 0) {
+			unpin_user_pages(cmd_buffer->pages, pinned);
+		}
+		goto error_pin;
+	}
+
+	cmd_buffer->vaddr = vmap(cmd_buffer->pages, cmd_buffer->num_pages, VM_MAP, PAGE_KERNEL);
+	if (!cmd_buffer->vaddr) {
+		dev_err(lwis_dev->dev, "Failed to map command buffer\n");
+		ret = -ENOMEM;
+		goto error_map;
+	}
+	cmd_buffer->buf = (uint8_t *)cmd_buffer->vaddr + page_offset;
+	cmd_buffer->size = info->size;
+
+	cmd_buffer->handle = ++lwis_client->cmd_buffer_counter;
+	hash_add(lwis_client->cmd_buffers, &cmd_buffer->node, cmd_buffer->handle);
+	info->handle = cmd_buffer->handle;
+
+	return 0;
+
+error_map:
+	unpin_user_pages(cmd_buffer->pages, cmd_buffer->num_pages);
+error_pin:
+	kvfree(cmd_buffer->pages);
+error_pages:
+	kfree(cmd_buffer);
+	return ret;
+}
+
+struct lwis_cmd_buffer *lwis_cmd_buffer_find(struct lwis_client *lwis_client, int32_t handle)
+{
+	struct lwis_cmd_buffer *p;
+
+	hash_for_each_possible (lwis_client->cmd_buffers, p, node, handle) {
+		if (p->handle == handle) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+int lwis_cmd_buffer_unregister(struct lwis_client *lwis_client, int32_t handle)
+{
+	struct lwis_cmd_buffer *cmd_buffer;
+
+	cmd_buffer = lwis_cmd_buffer_find(lwis_client, handle);
+	if (!cmd_buffer) {
+		dev_err(lwis_client->lwis_dev->dev, "Cannot find command buffer %d\n", handle);
+		return -ENOENT;
+	}
+
+	hash_del(&cmd_buffer->node);
+	cmd_buffer_release(cmd_buffer);
+	return 0;
+}
+
+int lwis_client_cmd_buffers_clear(struct lwis_client *lwis_client)
+{
+	struct lwis_cmd_buffer *cmd_buffer;
+	struct hlist_node *n;
+	int i;
+
+	if (!lwis_client) {
+		pr_err("lwis_client_cmd_buffers_clear: LWIS client is NULL\n");
+		return -ENODEV;
+	}
+
+	hash_for_each_safe (lwis_client->cmd_buffers, i, n, cmd_buffer, node) {
+		hash_del(&cmd_buffer->node);
+		cmd_buffer_release(cmd_buffer);
+	}
+	return 0;
+}
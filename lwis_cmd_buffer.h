@@ -0,0 +1,78 @@
+/*
+ * Google LWIS Registered Command Buffers
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_CMD_BUFFER_H_
+#define LWIS_CMD_BUFFER_H_
+
+#include <linux/list.h>
+#include <linux/mm_types.h>
+
+#include "lwis_commands.h"
+#include "lwis_device.h"
+
+/*
+ *  struct lwis_cmd_buffer
+ *  Userspace memory holding io_entries and their batch data, pinned and
+ *  mapped into the kernel once so that LWIS_CMD_BUFFER_EXECUTE can run
+ *  entries from it and write results back into it without any copies.
+ */
+struct lwis_cmd_buffer {
+	int32_t handle;
+	struct page **pages;
+	int num_pages;
+	/* Kernel mapping of the pinned pages */
+	void *vaddr;
+	/* Start of the registered range within the mapping */
+	uint8_t *buf;
+	size_t size;
+	struct hlist_node node;
+};
+
+/*
+ * lwis_cmd_buffer_register: Pins the userspace range described by info,
+ * maps it into the kernel and returns its handle in info->handle.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Yes
+ * Returns: 0 on success
+ */
+int lwis_cmd_buffer_register(struct lwis_client *lwis_client, struct lwis_cmd_buffer_info *info);
+
+/*
+ * lwis_cmd_buffer_unregister: Unmaps and unpins the command buffer
+ * represented by handle.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Free only
+ * Returns: 0 on success
+ */
+int lwis_cmd_buffer_unregister(struct lwis_client *lwis_client, int32_t handle);
+
+/*
+ * lwis_cmd_buffer_find: Finds the registered command buffer based on the
+ * handle passed, and returns it
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: No
+ * Returns: Pointer on success, NULL otherwise
+ */
+struct lwis_cmd_buffer *lwis_cmd_buffer_find(struct lwis_client *lwis_client, int32_t handle);
+
+/*
+ * lwis_client_cmd_buffers_clear: Unregisters all items in
+ * lwisclient->cmd_buffers. Used for client shutdown only.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Free only
+ * Returns: 0 on success
+ */
+int lwis_client_cmd_buffers_clear(struct lwis_client *lwis_client);
+
+#endif /* LWIS_CMD_BUFFER_H_ */
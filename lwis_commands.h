@@ -75,6 +75,23 @@ struct lwis_clk_setting {
 	uint32_t frequency;
 };
 
+struct lwis_qos_setting {
+	// Frequency in hz.
+	int64_t frequency_hz;
+	// Device id for this vote.
+	int32_t device_id;
+	// Target clock family.
+	int32_t clock_family;
+	// read BW
+	int64_t read_bw;
+	// write BW
+	int64_t write_bw;
+	// peak BW
+	int64_t peak_bw;
+	// RT BW (total peak)
+	int64_t rt_bw;
+};
+
 struct lwis_reg_block {
 	// reg block name defined in device tree.
 	char name[LWIS_MAX_NAME_STRING_LEN];
@@ -135,6 +152,27 @@ struct lwis_enrolled_buffer_info {
 	uint64_t dma_vaddr;
 };
 
+struct lwis_buffer_enroll_batch {
+	// Input
+	size_t num_buffers;
+	// dma_vaddr of each enrolled buffer is written back as with
+	// LWIS_BUFFER_ENROLL.
+	struct lwis_buffer_info *buffers;
+	// Output
+	// One error code per buffer. Each buffer is enrolled on its own, a
+	// failure does not undo the enrollment of the others.
+	int32_t *error_codes;
+};
+
+struct lwis_buffer_disenroll_batch {
+	// Input
+	size_t num_buffers;
+	struct lwis_enrolled_buffer_info *buffers;
+	// Output
+	// One error code per buffer.
+	int32_t *error_codes;
+};
+
 struct lwis_buffer_cpu_access_op {
 	int32_t fd;
 	bool start;
@@ -144,6 +182,15 @@ struct lwis_buffer_cpu_access_op {
 	size_t len;
 };
 
+struct lwis_buffer_cpu_access_batch {
+	// Input
+	size_t num_ops;
+	struct lwis_buffer_cpu_access_op *ops;
+	// Output
+	// One error code per operation. Every operation is attempted.
+	int32_t *error_codes;
+};
+
 enum lwis_io_entry_types {
 	LWIS_IO_ENTRY_READ,
 	LWIS_IO_ENTRY_READ_BATCH,
@@ -151,7 +198,15 @@ enum lwis_io_entry_types {
 	LWIS_IO_ENTRY_WRITE_BATCH,
 	LWIS_IO_ENTRY_MODIFY,
 	LWIS_IO_ENTRY_POLL,
-	LWIS_IO_ENTRY_READ_ASSERT
+	LWIS_IO_ENTRY_READ_ASSERT,
+	LWIS_IO_ENTRY_READ_BATCH_TO_BUFFER,
+	// Transactions executed by the worker only, i.e. neither run in event
+	// context nor at real time.
+	LWIS_IO_ENTRY_CLOCK_SET,
+	LWIS_IO_ENTRY_QOS_VOTE,
+	// POLL that reads again each time the device emits an event, e.g. an IRQ,
+	// instead of sleeping. Not limited to the worker.
+	LWIS_IO_ENTRY_POLL_EVENT
 };
 
 // For io_entry read and write types.
@@ -169,6 +224,16 @@ struct lwis_io_entry_rw_batch {
 	bool is_offset_fixed;
 };
 
+// For io_entry read batch to buffer type. Transactions only, the values are
+// written into an allocated or enrolled buffer instead of the response.
+struct lwis_io_entry_read_to_buffer {
+	int32_t bid;
+	uint64_t offset;
+	size_t size_in_bytes;
+	int32_t buffer_fd;
+	size_t buffer_offset;
+};
+
 // For io_entry modify types.
 struct lwis_io_entry_modify {
 	int32_t bid;
@@ -186,6 +251,50 @@ struct lwis_io_entry_read_assert {
 	uint64_t timeout_ms;
 };
 
+// For io_entry poll event type. Same as read assert with a 32-bit offset and
+// timeout, so that it is no larger than read assert with either 4 or 8 byte
+// alignment of 64-bit fields and the lwis_io_entry union keeps its size.
+struct lwis_io_entry_poll_event {
+	int32_t bid;
+	uint32_t offset;
+	uint64_t val;
+	uint64_t mask;
+	// Event of the device to wait for before reading again.
+	// LWIS_EVENT_ID_NONE to sleep as POLL does.
+	int64_t event_id;
+	uint32_t timeout_ms;
+};
+
+// For io_entry clock set type. Same as lwis_clk_setting without the name,
+// which the clock index already identifies.
+struct lwis_io_entry_clk_set {
+	// clock index stored in lwis_dev->clocks
+	int32_t clk_index;
+	// clock rate
+	uint32_t frequency;
+};
+
+// For io_entry qos vote type. Same as lwis_qos_setting with 32-bit
+// bandwidths, so that it fits the lwis_io_entry union.
+struct lwis_io_entry_qos_vote {
+	// Frequency in hz.
+	int64_t frequency_hz;
+	// Device id for this vote.
+	int32_t device_id;
+	// Target clock family.
+	int32_t clock_family;
+	// read BW
+	int32_t read_bw;
+	// write BW
+	int32_t write_bw;
+	// peak BW
+	int32_t peak_bw;
+	// RT BW (total peak)
+	int32_t rt_bw;
+};
+
+// The members of the union may not be larger than lwis_io_entry_read_assert,
+// which sets the size of lwis_io_entry for existing userspace.
 struct lwis_io_entry {
 	int32_t type;
 	union {
@@ -193,6 +302,14 @@ struct lwis_io_entry {
 		struct lwis_io_entry_rw_batch rw_batch;
 		struct lwis_io_entry_modify mod;
 		struct lwis_io_entry_read_assert read_assert;
+		struct lwis_io_entry_poll_event poll_event;
+		struct lwis_io_entry_read_to_buffer read_to_buffer;
+		// Sets a clock of the device, as LWIS_DPM_CLK_UPDATE would.
+		struct lwis_io_entry_clk_set clk;
+		// Votes for a clock family or bandwidth, as LWIS_DPM_QOS_UPDATE would.
+		// qos.device_id must be the device of the transaction, unless the
+		// transaction is submitted to the DPM device. -EPERM otherwise.
+		struct lwis_io_entry_qos_vote qos;
 	};
 };
 
@@ -201,6 +318,25 @@ struct lwis_io_entries {
 	struct lwis_io_entry *io_entries;
 };
 
+// Userspace memory registered once to hold io_entries and their batch data.
+// Entries executed from it refer to their batch data with rw_batch.buf set to
+// a byte offset into the command buffer instead of a pointer, and all results
+// are written back into the command buffer.
+struct lwis_cmd_buffer_info {
+	// IOCTL input for CMD_BUFFER_REGISTER
+	void *buf;
+	size_t size;
+	// IOCTL output for CMD_BUFFER_REGISTER
+	int32_t handle;
+};
+
+struct lwis_cmd_buffer_exec {
+	int32_t handle;
+	// Offset of the first io_entry from the start of the command buffer
+	size_t entries_offset;
+	uint32_t num_io_entries;
+};
+
 struct lwis_echo {
 	size_t size;
 	const char *msg;
@@ -217,6 +353,7 @@ struct lwis_echo {
 #define LWIS_EVENT_ID_INVALID 0
 #define LWIS_EVENT_ID_HEARTBEAT 1
 #define LWIS_EVENT_ID_CLIENT_CLEANUP 2
+#define LWIS_EVENT_ID_DEVICE_ENABLE_DONE 3
 // ...
 // Error event defines
 #define LWIS_EVENT_ID_START_OF_ERROR_RANGE 2048
@@ -255,6 +392,20 @@ struct lwis_event_info {
 #define LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE (1ULL << 0)
 #define LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE (1ULL << 1)
 #define LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE (1ULL << 2)
+// Aggregate occurrences of the event and queue one event, carrying a
+// struct lwis_event_coalesced_payload, per coalesce_count occurrences and/or
+// per coalesce_window_ns (counted from the first aggregated occurrence)
+#define LWIS_EVENT_CONTROL_FLAG_COALESCE (1ULL << 3)
+// With COALESCE, masks the IRQ of the event once coalesce_count occurrences
+// were seen in a window, until the window ends
+#define LWIS_EVENT_CONTROL_FLAG_COALESCE_MASK_IRQ (1ULL << 4)
+// Policy when the event finds the client queue full, the new occurrence is
+// dropped by default. DROP_OLDEST makes room by dropping the front of the
+// queue. OVERFLOW_COALESCE updates the counter and timestamp of the last
+// queued entry of the same event instead, and falls back to the other flags
+// if there is none. Events streamed into an event ring are always dropped.
+#define LWIS_EVENT_CONTROL_FLAG_OVERFLOW_DROP_OLDEST (1ULL << 5)
+#define LWIS_EVENT_CONTROL_FLAG_OVERFLOW_COALESCE (1ULL << 6)
 
 struct lwis_event_control {
 	// IOCTL Inputs
@@ -263,15 +414,154 @@ struct lwis_event_control {
 	uint64_t flags;
 };
 
+// Event control with the options added after lwis_event_control, for
+// LWIS_EVENT_CONTROL_GET_V2 and LWIS_EVENT_CONTROL_SET_V2. The layout of both
+// structs is fixed, further options come with a new version. Options missing
+// from lwis_event_control are left unchanged by LWIS_EVENT_CONTROL_SET.
+struct lwis_event_control_v2 {
+	// IOCTL Inputs
+	int64_t event_id;
+	// IOCTL Outputs
+	uint64_t flags;
+	// Used with LWIS_EVENT_CONTROL_FLAG_COALESCE, 0 disables the limit
+	uint32_t coalesce_count;
+	int64_t coalesce_window_ns;
+	// Only queue every decimation_factor-th occurrence, starting with the
+	// first one, 0 or 1 queues all of them
+	uint32_t decimation_factor;
+	// Only queue occurrences at least min_interval_ns after the last queued
+	// one, 0 disables the check
+	int64_t min_interval_ns;
+};
+
+// Payload of the events queued for LWIS_EVENT_CONTROL_FLAG_COALESCE. The
+// event_counter and timestamp_ns of the event are the ones of the last
+// occurrence.
+struct lwis_event_coalesced_payload {
+	int64_t count;
+	int64_t first_timestamp_ns;
+	int64_t last_timestamp_ns;
+};
+
 struct lwis_event_control_list {
 	size_t num_event_controls;
 	struct lwis_event_control *event_controls;
 };
 
+struct lwis_event_control_list_v2 {
+	size_t num_event_controls;
+	struct lwis_event_control_v2 *event_controls;
+};
+
+/*
+ * Event ring shared with userspace through mmap on the LWIS device fd.
+ *
+ * The mapping starts with struct lwis_event_ring_header, and the record area
+ * begins at data_offset. Records are a struct lwis_event_ring_record followed
+ * by its payload, padded to LWIS_EVENT_RING_RECORD_ALIGN bytes. head and tail
+ * are free running byte counters, the position in the record area is obtained
+ * by masking them with (data_size - 1). The kernel only advances head and
+ * userspace only advances tail. If the space left before the end of the record
+ * area is smaller than a record header, the consumer skips to the beginning of
+ * the record area; otherwise records flagged with
+ * LWIS_EVENT_RING_RECORD_FLAG_PADDING must be skipped.
+ *
+ * Error events are not written to the ring, they are still delivered through
+ * LWIS_EVENT_DEQUEUE and signalled with POLLERR.
+ */
+#define LWIS_EVENT_RING_RECORD_ALIGN 8
+#define LWIS_EVENT_RING_RECORD_FLAG_PADDING (1U << 0)
+
+struct lwis_event_ring_header {
+	// Written by kernel after a record is complete
+	uint64_t head;
+	// Written by userspace after a record is consumed
+	uint64_t tail;
+	// Offset of the record area from the start of the mapping
+	uint64_t data_offset;
+	// Size of the record area, always a power of 2
+	uint64_t data_size;
+	// Number of events dropped because the ring was full
+	uint64_t num_dropped;
+};
+
+struct lwis_event_ring_record {
+	int64_t event_id;
+	int64_t event_counter;
+	int64_t timestamp_ns;
+	// Size of the record including header, payload and padding
+	uint32_t record_size;
+	uint32_t payload_size;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+struct lwis_event_ring_info {
+	// IOCTL Inputs
+	// Requested size of the record area, rounded up to a power of 2
+	size_t data_size;
+	// IOCTL Outputs
+	// Size to pass to mmap
+	size_t mmap_size;
+};
+
+/*
+ * LWIS_EVENT_DEQUEUE_BATCH packs queued events into buffer using the event
+ * ring record format: struct lwis_event_ring_record followed by the payload,
+ * padded to LWIS_EVENT_RING_RECORD_ALIGN bytes. Error events are returned
+ * ahead of the other events.
+ */
+struct lwis_event_dequeue_batch {
+	// IOCTL Inputs
+	// Time to wait for the first event, 0 returns right away and a negative
+	// value waits until an event arrives
+	int64_t timeout_ns;
+	void *buffer;
+	size_t buffer_size;
+	// IOCTL Outputs
+	size_t num_events;
+	size_t bytes_used;
+	// Record size of the front event when it does not fit in the buffer
+	size_t required_size;
+};
+
+/*
+ * Command of an IORING_OP_URING_CMD submission on a LWIS device fd, when the
+ * feature flags list uring-cmd. cmd_op of the SQE is the ioctl number, one of
+ * LWIS_TRANSACTION_SUBMIT, LWIS_TRANSACTION_SUBMIT_BATCH,
+ * LWIS_TRANSACTION_CANCEL, LWIS_TRANSACTION_REPLACE, LWIS_REG_IO,
+ * LWIS_EVENT_DEQUEUE, LWIS_EVENT_DEQUEUE_BATCH and the LWIS_BUFFER_ENROLL and
+ * LWIS_BUFFER_DISENROLL commands. The result of the CQE is the ioctl return
+ * value, LWIS_EVENT_DEQUEUE_BATCH completes once it got events or timed out.
+ * The dequeue commands report a buffer too small for the front event with
+ * -ENOBUFS rather than -EAGAIN.
+ */
+struct lwis_uring_cmd {
+	// Pointer to the ioctl argument
+	uint64_t arg;
+};
+
 // Invalid ID for Transaction id and Periodic IO id
 #define LWIS_ID_INVALID (-1LL)
 #define LWIS_EVENT_COUNTER_ON_NEXT_OCCURRENCE (-1LL)
 #define LWIS_EVENT_COUNTER_EVERY_TIME (-2LL)
+
+// Overrides the value of a WRITE or MODIFY entry of a registered io_entry
+// program, for one transaction only.
+struct lwis_io_entry_patch {
+	uint32_t index;
+	uint64_t val;
+};
+
+struct lwis_io_program_info {
+	// IOCTL input for IO_PROGRAM_REGISTER
+	char name[LWIS_MAX_NAME_STRING_LEN];
+	size_t num_io_entries;
+	struct lwis_io_entry *io_entries;
+	// IOCTL output for IO_PROGRAM_REGISTER
+	int32_t handle;
+};
+
 struct lwis_transaction_info {
 	// Input
 	int64_t trigger_event_id;
@@ -283,6 +573,48 @@ struct lwis_transaction_info {
 	int64_t emit_success_event_id;
 	int64_t emit_error_event_id;
 	bool allow_counter_eq;
+	// Queued transactions with a higher priority are processed first, then
+	// the ones with the earliest deadline.
+	int32_t priority;
+	// Time allowed between the transaction getting triggered and its
+	// completion, 0 if the transaction has no deadline.
+	int64_t deadline_ns;
+	// Handle of a registered io_entry program to run instead of
+	// io_entries, 0 for none. The patches are applied to the values of the
+	// program entries for this transaction only.
+	int32_t program_handle;
+	size_t num_patches;
+	struct lwis_io_entry_patch *patches;
+	// Output
+	int64_t id;
+	// Only will be set if trigger_event_id is specified.
+	// Otherwise, the value is -1.
+	int64_t current_trigger_event_counter;
+	int64_t submission_timestamp_ns;
+};
+
+// io_entries of a transaction group executing on one device.
+struct lwis_transaction_program {
+	int32_t device_id;
+	size_t num_io_entries;
+	struct lwis_io_entry *io_entries;
+};
+
+// A transaction whose io_entries span several devices. Triggering it runs the
+// programs in order, back to back, and emits one completion event with the
+// results of all programs.
+struct lwis_transaction_group_info {
+	// Input
+	int64_t trigger_event_id;
+	int64_t trigger_event_counter;
+	size_t num_programs;
+	struct lwis_transaction_program *programs;
+	int64_t emit_success_event_id;
+	int64_t emit_error_event_id;
+	bool allow_counter_eq;
+	// Same as lwis_transaction_info
+	int32_t priority;
+	int64_t deadline_ns;
 	// Output
 	int64_t id;
 	// Only will be set if trigger_event_id is specified.
@@ -291,6 +623,19 @@ struct lwis_transaction_info {
 	int64_t submission_timestamp_ns;
 };
 
+struct lwis_transaction_batch {
+	// Input
+	size_t num_transactions;
+	// Each transaction's id and event counter are written back as with
+	// LWIS_TRANSACTION_SUBMIT.
+	struct lwis_transaction_info *transactions;
+	// Output
+	// One error code per transaction. Transactions are submitted all or
+	// nothing: if any of them fails, none are submitted and the others
+	// report -ECANCELED.
+	int32_t *error_codes;
+};
+
 // Actual size of this struct depends on num_entries
 struct lwis_transaction_response_header {
 	int64_t id;
@@ -307,6 +652,14 @@ struct lwis_io_result {
 	uint8_t values[];
 };
 
+// Values of an io_result for io_entry read batch to buffer, describing where
+// the register values were written.
+struct lwis_io_result_buffer {
+	int32_t buffer_fd;
+	size_t buffer_offset;
+	size_t size_in_bytes;
+};
+
 struct lwis_periodic_io_info {
 	// Input
 	int32_t batch_size;
@@ -315,6 +668,15 @@ struct lwis_periodic_io_info {
 	struct lwis_io_entry *io_entries;
 	int64_t emit_success_event_id;
 	int64_t emit_error_event_id;
+	// Optional phase lock. Unless LWIS_EVENT_ID_NONE, the periodic io runs
+	// samples_per_event times every period_ns, with the first run
+	// phase_offset_ns after each emission of this event of the device.
+	int64_t phase_event_id;
+	int64_t phase_offset_ns;
+	int32_t samples_per_event;
+	// How late a free-running period may be served, so that it can share a
+	// timer expiration with other periodic ios. 0 for none.
+	int64_t timer_slack_ns;
 	// Output
 	int64_t id;
 };
@@ -339,23 +701,6 @@ struct lwis_dpm_clk_settings {
 	size_t num_settings;
 };
 
-struct lwis_qos_setting {
-	// Frequency in hz.
-	int64_t frequency_hz;
-	// Device id for this vote.
-	int32_t device_id;
-	// Target clock family.
-	int32_t clock_family;
-	// read BW
-	int64_t read_bw;
-	// write BW
-	int64_t write_bw;
-	// peak BW
-	int64_t peak_bw;
-	// RT BW (total peak)
-	int64_t rt_bw;
-};
-
 struct lwis_dpm_qos_requirements {
 	// qos entities from user.
 	struct lwis_qos_setting *qos_settings;
@@ -363,6 +708,94 @@ struct lwis_dpm_qos_requirements {
 	size_t num_settings;
 };
 
+// Closed-loop bandwidth voting of a device from its traffic counters, which
+// are given by the "bts-traffic-counters" device tree property.
+struct lwis_dpm_bts_auto_setting {
+	// Device whose bandwidth is voted.
+	int32_t device_id;
+	// Event of that device on which the counters are sampled, e.g. end of
+	// frame. LWIS_EVENT_ID_NONE stops the closed loop.
+	int64_t frame_event_id;
+	// Bounds of the read and write bandwidth votes in KB/s.
+	int64_t floor_kbps;
+	int64_t ceiling_kbps;
+};
+
+// Cumulative counters returned by LWIS_GET_STATS. The client counters cover
+// the file descriptor the ioctl is issued on, the device counters all of its
+// clients since probe.
+struct lwis_stats {
+	// Events delivered to the queue or the event ring of the client.
+	uint64_t events_queued;
+	// Events lost because the queue or the event ring was full.
+	uint64_t events_dropped;
+	// Most events ever waiting in the queue of the client.
+	uint64_t event_queue_high_water;
+	// Transactions by outcome of their execution, or cancelled before it.
+	uint64_t transactions_succeeded;
+	uint64_t transactions_failed;
+	uint64_t transactions_cancelled;
+	// Transactions completed after their deadline.
+	uint64_t transaction_deadline_misses;
+	// Periods that elapsed while a periodic io was still pending.
+	uint64_t periodic_io_ticks_missed;
+	uint64_t alloc_failures;
+	uint64_t device_events_emitted;
+	uint64_t device_alloc_failures;
+	// Register bytes read and written over the bus of the device.
+	uint64_t device_bytes_read;
+	uint64_t device_bytes_written;
+};
+
+// Paths register accesses are captured from.
+enum lwis_reg_capture_source {
+	LWIS_REG_CAPTURE_SOURCE_IOCTL = 0,
+	LWIS_REG_CAPTURE_SOURCE_TRANSACTION,
+	LWIS_REG_CAPTURE_SOURCE_PERIODIC_IO,
+	LWIS_REG_CAPTURE_SOURCE_REPLAY,
+};
+
+// Register access read from the reg_io_capture debugfs file of a device, and
+// replayed by LWIS_REG_IO_REPLAY. Only read, write and modify entries are
+// captured. Batch accesses record their size but not their data, replayed
+// batch writes write zeros.
+struct lwis_reg_capture_record {
+	// Start of the access, in the clock of lwis event timestamps.
+	int64_t timestamp_ns;
+	// Transaction or periodic io id, index of the replayed record, 0 for
+	// accesses of LWIS_REG_IO.
+	int64_t source_id;
+	uint64_t offset;
+	// Value read or written, or applied under mask for modifies.
+	uint64_t value;
+	uint64_t mask;
+	int32_t bid;
+	// Error code of the access, 0 on success.
+	int32_t error_code;
+	// Register bytes accessed, the batch size for batches.
+	uint32_t size_in_bytes;
+	uint32_t duration_ns;
+	// LWIS_IO_ENTRY_* type of the access.
+	int16_t type;
+	// enum lwis_reg_capture_source
+	uint8_t source;
+	uint8_t reserved[5];
+};
+
+// Replays the records as fast as possible instead of with their original timing.
+#define LWIS_REG_IO_REPLAY_FLAG_NO_DELAY (1U << 0)
+
+struct lwis_reg_io_replay {
+	// IOCTL input
+	uint32_t num_records;
+	uint32_t flags;
+	struct lwis_reg_capture_record *records;
+	// IOCTL output
+	// Records whose access failed, the replay carries on past them.
+	uint32_t num_failed;
+	int64_t duration_ns;
+};
+
 /*
  *  IOCTL Commands
  */
@@ -373,6 +806,7 @@ struct lwis_dpm_qos_requirements {
 #define LWIS_BUFFER_ENROLL _IOWR(LWIS_IOC_TYPE, 2, struct lwis_buffer_info)
 #define LWIS_BUFFER_DISENROLL _IOWR(LWIS_IOC_TYPE, 3, struct lwis_enrolled_buffer_info)
 #define LWIS_BUFFER_CPU_ACCESS _IOWR(LWIS_IOC_TYPE, 4, struct lwis_buffer_cpu_access_op)
+#define LWIS_BUFFER_CPU_ACCESS_BATCH _IOWR(LWIS_IOC_TYPE, 5, struct lwis_buffer_cpu_access_batch)
 #define LWIS_DEVICE_ENABLE _IO(LWIS_IOC_TYPE, 6)
 #define LWIS_DEVICE_DISABLE _IO(LWIS_IOC_TYPE, 7)
 #define LWIS_BUFFER_ALLOC _IOWR(LWIS_IOC_TYPE, 8, struct lwis_alloc_buffer_info)
@@ -381,14 +815,30 @@ struct lwis_dpm_qos_requirements {
 #define LWIS_REG_IO _IOWR(LWIS_IOC_TYPE, 11, struct lwis_io_entries)
 #define LWIS_ECHO _IOWR(LWIS_IOC_TYPE, 12, struct lwis_echo)
 #define LWIS_DEVICE_RESET _IOWR(LWIS_IOC_TYPE, 13, struct lwis_io_entries)
+#define LWIS_CMD_BUFFER_REGISTER _IOWR(LWIS_IOC_TYPE, 14, struct lwis_cmd_buffer_info)
+#define LWIS_CMD_BUFFER_UNREGISTER _IOWR(LWIS_IOC_TYPE, 15, int32_t)
+#define LWIS_CMD_BUFFER_EXECUTE _IOWR(LWIS_IOC_TYPE, 16, struct lwis_cmd_buffer_exec)
+#define LWIS_BUFFER_ENROLL_BATCH _IOWR(LWIS_IOC_TYPE, 17, struct lwis_buffer_enroll_batch)
+#define LWIS_BUFFER_DISENROLL_BATCH _IOWR(LWIS_IOC_TYPE, 18, struct lwis_buffer_disenroll_batch)
+#define LWIS_DEVICE_ENABLE_ASYNC _IO(LWIS_IOC_TYPE, 19)
 
 #define LWIS_EVENT_CONTROL_GET _IOWR(LWIS_IOC_TYPE, 20, struct lwis_event_control)
 #define LWIS_EVENT_CONTROL_SET _IOW(LWIS_IOC_TYPE, 21, struct lwis_event_control_list)
 #define LWIS_EVENT_DEQUEUE _IOWR(LWIS_IOC_TYPE, 22, struct lwis_event_info)
+#define LWIS_EVENT_RING_SETUP _IOWR(LWIS_IOC_TYPE, 23, struct lwis_event_ring_info)
+#define LWIS_EVENT_DEQUEUE_BATCH _IOWR(LWIS_IOC_TYPE, 24, struct lwis_event_dequeue_batch)
+#define LWIS_GET_STATS _IOR(LWIS_IOC_TYPE, 25, struct lwis_stats)
+#define LWIS_EVENT_QUEUE_DEPTH_SET _IOW(LWIS_IOC_TYPE, 26, uint32_t)
+#define LWIS_EVENT_CONTROL_GET_V2 _IOWR(LWIS_IOC_TYPE, 27, struct lwis_event_control_v2)
+#define LWIS_EVENT_CONTROL_SET_V2 _IOW(LWIS_IOC_TYPE, 28, struct lwis_event_control_list_v2)
 
 #define LWIS_TRANSACTION_SUBMIT _IOWR(LWIS_IOC_TYPE, 30, struct lwis_transaction_info)
 #define LWIS_TRANSACTION_CANCEL _IOWR(LWIS_IOC_TYPE, 31, int64_t)
 #define LWIS_TRANSACTION_REPLACE _IOWR(LWIS_IOC_TYPE, 32, struct lwis_transaction_info)
+#define LWIS_TRANSACTION_SUBMIT_BATCH _IOWR(LWIS_IOC_TYPE, 33, struct lwis_transaction_batch)
+#define LWIS_TRANSACTION_GROUP_SUBMIT _IOWR(LWIS_IOC_TYPE, 34, struct lwis_transaction_group_info)
+#define LWIS_IO_PROGRAM_REGISTER _IOWR(LWIS_IOC_TYPE, 35, struct lwis_io_program_info)
+#define LWIS_IO_PROGRAM_UNREGISTER _IOWR(LWIS_IOC_TYPE, 36, int32_t)
 
 #define LWIS_PERIODIC_IO_SUBMIT _IOWR(LWIS_IOC_TYPE, 40, struct lwis_periodic_io_info)
 #define LWIS_PERIODIC_IO_CANCEL _IOWR(LWIS_IOC_TYPE, 41, int64_t)
@@ -396,11 +846,20 @@ struct lwis_dpm_qos_requirements {
 #define LWIS_DPM_CLK_UPDATE _IOW(LWIS_IOC_TYPE, 50, struct lwis_dpm_clk_settings)
 #define LWIS_DPM_QOS_UPDATE _IOW(LWIS_IOC_TYPE, 51, struct lwis_dpm_qos_requirements)
 #define LWIS_DPM_GET_CLOCK _IOW(LWIS_IOC_TYPE, 52, struct lwis_qos_setting)
+#define LWIS_DPM_BTS_AUTO _IOW(LWIS_IOC_TYPE, 53, struct lwis_dpm_bts_auto_setting)
+
+#define LWIS_REG_IO_REPLAY _IOWR(LWIS_IOC_TYPE, 60, struct lwis_reg_io_replay)
 
 /*
  * Event payloads
  */
 
+/* For LWIS_EVENT_ID_DEVICE_ENABLE_DONE */
+struct lwis_device_enable_event_payload {
+	// Result of the power up, 0 on success or a negative errno
+	int32_t result;
+};
+
 /* For LWIS_ERROR_EVENT_ID_MEMORY_PAGE_FAULT */
 struct lwis_mem_page_fault_event_payload {
 	uint64_t fault_address;
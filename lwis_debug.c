@@ -12,12 +12,18 @@
 #include <linux/fs.h>
 #include <linux/hashtable.h>
 #include <linux/list.h>
+#include <linux/seq_file.h>
 #include <linux/string.h>
 
+#include "lwis_allocator.h"
+#include "lwis_benchmark.h"
 #include "lwis_buffer.h"
 #include "lwis_debug.h"
 #include "lwis_device.h"
+#include "lwis_device_dpm.h"
+#include "lwis_device_slc.h"
 #include "lwis_event.h"
+#include "lwis_reg_capture.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
 
@@ -42,401 +48,712 @@ static void print_to_log(char *buffer)
 	}
 }
 
-static void list_transactions(struct lwis_client *client, char *k_buf, size_t k_buf_size)
+/*
+ * The debug info of a device is printed as a sequence of records, each short
+ * enough to be formatted under a single hold of the lock it needs: a header,
+ * the records of the device, then the records of each client.
+ */
+struct lwis_debug_records {
+	/* Records printed for the device and for each client, after the header */
+	int device_records;
+	int client_records;
+	void (*show_header)(struct seq_file *m, struct lwis_device *lwis_dev);
+	void (*show_device_record)(struct seq_file *m, struct lwis_device *lwis_dev, int record);
+	void (*show_client_record)(struct seq_file *m, struct lwis_client *client, int client_idx,
+				   int record);
+};
+
+/* Transactions: the client line, the pending transactions of each bucket of
+ * transaction_list, then the transaction history */
+#define TRANSACTION_INFO_CLIENT_RECORDS                                                            \
+	(1 + (1 << TRANSACTION_HASH_BITS) + TRANSACTION_DEBUG_HISTORY_SIZE)
+/* Buffers: the client line, then the buckets of allocated and enrolled buffers */
+#define BUFFER_INFO_CLIENT_RECORDS (1 + 2 * (1 << BUFFER_HASH_BITS))
+/* Event states: the buckets of event_states, then the event history */
+#define EVENT_STATES_DEVICE_RECORDS ((1 << EVENT_HASH_BITS) + EVENT_DEBUG_HISTORY_SIZE)
+
+static void show_pending_transaction(struct seq_file *m, struct lwis_transaction *transaction)
+{
+	seq_printf(m, "ID: 0x%llx Trigger Event: 0x%llx Count: 0x%llx Submitted: %lld\n",
+		   transaction->info.id, transaction->info.trigger_event_id,
+		   transaction->info.trigger_event_counter,
+		   transaction->info.submission_timestamp_ns);
+	seq_printf(m, "  Emit Success: 0x%llx Error: %llx\n",
+		   transaction->info.emit_success_event_id, transaction->info.emit_error_event_id);
+}
+
+static void show_transaction_record(struct seq_file *m, struct lwis_client *client,
+				    int client_idx, int record)
 {
-	/* Temporary buffer to be concatenated to the main buffer. */
-	char tmp_buf[128] = {};
-	int i, hist_idx;
 	unsigned long flags;
 	struct lwis_transaction_event_list *transaction_list;
 	struct lwis_transaction *transaction;
-	struct list_head *it_tran;
 	struct lwis_transaction_history *trans_hist;
+	struct rb_node *node;
+	int hist_idx;
 
-	spin_lock_irqsave(&client->transaction_lock, flags);
-	if (hash_empty(client->transaction_list)) {
-		strlcat(k_buf, "No transactions pending\n", k_buf_size);
-		goto exit;
-	}
-	strlcat(k_buf, "Pending Transactions:\n", k_buf_size);
-	hash_for_each (client->transaction_list, i, transaction_list, node) {
-		if (list_empty(&transaction_list->list)) {
-			scnprintf(tmp_buf, sizeof(tmp_buf),
-				  "No pending transaction for event 0x%llx\n",
-				  transaction_list->event_id);
-			strlcat(k_buf, tmp_buf, k_buf_size);
-			continue;
-		}
-		list_for_each (it_tran, &transaction_list->list) {
-			transaction = list_entry(it_tran, struct lwis_transaction, event_list_node);
-			scnprintf(
-				tmp_buf, sizeof(tmp_buf),
-				"ID: 0x%llx Trigger Event: 0x%llx Count: 0x%llx Submitted: %lld\n",
-				transaction->info.id, transaction->info.trigger_event_id,
-				transaction->info.trigger_event_counter,
-				transaction->info.submission_timestamp_ns);
-			strlcat(k_buf, tmp_buf, k_buf_size);
-			scnprintf(tmp_buf, sizeof(tmp_buf), "  Emit Success: 0x%llx Error: %llx\n",
-				  transaction->info.emit_success_event_id,
-				  transaction->info.emit_error_event_id);
-			strlcat(k_buf, tmp_buf, k_buf_size);
-		}
+	if (record == 0) {
+		seq_printf(m, "Client %d:\n", client_idx);
+		seq_printf(m, "Deadline Misses: %lld\n",
+			   atomic64_read(&client->debug_info.transaction_deadline_misses));
+		return;
 	}
+	record--;
 
-	strlcat(k_buf, "Last Transactions:\n", k_buf_size);
-	hist_idx = client->debug_info.cur_transaction_hist_idx;
-	for (i = 0; i < TRANSACTION_DEBUG_HISTORY_SIZE; ++i) {
-		trans_hist = &client->debug_info.transaction_hist[hist_idx];
-		/* Skip uninitialized entries */
-		if (trans_hist->process_timestamp != 0) {
-			scnprintf(tmp_buf, sizeof(tmp_buf),
-				  "[%2d] ID: 0x%llx Trigger Event: 0x%llx Count: 0x%llx\n", i,
-				  trans_hist->info.id, trans_hist->info.trigger_event_id,
-				  trans_hist->info.trigger_event_counter);
-			strlcat(k_buf, tmp_buf, k_buf_size);
-			scnprintf(tmp_buf, sizeof(tmp_buf),
-				  "     Emit Success: 0x%llx Error: %llx\n",
-				  trans_hist->info.emit_success_event_id,
-				  trans_hist->info.emit_error_event_id);
-			strlcat(k_buf, tmp_buf, k_buf_size);
-			scnprintf(tmp_buf, sizeof(tmp_buf),
-				  "     Num Entries: %zu Processed @ %lld for %lldns\n",
-				  trans_hist->info.num_io_entries, trans_hist->process_timestamp,
-				  trans_hist->process_duration_ns);
-			strlcat(k_buf, tmp_buf, k_buf_size);
+	spin_lock_irqsave(&client->transaction_lock, flags);
+	if (record < (1 << TRANSACTION_HASH_BITS)) {
+		if (record == 0) {
+			seq_puts(m, hash_empty(client->transaction_list) ?
+					    "No transactions pending\n" :
+					    "Pending Transactions:\n");
 		}
-		hist_idx++;
-		if (hist_idx >= TRANSACTION_DEBUG_HISTORY_SIZE) {
-			hist_idx = 0;
+		hlist_for_each_entry (transaction_list, &client->transaction_list[record], node) {
+			if (list_empty(&transaction_list->list) &&
+			    RB_EMPTY_ROOT(&transaction_list->counter_queue.rb_root)) {
+				seq_printf(m, "No pending transaction for event 0x%llx\n",
+					   transaction_list->event_id);
+				continue;
+			}
+			list_for_each_entry (transaction, &transaction_list->list,
+					     event_list_node) {
+				show_pending_transaction(m, transaction);
+			}
+			for (node = rb_first_cached(&transaction_list->counter_queue); node;
+			     node = rb_next(node)) {
+				show_pending_transaction(
+					m, rb_entry(node, struct lwis_transaction, counter_node));
+			}
 		}
+		goto exit;
 	}
-exit:
-	spin_unlock_irqrestore(&client->transaction_lock, flags);
-}
-
-static void list_allocated_buffers(struct lwis_client *client, char *k_buf, size_t k_buf_size)
-{
-	char tmp_buf[64] = {};
-	struct lwis_allocated_buffer *buffer;
-	int i;
-	int idx = 0;
+	record -= 1 << TRANSACTION_HASH_BITS;
 
-	if (hash_empty(client->allocated_buffers)) {
-		strlcat(k_buf, "Allocated buffers: None\n", k_buf_size);
-		return;
+	if (record == 0) {
+		seq_puts(m, "Last Transactions:\n");
 	}
-
-	strlcat(k_buf, "Allocated buffers:\n", k_buf_size);
-	hash_for_each (client->allocated_buffers, i, buffer, node) {
-		scnprintf(tmp_buf, sizeof(tmp_buf), "[%2d] FD: %d Size: %zu\n", idx++, buffer->fd,
-			  buffer->size);
-		strlcat(k_buf, tmp_buf, k_buf_size);
+	hist_idx = (client->debug_info.cur_transaction_hist_idx + record) %
+		   TRANSACTION_DEBUG_HISTORY_SIZE;
+	trans_hist = &client->debug_info.transaction_hist[hist_idx];
+	/* Skip uninitialized entries */
+	if (trans_hist->process_timestamp != 0) {
+		seq_printf(m, "[%2d] ID: 0x%llx Trigger Event: 0x%llx Count: 0x%llx\n", record,
+			   trans_hist->info.id, trans_hist->info.trigger_event_id,
+			   trans_hist->info.trigger_event_counter);
+		seq_printf(m, "     Emit Success: 0x%llx Error: %llx\n",
+			   trans_hist->info.emit_success_event_id,
+			   trans_hist->info.emit_error_event_id);
+		seq_printf(m, "     Num Entries: %zu Processed @ %lld for %lldns\n",
+			   trans_hist->info.num_io_entries, trans_hist->process_timestamp,
+			   trans_hist->process_duration_ns);
 	}
+exit:
+	spin_unlock_irqrestore(&client->transaction_lock, flags);
 }
 
-static void list_enrolled_buffers(struct lwis_client *client, char *k_buf, size_t k_buf_size)
+static void show_buffer_record(struct seq_file *m, struct lwis_client *client, int client_idx,
+			       int record)
 {
-	char tmp_buf[128] = {};
+	unsigned long flags;
+	struct lwis_allocated_buffer *alloc_buffer;
 	struct lwis_buffer_enrollment_list *enrollment_list;
-	struct list_head *it_enrollment;
 	struct lwis_enrolled_buffer *buffer;
 	dma_addr_t end_dma_vaddr;
-	int i;
-	int idx = 0;
+	struct lwis_device *lwis_dev = client->lwis_dev;
 
-	if (hash_empty(client->enrolled_buffers)) {
-		strlcat(k_buf, "Enrolled buffers: None\n", k_buf_size);
+	if (record == 0) {
+		seq_printf(m, "Client %d:\n", client_idx);
 		return;
 	}
+	record--;
 
-	strlcat(k_buf, "Enrolled buffers:\n", k_buf_size);
-	hash_for_each (client->enrolled_buffers, i, enrollment_list, node) {
-		list_for_each (it_enrollment, &enrollment_list->list) {
-			buffer = list_entry(it_enrollment, struct lwis_enrolled_buffer, list_node);
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	if (record < (1 << BUFFER_HASH_BITS)) {
+		if (record == 0) {
+			seq_puts(m, hash_empty(client->allocated_buffers) ?
+					    "Allocated buffers: None\n" :
+					    "Allocated buffers:\n");
+		}
+		hlist_for_each_entry (alloc_buffer, &client->allocated_buffers[record], node) {
+			seq_printf(m, "FD: %d Size: %zu\n", alloc_buffer->fd, alloc_buffer->size);
+		}
+		goto exit;
+	}
+	record -= 1 << BUFFER_HASH_BITS;
+
+	if (record == 0) {
+		seq_puts(m, hash_empty(client->enrolled_buffers) ? "Enrolled buffers: None\n" :
+								   "Enrolled buffers:\n");
+	}
+	hlist_for_each_entry (enrollment_list, &client->enrolled_buffers[record], node) {
+		list_for_each_entry (buffer, &enrollment_list->list, list_node) {
 			end_dma_vaddr = buffer->info.dma_vaddr + (buffer->dma_buf->size - 1);
-			scnprintf(tmp_buf, sizeof(tmp_buf),
-				  "[%2d] FD: %d Mode: %s%s Addr:[%pad ~ %pad] Size: %zu\n", idx++,
-				  buffer->info.fd, buffer->info.dma_read ? "r" : "",
-				  buffer->info.dma_write ? "w" : "", &buffer->info.dma_vaddr,
-				  &end_dma_vaddr, buffer->dma_buf->size);
-			strlcat(k_buf, tmp_buf, k_buf_size);
+			seq_printf(m, "FD: %d Mode: %s%s Addr:[%pad ~ %pad] Size: %zu\n",
+				   buffer->info.fd, buffer->info.dma_read ? "r" : "",
+				   buffer->info.dma_write ? "w" : "", &buffer->info.dma_vaddr,
+				   &end_dma_vaddr, buffer->dma_buf->size);
 		}
 	}
+exit:
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 }
 
-static int generate_device_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+static void show_device_info(struct seq_file *m, struct lwis_device *lwis_dev)
 {
-	if (lwis_dev == NULL) {
-		pr_err("Unknown LWIS device pointer\n");
-		return -EINVAL;
+	const char *state;
+
+	if (lwis_dev->enabled) {
+		state = "Enabled";
+	} else if (lwis_dev->power_lingering) {
+		/* Still powered, waiting for the linger to expire */
+		state = "Lingering";
+	} else {
+		state = "Disabled";
 	}
-	scnprintf(buffer, buffer_size, "%s Device Name: %s ID: %d State: %s\n",
-		  lwis_device_type_to_string(lwis_dev->type), lwis_dev->name, lwis_dev->id,
-		  lwis_dev->enabled ? "Enabled" : "Disabled");
-	return 0;
+	seq_printf(m, "%s Device Name: %s ID: %d State: %s\n",
+		   lwis_device_type_to_string(lwis_dev->type), lwis_dev->name, lwis_dev->id, state);
 }
 
-static int generate_event_states_info(struct lwis_device *lwis_dev, char *buffer,
-				      size_t buffer_size)
+static void show_event_states_header(struct seq_file *m, struct lwis_device *lwis_dev)
 {
-	/* Temporary buffer to be concatenated to the main buffer. */
-	char tmp_buf[96] = {};
 	int i;
-	int idx = 0;
 	unsigned long flags;
 	struct lwis_device_event_state *state;
 	bool enabled_event_present = false;
 
-	if (lwis_dev == NULL) {
-		pr_err("Unknown LWIS device pointer\n");
-		return -EINVAL;
-	}
-
-	scnprintf(buffer, buffer_size, "=== LWIS EVENT STATES INFO: %s ===\n", lwis_dev->name);
+	seq_printf(m, "=== LWIS EVENT STATES INFO: %s ===\n", lwis_dev->name);
 
 	spin_lock_irqsave(&lwis_dev->lock, flags);
 	if (hash_empty(lwis_dev->event_states)) {
-		strlcat(buffer, "  No events being monitored\n", buffer_size);
+		seq_puts(m, "  No events being monitored\n");
 		goto exit;
 	}
-	strlcat(buffer, "Enabled Device Events:\n", buffer_size);
 	hash_for_each (lwis_dev->event_states, i, state, node) {
 		if (state->enable_counter > 0) {
-			scnprintf(tmp_buf, sizeof(tmp_buf), "[%2d] ID: 0x%llx Counter: 0x%llx\n",
-				  idx++, state->event_id, state->event_counter);
-			strlcat(buffer, tmp_buf, buffer_size);
 			enabled_event_present = true;
+			break;
 		}
 	}
-	if (!enabled_event_present) {
-		strlcat(buffer, "No enabled events\n", buffer_size);
-	}
-	strlcat(buffer, "Last Events:\n", buffer_size);
-	idx = lwis_dev->debug_info.cur_event_hist_idx;
-	for (i = 0; i < EVENT_DEBUG_HISTORY_SIZE; ++i) {
-		state = &lwis_dev->debug_info.event_hist[idx].state;
-		/* Skip uninitialized entries */
-		if (state->event_id != 0) {
-			scnprintf(tmp_buf, sizeof(tmp_buf),
-				  "[%2d] ID: 0x%llx Counter: 0x%llx Timestamp: %lld\n", i,
-				  state->event_id, state->event_counter,
-				  lwis_dev->debug_info.event_hist[idx].timestamp);
-			strlcat(buffer, tmp_buf, buffer_size);
-		}
-		idx++;
-		if (idx >= EVENT_DEBUG_HISTORY_SIZE) {
-			idx = 0;
+	seq_puts(m, enabled_event_present ? "Enabled Device Events:\n" : "No enabled events\n");
+exit:
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+}
+
+static void show_event_states_record(struct seq_file *m, struct lwis_device *lwis_dev,
+				     int record)
+{
+	unsigned long flags;
+	struct lwis_device_event_state *state;
+	int hist_idx;
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	if (record < (1 << EVENT_HASH_BITS)) {
+		hlist_for_each_entry (state, &lwis_dev->event_states[record], node) {
+			if (state->enable_counter > 0) {
+				seq_printf(m, "ID: 0x%llx Counter: 0x%llx\n", state->event_id,
+					   state->event_counter);
+			}
 		}
+		goto exit;
 	}
+	record -= 1 << EVENT_HASH_BITS;
 
+	if (record == 0) {
+		seq_puts(m, "Last Events:\n");
+	}
+	hist_idx = (lwis_dev->debug_info.cur_event_hist_idx + record) % EVENT_DEBUG_HISTORY_SIZE;
+	state = &lwis_dev->debug_info.event_hist[hist_idx].state;
+	/* Skip uninitialized entries */
+	if (state->event_id != 0) {
+		seq_printf(m, "[%2d] ID: 0x%llx Counter: 0x%llx Timestamp: %lld\n", record,
+			   state->event_id, state->event_counter,
+			   lwis_dev->debug_info.event_hist[hist_idx].timestamp);
+	}
 exit:
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
-	return 0;
 }
 
-static int generate_transaction_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+static void show_clients_header(struct seq_file *m, struct lwis_device *lwis_dev,
+				const char *title)
 {
-	/* Temporary buffer to be concatenated to the main buffer. */
-	char tmp_buf[64] = {};
+	seq_printf(m, "=== LWIS %s: %s ===\n", title, lwis_dev->name);
+	if (list_empty(&lwis_dev->clients)) {
+		seq_puts(m, "No clients opened\n");
+	}
+}
+
+static void show_transaction_header(struct seq_file *m, struct lwis_device *lwis_dev)
+{
+	show_clients_header(m, lwis_dev, "TRANSACTION INFO");
+}
+
+static void show_buffer_header(struct seq_file *m, struct lwis_device *lwis_dev)
+{
+	show_clients_header(m, lwis_dev, "BUFFER INFO");
+}
+
+static const struct lwis_debug_records event_states_records = {
+	.device_records = EVENT_STATES_DEVICE_RECORDS,
+	.show_header = show_event_states_header,
+	.show_device_record = show_event_states_record,
+};
+
+static const struct lwis_debug_records transaction_records = {
+	.client_records = TRANSACTION_INFO_CLIENT_RECORDS,
+	.show_header = show_transaction_header,
+	.show_client_record = show_transaction_record,
+};
+
+static const struct lwis_debug_records buffer_records = {
+	.client_records = BUFFER_INFO_CLIENT_RECORDS,
+	.show_header = show_buffer_header,
+	.show_client_record = show_buffer_record,
+};
+
+#define PRINT_RECORD_BUFFER_SIZE 1024
+/*
+ * print_records: Prints the records to the kernel log one at a time, through
+ * a seq_file over a buffer of its own. The client list is walked without
+ * client_lock, as these dumps are requested from fault handlers.
+ */
+static int print_records(struct lwis_device *lwis_dev, const struct lwis_debug_records *records)
+{
+	struct seq_file m = {};
 	struct lwis_client *client;
-	int idx = 0;
+	int client_idx = 0;
+	int i;
 
-	if (lwis_dev == NULL) {
-		pr_err("Unknown LWIS device pointer\n");
-		return -EINVAL;
+	/* One more byte to terminate a full buffer */
+	m.buf = kmalloc(PRINT_RECORD_BUFFER_SIZE + 1, GFP_KERNEL);
+	if (!m.buf) {
+		dev_err(lwis_dev->dev, "Failed to allocate log buffer\n");
+		return -ENOMEM;
+	}
+	m.size = PRINT_RECORD_BUFFER_SIZE;
+
+	records->show_header(&m, lwis_dev);
+	m.buf[m.count] = '\0';
+	print_to_log(m.buf);
+	for (i = 0; i < records->device_records; ++i) {
+		m.count = 0;
+		records->show_device_record(&m, lwis_dev, i);
+		m.buf[m.count] = '\0';
+		print_to_log(m.buf);
+	}
+	list_for_each_entry (client, &lwis_dev->clients, node) {
+		for (i = 0; i < records->client_records; ++i) {
+			m.count = 0;
+			records->show_client_record(&m, client, client_idx, i);
+			m.buf[m.count] = '\0';
+			print_to_log(m.buf);
+		}
+		client_idx++;
 	}
 
-	scnprintf(buffer, buffer_size, "=== LWIS TRANSACTION INFO: %s ===\n", lwis_dev->name);
+	kfree(m.buf);
+	return 0;
+}
 
-	if (list_empty(&lwis_dev->clients)) {
-		scnprintf(buffer, buffer_size, "No clients opened\n");
-		return 0;
-	}
+int lwis_debug_print_device_info(struct lwis_device *lwis_dev)
+{
+	/* Buffer to store information */
+	char buffer[256] = {};
+	struct seq_file m = {
+		.buf = buffer,
+		.size = sizeof(buffer) - 1,
+	};
+
+	show_device_info(&m, lwis_dev);
+	print_to_log(buffer);
+	return 0;
+}
+
+int lwis_debug_print_event_states_info(struct lwis_device *lwis_dev)
+{
+	return print_records(lwis_dev, &event_states_records);
+}
+
+int lwis_debug_print_transaction_info(struct lwis_device *lwis_dev)
+{
+	return print_records(lwis_dev, &transaction_records);
+}
+
+int lwis_debug_print_buffer_info(struct lwis_device *lwis_dev)
+{
+	return print_records(lwis_dev, &buffer_records);
+}
+
+void lwis_debug_print_buffer_at(struct lwis_device *lwis_dev, dma_addr_t dma_vaddr)
+{
+	struct lwis_client *client;
+	struct lwis_enrolled_buffer *buffer;
+	dma_addr_t end_dma_vaddr;
+	unsigned long flags;
+	int idx = 0;
+	bool found = false;
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
 	list_for_each_entry (client, &lwis_dev->clients, node) {
-		scnprintf(tmp_buf, sizeof(tmp_buf), "Client %d:\n", idx);
-		strlcat(buffer, tmp_buf, buffer_size);
-		list_transactions(client, buffer, buffer_size);
+		buffer = lwis_client_enrolled_buffer_find_range(client, dma_vaddr, 1);
+		if (buffer) {
+			end_dma_vaddr = buffer->info.dma_vaddr + (buffer->dma_buf->size - 1);
+			pr_err("%pad is in client %d FD: %d Addr:[%pad ~ %pad] Offset: %#llx\n",
+			       &dma_vaddr, idx, buffer->info.fd, &buffer->info.dma_vaddr,
+			       &end_dma_vaddr, (u64)(dma_vaddr - buffer->info.dma_vaddr));
+			found = true;
+		}
 		idx++;
 	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 
-	return 0;
+	if (!found) {
+		pr_err("Address %pad is not in any enrolled buffer of %s\n", &dma_vaddr,
+		       lwis_dev->name);
+	}
 }
 
-static int generate_buffer_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+/* DebugFS specific functions */
+#ifdef CONFIG_DEBUG_FS
+
+static const char *transaction_exec_type_names[LWIS_TRANSACTION_EXEC_NUM_TYPES] = {
+	[LWIS_TRANSACTION_EXEC_EVENT_CONTEXT] = "Event Context",
+	[LWIS_TRANSACTION_EXEC_REAL_TIME] = "Real Time",
+	[LWIS_TRANSACTION_EXEC_WORKER] = "Worker",
+};
+
+static const char *transaction_latency_stage_names[LWIS_TRANSACTION_LATENCY_NUM_STAGES] = {
+	[LWIS_TRANSACTION_LATENCY_TRIGGER_TO_START] = "Trigger to Start",
+	[LWIS_TRANSACTION_LATENCY_START_TO_END] = "Start to End",
+	[LWIS_TRANSACTION_LATENCY_END_TO_DELIVERED] = "End to Delivered",
+};
+
+static int generate_transaction_latency_info(struct lwis_device *lwis_dev, char *buffer,
+					     size_t buffer_size)
 {
 	/* Temporary buffer to be concatenated to the main buffer. */
 	char tmp_buf[64] = {};
-	struct lwis_client *client;
-	int idx = 0;
-	unsigned long flags;
+	struct lwis_latency_histogram *hist;
+	int64_t count;
+	int i, j, k;
 
 	if (lwis_dev == NULL) {
 		pr_err("Unknown LWIS device pointer\n");
 		return -EINVAL;
 	}
 
-	scnprintf(buffer, buffer_size, "=== LWIS BUFFER INFO: %s ===\n", lwis_dev->name);
+	scnprintf(buffer, buffer_size, "=== LWIS TRANSACTION LATENCY: %s ===\n", lwis_dev->name);
+	for (i = 0; i < LWIS_TRANSACTION_EXEC_NUM_TYPES; ++i) {
+		for (j = 0; j < LWIS_TRANSACTION_LATENCY_NUM_STAGES; ++j) {
+			hist = &lwis_dev->debug_info.transaction_latency[i][j];
+			scnprintf(tmp_buf, sizeof(tmp_buf), "%s - %s:\n",
+				  transaction_exec_type_names[i], transaction_latency_stage_names[j]);
+			strlcat(buffer, tmp_buf, buffer_size);
+			/* Only print the buckets that have samples */
+			for (k = 0; k < LWIS_LATENCY_HISTOGRAM_NUM_BUCKETS; ++k) {
+				count = atomic64_read(&hist->buckets[k]);
+				if (count == 0) {
+					continue;
+				}
+				scnprintf(tmp_buf, sizeof(tmp_buf), "  >= %lluns: %lld\n", 1ULL << k,
+					  count);
+				strlcat(buffer, tmp_buf, buffer_size);
+			}
+		}
+	}
 
-	if (list_empty(&lwis_dev->clients)) {
-		scnprintf(buffer, buffer_size, "No clients opened\n");
+	return 0;
+}
+
+static void reset_transaction_latency_info(struct lwis_device *lwis_dev)
+{
+	int i, j;
+
+	for (i = 0; i < LWIS_TRANSACTION_EXEC_NUM_TYPES; ++i) {
+		for (j = 0; j < LWIS_TRANSACTION_LATENCY_NUM_STAGES; ++j) {
+			lwis_latency_histogram_reset(&lwis_dev->debug_info.transaction_latency[i][j]);
+		}
+	}
+}
+
+static int generate_allocator_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+{
+	/* Temporary buffer to be concatenated to the main buffer. */
+	char tmp_buf[160] = {};
+	struct lwis_allocator_block_mgr *block_mgr;
+	struct lwis_allocator_block_pool *pools[LWIS_ALLOCATOR_NUM_POOLS];
+	int i;
+
+	scnprintf(buffer, buffer_size, "=== LWIS ALLOCATOR INFO: %s ===\n", lwis_dev->name);
+
+	/* The block manager only lives while clients are open */
+	mutex_lock(&lwis_dev->client_lock);
+	block_mgr = lwis_dev->block_mgr;
+	if (block_mgr == NULL) {
+		mutex_unlock(&lwis_dev->client_lock);
+		strlcat(buffer, "No clients opened\n", buffer_size);
 		return 0;
 	}
 
-	spin_lock_irqsave(&lwis_dev->lock, flags);
-	list_for_each_entry (client, &lwis_dev->clients, node) {
-		scnprintf(tmp_buf, sizeof(tmp_buf), "Client %d:\n", idx);
+	pools[0] = &block_mgr->pool_8k;
+	pools[1] = &block_mgr->pool_16k;
+	pools[2] = &block_mgr->pool_32k;
+	pools[3] = &block_mgr->pool_64k;
+	pools[4] = &block_mgr->pool_128k;
+	pools[5] = &block_mgr->pool_256k;
+	pools[6] = &block_mgr->pool_512k;
+	for (i = 0; i < LWIS_ALLOCATOR_NUM_POOLS; ++i) {
+		scnprintf(tmp_buf, sizeof(tmp_buf),
+			  "%s: In use: %d High water: %d Free: %u Reserve: %u Hits: %lld "
+			  "Misses: %lld\n",
+			  pools[i]->name, atomic_read(&pools[i]->in_use_count),
+			  atomic_read(&pools[i]->high_water), READ_ONCE(pools[i]->free_count),
+			  pools[i]->reserve, atomic64_read(&pools[i]->hits),
+			  atomic64_read(&pools[i]->misses));
 		strlcat(buffer, tmp_buf, buffer_size);
-		list_allocated_buffers(client, buffer, buffer_size);
-		list_enrolled_buffers(client, buffer, buffer_size);
-		idx++;
 	}
-	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+	scnprintf(tmp_buf, sizeof(tmp_buf), "%s: In use: %d\n", block_mgr->pool_large.name,
+		  atomic_read(&block_mgr->pool_large.in_use_count));
+	strlcat(buffer, tmp_buf, buffer_size);
+	mutex_unlock(&lwis_dev->client_lock);
 
 	return 0;
 }
 
-int lwis_debug_print_device_info(struct lwis_device *lwis_dev)
+static void show_stats_header(struct seq_file *m, struct lwis_device *lwis_dev)
 {
-	int ret = 0;
-	/* Buffer to store information */
-	char buffer[256] = {};
-	const size_t buffer_size = sizeof(buffer);
+	seq_printf(m, "=== LWIS STATS: %s ===\n", lwis_dev->name);
+	seq_printf(m,
+		   "Events emitted: %lld Alloc failures: %lld Bytes read: %lld Bytes written: %lld\n",
+		   atomic64_read(&lwis_dev->stats.events_emitted),
+		   atomic64_read(&lwis_dev->stats.alloc_failures),
+		   atomic64_read(&lwis_dev->stats.bytes_read),
+		   atomic64_read(&lwis_dev->stats.bytes_written));
+}
 
-	ret = generate_device_info(lwis_dev, buffer, buffer_size);
-	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to generate device info");
-		return ret;
+static void show_stats_record(struct seq_file *m, struct lwis_client *client, int client_idx,
+			      int record)
+{
+	struct lwis_stats stats;
+
+	lwis_client_stats_get(client, &stats);
+	seq_printf(m, "Client %d: Events queued: %llu dropped: %llu high water: %llu\n", client_idx,
+		   stats.events_queued, stats.events_dropped, stats.event_queue_high_water);
+	seq_printf(m, "  Transactions succeeded: %llu failed: %llu cancelled: %llu late: %llu\n",
+		   stats.transactions_succeeded, stats.transactions_failed,
+		   stats.transactions_cancelled, stats.transaction_deadline_misses);
+	seq_printf(m, "  Periodic io ticks missed: %llu Alloc failures: %llu\n",
+		   stats.periodic_io_ticks_missed, stats.alloc_failures);
+}
+
+static const struct lwis_debug_records stats_records = {
+	.client_records = 1,
+	.show_header = show_stats_header,
+	.show_client_record = show_stats_record,
+};
+
+/* State of an open debugfs file printing lwis_debug_records */
+struct lwis_debug_seq {
+	struct lwis_device *lwis_dev;
+	const struct lwis_debug_records *records;
+	/* Records to print, counted with client_lock held */
+	loff_t num_records;
+};
+
+/* Records are handed around as their position plus one, NULL ending the walk */
+static void *records_seq_start(struct seq_file *m, loff_t *pos)
+{
+	struct lwis_debug_seq *seq = m->private;
+	struct lwis_device *lwis_dev = seq->lwis_dev;
+	struct lwis_client *client;
+
+	/* Held until stop, so that clients stay in place between records. The
+	 * records take their own spinlocks just while they are formatted. */
+	mutex_lock(&lwis_dev->client_lock);
+	seq->num_records = 1 + seq->records->device_records;
+	list_for_each_entry (client, &lwis_dev->clients, node) {
+		seq->num_records += seq->records->client_records;
 	}
-	print_to_log(buffer);
-	return 0;
+	if (*pos >= seq->num_records) {
+		return NULL;
+	}
+	return (void *)(uintptr_t)(*pos + 1);
 }
 
-int lwis_debug_print_event_states_info(struct lwis_device *lwis_dev)
+static void *records_seq_next(struct seq_file *m, void *v, loff_t *pos)
 {
-	int ret = 0;
-	/* Buffer to store information */
-	const size_t buffer_size = 8192;
-	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
-	if (!buffer) {
-		dev_err(lwis_dev->dev, "Failed to allocate event states log buffer\n");
-		return -ENOMEM;
+	struct lwis_debug_seq *seq = m->private;
+
+	++*pos;
+	if (*pos >= seq->num_records) {
+		return NULL;
 	}
+	return (void *)(uintptr_t)(*pos + 1);
+}
 
-	ret = generate_event_states_info(lwis_dev, buffer, buffer_size);
-	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to generate event states info");
-		goto exit;
+static void records_seq_stop(struct seq_file *m, void *v)
+{
+	struct lwis_debug_seq *seq = m->private;
+
+	mutex_unlock(&seq->lwis_dev->client_lock);
+}
+
+static int records_seq_show(struct seq_file *m, void *v)
+{
+	struct lwis_debug_seq *seq = m->private;
+	const struct lwis_debug_records *records = seq->records;
+	struct lwis_device *lwis_dev = seq->lwis_dev;
+	struct lwis_client *client;
+	loff_t record = (uintptr_t)v - 1;
+	int client_idx = 0;
+
+	if (record == 0) {
+		records->show_header(m, lwis_dev);
+		return 0;
 	}
-	print_to_log(buffer);
-exit:
-	kfree(buffer);
-	return ret;
+	record--;
+	if (record < records->device_records) {
+		records->show_device_record(m, lwis_dev, record);
+		return 0;
+	}
+	record -= records->device_records;
+	list_for_each_entry (client, &lwis_dev->clients, node) {
+		if (record < records->client_records) {
+			records->show_client_record(m, client, client_idx, record);
+			break;
+		}
+		record -= records->client_records;
+		client_idx++;
+	}
+	return 0;
 }
 
-int lwis_debug_print_transaction_info(struct lwis_device *lwis_dev)
+static const struct seq_operations records_seq_ops = {
+	.start = records_seq_start,
+	.next = records_seq_next,
+	.stop = records_seq_stop,
+	.show = records_seq_show,
+};
+
+static int records_open(struct inode *inode, struct file *fp,
+			const struct lwis_debug_records *records)
 {
-	int ret = 0;
-	/* Buffer to store information */
-	const size_t buffer_size = 10240;
-	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
-	if (!buffer) {
-		dev_err(lwis_dev->dev, "Failed to allocate transaction info log buffer\n");
+	struct lwis_debug_seq *seq;
+
+	seq = __seq_open_private(fp, &records_seq_ops, sizeof(struct lwis_debug_seq));
+	if (!seq) {
 		return -ENOMEM;
 	}
+	seq->lwis_dev = inode->i_private;
+	seq->records = records;
+	return 0;
+}
 
-	ret = generate_transaction_info(lwis_dev, buffer, buffer_size);
-	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to generate transaction info");
-		goto exit;
-	}
-	print_to_log(buffer);
-exit:
-	kfree(buffer);
-	return ret;
+static int dev_info_show(struct seq_file *m, void *v)
+{
+	show_device_info(m, m->private);
+	return 0;
 }
 
-int lwis_debug_print_buffer_info(struct lwis_device *lwis_dev)
+static int dev_info_open(struct inode *inode, struct file *fp)
+{
+	return single_open(fp, dev_info_show, inode->i_private);
+}
+
+static int event_states_open(struct inode *inode, struct file *fp)
+{
+	return records_open(inode, fp, &event_states_records);
+}
+
+static int transaction_info_open(struct inode *inode, struct file *fp)
+{
+	return records_open(inode, fp, &transaction_records);
+}
+
+static int buffer_info_open(struct inode *inode, struct file *fp)
+{
+	return records_open(inode, fp, &buffer_records);
+}
+
+static int stats_open(struct inode *inode, struct file *fp)
+{
+	return records_open(inode, fp, &stats_records);
+}
+
+static ssize_t transaction_latency_read(struct file *fp, char __user *user_buf, size_t count,
+					loff_t *position)
 {
 	int ret = 0;
 	/* Buffer to store information */
-	const size_t buffer_size = 2048;
+	const size_t buffer_size = 8192;
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
 	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
 	if (!buffer) {
-		dev_err(lwis_dev->dev, "Failed to allocate buffer info log buffer\n");
+		dev_err(lwis_dev->dev, "Failed to allocate transaction latency log buffer\n");
 		return -ENOMEM;
 	}
 
-	ret = generate_buffer_info(lwis_dev, buffer, buffer_size);
+	ret = generate_transaction_latency_info(lwis_dev, buffer, buffer_size);
 	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to generate buffer info");
+		dev_err(lwis_dev->dev, "Failed to generate transaction latency info\n");
 		goto exit;
 	}
-	print_to_log(buffer);
+
+	ret = simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
 exit:
 	kfree(buffer);
 	return ret;
 }
 
-/* DebugFS specific functions */
-#ifdef CONFIG_DEBUG_FS
-
-static ssize_t dev_info_read(struct file *fp, char __user *user_buf, size_t count, loff_t *position)
+/* Writing anything to the file resets the histograms */
+static ssize_t transaction_latency_write(struct file *fp, const char __user *user_buf,
+					 size_t count, loff_t *position)
 {
-	int ret = 0;
-	/* Buffer to store information */
-	char buffer[256] = {};
-	const size_t buffer_size = sizeof(buffer);
 	struct lwis_device *lwis_dev = fp->f_inode->i_private;
 
-	ret = generate_device_info(lwis_dev, buffer, buffer_size);
-	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to generate device info");
-		return ret;
-	}
-
-	return simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
+	reset_transaction_latency_info(lwis_dev);
+	return count;
 }
 
-static ssize_t event_states_read(struct file *fp, char __user *user_buf, size_t count,
-				 loff_t *position)
+static ssize_t allocator_info_read(struct file *fp, char __user *user_buf, size_t count,
+				   loff_t *position)
 {
 	int ret = 0;
 	/* Buffer to store information */
-	const size_t buffer_size = 8192;
+	const size_t buffer_size = 2048;
 	struct lwis_device *lwis_dev = fp->f_inode->i_private;
 	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
 	if (!buffer) {
-		dev_err(lwis_dev->dev, "Failed to allocate event states log buffer\n");
+		dev_err(lwis_dev->dev, "Failed to allocate allocator info log buffer\n");
 		return -ENOMEM;
 	}
 
-	ret = generate_event_states_info(lwis_dev, buffer, buffer_size);
+	ret = generate_allocator_info(lwis_dev, buffer, buffer_size);
 	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to generate event states info");
+		dev_err(lwis_dev->dev, "Failed to generate allocator info\n");
 		goto exit;
 	}
+
 	ret = simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
 exit:
 	kfree(buffer);
 	return ret;
 }
 
-static ssize_t transaction_info_read(struct file *fp, char __user *user_buf, size_t count,
-				     loff_t *position)
+static ssize_t slc_info_read(struct file *fp, char __user *user_buf, size_t count,
+			     loff_t *position)
 {
 	int ret = 0;
 	/* Buffer to store information */
-	const size_t buffer_size = 10240;
+	const size_t buffer_size = 4096;
 	struct lwis_device *lwis_dev = fp->f_inode->i_private;
 	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
 	if (!buffer) {
-		dev_err(lwis_dev->dev, "Failed to allocate transaction info log buffer\n");
+		dev_err(lwis_dev->dev, "Failed to allocate SLC info log buffer\n");
 		return -ENOMEM;
 	}
 
-	ret = generate_transaction_info(lwis_dev, buffer, buffer_size);
+	ret = lwis_slc_generate_info(lwis_dev, buffer, buffer_size);
 	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to generate transaction info\n");
+		dev_err(lwis_dev->dev, "Failed to generate SLC info\n");
 		goto exit;
 	}
 
@@ -446,22 +763,70 @@ exit:
 	return ret;
 }
 
-static ssize_t buffer_info_read(struct file *fp, char __user *user_buf, size_t count,
-				loff_t *position)
+static struct file_operations dev_info_fops = {
+	.owner = THIS_MODULE,
+	.open = dev_info_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static struct file_operations event_states_fops = {
+	.owner = THIS_MODULE,
+	.open = event_states_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release_private,
+};
+
+static struct file_operations transaction_info_fops = {
+	.owner = THIS_MODULE,
+	.open = transaction_info_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release_private,
+};
+
+static struct file_operations transaction_latency_fops = {
+	.owner = THIS_MODULE,
+	.read = transaction_latency_read,
+	.write = transaction_latency_write,
+};
+
+static struct file_operations buffer_info_fops = {
+	.owner = THIS_MODULE,
+	.open = buffer_info_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release_private,
+};
+
+static struct file_operations allocator_info_fops = {
+	.owner = THIS_MODULE,
+	.read = allocator_info_read,
+};
+
+static struct file_operations slc_info_fops = {
+	.owner = THIS_MODULE,
+	.read = slc_info_read,
+};
+
+static ssize_t bts_info_read(struct file *fp, char __user *user_buf, size_t count,
+			     loff_t *position)
 {
 	int ret = 0;
 	/* Buffer to store information */
-	const size_t buffer_size = 2048;
+	const size_t buffer_size = 4096;
 	struct lwis_device *lwis_dev = fp->f_inode->i_private;
 	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
 	if (!buffer) {
-		dev_err(lwis_dev->dev, "Failed to allocate buffer info log buffer\n");
+		dev_err(lwis_dev->dev, "Failed to allocate bts info log buffer\n");
 		return -ENOMEM;
 	}
 
-	ret = generate_buffer_info(lwis_dev, buffer, buffer_size);
+	ret = lwis_dpm_bts_auto_generate_info(lwis_dev, buffer, buffer_size);
 	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to generate buffer info\n");
+		dev_err(lwis_dev->dev, "Failed to generate bts info\n");
 		goto exit;
 	}
 
@@ -471,25 +836,88 @@ exit:
 	return ret;
 }
 
-static struct file_operations dev_info_fops = {
+static struct file_operations bts_info_fops = {
 	.owner = THIS_MODULE,
-	.read = dev_info_read,
+	.read = bts_info_read,
 };
 
-static struct file_operations event_states_fops = {
+static struct file_operations stats_fops = {
 	.owner = THIS_MODULE,
-	.read = event_states_read,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release_private,
 };
 
-static struct file_operations transaction_info_fops = {
+/* Reads move the captured records out, oldest first */
+static ssize_t reg_capture_read(struct file *fp, char __user *user_buf, size_t count,
+				loff_t *position)
+{
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+
+	return lwis_reg_capture_read(lwis_dev, user_buf, count);
+}
+
+/* Writing the number of records of the ring starts a capture, 0 stops it */
+static ssize_t reg_capture_write(struct file *fp, const char __user *user_buf, size_t count,
+				 loff_t *position)
+{
+	int ret;
+	unsigned long num_records;
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+
+	ret = kstrtoul_from_user(user_buf, count, 0, &num_records);
+	if (ret) {
+		return ret;
+	}
+	ret = lwis_reg_capture_start(lwis_dev, num_records);
+	return ret ? ret : count;
+}
+
+static struct file_operations reg_capture_fops = {
 	.owner = THIS_MODULE,
-	.read = transaction_info_read,
+	.read = reg_capture_read,
+	.write = reg_capture_write,
+	.llseek = no_llseek,
 };
 
-static struct file_operations buffer_info_fops = {
+#ifdef CONFIG_LWIS_BENCHMARK
+static ssize_t benchmark_read(struct file *fp, char __user *user_buf, size_t count,
+			      loff_t *position)
+{
+	int ret = 0;
+	/* Buffer to store information */
+	const size_t buffer_size = 4096;
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+	char *buffer;
+
+	/* Results of the first read are returned in full, a rerun needs a reopen */
+	if (*position > 0) {
+		return 0;
+	}
+
+	buffer = kzalloc(buffer_size, GFP_KERNEL);
+	if (!buffer) {
+		dev_err(lwis_dev->dev, "Failed to allocate benchmark log buffer\n");
+		return -ENOMEM;
+	}
+
+	ret = lwis_benchmark_run(lwis_dev, buffer, buffer_size);
+	if (ret) {
+		goto exit;
+	}
+
+	ret = simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
+exit:
+	kfree(buffer);
+	return ret;
+}
+
+static struct file_operations benchmark_fops = {
 	.owner = THIS_MODULE,
-	.read = buffer_info_read,
+	.read = benchmark_read,
 };
+#endif
 
 int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_root)
 {
@@ -497,7 +925,14 @@ int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_r
 	struct dentry *dbg_dev_info_file;
 	struct dentry *dbg_event_file;
 	struct dentry *dbg_transaction_file;
+	struct dentry *dbg_transaction_latency_file;
 	struct dentry *dbg_buffer_file;
+	struct dentry *dbg_allocator_file;
+	struct dentry *dbg_slc_file = NULL;
+	struct dentry *dbg_bts_file = NULL;
+	struct dentry *dbg_benchmark_file = NULL;
+	struct dentry *dbg_stats_file;
+	struct dentry *dbg_reg_capture_file;
 
 	/* DebugFS not present, just return */
 	if (dbg_root == NULL) {
@@ -535,6 +970,14 @@ int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_r
 		dbg_transaction_file = NULL;
 	}
 
+	dbg_transaction_latency_file = debugfs_create_file("transaction_latency", 0644, dbg_dir,
+							   lwis_dev, &transaction_latency_fops);
+	if (IS_ERR_OR_NULL(dbg_transaction_latency_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS transaction_latency - %ld",
+			 PTR_ERR(dbg_transaction_latency_file));
+		dbg_transaction_latency_file = NULL;
+	}
+
 	dbg_buffer_file =
 		debugfs_create_file("buffer_info", 0444, dbg_dir, lwis_dev, &buffer_info_fops);
 	if (IS_ERR_OR_NULL(dbg_buffer_file)) {
@@ -543,11 +986,71 @@ int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_r
 		dbg_buffer_file = NULL;
 	}
 
+	dbg_allocator_file = debugfs_create_file("allocator_info", 0444, dbg_dir, lwis_dev,
+						 &allocator_info_fops);
+	if (IS_ERR_OR_NULL(dbg_allocator_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS allocator_info - %ld",
+			 PTR_ERR(dbg_allocator_file));
+		dbg_allocator_file = NULL;
+	}
+
+	dbg_stats_file = debugfs_create_file("stats", 0444, dbg_dir, lwis_dev, &stats_fops);
+	if (IS_ERR_OR_NULL(dbg_stats_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS stats - %ld",
+			 PTR_ERR(dbg_stats_file));
+		dbg_stats_file = NULL;
+	}
+
+	dbg_reg_capture_file = debugfs_create_file("reg_io_capture", 0600, dbg_dir, lwis_dev,
+						   &reg_capture_fops);
+	if (IS_ERR_OR_NULL(dbg_reg_capture_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS reg_io_capture - %ld",
+			 PTR_ERR(dbg_reg_capture_file));
+		dbg_reg_capture_file = NULL;
+	}
+
+	if (lwis_dev->type == DEVICE_TYPE_SLC) {
+		dbg_slc_file =
+			debugfs_create_file("slc_info", 0444, dbg_dir, lwis_dev, &slc_info_fops);
+		if (IS_ERR_OR_NULL(dbg_slc_file)) {
+			dev_warn(lwis_dev->dev, "Failed to create DebugFS slc_info - %ld",
+				 PTR_ERR(dbg_slc_file));
+			dbg_slc_file = NULL;
+		}
+	}
+
+	if (lwis_dev->bts_counters_present) {
+		dbg_bts_file =
+			debugfs_create_file("bts_info", 0444, dbg_dir, lwis_dev, &bts_info_fops);
+		if (IS_ERR_OR_NULL(dbg_bts_file)) {
+			dev_warn(lwis_dev->dev, "Failed to create DebugFS bts_info - %ld",
+				 PTR_ERR(dbg_bts_file));
+			dbg_bts_file = NULL;
+		}
+	}
+
+#ifdef CONFIG_LWIS_BENCHMARK
+	dbg_benchmark_file =
+		debugfs_create_file("benchmark", 0400, dbg_dir, lwis_dev, &benchmark_fops);
+	if (IS_ERR_OR_NULL(dbg_benchmark_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS benchmark - %ld",
+			 PTR_ERR(dbg_benchmark_file));
+		dbg_benchmark_file = NULL;
+	}
+#endif
+
 	lwis_dev->dbg_dir = dbg_dir;
 	lwis_dev->dbg_dev_info_file = dbg_dev_info_file;
 	lwis_dev->dbg_event_file = dbg_event_file;
 	lwis_dev->dbg_transaction_file = dbg_transaction_file;
+	lwis_dev->dbg_transaction_latency_file = dbg_transaction_latency_file;
 	lwis_dev->dbg_buffer_file = dbg_buffer_file;
+	lwis_dev->dbg_allocator_file = dbg_allocator_file;
+	lwis_dev->dbg_slc_file = dbg_slc_file;
+	lwis_dev->dbg_bts_file = dbg_bts_file;
+	lwis_dev->dbg_benchmark_file = dbg_benchmark_file;
+	lwis_dev->dbg_stats_file = dbg_stats_file;
+	lwis_dev->dbg_reg_capture_file = dbg_reg_capture_file;
 
 	return 0;
 }
@@ -563,7 +1066,14 @@ int lwis_device_debugfs_cleanup(struct lwis_device *lwis_dev)
 	lwis_dev->dbg_dev_info_file = NULL;
 	lwis_dev->dbg_event_file = NULL;
 	lwis_dev->dbg_transaction_file = NULL;
+	lwis_dev->dbg_transaction_latency_file = NULL;
 	lwis_dev->dbg_buffer_file = NULL;
+	lwis_dev->dbg_allocator_file = NULL;
+	lwis_dev->dbg_slc_file = NULL;
+	lwis_dev->dbg_bts_file = NULL;
+	lwis_dev->dbg_benchmark_file = NULL;
+	lwis_dev->dbg_stats_file = NULL;
+	lwis_dev->dbg_reg_capture_file = NULL;
 	return 0;
 }
 
@@ -14,6 +14,7 @@ int lwis_debug_print_device_info(struct lwis_device *lwis_dev);
 int lwis_debug_print_event_states_info(struct lwis_device *lwis_dev);
 int lwis_debug_print_transaction_info(struct lwis_device *lwis_dev);
 int lwis_debug_print_buffer_info(struct lwis_device *lwis_dev);
+void lwis_debug_print_buffer_at(struct lwis_device *lwis_dev, dma_addr_t dma_vaddr);
 
 /* DebugFS specific functions */
 int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_root);
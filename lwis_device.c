@@ -23,20 +23,29 @@
 
 #include "lwis_buffer.h"
 #include "lwis_clock.h"
+#include "lwis_cmd_buffer.h"
 #include "lwis_commands.h"
 #include "lwis_debug.h"
 #include "lwis_device.h"
 #include "lwis_device_dpm.h"
 #include "lwis_device_slc.h"
+#include "lwis_dma_pool.h"
 #include "lwis_dt.h"
 #include "lwis_event.h"
 #include "lwis_gpio.h"
+#include "lwis_i2c.h"
 #include "lwis_init.h"
+#include "lwis_io_entry.h"
+#include "lwis_io_program.h"
 #include "lwis_ioctl.h"
+#include "lwis_ioreg.h"
 #include "lwis_periodic_io.h"
 #include "lwis_pinctrl.h"
 #include "lwis_platform.h"
+#include "lwis_reg_cache.h"
+#include "lwis_reg_capture.h"
 #include "lwis_transaction.h"
+#include "lwis_util.h"
 #include "lwis_version.h"
 
 #ifdef CONFIG_OF
@@ -60,6 +69,7 @@ static int lwis_release(struct inode *node, struct file *fp);
 static long lwis_ioctl(struct file *fp, unsigned int type, unsigned long param);
 static unsigned int lwis_poll(struct file *fp, poll_table *wait);
 static ssize_t lwis_read(struct file *fp, char __user *user_buf, size_t count, loff_t *pos);
+static int lwis_mmap(struct file *fp, struct vm_area_struct *vma);
 
 static struct file_operations lwis_fops = {
 	.owner = THIS_MODULE,
@@ -68,6 +78,10 @@ static struct file_operations lwis_fops = {
 	.unlocked_ioctl = lwis_ioctl,
 	.poll = lwis_poll,
 	.read = lwis_read,
+	.mmap = lwis_mmap,
+#if LWIS_URING_CMD_SUPPORTED
+	.uring_cmd = lwis_ioctl_uring_cmd,
+#endif
 };
 
 /*
@@ -78,6 +92,7 @@ static int lwis_open(struct inode *node, struct file *fp)
 	struct lwis_device *lwis_dev;
 	struct lwis_client *lwis_client;
 	unsigned long flags;
+	int ret;
 
 	/* Making sure the minor number associated with fp exists */
 	mutex_lock(&core.lock);
@@ -106,6 +121,8 @@ static int lwis_open(struct inode *node, struct file *fp)
 
 	/* The event queue itself is a linked list */
 	INIT_LIST_HEAD(&lwis_client->event_queue);
+	lwis_client->event_queue_depth =
+		lwis_dev->event_queue_depth ? lwis_dev->event_queue_depth : MAX_NUM_PENDING_EVENTS;
 	INIT_LIST_HEAD(&lwis_client->error_event_queue);
 
 	/* Initialize the wait queue for the event queue */
@@ -116,9 +133,35 @@ static int lwis_open(struct inode *node, struct file *fp)
 
 	/* Empty hash table for client enrolled buffers */
 	hash_init(lwis_client->enrolled_buffers);
+	lwis_client->enrolled_buffer_tree = RB_ROOT_CACHED;
+
+	/* Empty hash table for kernel mappings of client buffers */
+	hash_init(lwis_client->kernel_mapped_buffers);
+
+	/* Empty hash table for client command buffers */
+	hash_init(lwis_client->cmd_buffers);
 
-	/* Initialize the allocator */
-	lwis_allocator_init(lwis_dev);
+	/* Empty hash table for client io_entry programs */
+	hash_init(lwis_client->io_programs);
+
+	/* Initialize the allocator and the workers, deferred from probe */
+	mutex_lock(&lwis_dev->client_lock);
+	ret = lwis_allocator_init(lwis_dev);
+	if (ret) {
+		mutex_unlock(&lwis_dev->client_lock);
+		dev_err(lwis_dev->dev, "Failed to initialize the allocator (%d)\n", ret);
+		kfree(lwis_client);
+		return ret;
+	}
+	ret = lwis_create_kthread_workers(lwis_dev);
+	if (ret) {
+		/* Drop the reference taken above, or the allocator never goes away */
+		lwis_allocator_release(lwis_dev);
+		mutex_unlock(&lwis_dev->client_lock);
+		kfree(lwis_client);
+		return ret;
+	}
+	mutex_unlock(&lwis_dev->client_lock);
 
 	/* Start transaction processor task */
 	lwis_transaction_init(lwis_client);
@@ -136,6 +179,7 @@ static int lwis_open(struct inode *node, struct file *fp)
 	fp->private_data = lwis_client;
 
 	lwis_client->is_enabled = false;
+	INIT_WORK(&lwis_client->enable_work, lwis_ioctl_device_enable_work);
 	return 0;
 }
 
@@ -164,10 +208,19 @@ static int lwis_cleanup_client(struct lwis_client *lwis_client)
 	/* Run cleanup transactions. */
 	lwis_transaction_client_cleanup(lwis_client);
 
+	/* Drop the kernel mappings before the buffers they map */
+	lwis_client_kernel_mapped_buffers_clear(lwis_client);
+
 	/* Disenroll and clear the table of allocated and enrolled buffers */
 	lwis_client_allocated_buffers_clear(lwis_client);
 	lwis_client_enrolled_buffers_clear(lwis_client);
 
+	/* Unpin all registered command buffers */
+	lwis_client_cmd_buffers_clear(lwis_client);
+
+	/* Drop the registered io_entry programs */
+	lwis_client_io_programs_clear(lwis_client);
+
 	mutex_unlock(&lwis_client->lock);
 
 	return 0;
@@ -186,6 +239,28 @@ static inline bool check_client_exists(const struct lwis_device *lwis_dev,
 	return false;
 }
 
+/* Stops the closed-loop bandwidth voting the dpm client set on any device */
+static void lwis_client_bts_auto_release(struct lwis_client *lwis_client)
+{
+	struct lwis_device *lwis_dev_it;
+	struct lwis_dpm_bts_auto *bts_auto;
+
+	/* One at a time, the work of the state is not to be waited for with
+	 * core.lock held */
+	do {
+		bts_auto = NULL;
+		mutex_lock(&core.lock);
+		list_for_each_entry (lwis_dev_it, &core.lwis_dev_list, dev_list) {
+			bts_auto = lwis_dpm_bts_auto_detach(lwis_dev_it, lwis_client);
+			if (bts_auto) {
+				break;
+			}
+		}
+		mutex_unlock(&core.lock);
+		lwis_dpm_bts_auto_free(bts_auto);
+	} while (bts_auto);
+}
+
 /* Release client and deletes its entry from the device's client list,
  * this assumes that LWIS device still exists and will hold LWIS device
  * and LWIS client locks. */
@@ -199,6 +274,10 @@ static int lwis_release_client(struct lwis_client *lwis_client)
 		return rc;
 	}
 
+	if (lwis_dev->type == DEVICE_TYPE_DPM) {
+		lwis_client_bts_auto_release(lwis_client);
+	}
+
 	/* Take this lwis_client off the list of active clients */
 	spin_lock_irqsave(&lwis_dev->lock, flags);
 	if (check_client_exists(lwis_dev, lwis_client)) {
@@ -209,6 +288,9 @@ static int lwis_release_client(struct lwis_client *lwis_client)
 	}
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 
+	/* No mapping can be left at this point since it holds the file */
+	lwis_client_event_ring_free(lwis_client);
+
 	kfree(lwis_client);
 	return 0;
 }
@@ -221,14 +303,20 @@ static int lwis_release(struct inode *node, struct file *fp)
 	struct lwis_client *lwis_client = fp->private_data;
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
 	int rc = 0;
-	bool is_client_enabled = lwis_client->is_enabled;
+	bool is_client_enabled;
+
+	/* Let a pending asynchronous enable settle before releasing power */
+	flush_work(&lwis_client->enable_work);
+	is_client_enabled = lwis_client->is_enabled;
 
 	dev_info(lwis_dev->dev, "Closing instance %d\n", iminor(node));
 
 	rc = lwis_release_client(lwis_client);
 
 	/* Release the allocator and its cache */
+	mutex_lock(&lwis_dev->client_lock);
 	lwis_allocator_release(lwis_dev);
+	mutex_unlock(&lwis_dev->client_lock);
 
 	mutex_lock(&lwis_dev->client_lock);
 	/* Release power if client closed without power down called */
@@ -236,7 +324,7 @@ static int lwis_release(struct inode *node, struct file *fp)
 		lwis_dev->enabled--;
 		if (lwis_dev->enabled == 0) {
 			dev_info(lwis_dev->dev, "No more client, power down\n");
-			rc = lwis_dev_power_down_locked(lwis_dev);
+			rc = lwis_dev_power_release_locked(lwis_dev);
 		}
 	}
 
@@ -247,6 +335,7 @@ static int lwis_release(struct inode *node, struct file *fp)
 		}
 		/* remove voted qos */
 		lwis_platform_remove_qos(lwis_dev);
+		lwis_dpm_votes_reset(lwis_dev);
 		/* Release device event states if no more client is using */
 		lwis_device_event_states_clear_locked(lwis_dev);
 	}
@@ -307,31 +396,45 @@ static unsigned int lwis_poll(struct file *fp, poll_table *wait)
 	/* Check if we have anything in the event lists */
 	if (lwis_client_error_event_peek_front(lwis_client, NULL) == 0) {
 		mask |= POLLERR;
-	} else if (lwis_client_event_peek_front(lwis_client, NULL) == 0) {
+	} else if (lwis_client_event_peek_front(lwis_client, NULL) == 0 ||
+		   lwis_client_event_ring_has_events(lwis_client)) {
 		mask |= POLLIN;
 	}
 
 	return mask;
 }
 
-static ssize_t lwis_read(struct file *fp, char __user *user_buf, size_t count, loff_t *pos)
+/*
+ *  lwis_mmap: Maps the client event ring into userspace
+ *
+ *  The ring needs to be set up with LWIS_EVENT_RING_SETUP first.
+ */
+static int lwis_mmap(struct file *fp, struct vm_area_struct *vma)
 {
-	int ret = 0;
-	/* Buffer to store information */
-	const size_t buffer_size = 8192;
-	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
-	if (!buffer) {
-		pr_err("Failed to allocate read buffer\n");
-		return -ENOMEM;
+	struct lwis_client *lwis_client;
+	int ret;
+
+	lwis_client = fp->private_data;
+	if (!lwis_client) {
+		pr_err("Cannot find client instance\n");
+		return -ENODEV;
 	}
 
-	lwis_get_feature_flags(buffer, buffer_size);
+	mutex_lock(&lwis_client->lock);
+	ret = lwis_client_event_ring_mmap(lwis_client, vma);
+	mutex_unlock(&lwis_client->lock);
+
+	return ret;
+}
 
-	ret = simple_read_from_buffer(user_buf, count, pos, buffer, strlen(buffer));
+static ssize_t lwis_read(struct file *fp, char __user *user_buf, size_t count, loff_t *pos)
+{
+	/* The feature flags are a couple of short lines, no need for a heap buffer */
+	char buffer[256] = {};
 
-	kfree(buffer);
+	lwis_get_feature_flags(buffer, sizeof(buffer));
 
-	return ret;
+	return simple_read_from_buffer(user_buf, count, pos, buffer, strlen(buffer));
 }
 
 static int lwis_base_setup(struct lwis_device *lwis_dev)
@@ -353,17 +456,44 @@ static int lwis_base_setup(struct lwis_device *lwis_dev)
 }
 
 /*
- *  lwis_assign_top_to_other: Assign top device to the devices probed before.
+ *  lwis_assign_top_to_other_locked: Assign top device to the devices probed before.
+ *  Assumes: core.lock is locked
  */
-static void lwis_assign_top_to_other(struct lwis_device *top_dev)
+static void lwis_assign_top_to_other_locked(struct lwis_device *top_dev)
 {
 	struct lwis_device *lwis_dev;
 
-	mutex_lock(&core.lock);
 	list_for_each_entry (lwis_dev, &core.lwis_dev_list, dev_list) {
 		lwis_dev->top_dev = top_dev;
 	}
-	mutex_unlock(&core.lock);
+}
+
+/*
+ * Returns true if powering the device up or down touches pins or gpios that
+ * other devices may toggle too.
+ */
+static bool lwis_dev_has_shared_power_resources(struct lwis_device *lwis_dev)
+{
+	int i;
+
+	if (lwis_dev->shared_pinctrl > 0 || lwis_dev->shared_enable_gpios_present) {
+		return true;
+	}
+	if (lwis_dev->gpios_list) {
+		for (i = 0; i < lwis_dev->gpios_list->count; ++i) {
+			if (lwis_dev->gpios_list->gpios_info[i].is_shared) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/* A lingering device is still powered, the resources it shares with other
+ * devices must stay on. Calling this function requires holding core.lock. */
+static bool lwis_dev_is_powered(struct lwis_device *lwis_dev)
+{
+	return lwis_dev->enabled || READ_ONCE(lwis_dev->power_lingering);
 }
 
 static int lwis_dev_power_up_by_seqs(struct lwis_device *lwis_dev)
@@ -389,23 +519,30 @@ static int lwis_dev_power_up_by_seqs(struct lwis_device *lwis_dev)
 			 list->seq_info[i].type, list->seq_info[i].name,
 			 list->seq_info[i].delay_us);
 #endif
-		if (strcmp(list->seq_info[i].type, "regulator") == 0) {
+		if (list->seq_info[i].seq_type == LWIS_POWER_SEQ_TYPE_REGULATOR) {
 			if (lwis_dev->regulators == NULL) {
 				dev_err(lwis_dev->dev, "No regulators defined\n");
 				return -EINVAL;
 			}
-			ret = lwis_regulator_enable_by_name(lwis_dev->regulators,
-							    list->seq_info[i].name);
+			if (list->seq_info[i].regulator_index >= 0) {
+				ret = lwis_regulator_enable_by_idx(
+					lwis_dev->regulators, list->seq_info[i].regulator_index);
+			} else {
+				ret = lwis_regulator_enable_by_name(lwis_dev->regulators,
+								    list->seq_info[i].name);
+			}
 			if (ret) {
 				dev_err(lwis_dev->dev, "Error enabling regulators (%d)\n", ret);
 				return ret;
 			}
-		} else if (strcmp(list->seq_info[i].type, "gpio") == 0) {
+		} else if (list->seq_info[i].seq_type == LWIS_POWER_SEQ_TYPE_GPIO) {
 			struct gpio_descs *gpios = NULL;
-			struct lwis_gpios_info *gpios_info = NULL;
+			struct lwis_gpios_info *gpios_info = list->seq_info[i].gpios_info;
 
-			gpios_info = lwis_gpios_get_info_by_name(lwis_dev->gpios_list,
-								 list->seq_info[i].name);
+			if (!gpios_info) {
+				gpios_info = lwis_gpios_get_info_by_name(lwis_dev->gpios_list,
+									 list->seq_info[i].name);
+			}
 			if (IS_ERR(gpios_info)) {
 				dev_err(lwis_dev->dev, "Get %s gpios info failed\n",
 					list->seq_info[i].name);
@@ -441,7 +578,7 @@ static int lwis_dev_power_up_by_seqs(struct lwis_device *lwis_dev)
 				}
 				gpios_info->gpios = gpios;
 			}
-		} else if (strcmp(list->seq_info[i].type, "pinctrl") == 0) {
+		} else if (list->seq_info[i].seq_type == LWIS_POWER_SEQ_TYPE_PINCTRL) {
 			bool activate_mclk = true;
 
 			lwis_dev->mclk_ctrl = devm_pinctrl_get(&lwis_dev->plat_dev->dev);
@@ -460,7 +597,7 @@ static int lwis_dev_power_up_by_seqs(struct lwis_device *lwis_dev)
 					if ((lwis_dev->id != lwis_dev_it->id) &&
 					    (lwis_dev_it->shared_pinctrl ==
 					     lwis_dev->shared_pinctrl) &&
-					    lwis_dev_it->enabled) {
+					    lwis_dev_is_powered(lwis_dev_it)) {
 						activate_mclk = false;
 						devm_pinctrl_put(lwis_dev->mclk_ctrl);
 						lwis_dev->mclk_ctrl = NULL;
@@ -579,7 +716,7 @@ static int lwis_dev_power_up_by_default(struct lwis_device *lwis_dev)
 			list_for_each_entry (lwis_dev_it, &core.lwis_dev_list, dev_list) {
 				if ((lwis_dev->id != lwis_dev_it->id) &&
 				    (lwis_dev_it->shared_pinctrl == lwis_dev->shared_pinctrl) &&
-				    lwis_dev_it->enabled) {
+				    lwis_dev_is_powered(lwis_dev_it)) {
 					activate_mclk = false;
 					devm_pinctrl_put(lwis_dev->mclk_ctrl);
 					lwis_dev->mclk_ctrl = NULL;
@@ -647,6 +784,7 @@ int lwis_dev_power_up_locked(struct lwis_device *lwis_dev)
 {
 	int ret;
 	struct lwis_i2c_device *i2c_dev = NULL;
+	bool shared_resources = lwis_dev_has_shared_power_resources(lwis_dev);
 
 	if (lwis_dev->type == DEVICE_TYPE_I2C) {
 		i2c_dev = container_of(lwis_dev, struct lwis_i2c_device, base_dev);
@@ -656,7 +794,11 @@ int lwis_dev_power_up_locked(struct lwis_device *lwis_dev)
 		}
 	}
 
-	/* Let's do the platform-specific enable call */
+	/* Registers come up with their reset values */
+	lwis_reg_cache_clear(lwis_dev);
+
+	/* Let's do the platform-specific enable call, which sets its own votes */
+	lwis_dpm_votes_reset(lwis_dev);
 	ret = lwis_platform_device_enable(lwis_dev);
 	if (ret) {
 		dev_err(lwis_dev->dev, "Platform-specific device enable fail: %d\n", ret);
@@ -672,31 +814,34 @@ int lwis_dev_power_up_locked(struct lwis_device *lwis_dev)
 		}
 	}
 
+	/* Devices on the same I2C group or sharing pins are sequenced one after
+	 * another, independent ones may power up concurrently */
 	if (lwis_dev->type == DEVICE_TYPE_I2C) {
 		mutex_lock(i2c_dev->group_i2c_lock);
 	}
+	if (shared_resources) {
+		mutex_lock(&core.shared_power_lock);
+	}
 	if (lwis_dev->power_up_seqs_present) {
 		ret = lwis_dev_power_up_by_seqs(lwis_dev);
 		if (ret) {
 			dev_err(lwis_dev->dev, "Error lwis_dev_power_up_by_seqs (%d)\n", ret);
-			if (lwis_dev->type == DEVICE_TYPE_I2C) {
-				mutex_unlock(i2c_dev->group_i2c_lock);
-			}
-			goto error_power_up;
 		}
 	} else {
 		ret = lwis_dev_power_up_by_default(lwis_dev);
 		if (ret) {
 			dev_err(lwis_dev->dev, "Error lwis_dev_power_up_by_default (%d)\n", ret);
-			if (lwis_dev->type == DEVICE_TYPE_I2C) {
-				mutex_unlock(i2c_dev->group_i2c_lock);
-			}
-			goto error_power_up;
 		}
 	}
+	if (shared_resources) {
+		mutex_unlock(&core.shared_power_lock);
+	}
 	if (lwis_dev->type == DEVICE_TYPE_I2C) {
 		mutex_unlock(i2c_dev->group_i2c_lock);
 	}
+	if (ret) {
+		goto error_power_up;
+	}
 
 	if (lwis_dev->phys) {
 		/* Power on the PHY */
@@ -750,23 +895,30 @@ static int lwis_dev_power_down_by_seqs(struct lwis_device *lwis_dev)
 			 list->seq_info[i].type, list->seq_info[i].name,
 			 list->seq_info[i].delay_us);
 #endif
-		if (strcmp(list->seq_info[i].type, "regulator") == 0) {
+		if (list->seq_info[i].seq_type == LWIS_POWER_SEQ_TYPE_REGULATOR) {
 			if (lwis_dev->regulators == NULL) {
 				dev_err(lwis_dev->dev, "No regulators defined\n");
 				last_error = -EINVAL;
 				continue;
 			}
-			ret = lwis_regulator_disable_by_name(lwis_dev->regulators,
-							     list->seq_info[i].name);
+			if (list->seq_info[i].regulator_index >= 0) {
+				ret = lwis_regulator_disable_by_idx(
+					lwis_dev->regulators, list->seq_info[i].regulator_index);
+			} else {
+				ret = lwis_regulator_disable_by_name(lwis_dev->regulators,
+								     list->seq_info[i].name);
+			}
 			if (ret) {
 				dev_err(lwis_dev->dev, "Error disabling regulators (%d)\n", ret);
 				last_error = ret;
 			}
-		} else if (strcmp(list->seq_info[i].type, "gpio") == 0) {
-			struct lwis_gpios_info *gpios_info = NULL;
+		} else if (list->seq_info[i].seq_type == LWIS_POWER_SEQ_TYPE_GPIO) {
+			struct lwis_gpios_info *gpios_info = list->seq_info[i].gpios_info;
 
-			gpios_info = lwis_gpios_get_info_by_name(lwis_dev->gpios_list,
-								 list->seq_info[i].name);
+			if (!gpios_info) {
+				gpios_info = lwis_gpios_get_info_by_name(lwis_dev->gpios_list,
+									 list->seq_info[i].name);
+			}
 			if (IS_ERR(gpios_info)) {
 				dev_err(lwis_dev->dev, "Get %s gpios info failed\n",
 					list->seq_info[i].name);
@@ -793,7 +945,7 @@ static int lwis_dev_power_down_by_seqs(struct lwis_device *lwis_dev)
 			/* Release "ownership" of the GPIO pins */
 			lwis_gpio_list_put(gpios_info->gpios, &lwis_dev->plat_dev->dev);
 			gpios_info->gpios = NULL;
-		} else if (strcmp(list->seq_info[i].type, "pinctrl") == 0) {
+		} else if (list->seq_info[i].seq_type == LWIS_POWER_SEQ_TYPE_PINCTRL) {
 			bool deactivate_mclk = true;
 
 			if (lwis_dev->mclk_ctrl == NULL) {
@@ -810,7 +962,7 @@ static int lwis_dev_power_down_by_seqs(struct lwis_device *lwis_dev)
 					if ((lwis_dev->id != lwis_dev_it->id) &&
 					    (lwis_dev_it->shared_pinctrl ==
 					     lwis_dev->shared_pinctrl) &&
-					    lwis_dev_it->enabled) {
+					    lwis_dev_is_powered(lwis_dev_it)) {
 						/*
 						 * Move mclk owner to the device who
 						 * still using it
@@ -867,7 +1019,7 @@ static int lwis_dev_power_down_by_default(struct lwis_device *lwis_dev)
 			list_for_each_entry (lwis_dev_it, &core.lwis_dev_list, dev_list) {
 				if ((lwis_dev->id != lwis_dev_it->id) &&
 				    (lwis_dev_it->shared_pinctrl == lwis_dev->shared_pinctrl) &&
-				    lwis_dev_it->enabled) {
+				    lwis_dev_is_powered(lwis_dev_it)) {
 					/*
 					 * Move mclk owner to the device who
 					 * still using it
@@ -958,6 +1110,7 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 	int ret;
 	int last_error = 0;
 	struct lwis_i2c_device *i2c_dev = NULL;
+	bool shared_resources = lwis_dev_has_shared_power_resources(lwis_dev);
 
 	if (lwis_dev->type == DEVICE_TYPE_I2C) {
 		i2c_dev = container_of(lwis_dev, struct lwis_i2c_device, base_dev);
@@ -967,6 +1120,9 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 		}
 	}
 
+	/* Register contents are lost once the device is powered down */
+	lwis_reg_cache_clear(lwis_dev);
+
 	if (lwis_dev->vops.device_disable) {
 		ret = lwis_dev->vops.device_disable(lwis_dev);
 		if (ret) {
@@ -988,6 +1144,9 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 	if (lwis_dev->type == DEVICE_TYPE_I2C) {
 		mutex_lock(i2c_dev->group_i2c_lock);
 	}
+	if (shared_resources) {
+		mutex_lock(&core.shared_power_lock);
+	}
 	if (lwis_dev->power_down_seqs_present) {
 		ret = lwis_dev_power_down_by_seqs(lwis_dev);
 		if (ret) {
@@ -1001,6 +1160,9 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 			last_error = ret;
 		}
 	}
+	if (shared_resources) {
+		mutex_unlock(&core.shared_power_lock);
+	}
 	if (lwis_dev->type == DEVICE_TYPE_I2C) {
 		mutex_unlock(i2c_dev->group_i2c_lock);
 	}
@@ -1010,8 +1172,9 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 		lwis_clock_disable_all(lwis_dev->clocks);
 	}
 
-	/* Let's do the platform-specific disable call */
+	/* Let's do the platform-specific disable call, which drops the votes */
 	ret = lwis_platform_device_disable(lwis_dev);
+	lwis_dpm_votes_reset(lwis_dev);
 	if (ret) {
 		dev_err(lwis_dev->dev, "Platform-specific device disable fail: %d\n", ret);
 		last_error = ret;
@@ -1024,6 +1187,226 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 	return ret;
 }
 
+static void lwis_dev_power_linger_work(struct work_struct *work)
+{
+	struct lwis_device *lwis_dev =
+		container_of(to_delayed_work(work), struct lwis_device, power_linger_work);
+
+	mutex_lock(&lwis_dev->client_lock);
+	/* A re-enable within the linger took the power over */
+	if (lwis_dev->power_lingering && lwis_dev->enabled == 0) {
+		lwis_dev->power_lingering = false;
+		dev_info(lwis_dev->dev, "Linger expired, power down\n");
+		lwis_dev_power_down_locked(lwis_dev);
+	}
+	mutex_unlock(&lwis_dev->client_lock);
+}
+
+int lwis_dev_power_acquire_locked(struct lwis_device *lwis_dev)
+{
+	if (lwis_dev->power_lingering) {
+		/* The work may already be running, it backs off on the flag */
+		lwis_dev->power_lingering = false;
+		cancel_delayed_work(&lwis_dev->power_linger_work);
+		dev_info(lwis_dev->dev, "Reusing lingering power\n");
+		return 0;
+	}
+	return lwis_dev_power_up_locked(lwis_dev);
+}
+
+int lwis_dev_power_release_locked(struct lwis_device *lwis_dev)
+{
+	if (lwis_dev->power_linger_ms == 0) {
+		return lwis_dev_power_down_locked(lwis_dev);
+	}
+	lwis_dev->power_lingering = true;
+	mod_delayed_work(system_wq, &lwis_dev->power_linger_work,
+			 msecs_to_jiffies(lwis_dev->power_linger_ms));
+	return 0;
+}
+
+void lwis_dev_power_linger_stop(struct lwis_device *lwis_dev)
+{
+	cancel_delayed_work_sync(&lwis_dev->power_linger_work);
+
+	mutex_lock(&lwis_dev->client_lock);
+	if (lwis_dev->power_lingering) {
+		lwis_dev->power_lingering = false;
+		lwis_dev_power_down_locked(lwis_dev);
+	}
+	mutex_unlock(&lwis_dev->client_lock);
+}
+
+/* Reads or writes back all the suspend-save-ranges of the device */
+static int suspend_save_ranges_io(struct lwis_device *lwis_dev, int32_t type)
+{
+	int i;
+	int ret = 0;
+	struct lwis_suspend_save_range *range;
+	struct lwis_io_entry entry = { .type = type };
+
+	for (i = 0; i < lwis_dev->num_suspend_save_ranges; ++i) {
+		range = &lwis_dev->suspend_save_ranges[i];
+		entry.rw_batch.bid = range->bid;
+		entry.rw_batch.offset = range->offset;
+		entry.rw_batch.size_in_bytes = range->size_in_bytes;
+		entry.rw_batch.buf = range->values;
+		entry.rw_batch.is_offset_fixed = false;
+		ret = lwis_dev->vops.register_io(lwis_dev, &entry, lwis_dev->native_value_bitwidth);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to %s range bid %d offset 0x%llx (%d)\n",
+				(type == LWIS_IO_ENTRY_READ_BATCH) ? "save" : "restore", range->bid,
+				range->offset, ret);
+			return ret;
+		}
+	}
+	return ret;
+}
+
+int lwis_dev_suspend_save(struct lwis_device *lwis_dev)
+{
+	struct lwis_client *lwis_client;
+	int ret;
+
+	if (lwis_dev->num_suspend_save_ranges == 0 || lwis_dev->vops.register_io == NULL) {
+		return -EOPNOTSUPP;
+	}
+
+	/* Let the io already handed to the workers complete, later periods and
+	 * transactions find the device disabled */
+	list_for_each_entry (lwis_client, &lwis_dev->clients, node) {
+		if (lwis_client->is_enabled && lwis_dev->transaction_worker_thread) {
+			kthread_flush_worker(lwis_client->transaction_worker);
+		}
+	}
+	if (lwis_dev->periodic_io_worker_thread) {
+		kthread_flush_worker(&lwis_dev->periodic_io_worker);
+	}
+
+	mutex_lock(&lwis_dev->client_lock);
+	lwis_io_entry_lock(lwis_dev, /*device_lock=*/true, U64_MAX);
+	ret = suspend_save_ranges_io(lwis_dev, LWIS_IO_ENTRY_READ_BATCH);
+	if (ret) {
+		lwis_io_entry_unlock(lwis_dev, /*device_lock=*/true, U64_MAX);
+		mutex_unlock(&lwis_dev->client_lock);
+		return ret;
+	}
+	lwis_dev->suspend_saved_enabled = lwis_dev->enabled;
+	lwis_dev->enabled = 0;
+	lwis_io_entry_unlock(lwis_dev, /*device_lock=*/true, U64_MAX);
+
+	ret = lwis_dev_power_down_locked(lwis_dev);
+	if (ret < 0) {
+		dev_err(lwis_dev->dev, "Failed to power down device\n");
+	}
+	dev_info(lwis_dev->dev, "Device registers saved for system suspend\n");
+	mutex_unlock(&lwis_dev->client_lock);
+	return 0;
+}
+
+int lwis_dev_resume_restore(struct lwis_device *lwis_dev)
+{
+	struct lwis_client *lwis_client, *n;
+	int ret;
+
+	mutex_lock(&lwis_dev->client_lock);
+	if (lwis_dev->suspend_saved_enabled == 0) {
+		mutex_unlock(&lwis_dev->client_lock);
+		return 0;
+	}
+
+	ret = lwis_dev_power_up_locked(lwis_dev);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to power up device\n");
+		lwis_dev->suspend_saved_enabled = 0;
+	} else {
+		lwis_io_entry_lock(lwis_dev, /*device_lock=*/true, U64_MAX);
+		ret = suspend_save_ranges_io(lwis_dev, LWIS_IO_ENTRY_WRITE_BATCH);
+		if (ret == 0) {
+			lwis_dev->enabled = lwis_dev->suspend_saved_enabled;
+		}
+		lwis_dev->suspend_saved_enabled = 0;
+		lwis_io_entry_unlock(lwis_dev, /*device_lock=*/true, U64_MAX);
+		if (ret) {
+			lwis_dev_power_down_locked(lwis_dev);
+		}
+	}
+	mutex_unlock(&lwis_dev->client_lock);
+
+	if (ret == 0) {
+		dev_info(lwis_dev->dev, "Device registers restored on system resume\n");
+		return 0;
+	}
+
+	/* Leave the device as a regular suspend does, disabled and powered down,
+	 * for userspace to reinitialize it on the error event */
+	lwis_device_error_event_emit(lwis_dev, LWIS_ERROR_EVENT_ID_SYSTEM_SUSPEND,
+				     /*payload=*/NULL, /*payload_size=*/0);
+	list_for_each_entry_safe (lwis_client, n, &lwis_dev->clients, node) {
+		if (!lwis_client->is_enabled) {
+			continue;
+		}
+		lwis_client_event_states_clear(lwis_client);
+		lwis_periodic_io_client_flush(lwis_client);
+		lwis_transaction_client_flush(lwis_client);
+		lwis_client->is_enabled = false;
+	}
+	mutex_lock(&lwis_dev->client_lock);
+	lwis_device_event_states_clear_locked(lwis_dev);
+	mutex_unlock(&lwis_dev->client_lock);
+	return 0;
+}
+
+void lwis_dev_stats_count_io(struct lwis_device *lwis_dev, const struct lwis_io_entry *entry,
+			     int access_size)
+{
+	switch (entry->type) {
+	case LWIS_IO_ENTRY_READ:
+		atomic64_add(access_size / BITS_PER_BYTE, &lwis_dev->stats.bytes_read);
+		break;
+	case LWIS_IO_ENTRY_READ_BATCH:
+		atomic64_add(entry->rw_batch.size_in_bytes, &lwis_dev->stats.bytes_read);
+		break;
+	case LWIS_IO_ENTRY_READ_BATCH_TO_BUFFER:
+		atomic64_add(entry->read_to_buffer.size_in_bytes, &lwis_dev->stats.bytes_read);
+		break;
+	case LWIS_IO_ENTRY_WRITE:
+		atomic64_add(access_size / BITS_PER_BYTE, &lwis_dev->stats.bytes_written);
+		break;
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		atomic64_add(entry->rw_batch.size_in_bytes, &lwis_dev->stats.bytes_written);
+		break;
+	case LWIS_IO_ENTRY_MODIFY:
+		/* Read back before being written */
+		atomic64_add(access_size / BITS_PER_BYTE, &lwis_dev->stats.bytes_read);
+		atomic64_add(access_size / BITS_PER_BYTE, &lwis_dev->stats.bytes_written);
+		break;
+	default:
+		break;
+	}
+}
+
+void lwis_client_stats_get(struct lwis_client *lwis_client, struct lwis_stats *stats)
+{
+	struct lwis_client_stats *client_stats = &lwis_client->stats;
+	struct lwis_device_stats *dev_stats = &lwis_client->lwis_dev->stats;
+
+	stats->events_queued = atomic64_read(&client_stats->events_queued);
+	stats->events_dropped = atomic64_read(&client_stats->events_dropped);
+	stats->event_queue_high_water = atomic64_read(&client_stats->event_queue_high_water);
+	stats->transactions_succeeded = atomic64_read(&client_stats->transactions_succeeded);
+	stats->transactions_failed = atomic64_read(&client_stats->transactions_failed);
+	stats->transactions_cancelled = atomic64_read(&client_stats->transactions_cancelled);
+	stats->transaction_deadline_misses =
+		atomic64_read(&lwis_client->debug_info.transaction_deadline_misses);
+	stats->periodic_io_ticks_missed = atomic64_read(&client_stats->periodic_io_ticks_missed);
+	stats->alloc_failures = atomic64_read(&client_stats->alloc_failures);
+	stats->device_events_emitted = atomic64_read(&dev_stats->events_emitted);
+	stats->device_alloc_failures = atomic64_read(&dev_stats->alloc_failures);
+	stats->device_bytes_read = atomic64_read(&dev_stats->bytes_read);
+	stats->device_bytes_written = atomic64_read(&dev_stats->bytes_written);
+}
+
 /*
  *  lwis_dev_power_seq_list_alloc:
  *  Allocate an instance of the lwis_device_power_sequence_info
@@ -1090,18 +1473,16 @@ void lwis_dev_power_seq_list_print(struct lwis_device_power_sequence_list *list)
 	}
 }
 
-static struct lwis_device *find_top_dev()
+/* Assumes: core.lock is locked */
+static struct lwis_device *find_top_dev_locked(void)
 {
 	struct lwis_device *lwis_dev;
 
-	mutex_lock(&core.lock);
 	list_for_each_entry (lwis_dev, &core.lwis_dev_list, dev_list) {
 		if (lwis_dev->type == DEVICE_TYPE_TOP) {
-			mutex_unlock(&core.lock);
 			return lwis_dev;
 		}
 	}
-	mutex_unlock(&core.lock);
 	return NULL;
 }
 
@@ -1144,7 +1525,7 @@ bool lwis_i2c_dev_is_in_use(struct lwis_device *lwis_dev)
 				container_of(lwis_dev_it, struct lwis_i2c_device, base_dev);
 			/* Look up if i2c bus are still in use by other device*/
 			if ((i2c_dev_it->state_pinctrl == i2c_dev->state_pinctrl) &&
-			    (i2c_dev_it != i2c_dev) && lwis_dev_it->enabled) {
+			    (i2c_dev_it != i2c_dev) && lwis_dev_is_powered(lwis_dev_it)) {
 				mutex_unlock(&core.lock);
 				return true;
 			}
@@ -1188,6 +1569,7 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
 	/* Initialize enabled state */
 	lwis_dev->enabled = 0;
 	lwis_dev->clock_family = CLOCK_FAMILY_INVALID;
+	lwis_dpm_votes_reset(lwis_dev);
 
 	/* Initialize client mutex */
 	mutex_init(&lwis_dev->client_lock);
@@ -1195,6 +1577,13 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
 	/* Initialize register access mutex */
 	mutex_init(&lwis_dev->reg_rw_lock);
 
+	INIT_DELAYED_WORK(&lwis_dev->power_linger_work, lwis_dev_power_linger_work);
+
+	init_waitqueue_head(&lwis_dev->event_wait_queue);
+
+	/* Initialize the timer shared by periodic io of all clients */
+	lwis_periodic_io_device_init(lwis_dev);
+
 	/* Initialize an empty list of clients */
 	INIT_LIST_HEAD(&lwis_dev->clients);
 
@@ -1204,18 +1593,18 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
 	/* Initialize the spinlock */
 	spin_lock_init(&lwis_dev->lock);
 
+	/* Link the top device and add this instance to the device list at once,
+	 * as devices may probe concurrently */
+	mutex_lock(&core.lock);
 	if (lwis_dev->type == DEVICE_TYPE_TOP) {
 		lwis_dev->top_dev = lwis_dev;
 		/* Assign top device to the devices probed before */
-		lwis_assign_top_to_other(lwis_dev);
+		lwis_assign_top_to_other_locked(lwis_dev);
 	} else {
-		lwis_dev->top_dev = find_top_dev();
+		lwis_dev->top_dev = find_top_dev_locked();
 		if (lwis_dev->top_dev == NULL)
 			pr_warn("Top device not probed yet");
 	}
-
-	/* Add this instance to the device list */
-	mutex_lock(&core.lock);
 	list_add(&lwis_dev->dev_list, &core.lwis_dev_list);
 	mutex_unlock(&core.lock);
 
@@ -1269,6 +1658,11 @@ error_init:
 void lwis_base_unprobe(struct lwis_device *unprobe_lwis_dev)
 {
 	struct lwis_device *lwis_dev, *temp;
+	int i;
+
+	/* Before core.lock, powering down takes it */
+	lwis_dev_power_linger_stop(unprobe_lwis_dev);
+	lwis_dpm_bts_auto_free(lwis_dpm_bts_auto_detach(unprobe_lwis_dev, /*owner=*/NULL));
 
 	mutex_lock(&core.lock);
 	list_for_each_entry_safe (lwis_dev, temp, &core.lwis_dev_list, dev_list) {
@@ -1315,6 +1709,27 @@ void lwis_base_unprobe(struct lwis_device *unprobe_lwis_dev)
 				lwis_interrupt_list_free(lwis_dev->irq_gpios_info.irq_list);
 				lwis_dev->irq_gpios_info.irq_list = NULL;
 			}
+			/* Release the direct index of the IRQ event states */
+			kfree(lwis_dev->event_state_table);
+			lwis_dev->event_state_table = NULL;
+			lwis_dev->event_state_table_size = 0;
+			/* Release the locks of independent register blocks */
+			kfree(lwis_dev->block_locks);
+			lwis_dev->block_locks = NULL;
+			lwis_dev->independent_block_mask = 0;
+			/* Release registers saved across system suspend */
+			if (lwis_dev->suspend_save_ranges) {
+				for (i = 0; i < lwis_dev->num_suspend_save_ranges; ++i) {
+					kfree(lwis_dev->suspend_save_ranges[i].values);
+				}
+				kfree(lwis_dev->suspend_save_ranges);
+				lwis_dev->suspend_save_ranges = NULL;
+				lwis_dev->num_suspend_save_ranges = 0;
+			}
+			/* Release mappings kept for re-enrollment */
+			lwis_buffer_enroll_cache_destroy(lwis_dev);
+			lwis_reg_capture_destroy(lwis_dev);
+			lwis_dma_pool_device_remove(lwis_dev);
 			if (lwis_dev->irq_gpios_info.gpios) {
 				lwis_gpio_list_put(lwis_dev->irq_gpios_info.gpios,
 						   &lwis_dev->plat_dev->dev);
@@ -1453,14 +1868,29 @@ static int __init lwis_base_device_init(void)
 	/* Initialize the core struct */
 	memset(&core, 0, sizeof(struct lwis_core));
 	mutex_init(&core.lock);
+	mutex_init(&core.shared_power_lock);
 	for (i = 0; i < MAX_I2C_LOCK_NUM; ++i) {
 		mutex_init(&core.group_i2c_lock[i]);
 	}
 
+	ret = lwis_event_caches_init();
+	if (ret) {
+		pr_err("Failed to create LWIS event caches (%d)\n", ret);
+		return ret;
+	}
+
+	ret = lwis_transaction_cache_init();
+	if (ret) {
+		pr_err("Failed to create LWIS transaction cache (%d)\n", ret);
+		goto transaction_cache_failure;
+	}
+
+	lwis_dma_pool_init();
+
 	ret = lwis_register_base_device();
 	if (ret) {
 		pr_err("Failed to register LWIS base (%d)\n", ret);
-		return ret;
+		goto register_failure;
 	}
 
 	ret = lwis_top_device_init();
@@ -1505,6 +1935,11 @@ ioreg_failure:
 	lwis_top_device_deinit();
 top_failure:
 	lwis_unregister_base_device();
+register_failure:
+	lwis_dma_pool_deinit();
+	lwis_transaction_cache_deinit();
+transaction_cache_failure:
+	lwis_event_caches_deinit();
 	return ret;
 }
 
@@ -1517,6 +1952,8 @@ static void __exit lwis_driver_exit(void)
 	struct lwis_client *client, *client_temp;
 
 	pr_info("%s Clean up LWIS devices.\n", __func__);
+	/* Buffers freed by the clients released below are not pooled anymore */
+	lwis_dma_pool_deinit();
 	list_for_each_entry_safe (lwis_dev, temp, &core.lwis_dev_list, dev_list) {
 		pr_info("Destroy device %s id %d", lwis_dev->name, lwis_dev->id);
 		lwis_device_debugfs_cleanup(lwis_dev);
@@ -1526,12 +1963,22 @@ static void __exit lwis_driver_exit(void)
 			struct lwis_i2c_device *i2c_dev;
 			i2c_dev = container_of(lwis_dev, struct lwis_i2c_device, base_dev);
 			i2c_unregister_device(i2c_dev->client);
+			lwis_i2c_scratch_free(i2c_dev);
+		}
+		if (lwis_dev->type == DEVICE_TYPE_IOREG) {
+			lwis_ioreg_dma_put((struct lwis_ioreg_device *)lwis_dev);
 		}
+		lwis_reg_cache_destroy(lwis_dev);
+		lwis_dpm_bts_auto_free(lwis_dpm_bts_auto_detach(lwis_dev, /*owner=*/NULL));
 		/* Relase each client registered with dev */
 		list_for_each_entry_safe (client, client_temp, &lwis_dev->clients, node) {
 			if (lwis_release_client(client))
 				pr_info("Failed to release client.");
 		}
+		/* Release mappings kept for re-enrollment, after the clients
+		 * disenrolled their buffers */
+		lwis_buffer_enroll_cache_destroy(lwis_dev);
+		lwis_reg_capture_destroy(lwis_dev);
 		pm_runtime_disable(&lwis_dev->plat_dev->dev);
 		/* Release device clock list */
 		if (lwis_dev->clocks) {
@@ -1598,6 +2045,9 @@ static void __exit lwis_driver_exit(void)
 
 	/* Unregister base lwis device */
 	lwis_unregister_base_device();
+
+	lwis_transaction_cache_deinit();
+	lwis_event_caches_deinit();
 }
 
 subsys_initcall(lwis_base_device_init);
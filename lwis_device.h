@@ -15,13 +15,16 @@
 #include <linux/debugfs.h>
 #include <linux/fs.h>
 #include <linux/hashtable.h>
+#include <linux/hrtimer.h>
 #include <linux/idr.h>
+#include <linux/interval_tree.h>
 #include <linux/kernel.h>
 #include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/mutex.h>
 #include <linux/platform_device.h>
 #include <linux/poll.h>
+#include <linux/wait.h>
 #include <linux/workqueue.h>
 
 #include "lwis_clock.h"
@@ -32,6 +35,7 @@
 #include "lwis_phy.h"
 #include "lwis_regulator.h"
 #include "lwis_transaction.h"
+#include "lwis_util.h"
 
 #define LWIS_TOP_DEVICE_COMPAT "google,lwis-top-device"
 #define LWIS_I2C_DEVICE_COMPAT "google,lwis-i2c-device"
@@ -53,8 +57,18 @@ struct lwis_device;
 /* Forward declaration of a platform specific struct used by platform funcs */
 struct lwis_platform;
 
+/* Forward declaration of the closed-loop bandwidth voting state */
+struct lwis_dpm_bts_auto;
+
+/* Forward declaration of the shadow register cache */
+struct lwis_reg_cache;
+struct lwis_reg_capture;
+struct lwis_buffer_enroll_cache;
+
 /* Forward declaration of lwis allocator block manager */
 struct lwis_allocator_block_mgr;
+/* Number of recycling allocator block pools, 8K to 512K */
+#define LWIS_ALLOCATOR_NUM_POOLS 7
 int lwis_allocator_init(struct lwis_device *lwis_dev);
 void lwis_allocator_release(struct lwis_device *lwis_dev);
 
@@ -69,6 +83,9 @@ struct lwis_core {
 	struct cdev *chr_dev;
 	struct mutex lock;
 	struct mutex group_i2c_lock[MAX_I2C_LOCK_NUM];
+	/* Serializes power sequences of devices sharing pins or gpios, so that
+	 * the other devices can be powered up concurrently */
+	struct mutex shared_power_lock;
 	dev_t lwis_devt;
 	int device_major;
 	struct list_head lwis_dev_list;
@@ -84,6 +101,22 @@ struct lwis_device_subclass_operations {
 	/* Called by lwis_device when device register needs to be read/written */
 	int (*register_io)(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 			   int access_size);
+	/* Optional. Called by lwis_device to validate an io_entry once ahead of time
+	 * and resolve its register address into *resolved. Returns -EOPNOTSUPP if
+	 * the entry has to go through register_io instead.
+	 */
+	int (*register_io_prepare)(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+				   int access_size, void **resolved);
+	/* Called by lwis_device to read/write a register for an io_entry that was
+	 * validated by register_io_prepare, without checking it again.
+	 */
+	int (*register_io_prepared)(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+				    int access_size, void *resolved);
+	/* Optional. Called by lwis_device to execute a sequence of READ, WRITE,
+	 * READ_BATCH and WRITE_BATCH io_entries as a single bus transaction.
+	 */
+	int (*register_io_vector)(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				  int num_entries, int access_size);
 	/* Called by lwis_device when a read/write memory barrier needs to be inserted */
 	int (*register_io_barrier)(struct lwis_device *lwis_dev, bool use_read_barrier,
 				   bool use_write_barrier);
@@ -126,6 +159,34 @@ struct lwis_event_subscribe_operations {
 	void (*release)(struct lwis_device *lwis_dev);
 };
 
+/*
+ * enum lwis_device_power_sequence_type
+ * Kind of resource a power sequence step acts on, resolved from its type
+ * string when the device tree is parsed
+ */
+enum lwis_device_power_sequence_type {
+	LWIS_POWER_SEQ_TYPE_UNKNOWN,
+	LWIS_POWER_SEQ_TYPE_REGULATOR,
+	LWIS_POWER_SEQ_TYPE_GPIO,
+	LWIS_POWER_SEQ_TYPE_PINCTRL,
+};
+
+/*
+ * struct lwis_dpm_votes
+ * Last QoS and BTS votes applied to a device through the DPM device, used to
+ * skip updates that would not change anything
+ */
+struct lwis_dpm_votes {
+	/* Core clock votes in KHz per clock family, negative if none */
+	int qos_khz[NUM_CLOCK_FAMILY];
+	/* Bandwidth vote in KB/s, only meaningful when bts_valid */
+	bool bts_valid;
+	unsigned int bts_peak;
+	unsigned int bts_read;
+	unsigned int bts_write;
+	unsigned int bts_rt;
+};
+
 /*
  * struct lwis_device_power_sequence_info
  * This struct is to store the power up/down sequence information
@@ -134,6 +195,12 @@ struct lwis_device_power_sequence_info {
 	char name[LWIS_MAX_NAME_STRING_LEN];
 	char type[LWIS_MAX_NAME_STRING_LEN];
 	int delay_us;
+	/* Resolved at probe time so that power up/down needs no lookups */
+	enum lwis_device_power_sequence_type seq_type;
+	/* Index in lwis_dev->regulators, negative if not found */
+	int regulator_index;
+	/* Entry in lwis_dev->gpios_list, NULL if not found */
+	struct lwis_gpios_info *gpios_info;
 };
 
 /*
@@ -154,6 +221,8 @@ struct lwis_device_power_sequence_list {
 struct lwis_client_debug_info {
 	struct lwis_transaction_history transaction_hist[TRANSACTION_DEBUG_HISTORY_SIZE];
 	int cur_transaction_hist_idx;
+	/* Transactions completed after their deadline */
+	atomic64_t transaction_deadline_misses;
 };
 
 /* struct lwis_device_debug_info
@@ -164,6 +233,50 @@ struct lwis_client_debug_info {
 struct lwis_device_debug_info {
 	struct lwis_device_event_state_history event_hist[EVENT_DEBUG_HISTORY_SIZE];
 	int cur_event_hist_idx;
+	/* Transaction latencies of all the clients of this device */
+	struct lwis_latency_histogram transaction_latency[LWIS_TRANSACTION_EXEC_NUM_TYPES]
+							 [LWIS_TRANSACTION_LATENCY_NUM_STAGES];
+};
+
+/* struct lwis_client_stats
+ * Cumulative counters of a client, reported by LWIS_GET_STATS and the stats
+ * debugfs file.
+ */
+struct lwis_client_stats {
+	atomic64_t events_queued;
+	/* Events lost because the queue or the event ring was full */
+	atomic64_t events_dropped;
+	/* Most events ever waiting in the queue, updated under event_lock */
+	atomic64_t event_queue_high_water;
+	atomic64_t transactions_succeeded;
+	atomic64_t transactions_failed;
+	atomic64_t transactions_cancelled;
+	/* Periods that elapsed while the periodic io was still pending */
+	atomic64_t periodic_io_ticks_missed;
+	atomic64_t alloc_failures;
+};
+
+/* struct lwis_device_stats
+ * Cumulative counters of all the clients of a device.
+ */
+struct lwis_device_stats {
+	atomic64_t events_emitted;
+	atomic64_t alloc_failures;
+	/* Register bytes moved over the bus through vops */
+	atomic64_t bytes_read;
+	atomic64_t bytes_written;
+};
+
+/*
+ *  struct lwis_suspend_save_range
+ *  Register range kept across system suspend: read into values before the
+ *  device powers down and written back after it powers up again.
+ */
+struct lwis_suspend_save_range {
+	int32_t bid;
+	uint64_t offset;
+	size_t size_in_bytes;
+	uint8_t *values;
 };
 
 /*
@@ -203,10 +316,23 @@ struct lwis_device {
 	struct list_head clients;
 	/* Hash table of device-specific per-event state/control data */
 	DECLARE_HASHTABLE(event_states, EVENT_HASH_BITS);
+	/* Direct index of the event states of this device whose code is within
+	 * event_state_table_base + [0, event_state_table_size), covering the IRQ
+	 * events. Slots are filled on lookup, a NULL slot falls back to the hash
+	 * table. Protected by lock. */
+	struct lwis_device_event_state **event_state_table;
+	int64_t event_state_table_base;
+	int event_state_table_size;
 	/* Virtual function table for sub classes */
 	struct lwis_device_subclass_operations vops;
 	/* Mutex used to synchronize register access between clients */
 	struct mutex reg_rw_lock;
+	/* Register blocks, by bid, declared independent of the others. io_entries
+	 * touching only such blocks take their block_locks instead of reg_rw_lock */
+	uint64_t independent_block_mask;
+	struct mutex *block_locks;
+	/* Woken up every time the device emits an event */
+	wait_queue_head_t event_wait_queue;
 	/* Heartbeat timer structure */
 	struct timer_list heartbeat_timer;
 	/* Register-related properties */
@@ -221,10 +347,19 @@ struct lwis_device {
 	struct dentry *dbg_dev_info_file;
 	struct dentry *dbg_event_file;
 	struct dentry *dbg_transaction_file;
+	struct dentry *dbg_transaction_latency_file;
 	struct dentry *dbg_buffer_file;
+	struct dentry *dbg_allocator_file;
+	struct dentry *dbg_slc_file;
+	struct dentry *dbg_bts_file;
+	struct dentry *dbg_benchmark_file;
+	struct dentry *dbg_stats_file;
+	struct dentry *dbg_reg_capture_file;
 #endif
 	/* Structure to store info to help debugging device data */
 	struct lwis_device_debug_info debug_info;
+	/* Counters reported by LWIS_GET_STATS */
+	struct lwis_device_stats stats;
 
 	/* clock family this device belongs to */
 	int clock_family;
@@ -234,6 +369,17 @@ struct lwis_device {
 	const char *bts_scenario_name;
 	/* BTS scenario index */
 	unsigned int bts_scenario;
+	/* Votes last applied through the DPM device */
+	struct lwis_dpm_votes dpm_votes;
+	/* Registers counting the bytes read and written by the device, sampled
+	 * for closed-loop bandwidth voting */
+	bool bts_counters_present;
+	int32_t bts_counter_bid;
+	uint64_t bts_read_counter_offset;
+	uint64_t bts_write_counter_offset;
+	/* Closed-loop bandwidth voting state, set through the DPM device and
+	 * guarded by lwis_dev->lock */
+	struct lwis_dpm_bts_auto *bts_auto;
 
 	/* Does power-up-seqs present */
 	bool power_up_seqs_present;
@@ -250,21 +396,62 @@ struct lwis_device {
 
 	/* Power management hibernation state of the device */
 	int pm_hibernation;
+	/* Time the device stays powered after its last disable, 0 to power
+	 * down right away */
+	u32 power_linger_ms;
+	/* Event queue depth of the clients at open, 0 for the default */
+	u32 event_queue_depth;
+	/* Powered with no client enabled, waiting for power_linger_work */
+	bool power_lingering;
+	struct delayed_work power_linger_work;
+	/* Register ranges saved and restored across system suspend, so that an
+	 * enabled device resumes without userspace reinitializing it */
+	int num_suspend_save_ranges;
+	struct lwis_suspend_save_range *suspend_save_ranges;
+	/* Enable count kept while the device sleeps with its registers saved */
+	int suspend_saved_enabled;
 
 	/* Is device read only */
 	bool is_read_only;
+	/* Merge contiguous single-register io_entries of transactions into batch accesses */
+	bool coalesce_io_entries;
+	/* Events of other devices are delivered in the top device tasklet as if
+	 * emitted from IRQ context, so that run_in_event_context transactions run
+	 * right away instead of from the transaction worker */
+	bool direct_external_events;
+	/* Optional shadow copy of register values */
+	struct lwis_reg_cache *reg_cache;
+	/* Ring of the last register accesses, created by the reg_io_capture debugfs file */
+	struct lwis_reg_capture *reg_capture;
+	/* Mappings of disenrolled buffers, NULL if the device does not cache them */
+	struct lwis_buffer_enroll_cache *enroll_cache;
 	/* Adjust thread priority */
 	u32 transaction_thread_priority;
 	u32 periodic_io_thread_priority;
+	/* CPUs the worker threads may run on, empty for no restriction */
+	struct cpumask transaction_thread_cpus;
+	struct cpumask periodic_io_thread_cpus;
+	/* Give every client its own transaction worker, so that a slow client
+	 * does not hold up the transactions of the others */
+	bool transaction_worker_per_client;
 
 	/* LWIS allocator block manager */
 	struct lwis_allocator_block_mgr *block_mgr;
+	/* Free blocks to keep in each allocator block pool, 8K to 512K */
+	uint32_t allocator_reserve[LWIS_ALLOCATOR_NUM_POOLS];
 
-	/* Worker thread */
+	/* Worker thread, created on first open */
 	struct kthread_worker transaction_worker;
 	struct task_struct *transaction_worker_thread;
+	const char *transaction_worker_name;
 	struct kthread_worker periodic_io_worker;
 	struct task_struct *periodic_io_worker_thread;
+	const char *periodic_io_worker_name;
+	/* Timer serving the free-running periodic io lists of all clients */
+	struct hrtimer periodic_io_timer;
+	/* Lock protecting the timer and its list of periodic io lists */
+	spinlock_t periodic_io_timer_lock;
+	struct list_head periodic_io_timer_lists;
 };
 
 /*
@@ -280,16 +467,34 @@ struct lwis_client {
 	/* Queue of pending events to be consumed by userspace */
 	struct list_head event_queue;
 	size_t event_queue_size;
+	/* Number of events event_queue holds before overflowing */
+	size_t event_queue_depth;
 	struct list_head error_event_queue;
 	size_t error_event_queue_size;
 	/* Spinlock used to synchronize access to event states and queue */
 	spinlock_t event_lock;
 	/* Event wait queue for waking up userspace */
 	wait_queue_head_t event_wait_queue;
+	/* Optional event ring mapped into userspace, replaces event_queue when set */
+	struct lwis_event_ring *event_ring;
 	/* Hash table of allocated buffers keyed by file descriptor. */
 	DECLARE_HASHTABLE(allocated_buffers, BUFFER_HASH_BITS);
 	/* Hash table of enrolled buffers keyed by dvaddr */
 	DECLARE_HASHTABLE(enrolled_buffers, BUFFER_HASH_BITS);
+	/* Interval tree of enrolled buffers keyed by their dvaddr range, for
+	 * containment lookups. Modified under lwis_dev->lock as well, so that
+	 * it can be searched from the IOMMU fault handler. */
+	struct rb_root_cached enrolled_buffer_tree;
+	/* Hash table of kernel mappings of client buffers keyed by dma_buf */
+	DECLARE_HASHTABLE(kernel_mapped_buffers, BUFFER_HASH_BITS);
+	/* Hash table of registered command buffers keyed by handle */
+	DECLARE_HASHTABLE(cmd_buffers, BUFFER_HASH_BITS);
+	/* Command buffer counter, which also provides command buffer handle */
+	int32_t cmd_buffer_counter;
+	/* Hash table of registered io_entry programs keyed by handle */
+	DECLARE_HASHTABLE(io_programs, BUFFER_HASH_BITS);
+	/* io_entry program counter, which also provides program handle */
+	int32_t io_program_counter;
 	/* Hash table of transactions keyed by trigger event ID */
 	DECLARE_HASHTABLE(transaction_list, TRANSACTION_HASH_BITS);
 	/* Transaction task-related variables */
@@ -303,6 +508,11 @@ struct lwis_client {
 	int64_t transaction_counter;
 	/* Hash table of hrtimer keyed by time out duration */
 	DECLARE_HASHTABLE(timer_list, PERIODIC_IO_HASH_BITS);
+	/* Timers of the periodic ios that are phase locked to an event */
+	struct list_head phase_locked_timer_list;
+	/* Worker running the transactions of this client, either the one of the
+	 * device or a dedicated one */
+	struct kthread_worker *transaction_worker;
 	/* Work item */
 	struct kthread_work transaction_work;
 	struct kthread_work periodic_io_work;
@@ -314,12 +524,23 @@ struct lwis_client {
 	int64_t periodic_io_counter;
 	/* Structure to store info to help debugging client data */
 	struct lwis_client_debug_info debug_info;
+	/* Counters reported by LWIS_GET_STATS */
+	struct lwis_client_stats stats;
 	/* Each device has a linked list of clients */
 	struct list_head node;
 	/* Mark if the client called device enable */
 	bool is_enabled;
+	/* Work item running LWIS_DEVICE_ENABLE_ASYNC */
+	struct work_struct enable_work;
 };
 
+/* Counts an allocation failure against both the client and its device */
+static inline void lwis_client_stats_alloc_failure(struct lwis_client *lwis_client)
+{
+	atomic64_inc(&lwis_client->stats.alloc_failures);
+	atomic64_inc(&lwis_client->lwis_dev->stats.alloc_failures);
+}
+
 /*
  *  lwis_base_probe: Common probe function that will be used for all types
  *  of devices.
@@ -354,6 +575,52 @@ int lwis_dev_power_up_locked(struct lwis_device *lwis_dev);
  */
 int lwis_dev_power_down_locked(struct lwis_device *lwis_dev);
 
+/*
+ * Powers up a LWIS device for its first enable, reusing the power left on by
+ * a linger when there is one.
+ * lwis_dev->client_lock should be held before this function.
+ */
+int lwis_dev_power_acquire_locked(struct lwis_device *lwis_dev);
+
+/*
+ * Powers down a LWIS device after its last disable, or keeps it powered for
+ * power_linger_ms so that a quick re-enable skips the power sequences.
+ * lwis_dev->client_lock should be held before this function.
+ */
+int lwis_dev_power_release_locked(struct lwis_device *lwis_dev);
+
+/*
+ * Ends a pending linger and powers the device down right away, e.g. on
+ * system suspend.
+ */
+void lwis_dev_power_linger_stop(struct lwis_device *lwis_dev);
+
+/*
+ * Saves the suspend-save-ranges of an enabled device and powers it down,
+ * leaving its clients enabled for lwis_dev_resume_restore.
+ * Returns 0 on success, otherwise the device is left untouched for the
+ * regular suspend path.
+ */
+int lwis_dev_suspend_save(struct lwis_device *lwis_dev);
+
+/*
+ * Powers up a device suspended by lwis_dev_suspend_save and writes its saved
+ * registers back before enabling it again.
+ */
+int lwis_dev_resume_restore(struct lwis_device *lwis_dev);
+
+/*
+ * Adds the register bytes moved by a successful io_entry to the device stats.
+ * Called by the register_io vops, with access_size in bits.
+ */
+void lwis_dev_stats_count_io(struct lwis_device *lwis_dev, const struct lwis_io_entry *entry,
+			     int access_size);
+
+/*
+ * Snapshots the counters of a client and of its device into stats.
+ */
+void lwis_client_stats_get(struct lwis_client *lwis_client, struct lwis_stats *stats);
+
 /*
  *  lwis_dev_power_seq_list_alloc:
  *  Allocate an instance of the lwis_device_power_sequence_info
@@ -13,14 +13,21 @@
 #include "lwis_device_dpm.h"
 
 #include <linux/clk.h>
+#include <linux/math64.h>
 #include <linux/slab.h>
 
 #include "lwis_commands.h"
 #include "lwis_init.h"
+#include "lwis_io_entry.h"
 #include "lwis_platform.h"
 
 #define LWIS_DRIVER_NAME "lwis-dpm"
 
+/* Closed-loop votes leave this fraction of headroom above the measured
+ * bandwidth, and are only updated when they move by more than the hysteresis */
+#define BTS_AUTO_HEADROOM_SHIFT 2
+#define BTS_AUTO_HYSTERESIS_SHIFT 3
+
 static struct lwis_device_subclass_operations dpm_vops = {
 	.register_io = NULL,
 	.register_io_barrier = NULL,
@@ -38,6 +45,47 @@ static struct lwis_event_subscribe_operations dpm_subscribe_ops = {
 	.release = NULL,
 };
 
+void lwis_dpm_votes_reset(struct lwis_device *lwis_dev)
+{
+	int i;
+
+	for (i = 0; i < NUM_CLOCK_FAMILY; ++i) {
+		lwis_dev->dpm_votes.qos_khz[i] = -1;
+	}
+	lwis_dev->dpm_votes.bts_valid = false;
+}
+
+static int dpm_vote_qos(struct lwis_device *lwis_dev, int value, int32_t clock_family)
+{
+	int ret;
+
+	if (lwis_dev->dpm_votes.qos_khz[clock_family] == value) {
+		return 0;
+	}
+	ret = lwis_platform_update_qos(lwis_dev, value, clock_family);
+	lwis_dev->dpm_votes.qos_khz[clock_family] = ret ? -1 : value;
+	return ret;
+}
+
+static int dpm_vote_bts(struct lwis_device *lwis_dev, unsigned int peak_bw, unsigned int read_bw,
+			unsigned int write_bw, unsigned int rt_bw)
+{
+	int ret;
+	struct lwis_dpm_votes *votes = &lwis_dev->dpm_votes;
+
+	if (votes->bts_valid && votes->bts_peak == peak_bw && votes->bts_read == read_bw &&
+	    votes->bts_write == write_bw && votes->bts_rt == rt_bw) {
+		return 0;
+	}
+	ret = lwis_platform_update_bts(lwis_dev, peak_bw, read_bw, write_bw, rt_bw);
+	votes->bts_valid = (ret >= 0);
+	votes->bts_peak = peak_bw;
+	votes->bts_read = read_bw;
+	votes->bts_write = write_bw;
+	votes->bts_rt = rt_bw;
+	return ret;
+}
+
 /*
  *  lwis_dpm_update_qos: update qos requirement for lwis device.
  */
@@ -69,9 +117,8 @@ int lwis_dpm_update_qos(struct lwis_device *lwis_dev, struct lwis_qos_setting *q
 			/* vote to qos if frequency is specified. The vote only available for dpm
 			 * device
 			 */
-			ret = lwis_platform_update_qos(lwis_dev,
-						       (int)(qos_setting->frequency_hz / 1000),
-						       qos_setting->clock_family);
+			ret = dpm_vote_qos(lwis_dev, (int)(qos_setting->frequency_hz / 1000),
+					   qos_setting->clock_family);
 			if (ret) {
 				dev_err(lwis_dev->dev,
 					"Failed to vote to qos for clock family %d\n",
@@ -84,7 +131,7 @@ int lwis_dpm_update_qos(struct lwis_device *lwis_dev, struct lwis_qos_setting *q
 						qos_setting->peak_bw :
 						((read_bw > write_bw) ? read_bw : write_bw) / 4;
 			rt_bw = (qos_setting->rt_bw > 0) ? qos_setting->rt_bw : 0;
-			ret = lwis_platform_update_bts(target_dev, peak_bw, read_bw, write_bw, rt_bw);
+			ret = dpm_vote_bts(target_dev, peak_bw, read_bw, write_bw, rt_bw);
 			if (ret < 0) {
 				dev_err(lwis_dev->dev, "Failed to update bandwidth to bts, ret: %d\n", ret);
 			}
@@ -94,8 +141,8 @@ int lwis_dpm_update_qos(struct lwis_device *lwis_dev, struct lwis_qos_setting *q
 	case CLOCK_FAMILY_CAM:
 	case CLOCK_FAMILY_INTCAM:
 		/* convert value to KHz */
-		ret = lwis_platform_update_qos(target_dev, (int)(qos_setting->frequency_hz / 1000),
-					       qos_setting->clock_family);
+		ret = dpm_vote_qos(target_dev, (int)(qos_setting->frequency_hz / 1000),
+				   qos_setting->clock_family);
 		if (ret) {
 			dev_err(lwis_dev->dev,
 				"Failed to apply core clock requirement for %s, ret: %d\n",
@@ -110,6 +157,298 @@ int lwis_dpm_update_qos(struct lwis_device *lwis_dev, struct lwis_qos_setting *q
 	return ret;
 }
 
+static int bts_auto_read_counter(struct lwis_device *lwis_dev, uint64_t offset, uint64_t *value)
+{
+	int ret;
+	struct lwis_io_entry entry = {
+		.type = LWIS_IO_ENTRY_READ,
+		.rw = {
+			.bid = lwis_dev->bts_counter_bid,
+			.offset = offset,
+		},
+	};
+
+	ret = lwis_dev->vops.register_io(lwis_dev, &entry, lwis_dev->native_value_bitwidth);
+	*value = entry.rw.val;
+	return ret;
+}
+
+/* Bandwidth in KB/s of the bytes counted since the previous sample */
+static unsigned int bts_auto_kbps(struct lwis_device *lwis_dev, uint64_t prev, uint64_t cur,
+				  int64_t delta_ns)
+{
+	uint64_t mask = lwis_dev->native_value_bitwidth >= 64 ?
+				U64_MAX :
+				(1ULL << lwis_dev->native_value_bitwidth) - 1;
+	/* Counters narrower than 64 bits wrap around */
+	uint64_t bytes = (cur - prev) & mask;
+
+	return (unsigned int)min_t(uint64_t, div64_u64(bytes * USEC_PER_SEC, delta_ns), UINT_MAX);
+}
+
+static unsigned int bts_auto_target(struct lwis_dpm_bts_auto *bts_auto, unsigned int kbps)
+{
+	uint64_t target = (uint64_t)kbps + (kbps >> BTS_AUTO_HEADROOM_SHIFT);
+
+	return (unsigned int)clamp_t(uint64_t, target, bts_auto->floor_kbps,
+				     bts_auto->ceiling_kbps);
+}
+
+static bool bts_auto_vote_close(unsigned int vote, unsigned int target)
+{
+	unsigned int diff = vote > target ? vote - target : target - vote;
+
+	return diff <= (vote >> BTS_AUTO_HYSTERESIS_SHIFT);
+}
+
+static void bts_auto_work_func(struct work_struct *work)
+{
+	int ret;
+	unsigned long flags;
+	uint64_t read_bytes, write_bytes;
+	int64_t now_ns, delta_ns;
+	struct lwis_dpm_bts_sample sample;
+	struct lwis_dpm_bts_auto *bts_auto = container_of(work, struct lwis_dpm_bts_auto, work);
+	struct lwis_device *lwis_dev = bts_auto->lwis_dev;
+	struct lwis_dpm_votes *votes = &lwis_dev->dpm_votes;
+
+	/* Counters restart with the device, which cannot power down while they
+	 * are read */
+	mutex_lock(&lwis_dev->client_lock);
+	if (lwis_dev->enabled == 0) {
+		mutex_unlock(&lwis_dev->client_lock);
+		bts_auto->prev_timestamp_ns = 0;
+		return;
+	}
+
+	lwis_io_entry_lock(lwis_dev, /*device_lock=*/true, U64_MAX);
+	ret = bts_auto_read_counter(lwis_dev, lwis_dev->bts_read_counter_offset, &read_bytes);
+	if (!ret) {
+		ret = bts_auto_read_counter(lwis_dev, lwis_dev->bts_write_counter_offset,
+					    &write_bytes);
+	}
+	lwis_io_entry_unlock(lwis_dev, /*device_lock=*/true, U64_MAX);
+	mutex_unlock(&lwis_dev->client_lock);
+	now_ns = ktime_to_ns(lwis_get_time());
+	if (ret) {
+		dev_err_ratelimited(lwis_dev->dev, "Failed to read traffic counters (%d)\n", ret);
+		bts_auto->prev_timestamp_ns = 0;
+		return;
+	}
+
+	delta_ns = now_ns - bts_auto->prev_timestamp_ns;
+	if (bts_auto->prev_timestamp_ns == 0 || delta_ns <= 0) {
+		goto save_counters;
+	}
+
+	sample.timestamp_ns = now_ns;
+	sample.read_kbps =
+		bts_auto_kbps(lwis_dev, bts_auto->prev_read_bytes, read_bytes, delta_ns);
+	sample.write_kbps =
+		bts_auto_kbps(lwis_dev, bts_auto->prev_write_bytes, write_bytes, delta_ns);
+	sample.vote_read = bts_auto_target(bts_auto, sample.read_kbps);
+	sample.vote_write = bts_auto_target(bts_auto, sample.write_kbps);
+	/* Same peak heuristic as votes without an explicit peak */
+	sample.vote_peak = max(sample.vote_read, sample.vote_write) / 4;
+
+	if (votes->bts_valid && bts_auto_vote_close(votes->bts_read, sample.vote_read) &&
+	    bts_auto_vote_close(votes->bts_write, sample.vote_write)) {
+		sample.vote_peak = votes->bts_peak;
+		sample.vote_read = votes->bts_read;
+		sample.vote_write = votes->bts_write;
+	} else {
+		ret = dpm_vote_bts(lwis_dev, sample.vote_peak, sample.vote_read, sample.vote_write,
+				   /*rt_bw=*/0);
+		if (ret < 0) {
+			dev_err_ratelimited(lwis_dev->dev,
+					    "Failed to update closed-loop bts (%d)\n", ret);
+		}
+	}
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	bts_auto->history[bts_auto->history_head] = sample;
+	bts_auto->history_head = (bts_auto->history_head + 1) % DPM_BTS_AUTO_HISTORY_SIZE;
+	if (bts_auto->history_count < DPM_BTS_AUTO_HISTORY_SIZE) {
+		bts_auto->history_count++;
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+
+save_counters:
+	bts_auto->prev_read_bytes = read_bytes;
+	bts_auto->prev_write_bytes = write_bytes;
+	bts_auto->prev_timestamp_ns = now_ns;
+}
+
+void lwis_dpm_bts_auto_event(struct lwis_device *lwis_dev, int64_t event_id)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	if (lwis_dev->bts_auto && lwis_dev->bts_auto->frame_event_id == event_id) {
+		queue_work(system_highpri_wq, &lwis_dev->bts_auto->work);
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+}
+
+struct lwis_dpm_bts_auto *lwis_dpm_bts_auto_detach(struct lwis_device *lwis_dev,
+						   struct lwis_client *owner)
+{
+	unsigned long flags;
+	struct lwis_dpm_bts_auto *bts_auto = NULL;
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	if (lwis_dev->bts_auto && (!owner || lwis_dev->bts_auto->owner == owner)) {
+		bts_auto = lwis_dev->bts_auto;
+		lwis_dev->bts_auto = NULL;
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+	return bts_auto;
+}
+
+void lwis_dpm_bts_auto_free(struct lwis_dpm_bts_auto *bts_auto)
+{
+	if (!bts_auto) {
+		return;
+	}
+	cancel_work_sync(&bts_auto->work);
+	kfree(bts_auto);
+}
+
+int lwis_dpm_bts_auto_set(struct lwis_client *lwis_client,
+			  struct lwis_dpm_bts_auto_setting *setting)
+{
+	unsigned long flags;
+	struct lwis_dpm_bts_auto *bts_auto;
+	struct lwis_dpm_bts_auto *new_bts_auto = NULL;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	struct lwis_device *target_dev = lwis_find_dev_by_id(setting->device_id);
+
+	if (!target_dev) {
+		dev_err(lwis_dev->dev, "Can't find device by id: %d\n", setting->device_id);
+		return -ENOENT;
+	}
+
+	if (setting->frame_event_id == LWIS_EVENT_ID_NONE) {
+		lwis_dpm_bts_auto_free(lwis_dpm_bts_auto_detach(target_dev, /*owner=*/NULL));
+		return 0;
+	}
+
+	if (!target_dev->bts_counters_present || target_dev->bts_index == BTS_UNSUPPORTED ||
+	    !target_dev->vops.register_io) {
+		dev_err(lwis_dev->dev, "%s has no traffic counters or bts\n", target_dev->name);
+		return -EINVAL;
+	}
+	if (setting->floor_kbps < 0 || setting->ceiling_kbps <= 0 ||
+	    setting->floor_kbps > setting->ceiling_kbps || setting->ceiling_kbps > UINT_MAX) {
+		dev_err(lwis_dev->dev, "Invalid closed-loop bts bounds [%lld, %lld]\n",
+			setting->floor_kbps, setting->ceiling_kbps);
+		return -EINVAL;
+	}
+
+	if (!target_dev->bts_auto) {
+		new_bts_auto = kzalloc(sizeof(struct lwis_dpm_bts_auto), GFP_KERNEL);
+		if (!new_bts_auto) {
+			dev_err(lwis_dev->dev, "Failed to allocate closed-loop bts state\n");
+			return -ENOMEM;
+		}
+		new_bts_auto->lwis_dev = target_dev;
+		INIT_WORK(&new_bts_auto->work, bts_auto_work_func);
+	}
+
+	spin_lock_irqsave(&target_dev->lock, flags);
+	/* Another dpm client may have started it meanwhile */
+	if (!target_dev->bts_auto && new_bts_auto) {
+		target_dev->bts_auto = new_bts_auto;
+		new_bts_auto = NULL;
+	}
+	bts_auto = target_dev->bts_auto;
+	if (bts_auto) {
+		bts_auto->owner = lwis_client;
+		bts_auto->frame_event_id = setting->frame_event_id;
+		bts_auto->floor_kbps = (unsigned int)setting->floor_kbps;
+		bts_auto->ceiling_kbps = (unsigned int)setting->ceiling_kbps;
+	}
+	spin_unlock_irqrestore(&target_dev->lock, flags);
+
+	kfree(new_bts_auto);
+	return bts_auto ? 0 : -EAGAIN;
+}
+
+int lwis_dpm_bts_auto_generate_info(struct lwis_device *lwis_dev, char *buffer,
+				    size_t buffer_size)
+{
+	int i, idx;
+	unsigned long flags;
+	size_t len;
+	struct lwis_dpm_bts_auto *bts_auto;
+	struct lwis_dpm_bts_sample *sample;
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	bts_auto = lwis_dev->bts_auto;
+	if (!bts_auto) {
+		spin_unlock_irqrestore(&lwis_dev->lock, flags);
+		scnprintf(buffer, buffer_size, "Closed-loop bts disabled\n");
+		return 0;
+	}
+
+	len = scnprintf(buffer, buffer_size,
+			"Frame event: 0x%llx Bounds: [%u, %u] KB/s\n"
+			"Current vote: peak %u read %u write %u\n"
+			"History (newest first):\n",
+			bts_auto->frame_event_id, bts_auto->floor_kbps, bts_auto->ceiling_kbps,
+			lwis_dev->dpm_votes.bts_peak, lwis_dev->dpm_votes.bts_read,
+			lwis_dev->dpm_votes.bts_write);
+	for (i = 0; i < bts_auto->history_count; ++i) {
+		idx = (bts_auto->history_head - 1 - i + DPM_BTS_AUTO_HISTORY_SIZE) %
+		      DPM_BTS_AUTO_HISTORY_SIZE;
+		sample = &bts_auto->history[idx];
+		len += scnprintf(buffer + len, buffer_size - len,
+				 "[%lld] measured read %u write %u -> vote peak %u read %u write %u\n",
+				 sample->timestamp_ns, sample->read_kbps, sample->write_kbps,
+				 sample->vote_peak, sample->vote_read, sample->vote_write);
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+	return 0;
+}
+
+/*
+ * Returns true if the settings end up in the same vote, so that only the last
+ * one of them needs to be applied.
+ */
+static bool dpm_same_vote(struct lwis_qos_setting *a, struct lwis_qos_setting *b)
+{
+	return a->device_id == b->device_id && a->clock_family == b->clock_family &&
+	       (a->frequency_hz >= 0) == (b->frequency_hz >= 0);
+}
+
+int lwis_dpm_update_qos_batch(struct lwis_device *lwis_dev, struct lwis_qos_setting *qos_settings,
+			      size_t num_settings)
+{
+	int ret;
+	size_t i, j;
+	bool superseded;
+
+	for (i = 0; i < num_settings; ++i) {
+		superseded = false;
+		for (j = i + 1; j < num_settings; ++j) {
+			if (dpm_same_vote(&qos_settings[i], &qos_settings[j])) {
+				superseded = true;
+				break;
+			}
+		}
+		if (superseded) {
+			continue;
+		}
+
+		ret = lwis_dpm_update_qos(lwis_dev, &qos_settings[i]);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to apply qos setting, ret: %d\n", ret);
+			return ret;
+		}
+	}
+	return 0;
+}
+
 /*
  *  lwis_dpm_update_clock: update specific clock settings to lwis device.
  */
@@ -198,6 +537,7 @@ static struct platform_driver lwis_driver = {
 		.name = LWIS_DRIVER_NAME,
 		.owner = THIS_MODULE,
 		.of_match_table = lwis_id_match,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 };
 
@@ -216,6 +556,7 @@ static struct platform_driver lwis_driver = { .probe = lwis_dpm_device_probe,
 					      .driver = {
 						      .name = LWIS_DRIVER_NAME,
 						      .owner = THIS_MODULE,
+						      .probe_type = PROBE_PREFER_ASYNCHRONOUS,
 					      } };
 #endif /* CONFIG_OF */
 
@@ -22,6 +22,45 @@ struct lwis_dpm_device {
 	struct lwis_device base_dev;
 };
 
+#define DPM_BTS_AUTO_HISTORY_SIZE 16
+
+/*
+ *  struct lwis_dpm_bts_sample
+ *  Bandwidth measured over one frame and the votes chosen from it, in KB/s.
+ */
+struct lwis_dpm_bts_sample {
+	int64_t timestamp_ns;
+	unsigned int read_kbps;
+	unsigned int write_kbps;
+	unsigned int vote_peak;
+	unsigned int vote_read;
+	unsigned int vote_write;
+};
+
+/*
+ *  struct lwis_dpm_bts_auto
+ *  Closed-loop bandwidth voting of a device. Its traffic counters are sampled
+ *  on every frame event and the votes follow the measured bandwidth within
+ *  the bounds set by the dpm client.
+ */
+struct lwis_dpm_bts_auto {
+	struct lwis_device *lwis_dev;
+	/* dpm client that last set it, the voting stops when it is released */
+	struct lwis_client *owner;
+	int64_t frame_event_id;
+	unsigned int floor_kbps;
+	unsigned int ceiling_kbps;
+	struct work_struct work;
+	/* Counter values of the previous sample, none if prev_timestamp_ns is 0 */
+	uint64_t prev_read_bytes;
+	uint64_t prev_write_bytes;
+	int64_t prev_timestamp_ns;
+	/* Latest samples, guarded by lwis_dev->lock */
+	struct lwis_dpm_bts_sample history[DPM_BTS_AUTO_HISTORY_SIZE];
+	int history_head;
+	int history_count;
+};
+
 /*
  *  lwis_dpm_update_clock: update specific clock setting on lwis device.
  *  clk_settings needs to be freed at the end of this function.
@@ -34,6 +73,55 @@ int lwis_dpm_update_clock(struct lwis_device *lwis_dev, struct lwis_clk_setting
  */
 int lwis_dpm_update_qos(struct lwis_device *lwis_dev, struct lwis_qos_setting *qos_setting);
 
+/*
+ *  lwis_dpm_update_qos_batch: apply a set of qos requirements from dpm client.
+ *  Settings overridden by a later one of the set for the same device and
+ *  clock family are dropped, and votes equal to the current ones are skipped.
+ */
+int lwis_dpm_update_qos_batch(struct lwis_device *lwis_dev, struct lwis_qos_setting *qos_settings,
+			      size_t num_settings);
+
+/*
+ *  lwis_dpm_votes_reset: forget the votes cached for lwis_dev, e.g. when the
+ *  platform drops them on power up/down.
+ */
+void lwis_dpm_votes_reset(struct lwis_device *lwis_dev);
+
+/*
+ *  lwis_dpm_bts_auto_set: start, update or stop the closed-loop bandwidth
+ *  voting of the device given by setting.
+ */
+int lwis_dpm_bts_auto_set(struct lwis_client *lwis_client,
+			  struct lwis_dpm_bts_auto_setting *setting);
+
+/*
+ *  lwis_dpm_bts_auto_detach: take the closed-loop bandwidth voting state off
+ *  lwis_dev, if owner set it or owner is NULL. The state is to be freed with
+ *  lwis_dpm_bts_auto_free.
+ */
+struct lwis_dpm_bts_auto *lwis_dpm_bts_auto_detach(struct lwis_device *lwis_dev,
+						   struct lwis_client *owner);
+
+/*
+ *  lwis_dpm_bts_auto_free: wait for the last sample of a detached closed-loop
+ *  bandwidth voting state and free it. Must not be called with core.lock or
+ *  the client_lock of its device held.
+ */
+void lwis_dpm_bts_auto_free(struct lwis_dpm_bts_auto *bts_auto);
+
+/*
+ *  lwis_dpm_bts_auto_event: sample the traffic counters of lwis_dev if event_id
+ *  is its closed-loop frame event. Safe to call in IRQ context.
+ */
+void lwis_dpm_bts_auto_event(struct lwis_device *lwis_dev, int64_t event_id);
+
+/*
+ *  lwis_dpm_bts_auto_generate_info: print the closed-loop votes of lwis_dev
+ *  and their history for debugfs.
+ */
+int lwis_dpm_bts_auto_generate_info(struct lwis_device *lwis_dev, char *buffer,
+				    size_t buffer_size);
+
 /*
  *  lwis_dpm_read_clock: read current IP core clock for given lwis device.
  *  The unit is hz.
@@ -44,9 +44,12 @@ static int lwis_i2c_device_enable(struct lwis_device *lwis_dev);
 static int lwis_i2c_device_disable(struct lwis_device *lwis_dev);
 static int lwis_i2c_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				int access_size);
+static int lwis_i2c_register_io_vector(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				       int num_entries, int access_size);
 
 static struct lwis_device_subclass_operations i2c_vops = {
 	.register_io = lwis_i2c_register_io,
+	.register_io_vector = lwis_i2c_register_io_vector,
 	.register_io_barrier = NULL,
 	.device_enable = lwis_i2c_device_enable,
 	.device_disable = lwis_i2c_device_disable,
@@ -130,6 +133,26 @@ static int lwis_i2c_device_disable(struct lwis_device *lwis_dev)
 static int lwis_i2c_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				int access_size)
 {
+	int ret;
+	struct lwis_i2c_device *i2c_dev;
+	i2c_dev = container_of(lwis_dev, struct lwis_i2c_device, base_dev);
+
+	/* Running in interrupt context is not supported as i2c driver might sleep */
+	if (in_interrupt()) {
+		return -EAGAIN;
+	}
+	ret = lwis_i2c_io_entry_rw(i2c_dev, entry);
+	if (!ret) {
+		lwis_dev_stats_count_io(lwis_dev, entry, lwis_dev->native_value_bitwidth);
+	}
+	return ret;
+}
+
+static int lwis_i2c_register_io_vector(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				       int num_entries, int access_size)
+{
+	int i;
+	int ret;
 	struct lwis_i2c_device *i2c_dev;
 	i2c_dev = container_of(lwis_dev, struct lwis_i2c_device, base_dev);
 
@@ -137,7 +160,14 @@ static int lwis_i2c_register_io(struct lwis_device *lwis_dev, struct lwis_io_ent
 	if (in_interrupt()) {
 		return -EAGAIN;
 	}
-	return lwis_i2c_io_entry_rw(i2c_dev, entry);
+	ret = lwis_i2c_io_entries_rw(i2c_dev, entries, num_entries);
+	if (!ret) {
+		for (i = 0; i < num_entries; ++i) {
+			lwis_dev_stats_count_io(lwis_dev, &entries[i],
+						lwis_dev->native_value_bitwidth);
+		}
+	}
+	return ret;
 }
 
 static int lwis_i2c_addr_matcher(struct device *dev, void *data)
@@ -245,6 +275,10 @@ static int lwis_i2c_device_probe(struct platform_device *plat_dev)
 	i2c_dev->base_dev.vops = i2c_vops;
 	i2c_dev->base_dev.subscribe_ops = i2c_subscribe_ops;
 
+	/* Associated kworker threads are created on first open */
+	lwis_init_kthread_workers(&i2c_dev->base_dev, "lwis_i2c_trans_kthread",
+				  "lwis_i2c_prd_io_kthread");
+
 	/* Call the base device probe function */
 	ret = lwis_base_probe(&i2c_dev->base_dev, plat_dev);
 	if (ret) {
@@ -260,45 +294,18 @@ static int lwis_i2c_device_probe(struct platform_device *plat_dev)
 		goto error_probe;
 	}
 
-	/* Create associated kworker threads */
-	ret = lwis_create_kthread_workers(&i2c_dev->base_dev, "lwis_i2c_trans_kthread",
-					 "lwis_i2c_prd_io_kthread");
+	ret = lwis_i2c_scratch_init(i2c_dev);
 	if (ret) {
-		dev_err(i2c_dev->base_dev.dev,"Failed to create lwis_i2c_kthread");
 		lwis_base_unprobe(&i2c_dev->base_dev);
 		goto error_probe;
 	}
 
-	if (i2c_dev->base_dev.transaction_thread_priority != 0) {
-		ret = lwis_set_kthread_priority(&i2c_dev->base_dev,
-			i2c_dev->base_dev.transaction_worker_thread,
-			i2c_dev->base_dev.transaction_thread_priority);
-		if (ret) {
-			dev_err(i2c_dev->base_dev.dev,
-				"Failed to set LWIS I2C transaction kthread priority (%d)",
-				ret);
-			lwis_base_unprobe(&i2c_dev->base_dev);
-			goto error_probe;
-		}
-	}
-	if (i2c_dev->base_dev.periodic_io_thread_priority != 0) {
-		ret = lwis_set_kthread_priority(&i2c_dev->base_dev,
-			i2c_dev->base_dev.periodic_io_worker_thread,
-			i2c_dev->base_dev.periodic_io_thread_priority);
-		if (ret) {
-			dev_err(i2c_dev->base_dev.dev,
-				"Failed to set LWIS I2C periodic io kthread priority (%d)",
-				ret);
-			lwis_base_unprobe(&i2c_dev->base_dev);
-			goto error_probe;
-		}
-	}
-
 	dev_info(i2c_dev->base_dev.dev, "I2C Device Probe: Success\n");
 
 	return 0;
 
 error_probe:
+	lwis_i2c_scratch_free(i2c_dev);
 	kfree(i2c_dev);
 	return ret;
 }
@@ -310,6 +317,8 @@ static int lwis_i2c_device_suspend(struct device *dev)
 	struct lwis_client *lwis_client, *n;
 	int ret = 0;
 
+	/* A lingering device has no client left to notify */
+	lwis_dev_power_linger_stop(lwis_dev);
 	if (lwis_dev->enabled == 0) {
 		return ret;
 	}
@@ -319,6 +328,11 @@ static int lwis_i2c_device_suspend(struct device *dev)
 		return -EBUSY;
 	}
 
+	/* Devices declaring their register state resume as they were */
+	if (lwis_dev_suspend_save(lwis_dev) == 0) {
+		return 0;
+	}
+
 	/* Send an error event to userspace to handle the system suspend */
 	lwis_device_error_event_emit(lwis_dev, LWIS_ERROR_EVENT_ID_SYSTEM_SUSPEND,
 				     /*payload=*/NULL, /*payload_size=*/0);
@@ -365,7 +379,9 @@ static int lwis_i2c_device_suspend(struct device *dev)
 
 static int lwis_i2c_device_resume(struct device *dev)
 {
-	return 0;
+	struct lwis_device *lwis_dev = dev_get_drvdata(dev);
+
+	return lwis_dev_resume_restore(lwis_dev);
 }
 
 static SIMPLE_DEV_PM_OPS(lwis_i2c_device_ops, lwis_i2c_device_suspend, lwis_i2c_device_resume);
@@ -385,6 +401,7 @@ static struct platform_driver lwis_driver = {
 			.name = LWIS_DRIVER_NAME,
 			.owner = THIS_MODULE,
 			.of_match_table = lwis_id_match,
+			.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 			.pm	= &lwis_i2c_device_ops,
 		},
 };
@@ -403,6 +420,7 @@ static struct platform_driver lwis_driver = { .probe = lwis_i2c_device_probe,
 					      .driver = {
 						      .name = LWIS_DRIVER_NAME,
 						      .owner = THIS_MODULE,
+						      .probe_type = PROBE_PREFER_ASYNCHRONOUS,
 					      } };
 #endif /* CONFIG_OF */
 
@@ -31,6 +31,11 @@ struct lwis_i2c_device {
 	u32 i2c_lock_group_id;
 	/* Mutex shared by the same group id's I2C devices */
 	struct mutex *group_i2c_lock;
+	/* Scratch buffer for offsets, values and i2c messages of transfers,
+	 * grown to the largest transfer seen */
+	struct mutex scratch_lock;
+	uint8_t *scratch_buf;
+	size_t scratch_size;
 };
 
 int lwis_i2c_device_deinit(void);
@@ -36,10 +36,18 @@ static int lwis_ioreg_device_enable(struct lwis_device *lwis_dev);
 static int lwis_ioreg_device_disable(struct lwis_device *lwis_dev);
 static int lwis_ioreg_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				  int access_size);
+static int lwis_ioreg_register_io_prepare(struct lwis_device *lwis_dev,
+					  struct lwis_io_entry *entry, int access_size,
+					  void **resolved);
+static int lwis_ioreg_register_io_prepared(struct lwis_device *lwis_dev,
+					   struct lwis_io_entry *entry, int access_size,
+					   void *resolved);
 static int lwis_ioreg_register_io_barrier(struct lwis_device *lwis_dev, bool read, bool write);
 
 static struct lwis_device_subclass_operations ioreg_vops = {
 	.register_io = lwis_ioreg_register_io,
+	.register_io_prepare = lwis_ioreg_register_io_prepare,
+	.register_io_prepared = lwis_ioreg_register_io_prepared,
 	.register_io_barrier = lwis_ioreg_register_io_barrier,
 	.device_enable = lwis_ioreg_device_enable,
 	.device_disable = lwis_ioreg_device_disable,
@@ -68,7 +76,31 @@ static int lwis_ioreg_device_disable(struct lwis_device *lwis_dev)
 static int lwis_ioreg_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				  int access_size)
 {
-	return lwis_ioreg_io_entry_rw((struct lwis_ioreg_device *)lwis_dev, entry, access_size);
+	int ret = lwis_ioreg_io_entry_rw((struct lwis_ioreg_device *)lwis_dev, entry, access_size);
+	if (!ret) {
+		lwis_dev_stats_count_io(lwis_dev, entry, access_size);
+	}
+	return ret;
+}
+
+static int lwis_ioreg_register_io_prepare(struct lwis_device *lwis_dev,
+					  struct lwis_io_entry *entry, int access_size,
+					  void **resolved)
+{
+	return lwis_ioreg_io_entry_prepare((struct lwis_ioreg_device *)lwis_dev, entry,
+					   access_size, (void __iomem **)resolved);
+}
+
+static int lwis_ioreg_register_io_prepared(struct lwis_device *lwis_dev,
+					   struct lwis_io_entry *entry, int access_size,
+					   void *resolved)
+{
+	int ret = lwis_ioreg_io_entry_rw_prepared((struct lwis_ioreg_device *)lwis_dev, entry,
+						  (void __iomem *)resolved);
+	if (!ret) {
+		lwis_dev_stats_count_io(lwis_dev, entry, access_size);
+	}
+	return ret;
 }
 
 static int lwis_ioreg_register_io_barrier(struct lwis_device *lwis_dev, bool use_read_barrier,
@@ -112,6 +144,10 @@ static int lwis_ioreg_device_probe(struct platform_device *plat_dev)
 	ioreg_dev->base_dev.vops = ioreg_vops;
 	ioreg_dev->base_dev.subscribe_ops = ioreg_subscribe_ops;
 
+	/* Associated kworker threads are created on first open */
+	lwis_init_kthread_workers(&ioreg_dev->base_dev, "lwis_ioreg_trans_kthread",
+				  "lwis_ioreg_prd_io_kthread");
+
 	/* Call the base device probe function */
 	ret = lwis_base_probe(&ioreg_dev->base_dev, plat_dev);
 	if (ret) {
@@ -127,45 +163,12 @@ static int lwis_ioreg_device_probe(struct platform_device *plat_dev)
 		goto error_probe;
 	}
 
-	/* Create associated kworker threads */
-	ret = lwis_create_kthread_workers(&ioreg_dev->base_dev, "lwis_ioreg_trans_kthread",
-					 "lwis_ioreg_prd_io_kthread");
-	if (ret) {
-		dev_err(ioreg_dev->base_dev.dev, "Failed to create lwis_ioreg_kthread");
-		lwis_base_unprobe(&ioreg_dev->base_dev);
-		goto error_probe;
-	}
-
-	if (ioreg_dev->base_dev.transaction_thread_priority != 0) {
-		ret = lwis_set_kthread_priority(&ioreg_dev->base_dev,
-			ioreg_dev->base_dev.transaction_worker_thread,
-			ioreg_dev->base_dev.transaction_thread_priority);
-		if (ret) {
-			dev_err(ioreg_dev->base_dev.dev,
-				"Failed to set LWIS IOREG transaction kthread priority (%d)",
-				ret);
-			lwis_base_unprobe(&ioreg_dev->base_dev);
-			goto error_probe;
-		}
-	}
-	if (ioreg_dev->base_dev.periodic_io_thread_priority != 0) {
-		ret = lwis_set_kthread_priority(&ioreg_dev->base_dev,
-			ioreg_dev->base_dev.periodic_io_worker_thread,
-			ioreg_dev->base_dev.periodic_io_thread_priority);
-		if (ret) {
-			dev_err(ioreg_dev->base_dev.dev,
-				"Failed to set LWIS IOREG periodic io kthread priority (%d)",
-				ret);
-			lwis_base_unprobe(&ioreg_dev->base_dev);
-			goto error_probe;
-		}
-	}
-
 	dev_info(ioreg_dev->base_dev.dev, "IOREG Device Probe: Success\n");
 
 	return 0;
 
 error_probe:
+	lwis_ioreg_dma_put(ioreg_dev);
 	kfree(ioreg_dev);
 	return ret;
 }
@@ -177,10 +180,17 @@ static int lwis_ioreg_device_suspend(struct device *dev)
 	struct lwis_client *lwis_client, *n;
 	int ret = 0;
 
+	/* A lingering device has no client left to notify */
+	lwis_dev_power_linger_stop(lwis_dev);
 	if (lwis_dev->enabled == 0) {
 		return ret;
 	}
 
+	/* Devices declaring their register state resume as they were */
+	if (lwis_dev_suspend_save(lwis_dev) == 0) {
+		return 0;
+	}
+
 	/* Send an error event to userspace to handle the system suspend */
 	lwis_device_error_event_emit(lwis_dev, LWIS_ERROR_EVENT_ID_SYSTEM_SUSPEND,
 				     /*payload=*/NULL, /*payload_size=*/0);
@@ -227,7 +237,9 @@ static int lwis_ioreg_device_suspend(struct device *dev)
 
 static int lwis_ioreg_device_resume(struct device *dev)
 {
-	return 0;
+	struct lwis_device *lwis_dev = dev_get_drvdata(dev);
+
+	return lwis_dev_resume_restore(lwis_dev);
 }
 
 static SIMPLE_DEV_PM_OPS(lwis_ioreg_device_ops, lwis_ioreg_device_suspend,
@@ -248,6 +260,7 @@ static struct platform_driver lwis_driver = {
 			.name = LWIS_DRIVER_NAME,
 			.owner = THIS_MODULE,
 			.of_match_table = lwis_id_match,
+			.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 			.pm = &lwis_ioreg_device_ops,
 		},
 };
@@ -266,6 +279,7 @@ static struct platform_driver lwis_driver = { .probe = lwis_ioreg_device_probe,
 					      .driver = {
 						      .name = LWIS_DRIVER_NAME,
 						      .owner = THIS_MODULE,
+						      .probe_type = PROBE_PREFER_ASYNCHRONOUS,
 					      } };
 #endif /* CONFIG_OF */
 
@@ -11,6 +11,8 @@
 #ifndef LWIS_DEVICE_IOREG_H_
 #define LWIS_DEVICE_IOREG_H_
 
+#include <linux/dmaengine.h>
+#include <linux/mutex.h>
 #include <linux/types.h>
 
 #include "lwis_device.h"
@@ -20,6 +22,8 @@ struct lwis_ioreg {
 	int size;
 	void __iomem *base;
 	char *name;
+	/* Block tolerates accesses wider than native_value_bitwidth */
+	bool wide_access;
 };
 
 struct lwis_ioreg_list {
@@ -34,6 +38,13 @@ struct lwis_ioreg_list {
 struct lwis_ioreg_device {
 	struct lwis_device base_dev;
 	struct lwis_ioreg_list reg_list;
+	/* Optional dmaengine channel for large batch transfers */
+	struct dma_chan *dma_chan;
+	/* Serializes transfers on dma_chan, so that a timeout terminating the
+	 * channel only aborts its own transfer */
+	struct mutex dma_lock;
+	/* Smallest batch in bytes transferred through dma_chan */
+	size_t dma_min_bytes;
 };
 
 int lwis_ioreg_device_deinit(void);
@@ -99,6 +99,9 @@ static int lwis_slc_enable(struct lwis_device *lwis_dev)
 		slc_dev->partition_handle = NULL;
 		return ret;
 	}
+	mutex_lock(&slc_dev->lock);
+	slc_dev->keep_alive = of_property_read_bool(node, "pt_keep_alive");
+	slc_dev->num_alloc_failures = 0;
 	slc_dev->num_pt = num_pt_id;
 	for (i = 0; i < slc_dev->num_pt; i++) {
 		slc_dev->pt[i].id = i;
@@ -106,7 +109,12 @@ static int lwis_slc_enable(struct lwis_device *lwis_dev)
 		slc_dev->pt[i].fd = -1;
 		slc_dev->pt[i].partition_id = PT_PTID_INVALID;
 		slc_dev->pt[i].partition_handle = slc_dev->partition_handle;
+		slc_dev->pt[i].num_allocs = 0;
+		slc_dev->pt[i].num_activations = 0;
+		slc_dev->pt[i].request_kb = 0;
+		slc_dev->pt[i].max_request_kb = 0;
 	}
+	mutex_unlock(&slc_dev->lock);
 	return 0;
 #else /* CONFIG_OF not defined */
 	return -ENOENT;
@@ -127,6 +135,7 @@ static int lwis_slc_disable(struct lwis_device *lwis_dev)
 		dev_err(slc_dev->base_dev.dev, "Partition handle is NULL\n");
 		return -ENODEV;
 	}
+	mutex_lock(&slc_dev->lock);
 	for (i = 0; i < slc_dev->num_pt; i++) {
 		if (slc_dev->pt[i].partition_id != PT_PTID_INVALID) {
 			dev_info(slc_dev->base_dev.dev,
@@ -137,14 +146,59 @@ static int lwis_slc_disable(struct lwis_device *lwis_dev)
 		}
 	}
 	pt_client_unregister(slc_dev->partition_handle);
+	mutex_unlock(&slc_dev->lock);
 	return 0;
 }
 
+static bool slc_partition_in_use(struct slc_partition *slc_pt)
+{
+	return slc_pt->fd >= 0;
+}
+
+static bool slc_partition_active(struct slc_partition *slc_pt)
+{
+	return slc_pt->partition_id != PT_PTID_INVALID;
+}
+
+static void slc_partition_deactivate(struct slc_partition *slc_pt)
+{
+	pt_client_disable(slc_pt->partition_handle, slc_pt->id);
+	slc_pt->partition_id = PT_PTID_INVALID;
+}
+
+/*
+ * Finds the smallest free partition that fits request_kb. Among partitions of
+ * the same size, one that is still activated is preferred, since reusing it
+ * skips enabling the partition again.
+ */
+static struct slc_partition *slc_partition_best_fit(struct lwis_slc_device *slc_dev,
+						    size_t request_kb)
+{
+	int i;
+	struct slc_partition *slc_pt;
+	struct slc_partition *best = NULL;
+
+	for (i = 0; i < slc_dev->num_pt; i++) {
+		slc_pt = &slc_dev->pt[i];
+		if (slc_partition_in_use(slc_pt) || slc_pt->size_kb < request_kb) {
+			continue;
+		}
+		if (!best || slc_pt->size_kb < best->size_kb ||
+		    (slc_pt->size_kb == best->size_kb && !slc_partition_active(best) &&
+		     slc_partition_active(slc_pt))) {
+			best = slc_pt;
+		}
+	}
+	return best;
+}
+
 int lwis_slc_buffer_alloc(struct lwis_device *lwis_dev, struct lwis_alloc_buffer_info *alloc_info)
 {
 	struct lwis_slc_device *slc_dev = (struct lwis_slc_device *)lwis_dev;
-	int i = 0, fd_or_err = -1;
+	struct slc_partition *slc_pt;
+	int i = 0, fd_or_err = -1, ret = 0;
 	ptid_t partition_id = PT_PTID_INVALID;
+	size_t request_kb;
 
 	if (!lwis_dev) {
 		pr_err("LWIS device cannot be NULL\n");
@@ -165,45 +219,61 @@ int lwis_slc_buffer_alloc(struct lwis_device *lwis_dev, struct lwis_alloc_buffer
 		dev_err(slc_dev->base_dev.dev, "No valid partitions is found in SLC\n");
 		return -EINVAL;
 	}
+	request_kb = SIZE_TO_KB(alloc_info->size);
 
-	for (i = 0; i < slc_dev->num_pt; i++) {
-		if (slc_dev->pt[i].partition_id == PT_PTID_INVALID &&
-		    slc_dev->pt[i].size_kb >= SIZE_TO_KB(alloc_info->size)) {
-			partition_id =
-				pt_client_enable(slc_dev->partition_handle, slc_dev->pt[i].id);
-			if (partition_id != PT_PTID_INVALID) {
-				fd_or_err = anon_inode_getfd("slc_pt_file", &pt_file_ops,
-							     &slc_dev->pt[i], O_CLOEXEC);
-				if (fd_or_err < 0) {
-					dev_err(lwis_dev->dev,
-						"Failed to create a new file instance for the partition\n");
-					return fd_or_err;
-				}
-				slc_dev->pt[i].fd = fd_or_err;
-				slc_dev->pt[i].partition_id = partition_id;
-				alloc_info->dma_fd = fd_or_err;
-				alloc_info->partition_id = slc_dev->pt[i].partition_id;
-				return 0;
-			} else {
-				dev_err(lwis_dev->dev, "Failed to enable partition id %d\n",
-					slc_dev->pt[i].id);
-				return -EPROTO;
-			}
+	mutex_lock(&slc_dev->lock);
+	slc_pt = slc_partition_best_fit(slc_dev, request_kb);
+	if (!slc_pt) {
+		dev_err(lwis_dev->dev,
+			"Failed to find valid partition, largest size supported is %zuKB, asking for %zuKB\n",
+			slc_dev->pt[slc_dev->num_pt - 1].size_kb, request_kb);
+		for (i = 0; i < slc_dev->num_pt; i++) {
+			dev_err(lwis_dev->dev, "Partition[%d]: size %zuKB is %s\n", i,
+				slc_dev->pt[i].size_kb,
+				slc_partition_in_use(&slc_dev->pt[i]) ? "in use" : "NOT in use");
 		}
+		ret = -EINVAL;
+		goto error_alloc;
 	}
-	dev_err(lwis_dev->dev,
-		"Failed to find valid partition, largest size supported is %zuKB, asking for %zuKB\n",
-		slc_dev->pt[slc_dev->num_pt - 1].size_kb, SIZE_TO_KB(alloc_info->size));
-	for (i = 0; i < slc_dev->num_pt; i++) {
-		dev_err(lwis_dev->dev, "Partition[%d]: size %zuKB is %s\n", i,
-			slc_dev->pt[i].size_kb,
-			(slc_dev->pt[i].partition_id == PT_PTID_INVALID) ? "NOT in use" : "in use");
+
+	if (!slc_partition_active(slc_pt)) {
+		partition_id = pt_client_enable(slc_dev->partition_handle, slc_pt->id);
+		if (partition_id == PT_PTID_INVALID) {
+			dev_err(lwis_dev->dev, "Failed to enable partition id %d\n", slc_pt->id);
+			ret = -EPROTO;
+			goto error_alloc;
+		}
+		slc_pt->partition_id = partition_id;
+		slc_pt->num_activations++;
 	}
-	return -EINVAL;
+
+	fd_or_err = anon_inode_getfd("slc_pt_file", &pt_file_ops, slc_pt, O_CLOEXEC);
+	if (fd_or_err < 0) {
+		dev_err(lwis_dev->dev, "Failed to create a new file instance for the partition\n");
+		if (!slc_dev->keep_alive) {
+			slc_partition_deactivate(slc_pt);
+		}
+		ret = fd_or_err;
+		goto error_alloc;
+	}
+	slc_pt->fd = fd_or_err;
+	slc_pt->num_allocs++;
+	slc_pt->request_kb = request_kb;
+	slc_pt->max_request_kb = max(slc_pt->max_request_kb, request_kb);
+	alloc_info->dma_fd = fd_or_err;
+	alloc_info->partition_id = slc_pt->partition_id;
+	mutex_unlock(&slc_dev->lock);
+	return 0;
+
+error_alloc:
+	slc_dev->num_alloc_failures++;
+	mutex_unlock(&slc_dev->lock);
+	return ret;
 }
 
 int lwis_slc_buffer_free(struct lwis_device *lwis_dev, int fd)
 {
+	struct lwis_slc_device *slc_dev = (struct lwis_slc_device *)lwis_dev;
 	struct file *fp;
 	struct slc_partition *slc_pt;
 
@@ -218,23 +288,60 @@ int lwis_slc_buffer_free(struct lwis_device *lwis_dev, int fd)
 	}
 	slc_pt = fp->private_data;
 
+	mutex_lock(&slc_dev->lock);
 	if (slc_pt->fd != fd) {
 		dev_warn(lwis_dev->dev, "Stale SLC buffer free for fd %d with ptid %d\n", fd,
 			 slc_pt->partition_id);
+		mutex_unlock(&slc_dev->lock);
 		fput(fp);
 		return -EINVAL;
 	}
 
-	if (slc_pt->partition_id != PT_PTID_INVALID && slc_pt->partition_handle) {
-		pt_client_disable(slc_pt->partition_handle, slc_pt->id);
-		slc_pt->partition_id = PT_PTID_INVALID;
-		slc_pt->fd = -1;
+	slc_pt->fd = -1;
+	slc_pt->request_kb = 0;
+	/* A kept alive partition is handed out again without enabling it */
+	if (!slc_dev->keep_alive && slc_partition_active(slc_pt) && slc_pt->partition_handle) {
+		slc_partition_deactivate(slc_pt);
 	}
+	mutex_unlock(&slc_dev->lock);
 	fput(fp);
 
 	return 0;
 }
 
+int lwis_slc_generate_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+{
+	struct lwis_slc_device *slc_dev = (struct lwis_slc_device *)lwis_dev;
+	struct slc_partition *slc_pt;
+	/* Temporary buffer to be concatenated to the main buffer. */
+	char tmp_buf[160] = {};
+	int i;
+
+	scnprintf(buffer, buffer_size, "=== LWIS SLC INFO: %s ===\n", lwis_dev->name);
+
+	mutex_lock(&slc_dev->lock);
+	scnprintf(tmp_buf, sizeof(tmp_buf), "Keep alive: %s Allocation failures: %llu\n",
+		  slc_dev->keep_alive ? "yes" : "no", slc_dev->num_alloc_failures);
+	strlcat(buffer, tmp_buf, buffer_size);
+	for (i = 0; i < slc_dev->num_pt; i++) {
+		slc_pt = &slc_dev->pt[i];
+		scnprintf(tmp_buf, sizeof(tmp_buf),
+			  "[%2d] Size: %zuKB State: %s Used: %zuKB (%zu%%) Max: %zuKB "
+			  "Allocs: %llu Activations: %llu\n",
+			  slc_pt->id, slc_pt->size_kb,
+			  slc_partition_in_use(slc_pt) ?
+				  "in use" :
+				  (slc_partition_active(slc_pt) ? "kept alive" : "inactive"),
+			  slc_pt->request_kb,
+			  slc_pt->size_kb ? slc_pt->request_kb * 100 / slc_pt->size_kb : 0,
+			  slc_pt->max_request_kb, slc_pt->num_allocs, slc_pt->num_activations);
+		strlcat(buffer, tmp_buf, buffer_size);
+	}
+	mutex_unlock(&slc_dev->lock);
+
+	return 0;
+}
+
 static int lwis_slc_device_probe(struct platform_device *plat_dev)
 {
 	int ret = 0;
@@ -249,6 +356,7 @@ static int lwis_slc_device_probe(struct platform_device *plat_dev)
 
 	slc_dev->base_dev.type = DEVICE_TYPE_SLC;
 	slc_dev->base_dev.vops = slc_vops;
+	mutex_init(&slc_dev->lock);
 	slc_dev->base_dev.subscribe_ops = slc_subscribe_ops;
 
 	/* Call the base device probe function */
@@ -278,6 +386,7 @@ static struct platform_driver lwis_driver = {
 	.driver = {
 		.name = LWIS_DRIVER_NAME,
 		.owner = THIS_MODULE,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 		.of_match_table = lwis_id_match,
 	},
 };
@@ -15,12 +15,21 @@
 
 #define MAX_NUM_PT 16
 
+/*
+ * A partition is in use while it has an fd. It stays activated, with a valid
+ * partition_id, after it is freed if the device keeps partitions alive.
+ */
 struct slc_partition {
 	int id;
 	size_t size_kb;
 	int fd;
 	ptid_t partition_id;
 	struct pt_handle *partition_handle;
+	/* Usage statistics, exported through debugfs */
+	uint64_t num_allocs;
+	uint64_t num_activations;
+	size_t request_kb;
+	size_t max_request_kb;
 };
 
 /*
@@ -32,6 +41,11 @@ struct lwis_slc_device {
 	int num_pt;
 	struct slc_partition pt[MAX_NUM_PT];
 	struct pt_handle *partition_handle;
+	/* Keep freed partitions activated until the device is disabled */
+	bool keep_alive;
+	uint64_t num_alloc_failures;
+	/* Serializes partition allocation among clients */
+	struct mutex lock;
 };
 
 int lwis_slc_device_deinit(void);
@@ -40,4 +54,10 @@ int lwis_slc_buffer_alloc(struct lwis_device *lwis_dev, struct lwis_alloc_buffer
 
 int lwis_slc_buffer_free(struct lwis_device *lwis_dev, int fd);
 
+/*
+ * lwis_slc_generate_info: Prints the size, state and usage statistics of
+ * every partition into buffer, for debugfs.
+ */
+int lwis_slc_generate_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size);
+
 #endif /* LWIS_DEVICE_SLC_H_ */
@@ -19,7 +19,9 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/percpu.h>
 #include <linux/platform_device.h>
+#include <linux/rculist.h>
 #include <linux/slab.h>
 
 #ifdef CONFIG_OF
@@ -67,12 +69,14 @@ struct lwis_event_subscribe_info {
 	struct list_head list_node;
 	/* List of event subscriber info */
 	struct lwis_event_subscriber_list *event_subscriber_list;
+	struct rcu_head rcu;
 };
 
 struct lwis_event_subscriber_list {
 	int64_t trigger_event_id;
 	struct list_head list;
 	struct hlist_node node;
+	struct rcu_head rcu;
 };
 
 struct lwis_trigger_event_info {
@@ -82,8 +86,20 @@ struct lwis_trigger_event_info {
 	int64_t trigger_event_count;
 	/* Store emitted event timestamp from trigger device */
 	int64_t trigger_event_timestamp;
-	/* node of list head */
-	struct list_head node;
+};
+
+/* Number of trigger events each CPU can have pending for the tasklet */
+#define TRIGGER_EVENT_RING_SIZE 64
+
+/*
+ * Single producer, single consumer ring of trigger events. The producer is
+ * lwis_top_event_notify on the CPU owning the ring, with IRQs disabled, and
+ * the consumer is the subscribe tasklet. head and tail are free running.
+ */
+struct lwis_trigger_event_ring {
+	struct lwis_trigger_event_info events[TRIGGER_EVENT_RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
 };
 
 static struct lwis_event_subscriber_list *event_subscriber_list_find(struct lwis_device *lwis_dev,
@@ -99,10 +115,30 @@ static struct lwis_event_subscriber_list *event_subscriber_list_find(struct lwis
 	return NULL;
 }
 
+/*
+ * Same as event_subscriber_list_find, for readers that do not hold
+ * base_dev.lock.
+ *
+ * Assumes: rcu_read_lock is held
+ */
+static struct lwis_event_subscriber_list *
+event_subscriber_list_find_rcu(struct lwis_top_device *lwis_top_dev, int64_t trigger_event_id)
+{
+	struct lwis_event_subscriber_list *list;
+	hash_for_each_possible_rcu (lwis_top_dev->event_subscribers, list, node,
+				    trigger_event_id) {
+		if (list->trigger_event_id == trigger_event_id) {
+			return list;
+		}
+	}
+	return NULL;
+}
+
 static struct lwis_event_subscriber_list *event_subscriber_list_create(struct lwis_device *lwis_dev,
 								       int64_t trigger_event_id)
 {
 	struct lwis_top_device *lwis_top_dev = (struct lwis_top_device *)lwis_dev;
+	unsigned long flags;
 	struct lwis_event_subscriber_list *event_subscriber_list =
 		kmalloc(sizeof(struct lwis_event_subscriber_list), GFP_KERNEL);
 	if (!event_subscriber_list) {
@@ -111,7 +147,10 @@ static struct lwis_event_subscriber_list *event_subscriber_list_create(struct lw
 	}
 	event_subscriber_list->trigger_event_id = trigger_event_id;
 	INIT_LIST_HEAD(&event_subscriber_list->list);
-	hash_add(lwis_top_dev->event_subscribers, &event_subscriber_list->node, trigger_event_id);
+	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
+	hash_add_rcu(lwis_top_dev->event_subscribers, &event_subscriber_list->node,
+		     trigger_event_id);
+	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 	return event_subscriber_list;
 }
 
@@ -123,43 +162,52 @@ event_subscriber_list_find_or_create(struct lwis_device *lwis_dev, int64_t trigg
 	return (list == NULL) ? event_subscriber_list_create(lwis_dev, trigger_event_id) : list;
 }
 
-static void subscribe_tasklet_func(unsigned long data)
+static void subscribe_forward_event(struct lwis_top_device *lwis_top_dev,
+				    struct lwis_trigger_event_info *trigger_event)
 {
-	struct lwis_top_device *lwis_top_dev = (struct lwis_top_device *)data;
-	struct lwis_trigger_event_info *trigger_event;
-	struct lwis_event_subscribe_info *subscribe_info;
-	struct list_head *it_sub, *it_sub_tmp;
 	struct lwis_event_subscriber_list *event_subscriber_list;
-	struct list_head *it_event_subscriber, *it_event_subscriber_tmp;
-	unsigned long flags;
+	struct lwis_event_subscribe_info *subscribe_info;
 
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	list_for_each_safe (it_sub, it_sub_tmp, &lwis_top_dev->emitted_event_list_tasklet) {
-		trigger_event = list_entry(it_sub, struct lwis_trigger_event_info, node);
-		list_del(&trigger_event->node);
-		event_subscriber_list = event_subscriber_list_find((struct lwis_device *)data,
-								   trigger_event->trigger_event_id);
-		if (!event_subscriber_list || list_empty(&event_subscriber_list->list)) {
-			dev_err(lwis_top_dev->base_dev.dev,
-				"Failed to find event subscriber list for %llx\n",
-				trigger_event->trigger_event_id);
-			kfree(trigger_event);
-			continue;
+	rcu_read_lock();
+	event_subscriber_list =
+		event_subscriber_list_find_rcu(lwis_top_dev, trigger_event->trigger_event_id);
+	/* The last subscriber may be gone since the event was queued */
+	if (event_subscriber_list) {
+		list_for_each_entry_rcu (subscribe_info, &event_subscriber_list->list, list_node) {
+			/* Notify subscriber an event is happening, in this context
+			 * if the subscriber opted in */
+			lwis_device_external_event_emit(
+				subscribe_info->subscriber_dev, trigger_event->trigger_event_id,
+				trigger_event->trigger_event_count,
+				trigger_event->trigger_event_timestamp,
+				/*in_irq=*/subscribe_info->subscriber_dev->direct_external_events);
 		}
-		list_for_each_safe (it_event_subscriber, it_event_subscriber_tmp,
-				    &event_subscriber_list->list) {
-			subscribe_info = list_entry(it_event_subscriber,
-						    struct lwis_event_subscribe_info, list_node);
-			/* Notify subscriber an event is happening */
-			lwis_device_external_event_emit(subscribe_info->subscriber_dev,
-							trigger_event->trigger_event_id,
-							trigger_event->trigger_event_count,
-							trigger_event->trigger_event_timestamp,
-							false);
+	}
+	rcu_read_unlock();
+}
+
+static void subscribe_tasklet_func(unsigned long data)
+{
+	struct lwis_top_device *lwis_top_dev = (struct lwis_top_device *)data;
+	struct lwis_trigger_event_ring *ring;
+	struct lwis_trigger_event_info trigger_event;
+	unsigned int head, tail;
+	int cpu;
+
+	/* Events are forwarded in order per CPU, the CPUs are drained one after
+	 * the other */
+	for_each_possible_cpu (cpu) {
+		ring = per_cpu_ptr(lwis_top_dev->trigger_event_rings, cpu);
+		tail = ring->tail;
+		head = smp_load_acquire(&ring->head);
+		while (tail != head) {
+			trigger_event = ring->events[tail % TRIGGER_EVENT_RING_SIZE];
+			/* Hand the slot back before forwarding, which may take a while */
+			smp_store_release(&ring->tail, ++tail);
+			subscribe_forward_event(lwis_top_dev, &trigger_event);
+			head = smp_load_acquire(&ring->head);
 		}
-		kfree(trigger_event);
 	}
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 }
 
 static void lwis_top_event_notify(struct lwis_device *lwis_dev, int64_t trigger_event_id,
@@ -167,22 +215,29 @@ static void lwis_top_event_notify(struct lwis_device *lwis_dev, int64_t trigger_
 				  bool in_irq)
 {
 	struct lwis_top_device *lwis_top_dev = (struct lwis_top_device *)lwis_dev;
+	struct lwis_trigger_event_ring *ring;
+	struct lwis_trigger_event_info *trigger_event;
 	unsigned long flags;
-
-	struct lwis_trigger_event_info *trigger_event =
-		kmalloc(sizeof(struct lwis_trigger_event_info), GFP_ATOMIC);
-	if (trigger_event == NULL) {
-		dev_err(lwis_top_dev->base_dev.dev, "Allocate trigger_event_info failed");
+	unsigned int head;
+
+	/* Keep the producer of this CPU's ring unique */
+	local_irq_save(flags);
+	ring = this_cpu_ptr(lwis_top_dev->trigger_event_rings);
+	head = ring->head;
+	if (head - smp_load_acquire(&ring->tail) >= TRIGGER_EVENT_RING_SIZE) {
+		local_irq_restore(flags);
+		dev_err_ratelimited(lwis_top_dev->base_dev.dev,
+				    "Trigger event ring full, dropped event %llx\n",
+				    trigger_event_id);
+		tasklet_schedule(&lwis_top_dev->subscribe_tasklet);
 		return;
 	}
-
-	INIT_LIST_HEAD(&trigger_event->node);
+	trigger_event = &ring->events[head % TRIGGER_EVENT_RING_SIZE];
 	trigger_event->trigger_event_id = trigger_event_id;
 	trigger_event->trigger_event_count = trigger_event_count;
 	trigger_event->trigger_event_timestamp = trigger_event_timestamp;
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	list_add_tail(&trigger_event->node, &lwis_top_dev->emitted_event_list_tasklet);
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
+	smp_store_release(&ring->head, head + 1);
+	local_irq_restore(flags);
 	/* Schedule deferred subscribed events */
 	tasklet_schedule(&lwis_top_dev->subscribe_tasklet);
 }
@@ -240,9 +295,9 @@ static int lwis_top_event_subscribe(struct lwis_device *lwis_dev, int64_t trigge
 	new_subscription->event_id = trigger_event_id;
 	new_subscription->subscriber_dev = lwis_subscriber_dev;
 	new_subscription->trigger_dev = lwis_trigger_dev;
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	list_add_tail(&new_subscription->list_node, &event_subscriber_list->list);
 	new_subscription->event_subscriber_list = event_subscriber_list;
+	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
+	list_add_tail_rcu(&new_subscription->list_node, &event_subscriber_list->list);
 	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 	dev_info(lwis_dev->dev, "Subscribe event: %llx, trigger device: %s, subscriber device: %s",
 		 trigger_event_id, lwis_trigger_dev->name, lwis_subscriber_dev->name);
@@ -264,7 +319,6 @@ static int lwis_top_event_unsubscribe(struct lwis_device *lwis_dev, int64_t trig
 	struct lwis_event_subscribe_info *subscribe_info = NULL;
 	struct lwis_event_subscriber_list *event_subscriber_list;
 	struct list_head *it_event_subscriber, *it_event_subscriber_tmp;
-	struct lwis_trigger_event_info *pending_event, *n;
 	unsigned long flags;
 	bool has_subscriber = false;
 
@@ -288,38 +342,36 @@ static int lwis_top_event_unsubscribe(struct lwis_device *lwis_dev, int64_t trig
 				trigger_event_id, subscribe_info->trigger_dev->name,
 				subscribe_info->subscriber_dev->name);
 			trigger_dev = subscribe_info->trigger_dev;
-			list_del(&subscribe_info->list_node);
+			list_del_rcu(&subscribe_info->list_node);
 			if (list_empty(&subscribe_info->event_subscriber_list->list)) {
-				/* Clear pending events */
-				list_for_each_entry_safe (pending_event, n,
-							  &lwis_top_dev->emitted_event_list_tasklet,
-							  node) {
-					if (pending_event->trigger_event_id == trigger_event_id) {
-						list_del(&pending_event->node);
-						kfree(pending_event);
-					}
-				}
-				hash_del(&subscribe_info->event_subscriber_list->node);
-				kfree(subscribe_info->event_subscriber_list);
-				kfree(subscribe_info);
+				/* Events still pending for the trigger are dropped by the
+				 * tasklet once the list is gone */
+				hash_del_rcu(&subscribe_info->event_subscriber_list->node);
+				kfree_rcu(subscribe_info->event_subscriber_list, rcu);
+				kfree_rcu(subscribe_info, rcu);
 				spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 				lwis_device_event_update_subscriber(trigger_dev, trigger_event_id,
 								    has_subscriber);
 				return 0;
 			}
-			kfree(subscribe_info);
+			kfree_rcu(subscribe_info, rcu);
 		}
 	}
 	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 	return 0;
 }
 
-static void lwis_top_event_subscribe_init(struct lwis_top_device *lwis_top_dev)
+static int lwis_top_event_subscribe_init(struct lwis_top_device *lwis_top_dev)
 {
 	hash_init(lwis_top_dev->event_subscribers);
-	INIT_LIST_HEAD(&lwis_top_dev->emitted_event_list_tasklet);
+	lwis_top_dev->trigger_event_rings = alloc_percpu(struct lwis_trigger_event_ring);
+	if (!lwis_top_dev->trigger_event_rings) {
+		dev_err(lwis_top_dev->base_dev.dev, "Failed to allocate trigger event rings\n");
+		return -ENOMEM;
+	}
 	tasklet_init(&lwis_top_dev->subscribe_tasklet, subscribe_tasklet_func,
 		     (unsigned long)lwis_top_dev);
+	return 0;
 }
 
 static void lwis_top_event_subscribe_clear(struct lwis_device *lwis_dev)
@@ -329,33 +381,26 @@ static void lwis_top_event_subscribe_clear(struct lwis_device *lwis_dev)
 	struct list_head *it_event_subscriber, *it_event_subscriber_tmp;
 	struct lwis_event_subscribe_info *subscribe_info;
 	struct hlist_node *tmp;
-	struct lwis_trigger_event_info *pending_event, *n;
 	int i;
 	unsigned long flags;
 
 	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	/* Clean up subscription table */
+	/* Clean up subscription table, pending events get dropped by the
+	 * tasklet as they no longer have subscribers */
 	hash_for_each_safe (lwis_top_dev->event_subscribers, i, tmp, event_subscriber_list, node) {
 		list_for_each_safe (it_event_subscriber, it_event_subscriber_tmp,
 				    &event_subscriber_list->list) {
 			subscribe_info = list_entry(it_event_subscriber,
 						    struct lwis_event_subscribe_info, list_node);
 			/* Delete the node from the hash table */
-			list_del(&subscribe_info->list_node);
+			list_del_rcu(&subscribe_info->list_node);
 			if (list_empty(&subscribe_info->event_subscriber_list->list)) {
-				hash_del(&subscribe_info->event_subscriber_list->node);
-				kfree(subscribe_info->event_subscriber_list);
+				hash_del_rcu(&subscribe_info->event_subscriber_list->node);
+				kfree_rcu(subscribe_info->event_subscriber_list, rcu);
 			}
-			kfree(subscribe_info);
+			kfree_rcu(subscribe_info, rcu);
 		}
 	}
-
-	/* Clean up emitted event list */
-	list_for_each_entry_safe (pending_event, n, &lwis_top_dev->emitted_event_list_tasklet,
-				  node) {
-		list_del(&pending_event->node);
-		kfree(pending_event);
-	}
 	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 }
 
@@ -365,6 +410,8 @@ static void lwis_top_event_subscribe_release(struct lwis_device *lwis_dev)
 	lwis_top_event_subscribe_clear(lwis_dev);
 	/* Clean up tasklet process */
 	tasklet_kill(&lwis_top_dev->subscribe_tasklet);
+	free_percpu(lwis_top_dev->trigger_event_rings);
+	lwis_top_dev->trigger_event_rings = NULL;
 }
 
 static int lwis_top_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
@@ -476,6 +523,10 @@ static int lwis_top_device_probe(struct platform_device *plat_dev)
 	top_dev->base_dev.vops = top_vops;
 	top_dev->base_dev.subscribe_ops = top_subscribe_ops;
 
+	/* Associated kworker threads are created on first open */
+	lwis_init_kthread_workers(&top_dev->base_dev, "lwis_top_trans_kthread",
+				  "lwis_top_prd_io_kthread");
+
 	/* Call the base device probe function */
 	ret = lwis_base_probe(&top_dev->base_dev, plat_dev);
 	if (ret) {
@@ -491,13 +542,8 @@ static int lwis_top_device_probe(struct platform_device *plat_dev)
 		goto error_probe;
 	}
 
-	lwis_top_event_subscribe_init(top_dev);
-
-	/* Create associated kworker threads */
-	ret = lwis_create_kthread_workers(&top_dev->base_dev, "lwis_top_trans_kthread",
-					 "lwis_top_prd_io_kthread");
+	ret = lwis_top_event_subscribe_init(top_dev);
 	if (ret) {
-		dev_err(top_dev->base_dev.dev, "Failed to create lwis_top_kthread");
 		lwis_base_unprobe(&top_dev->base_dev);
 		goto error_probe;
 	}
@@ -522,6 +568,7 @@ static struct platform_driver lwis_driver = {
 		.name = LWIS_DRIVER_NAME,
 		.owner = THIS_MODULE,
 		.of_match_table = lwis_id_match,
+		.probe_type = PROBE_PREFER_ASYNCHRONOUS,
 	},
 };
 
@@ -540,6 +587,7 @@ static struct platform_driver lwis_driver = { .probe = lwis_top_device_probe,
 					      .driver = {
 						      .name = LWIS_DRIVER_NAME,
 						      .owner = THIS_MODULE,
+						      .probe_type = PROBE_PREFER_ASYNCHRONOUS,
 					      } };
 #endif /* CONFIG_OF */
 
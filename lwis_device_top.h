@@ -15,6 +15,8 @@
 
 #define SCRATCH_MEMORY_SIZE 16
 
+struct lwis_trigger_event_ring;
+
 /*
  *  struct lwis_top_device
  *  "Derived" lwis_device struct, with added top device related elements.
@@ -30,7 +32,8 @@ struct lwis_top_device {
 
 	/* Subscription tasklet */
 	struct tasklet_struct subscribe_tasklet;
-	struct list_head emitted_event_list_tasklet;
+	/* Trigger events pending for the tasklet, one ring per CPU */
+	struct lwis_trigger_event_ring __percpu *trigger_event_rings;
 };
 
 int lwis_top_device_deinit(void);
@@ -0,0 +1,390 @@
+/*
+ * Google LWIS DMA Buffer Pool
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-dma-pool: " fmt
+
+#include "lwis_dma_pool.h"
+
+#include <linux/dma-mapping.h>
+#include <linux/fs.h>
+#include <linux/highmem.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
+#include <linux/shrinker.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#include "lwis_commands.h"
+#include "lwis_platform_dma.h"
+
+/* Bytes of buffers kept by the pool, still referenced by userspace or not */
+#define DMA_POOL_MAX_BYTES SZ_128M
+/* Interval of the checks of the buffers still referenced by userspace */
+#define DMA_POOL_REAP_INTERVAL_MS 100
+/* Allocation flags of the buffers that are not interchangeable */
+#define DMA_POOL_KEY_FLAGS (LWIS_DMA_BUFFER_CACHED | LWIS_DMA_BUFFER_CONTIGUOUS)
+
+struct lwis_dma_pool {
+	struct mutex lock;
+	/* Buffers freed by their client but still referenced, through their fd
+	 * or a mapping, oldest first */
+	struct list_head pending;
+	/* Buffers only referenced by the pool, oldest first */
+	struct list_head idle;
+	int num_idle;
+	/* Bytes of the buffers of both lists, and of the one being zeroed */
+	size_t total_bytes;
+	/* Zeroes the idle buffers and moves the pending ones once released */
+	struct delayed_work work;
+	/* Releases idle buffers under memory pressure */
+	struct shrinker shrinker;
+	bool shrinker_registered;
+	/* Set on deinit, buffers are released right away from then on */
+	bool closed;
+	/* Device whose buffers are being dropped, not to be zeroed meanwhile */
+	struct device *removing_dev;
+};
+
+static struct lwis_dma_pool buffer_pool;
+
+static bool pool_flags_supported(unsigned int flags)
+{
+	/* Secure buffers cannot be zeroed by the CPU */
+	return !(flags & LWIS_DMA_BUFFER_SECURE);
+}
+
+static void pool_buffer_release(struct lwis_dma_pool_buffer *buffer)
+{
+	dma_buf_put(buffer->dma_buf);
+	kfree(buffer);
+}
+
+static void pool_buffers_release(struct list_head *buffers)
+{
+	struct lwis_dma_pool_buffer *buffer, *tmp;
+
+	list_for_each_entry_safe (buffer, tmp, buffers, node) {
+		list_del(&buffer->node);
+		pool_buffer_release(buffer);
+	}
+}
+
+static int pool_buffer_zero(struct lwis_dma_pool_buffer *buffer, struct device *dev)
+{
+	struct dma_buf_attachment *attachment;
+	struct sg_table *sg_table;
+	struct sg_page_iter piter;
+
+	attachment = dma_buf_attach(buffer->dma_buf, dev);
+	if (IS_ERR_OR_NULL(attachment)) {
+		pr_err("Could not attach dma buffer to zero it\n");
+		return -EINVAL;
+	}
+	sg_table = dma_buf_map_attachment(attachment, DMA_BIDIRECTIONAL);
+	if (IS_ERR_OR_NULL(sg_table)) {
+		pr_err("Could not map dma attachment to zero it\n");
+		dma_buf_detach(buffer->dma_buf, attachment);
+		return -EINVAL;
+	}
+	for_each_sgtable_page (sg_table, &piter, 0) {
+		clear_highpage(sg_page_iter_page(&piter));
+	}
+	/* Uncached buffers are accessed bypassing the CPU caches */
+	dma_sync_sgtable_for_device(dev, sg_table, DMA_TO_DEVICE);
+	dma_buf_unmap_attachment(attachment, sg_table, DMA_BIDIRECTIONAL);
+	dma_buf_detach(buffer->dma_buf, attachment);
+	return 0;
+}
+
+/* Moves the pending buffers no longer referenced by anyone else to the idle
+ * list. Calling this function requires holding the pool lock. */
+static void pool_reap_pending_locked(void)
+{
+	struct lwis_dma_pool_buffer *buffer, *tmp;
+
+	list_for_each_entry_safe (buffer, tmp, &buffer_pool.pending, node) {
+		if (file_count(buffer->dma_buf->file) == 1) {
+			list_move_tail(&buffer->node, &buffer_pool.idle);
+			buffer_pool.num_idle++;
+		}
+	}
+}
+
+/* Moves the oldest buffers to evicted until size more bytes fit in the pool.
+ * Calling this function requires holding the pool lock. */
+static void pool_evict_locked(size_t size, struct list_head *evicted)
+{
+	struct lwis_dma_pool_buffer *buffer;
+
+	while (buffer_pool.total_bytes + size > DMA_POOL_MAX_BYTES) {
+		if (!list_empty(&buffer_pool.idle)) {
+			buffer = list_first_entry(&buffer_pool.idle, struct lwis_dma_pool_buffer,
+						  node);
+			buffer_pool.num_idle--;
+		} else if (!list_empty(&buffer_pool.pending)) {
+			buffer = list_first_entry(&buffer_pool.pending,
+						  struct lwis_dma_pool_buffer, node);
+		} else {
+			return;
+		}
+		list_move_tail(&buffer->node, evicted);
+		buffer_pool.total_bytes -= buffer->dma_buf->size;
+	}
+}
+
+static void pool_work_func(struct work_struct *work)
+{
+	struct lwis_dma_pool_buffer *buffer;
+	struct lwis_dma_pool_buffer *it;
+	int ret;
+
+	mutex_lock(&buffer_pool.lock);
+	while (!buffer_pool.closed) {
+		pool_reap_pending_locked();
+		buffer = NULL;
+		list_for_each_entry (it, &buffer_pool.idle, node) {
+			if (!it->clean && it->dev != buffer_pool.removing_dev) {
+				buffer = it;
+				break;
+			}
+		}
+		if (!buffer) {
+			break;
+		}
+		list_del(&buffer->node);
+		buffer_pool.num_idle--;
+		mutex_unlock(&buffer_pool.lock);
+
+		ret = pool_buffer_zero(buffer, buffer->dev);
+
+		mutex_lock(&buffer_pool.lock);
+		if (ret || buffer_pool.closed) {
+			buffer_pool.total_bytes -= buffer->dma_buf->size;
+			mutex_unlock(&buffer_pool.lock);
+			pool_buffer_release(buffer);
+			mutex_lock(&buffer_pool.lock);
+			continue;
+		}
+		buffer->clean = true;
+		list_add_tail(&buffer->node, &buffer_pool.idle);
+		buffer_pool.num_idle++;
+	}
+	/* Check again later for the buffers userspace has not released yet */
+	if (!buffer_pool.closed && !list_empty(&buffer_pool.pending)) {
+		queue_delayed_work(system_unbound_wq, &buffer_pool.work,
+				   msecs_to_jiffies(DMA_POOL_REAP_INTERVAL_MS));
+	}
+	mutex_unlock(&buffer_pool.lock);
+}
+
+static unsigned long pool_shrinker_count(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	int count = READ_ONCE(buffer_pool.num_idle);
+
+	return count ? count : SHRINK_EMPTY;
+}
+
+static unsigned long pool_shrinker_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct lwis_dma_pool_buffer *buffer;
+	struct list_head evicted;
+	unsigned long freed = 0;
+
+	/* Allocating may be reclaiming memory with the lock held */
+	if (!mutex_trylock(&buffer_pool.lock)) {
+		return SHRINK_STOP;
+	}
+	INIT_LIST_HEAD(&evicted);
+	while (!list_empty(&buffer_pool.idle) && freed < sc->nr_to_scan) {
+		buffer = list_first_entry(&buffer_pool.idle, struct lwis_dma_pool_buffer, node);
+		list_move_tail(&buffer->node, &evicted);
+		buffer_pool.num_idle--;
+		buffer_pool.total_bytes -= buffer->dma_buf->size;
+		freed++;
+	}
+	mutex_unlock(&buffer_pool.lock);
+
+	pool_buffers_release(&evicted);
+	return freed ? freed : SHRINK_STOP;
+}
+
+void lwis_dma_pool_init(void)
+{
+	memset(&buffer_pool, 0, sizeof(buffer_pool));
+	mutex_init(&buffer_pool.lock);
+	INIT_LIST_HEAD(&buffer_pool.pending);
+	INIT_LIST_HEAD(&buffer_pool.idle);
+	INIT_DELAYED_WORK(&buffer_pool.work, pool_work_func);
+
+	buffer_pool.shrinker.count_objects = pool_shrinker_count;
+	buffer_pool.shrinker.scan_objects = pool_shrinker_scan;
+	buffer_pool.shrinker.seeks = DEFAULT_SEEKS;
+	/* Not fatal, the pool is then only bounded by DMA_POOL_MAX_BYTES */
+	buffer_pool.shrinker_registered = (register_shrinker(&buffer_pool.shrinker) == 0);
+	if (!buffer_pool.shrinker_registered) {
+		pr_warn("Failed to register DMA buffer pool shrinker\n");
+	}
+}
+
+/* Moves the buffers to be zeroed with dev to removed. Calling this function
+ * requires holding the pool lock. */
+static void pool_remove_device_locked(struct device *dev, struct list_head *removed)
+{
+	struct lwis_dma_pool_buffer *buffer, *tmp;
+
+	list_for_each_entry_safe (buffer, tmp, &buffer_pool.idle, node) {
+		if (buffer->dev == dev) {
+			list_move_tail(&buffer->node, removed);
+			buffer_pool.num_idle--;
+			buffer_pool.total_bytes -= buffer->dma_buf->size;
+		}
+	}
+	list_for_each_entry_safe (buffer, tmp, &buffer_pool.pending, node) {
+		if (buffer->dev == dev) {
+			list_move_tail(&buffer->node, removed);
+			buffer_pool.total_bytes -= buffer->dma_buf->size;
+		}
+	}
+}
+
+void lwis_dma_pool_device_remove(struct lwis_device *lwis_dev)
+{
+	struct device *dev = &lwis_dev->plat_dev->dev;
+	struct list_head removed;
+
+	INIT_LIST_HEAD(&removed);
+	mutex_lock(&buffer_pool.lock);
+	buffer_pool.removing_dev = dev;
+	pool_remove_device_locked(dev, &removed);
+	mutex_unlock(&buffer_pool.lock);
+
+	/* A buffer of the device may be getting zeroed, it is back in the idle
+	 * list once the work is done */
+	flush_delayed_work(&buffer_pool.work);
+
+	mutex_lock(&buffer_pool.lock);
+	pool_remove_device_locked(dev, &removed);
+	buffer_pool.removing_dev = NULL;
+	mutex_unlock(&buffer_pool.lock);
+
+	pool_buffers_release(&removed);
+}
+
+void lwis_dma_pool_deinit(void)
+{
+	struct list_head released;
+
+	INIT_LIST_HEAD(&released);
+	mutex_lock(&buffer_pool.lock);
+	buffer_pool.closed = true;
+	list_splice_init(&buffer_pool.idle, &released);
+	list_splice_tail_init(&buffer_pool.pending, &released);
+	buffer_pool.num_idle = 0;
+	buffer_pool.total_bytes = 0;
+	mutex_unlock(&buffer_pool.lock);
+
+	cancel_delayed_work_sync(&buffer_pool.work);
+	if (buffer_pool.shrinker_registered) {
+		unregister_shrinker(&buffer_pool.shrinker);
+		buffer_pool.shrinker_registered = false;
+	}
+	pool_buffers_release(&released);
+}
+
+struct dma_buf *lwis_dma_pool_alloc(struct lwis_device *lwis_dev, size_t len,
+				    unsigned int flags)
+{
+	struct lwis_dma_pool_buffer *buffer = NULL;
+	struct lwis_dma_pool_buffer *it;
+	struct dma_buf *dma_buf;
+	size_t size = PAGE_ALIGN(len);
+
+	if (!pool_flags_supported(flags)) {
+		return lwis_platform_dma_buffer_alloc(len, flags);
+	}
+
+	mutex_lock(&buffer_pool.lock);
+	pool_reap_pending_locked();
+	/* Zeroed buffers first, the others are zeroed below whatever the flags
+	 * as they hold data of their previous owner */
+	list_for_each_entry (it, &buffer_pool.idle, node) {
+		if (it->dma_buf->size != size || it->flags != (flags & DMA_POOL_KEY_FLAGS)) {
+			continue;
+		}
+		if (!buffer || it->clean) {
+			buffer = it;
+		}
+		if (buffer->clean) {
+			break;
+		}
+	}
+	if (buffer) {
+		list_del(&buffer->node);
+		buffer_pool.num_idle--;
+		buffer_pool.total_bytes -= size;
+	}
+	mutex_unlock(&buffer_pool.lock);
+
+	if (!buffer) {
+		return lwis_platform_dma_buffer_alloc(len, flags);
+	}
+	if (!buffer->clean && pool_buffer_zero(buffer, &lwis_dev->plat_dev->dev)) {
+		pool_buffer_release(buffer);
+		return lwis_platform_dma_buffer_alloc(len, flags);
+	}
+	/* The reference of the pool goes to the caller */
+	dma_buf = buffer->dma_buf;
+	kfree(buffer);
+	return dma_buf;
+}
+
+void lwis_dma_pool_free(struct lwis_device *lwis_dev, struct dma_buf *dma_buf,
+			unsigned int flags)
+{
+	struct lwis_dma_pool_buffer *buffer;
+	struct list_head evicted;
+
+	if (!pool_flags_supported(flags) || dma_buf->size > DMA_POOL_MAX_BYTES) {
+		dma_buf_put(dma_buf);
+		return;
+	}
+	buffer = kmalloc(sizeof(*buffer), GFP_KERNEL);
+	if (!buffer) {
+		dma_buf_put(dma_buf);
+		return;
+	}
+	buffer->dma_buf = dma_buf;
+	buffer->flags = flags & DMA_POOL_KEY_FLAGS;
+	buffer->dev = &lwis_dev->plat_dev->dev;
+	buffer->clean = false;
+
+	INIT_LIST_HEAD(&evicted);
+	mutex_lock(&buffer_pool.lock);
+	if (buffer_pool.closed || buffer->dev == buffer_pool.removing_dev) {
+		mutex_unlock(&buffer_pool.lock);
+		pool_buffer_release(buffer);
+		return;
+	}
+	pool_evict_locked(dma_buf->size, &evicted);
+	if (buffer_pool.total_bytes + dma_buf->size > DMA_POOL_MAX_BYTES) {
+		mutex_unlock(&buffer_pool.lock);
+		pool_buffers_release(&evicted);
+		pool_buffer_release(buffer);
+		return;
+	}
+	list_add_tail(&buffer->node, &buffer_pool.pending);
+	buffer_pool.total_bytes += dma_buf->size;
+	/* Zeroed in the background, as soon as userspace released it */
+	mod_delayed_work(system_unbound_wq, &buffer_pool.work, 0);
+	mutex_unlock(&buffer_pool.lock);
+
+	pool_buffers_release(&evicted);
+}
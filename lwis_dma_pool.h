@@ -0,0 +1,76 @@
+/*
+ * Google LWIS DMA Buffer Pool
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_DMA_POOL_H_
+#define LWIS_DMA_POOL_H_
+
+#include <linux/dma-buf.h>
+#include <linux/list.h>
+
+#include "lwis_device.h"
+
+/*
+ * Buffer allocated from the platform DMA heaps and handed back by a client,
+ * kept to serve a later allocation of the same size and flags.
+ * Holds a reference to the dma-buf.
+ */
+struct lwis_dma_pool_buffer {
+	struct dma_buf *dma_buf;
+	/* LWIS_DMA_BUFFER_CACHED and LWIS_DMA_BUFFER_CONTIGUOUS of the
+	 * allocation, the buffers of other flags are not interchangeable */
+	unsigned int flags;
+	/* Device attached to when zeroing the buffer */
+	struct device *dev;
+	/* Zeroed since it was last handed out */
+	bool clean;
+	struct list_head node;
+};
+
+/*
+ * lwis_dma_pool_init: Sets up the pool shared by all LWIS devices.
+ *
+ * Alloc: No
+ */
+void lwis_dma_pool_init(void);
+
+/*
+ * lwis_dma_pool_deinit: Releases the buffers of the pool, the buffers freed
+ * afterwards are released right away.
+ */
+void lwis_dma_pool_deinit(void);
+
+/*
+ * lwis_dma_pool_device_remove: Releases the buffers of the pool freed through
+ * the device, which zeroing them would use.
+ */
+void lwis_dma_pool_device_remove(struct lwis_device *lwis_dev);
+
+/*
+ * lwis_dma_pool_alloc: Allocates a DMA buffer of size of PAGE_ALIGN(len),
+ * reusing a buffer of the pool if any. Reused buffers are always zeroed, even
+ * with LWIS_DMA_BUFFER_UNINITIALIZED. Same as lwis_platform_dma_buffer_alloc
+ * otherwise.
+ *
+ * Alloc: Yes
+ * Returns: dma_buf on success, NULL or an ERR_PTR on error
+ */
+struct dma_buf *lwis_dma_pool_alloc(struct lwis_device *lwis_dev, size_t len,
+				    unsigned int flags);
+
+/*
+ * lwis_dma_pool_free: Drops the reference to a buffer of lwis_dma_pool_alloc,
+ * keeping it in the pool for reuse once no one else references it.
+ *
+ * Alloc: Yes
+ */
+void lwis_dma_pool_free(struct lwis_device *lwis_dev, struct dma_buf *dma_buf,
+			unsigned int flags);
+
+#endif /* LWIS_DMA_POOL_H_ */
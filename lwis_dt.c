@@ -19,16 +19,21 @@
 #include <linux/pinctrl/consumer.h>
 #include <linux/slab.h>
 
+#include "lwis_buffer.h"
 #include "lwis_clock.h"
 #include "lwis_device_dpm.h"
+#include "lwis_event.h"
 #include "lwis_gpio.h"
 #include "lwis_i2c.h"
 #include "lwis_ioreg.h"
+#include "lwis_reg_cache.h"
 #include "lwis_regulator.h"
 
 #define SHARED_STRING "shared-"
 #define PULSE_STRING "pulse-"
 
+#define DEFAULT_DMA_MIN_BATCH_BYTES 4096
+
 /* Uncomment this to help debug device tree parsing. */
 // #define LWIS_DT_DEBUG
 
@@ -391,12 +396,46 @@ static int parse_critical_irq_events(struct device_node *event_info, u64** irq_e
 	return critical_irq_events_num;
 }
 
+static int parse_interrupt_timestamp(struct lwis_device *lwis_dev,
+				     struct device_node *event_info, int index)
+{
+	int ret;
+	const char *source_name;
+	enum lwis_interrupt_timestamp_source source;
+	u64 timestamp_reg = 0;
+
+	/* Timestamps are taken at ISR entry by default */
+	if (of_property_read_string(event_info, "irq-timestamp-source", &source_name)) {
+		return 0;
+	}
+
+	if (strcmp(source_name, "entry") == 0) {
+		source = LWIS_INTERRUPT_TIMESTAMP_ENTRY;
+	} else if (strcmp(source_name, "counter") == 0) {
+		source = LWIS_INTERRUPT_TIMESTAMP_COUNTER;
+	} else if (strcmp(source_name, "register") == 0) {
+		source = LWIS_INTERRUPT_TIMESTAMP_REGISTER;
+		ret = of_property_read_u64(event_info, "irq-timestamp-reg", &timestamp_reg);
+		if (ret) {
+			pr_err("Error getting irq-timestamp-reg from dt: %d\n", ret);
+			return ret;
+		}
+	} else {
+		pr_err("Invalid irq-timestamp-source %s\n", source_name);
+		return -EINVAL;
+	}
+
+	return lwis_interrupt_set_timestamp_source(lwis_dev->irqs, index, source, timestamp_reg);
+}
+
 static int parse_interrupts(struct lwis_device *lwis_dev)
 {
 	int i;
 	int ret;
 	int count, event_infos_count;
 	const char *name;
+	bool threaded;
+	u32 cpu;
 	struct device_node *dev_node;
 	struct platform_device *plat_dev;
 	struct of_phandle_iterator it;
@@ -418,9 +457,14 @@ static int parse_interrupts(struct lwis_device *lwis_dev)
 		return PTR_ERR(lwis_dev->irqs);
 	}
 
+	threaded = of_property_read_bool(dev_node, "lwis,threaded-irq");
 	for (i = 0; i < count; ++i) {
 		of_property_read_string_index(dev_node, "interrupt-names", i, &name);
-		ret = lwis_interrupt_get(lwis_dev->irqs, i, (char *)name, plat_dev);
+		/* Optional CPU to pin each interrupt to, -1 for the platform default */
+		cpu = -1;
+		of_property_read_u32_index(dev_node, "interrupt-cpus", i, &cpu);
+		ret = lwis_interrupt_get(lwis_dev->irqs, i, (char *)name, plat_dev, threaded,
+					 (int)cpu);
 		if (ret) {
 			pr_err("Cannot set irq %s\n", name);
 			goto error_get_irq;
@@ -584,6 +628,17 @@ static int parse_interrupts(struct lwis_device *lwis_dev)
 			goto error_event_infos;
 		}
 
+		ret = parse_interrupt_timestamp(lwis_dev, event_info, i);
+		if (ret) {
+			pr_err("Error setting timestamp source for interrupt %d %d\n", i, ret);
+			if (critical_events) {
+				kfree(critical_events);
+			}
+			kfree(irq_events);
+			kfree(int_reg_bits);
+			goto error_event_infos;
+		}
+
 		of_node_put(event_info);
 		i++;
 		if (critical_events) {
@@ -682,6 +737,56 @@ static void parse_bitwidths(struct lwis_device *lwis_dev)
 	lwis_dev->native_value_bitwidth = value_bitwidth;
 }
 
+static enum lwis_device_power_sequence_type power_seq_type_from_string(const char *type)
+{
+	if (strcmp(type, "regulator") == 0) {
+		return LWIS_POWER_SEQ_TYPE_REGULATOR;
+	}
+	if (strcmp(type, "gpio") == 0) {
+		return LWIS_POWER_SEQ_TYPE_GPIO;
+	}
+	if (strcmp(type, "pinctrl") == 0) {
+		return LWIS_POWER_SEQ_TYPE_PINCTRL;
+	}
+	return LWIS_POWER_SEQ_TYPE_UNKNOWN;
+}
+
+/*
+ * Resolves the regulator and gpios each step of the power sequence acts on,
+ * so that powering up and down does not look them up by name every time.
+ * Steps that cannot be resolved are reported when they are executed.
+ */
+static void resolve_power_seq_list(struct lwis_device *lwis_dev,
+				   struct lwis_device_power_sequence_list *list)
+{
+	struct lwis_device_power_sequence_info *seq_info;
+	struct lwis_gpios_info *gpios_info;
+	int i, j;
+
+	for (i = 0; i < list->count; ++i) {
+		seq_info = &list->seq_info[i];
+		seq_info->regulator_index = -1;
+		seq_info->gpios_info = NULL;
+
+		if (seq_info->seq_type == LWIS_POWER_SEQ_TYPE_REGULATOR && lwis_dev->regulators) {
+			for (j = 0; j < lwis_dev->regulators->count; ++j) {
+				struct lwis_regulator *reg = &lwis_dev->regulators->reg[j];
+
+				if (reg->reg && strcmp(reg->name, seq_info->name) == 0) {
+					seq_info->regulator_index = j;
+					break;
+				}
+			}
+		} else if (seq_info->seq_type == LWIS_POWER_SEQ_TYPE_GPIO) {
+			gpios_info = lwis_gpios_get_info_by_name(lwis_dev->gpios_list,
+								 seq_info->name);
+			if (!IS_ERR(gpios_info)) {
+				seq_info->gpios_info = gpios_info;
+			}
+		}
+	}
+}
+
 static int parse_power_up_seqs(struct lwis_device *lwis_dev)
 {
 	struct device *dev;
@@ -740,9 +845,12 @@ static int parse_power_up_seqs(struct lwis_device *lwis_dev)
 		}
 		strlcpy(lwis_dev->power_up_sequence->seq_info[i].type, type,
 			LWIS_MAX_NAME_STRING_LEN);
-		if (strcmp(type, "gpio") == 0) {
+		lwis_dev->power_up_sequence->seq_info[i].seq_type =
+			power_seq_type_from_string(type);
+		if (lwis_dev->power_up_sequence->seq_info[i].seq_type == LWIS_POWER_SEQ_TYPE_GPIO) {
 			type_gpio_count++;
-		} else if (strcmp(type, "regulator") == 0) {
+		} else if (lwis_dev->power_up_sequence->seq_info[i].seq_type ==
+			   LWIS_POWER_SEQ_TYPE_REGULATOR) {
 			type_regulator_count++;
 		}
 
@@ -773,7 +881,8 @@ static int parse_power_up_seqs(struct lwis_device *lwis_dev)
 			struct lwis_gpios_info *gpios_info;
 			char *seq_item_name;
 
-			if (strcmp(lwis_dev->power_up_sequence->seq_info[i].type, "gpio") != 0) {
+			if (lwis_dev->power_up_sequence->seq_info[i].seq_type !=
+			    LWIS_POWER_SEQ_TYPE_GPIO) {
 				continue;
 			}
 
@@ -810,8 +919,8 @@ static int parse_power_up_seqs(struct lwis_device *lwis_dev)
 			struct device *dev;
 			char *seq_item_name;
 
-			if (strcmp(lwis_dev->power_up_sequence->seq_info[i].type,
-				   "regulator") != 0) {
+			if (lwis_dev->power_up_sequence->seq_info[i].seq_type !=
+			    LWIS_POWER_SEQ_TYPE_REGULATOR) {
 				continue;
 			}
 
@@ -827,6 +936,7 @@ static int parse_power_up_seqs(struct lwis_device *lwis_dev)
 		}
 	}
 
+	resolve_power_seq_list(lwis_dev, lwis_dev->power_up_sequence);
 	return 0;
 
 error_parse_power_up_seqs:
@@ -897,6 +1007,8 @@ static int parse_power_down_seqs(struct lwis_device *lwis_dev)
 		}
 		strlcpy(lwis_dev->power_down_sequence->seq_info[i].type, type,
 			LWIS_MAX_NAME_STRING_LEN);
+		lwis_dev->power_down_sequence->seq_info[i].seq_type =
+			power_seq_type_from_string(type);
 
 		ret = of_property_read_u32_index(dev_node, "power-down-seq-delays-us", i,
 						 &delay_us);
@@ -911,6 +1023,8 @@ static int parse_power_down_seqs(struct lwis_device *lwis_dev)
 	lwis_dev_power_seq_list_print(lwis_dev->power_down_sequence);
 #endif
 
+	/* Power down steps act on the resources acquired for power up */
+	resolve_power_seq_list(lwis_dev, lwis_dev->power_down_sequence);
 	lwis_dev->power_down_seqs_present = true;
 	return 0;
 
@@ -920,6 +1034,96 @@ error_parse_power_down_seqs:
 	return ret;
 }
 
+/* Registers counting the bytes read and written: <bid read-offset write-offset> */
+static int parse_bts_traffic_counters(struct lwis_device *lwis_dev)
+{
+	struct device_node *dev_node;
+	u32 counters[3];
+	int ret;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+	lwis_dev->bts_counters_present = false;
+	lwis_dev->bts_auto = NULL;
+
+	if (!of_find_property(dev_node, "bts-traffic-counters", NULL)) {
+		return 0;
+	}
+	ret = of_property_read_u32_array(dev_node, "bts-traffic-counters", counters,
+					 ARRAY_SIZE(counters));
+	if (ret) {
+		pr_err("bts-traffic-counters needs <bid read-offset write-offset>\n");
+		return ret;
+	}
+
+	lwis_dev->bts_counter_bid = counters[0];
+	lwis_dev->bts_read_counter_offset = counters[1];
+	lwis_dev->bts_write_counter_offset = counters[2];
+	lwis_dev->bts_counters_present = true;
+	return 0;
+}
+
+/* Register ranges saved across system suspend: <bid offset size-in-bytes>... */
+static int parse_suspend_save_ranges(struct lwis_device *lwis_dev)
+{
+	struct device_node *dev_node;
+	struct lwis_suspend_save_range *ranges;
+	u32 range[3];
+	int count;
+	int i, j;
+	int ret;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+	lwis_dev->num_suspend_save_ranges = 0;
+	lwis_dev->suspend_save_ranges = NULL;
+	lwis_dev->suspend_saved_enabled = 0;
+
+	count = of_property_count_u32_elems(dev_node, "suspend-save-ranges");
+	if (count <= 0) {
+		return 0;
+	}
+	if (count % ARRAY_SIZE(range) != 0) {
+		pr_err("suspend-save-ranges needs <bid offset size-in-bytes> triplets\n");
+		return -EINVAL;
+	}
+	count /= ARRAY_SIZE(range);
+
+	ranges = kcalloc(count, sizeof(*ranges), GFP_KERNEL);
+	if (!ranges) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < count; ++i) {
+		for (j = 0; j < ARRAY_SIZE(range); ++j) {
+			of_property_read_u32_index(dev_node, "suspend-save-ranges",
+						   i * ARRAY_SIZE(range) + j, &range[j]);
+		}
+		if (range[2] == 0) {
+			pr_err("Empty suspend-save-ranges entry %d\n", i);
+			ret = -EINVAL;
+			goto error_range;
+		}
+		ranges[i].bid = range[0];
+		ranges[i].offset = range[1];
+		ranges[i].size_in_bytes = range[2];
+		ranges[i].values = kzalloc(range[2], GFP_KERNEL);
+		if (!ranges[i].values) {
+			ret = -ENOMEM;
+			goto error_range;
+		}
+	}
+
+	lwis_dev->suspend_save_ranges = ranges;
+	lwis_dev->num_suspend_save_ranges = count;
+	return 0;
+
+error_range:
+	while (i-- > 0) {
+		kfree(ranges[i].values);
+	}
+	kfree(ranges);
+	return ret;
+}
+
 static int parse_pm_hibernation(struct lwis_device *lwis_dev)
 {
 	struct device_node *dev_node;
@@ -929,6 +1133,26 @@ static int parse_pm_hibernation(struct lwis_device *lwis_dev)
 
 	of_property_read_u32(dev_node, "pm-hibernation", &lwis_dev->pm_hibernation);
 
+	lwis_dev->power_linger_ms = 0;
+	of_property_read_u32(dev_node, "power-linger-ms", &lwis_dev->power_linger_ms);
+
+	return 0;
+}
+
+static int parse_event_queue_depth(struct lwis_device *lwis_dev)
+{
+	struct device_node *dev_node;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+	lwis_dev->event_queue_depth = 0;
+
+	of_property_read_u32(dev_node, "event-queue-depth", &lwis_dev->event_queue_depth);
+	if (lwis_dev->event_queue_depth > MAX_EVENT_QUEUE_DEPTH) {
+		pr_err("Event queue depth %u is larger than %d\n", lwis_dev->event_queue_depth,
+		       MAX_EVENT_QUEUE_DEPTH);
+		return -EINVAL;
+	}
+
 	return 0;
 }
 
@@ -939,10 +1163,82 @@ static int parse_access_mode(struct lwis_device *lwis_dev)
 	dev_node = lwis_dev->plat_dev->dev.of_node;
 
 	lwis_dev->is_read_only = of_property_read_bool(dev_node, "lwis,read-only");
+	lwis_dev->coalesce_io_entries = of_property_read_bool(dev_node, "lwis,coalesce-io-entries");
+	lwis_dev->direct_external_events =
+		of_property_read_bool(dev_node, "lwis,direct-external-events");
 
 	return 0;
 }
 
+static int parse_reg_cache(struct lwis_device *lwis_dev)
+{
+	struct device_node *dev_node;
+	struct lwis_reg_cache *cache;
+	int i;
+	int num_bids;
+	int num_range_elems;
+	u32 value;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+	lwis_dev->reg_cache = NULL;
+
+	if (!of_property_read_bool(dev_node, "lwis,shadow-cache")) {
+		return 0;
+	}
+
+	num_bids = of_property_count_u32_elems(dev_node, "shadow-cache-bids");
+	if (num_bids < 0) {
+		num_bids = 0;
+	}
+	/* Volatile ranges are <bid first-offset last-offset> triplets */
+	num_range_elems = of_property_count_u32_elems(dev_node, "shadow-cache-volatile-ranges");
+	if (num_range_elems < 0) {
+		num_range_elems = 0;
+	}
+	if (num_range_elems % 3) {
+		pr_err("shadow-cache-volatile-ranges must consist of triplets\n");
+		return -EINVAL;
+	}
+
+	cache = lwis_reg_cache_create(lwis_dev, num_bids, num_range_elems / 3);
+	if (IS_ERR(cache)) {
+		return PTR_ERR(cache);
+	}
+	for (i = 0; i < num_bids; ++i) {
+		of_property_read_u32_index(dev_node, "shadow-cache-bids", i, &value);
+		cache->bids[i] = value;
+	}
+	for (i = 0; i < num_range_elems / 3; ++i) {
+		of_property_read_u32_index(dev_node, "shadow-cache-volatile-ranges", i * 3, &value);
+		cache->volatile_ranges[i].bid = value;
+		of_property_read_u32_index(dev_node, "shadow-cache-volatile-ranges", i * 3 + 1,
+					   &value);
+		cache->volatile_ranges[i].start = value;
+		of_property_read_u32_index(dev_node, "shadow-cache-volatile-ranges", i * 3 + 2,
+					   &value);
+		cache->volatile_ranges[i].end = value;
+	}
+
+	return 0;
+}
+
+static int parse_enroll_cache(struct lwis_device *lwis_dev)
+{
+	struct device_node *dev_node;
+	u32 capacity = 0;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+	lwis_dev->enroll_cache = NULL;
+
+	/* Number of disenrolled buffers to keep mapped, 0 disables the cache */
+	of_property_read_u32(dev_node, "enroll-cache-size", &capacity);
+	if (capacity == 0) {
+		return 0;
+	}
+
+	return lwis_buffer_enroll_cache_create(lwis_dev, capacity);
+}
+
 static int parse_thread_priority(struct lwis_device *lwis_dev)
 {
 	struct device_node *dev_node;
@@ -959,6 +1255,80 @@ static int parse_thread_priority(struct lwis_device *lwis_dev)
 	return 0;
 }
 
+static int parse_cpu_list(struct lwis_device *lwis_dev, const char *prop, struct cpumask *cpus)
+{
+	struct device_node *dev_node;
+	int i;
+	int count;
+	u32 cpu;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+	cpumask_clear(cpus);
+
+	count = of_property_count_u32_elems(dev_node, prop);
+	for (i = 0; i < count; ++i) {
+		of_property_read_u32_index(dev_node, prop, i, &cpu);
+		if (cpu >= nr_cpu_ids || !cpu_possible(cpu)) {
+			pr_err("Invalid CPU %u in %s\n", cpu, prop);
+			return -EINVAL;
+		}
+		cpumask_set_cpu(cpu, cpus);
+	}
+
+	return 0;
+}
+
+static int parse_thread_affinity(struct lwis_device *lwis_dev)
+{
+	int ret;
+	struct device_node *dev_node;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+
+	ret = parse_cpu_list(lwis_dev, "transaction-thread-cpus",
+			     &lwis_dev->transaction_thread_cpus);
+	if (ret) {
+		return ret;
+	}
+	ret = parse_cpu_list(lwis_dev, "periodic-io-thread-cpus",
+			     &lwis_dev->periodic_io_thread_cpus);
+	if (ret) {
+		return ret;
+	}
+
+	lwis_dev->transaction_worker_per_client =
+		of_property_read_bool(dev_node, "transaction-worker-per-client");
+
+	return 0;
+}
+
+static int parse_allocator_reserve(struct lwis_device *lwis_dev)
+{
+	struct device_node *dev_node;
+	int count;
+	int i;
+
+	dev_node = lwis_dev->plat_dev->dev.of_node;
+	memset(lwis_dev->allocator_reserve, 0, sizeof(lwis_dev->allocator_reserve));
+
+	/* Free block counts of the 8K to 512K allocator pools, in that order */
+	count = of_property_count_u32_elems(dev_node, "allocator-reserve");
+	if (count <= 0) {
+		return 0;
+	}
+	if (count > LWIS_ALLOCATOR_NUM_POOLS) {
+		pr_err("allocator-reserve has %d entries, maximum is %d\n", count,
+		       LWIS_ALLOCATOR_NUM_POOLS);
+		return -EINVAL;
+	}
+	for (i = 0; i < count; ++i) {
+		of_property_read_u32_index(dev_node, "allocator-reserve", i,
+					   &lwis_dev->allocator_reserve[i]);
+	}
+
+	return 0;
+}
+
 static int parse_i2c_lock_group_id(struct lwis_i2c_device *i2c_dev)
 {
 	struct device_node *dev_node;
@@ -1089,13 +1459,55 @@ int lwis_base_parse_dt(struct lwis_device *lwis_dev)
 		return ret;
 	}
 
+	ret = parse_event_queue_depth(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing event queue depth\n");
+		return ret;
+	}
+
 	parse_access_mode(lwis_dev);
 	parse_thread_priority(lwis_dev);
 	parse_bitwidths(lwis_dev);
 
+	ret = parse_thread_affinity(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing thread affinity\n");
+		return ret;
+	}
+
+	ret = parse_reg_cache(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing shadow register cache\n");
+		return ret;
+	}
+
+	ret = parse_allocator_reserve(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing allocator reserve\n");
+		return ret;
+	}
+
+	ret = parse_enroll_cache(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing enroll cache\n");
+		return ret;
+	}
+
 	lwis_dev->bts_scenario_name = NULL;
 	of_property_read_string(dev_node, "bts-scenario", &lwis_dev->bts_scenario_name);
 
+	ret = parse_bts_traffic_counters(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing bts-traffic-counters\n");
+		return ret;
+	}
+
+	ret = parse_suspend_save_ranges(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing suspend-save-ranges\n");
+		return ret;
+	}
+
 	dev_node->data = lwis_dev;
 
 	pr_debug("Device tree entry [%s] - end\n", lwis_dev->name);
@@ -1142,9 +1554,12 @@ int lwis_ioreg_device_parse_dt(struct lwis_ioreg_device *ioreg_dev)
 {
 	struct device_node *dev_node;
 	int i;
+	int j;
 	int ret;
 	int blocks;
+	int count;
 	int reg_tuple_size;
+	u32 dma_min_bytes;
 	const char *name;
 
 	dev_node = ioreg_dev->base_dev.plat_dev->dev.of_node;
@@ -1171,9 +1586,71 @@ int lwis_ioreg_device_parse_dt(struct lwis_ioreg_device *ioreg_dev)
 		}
 	}
 
+	/* Blocks such as statistics or LUT windows that can be copied in bulk */
+	count = of_property_count_strings(dev_node, "wide-access-reg-names");
+	for (i = 0; i < count; ++i) {
+		of_property_read_string_index(dev_node, "wide-access-reg-names", i, &name);
+		for (j = 0; j < blocks; ++j) {
+			if (ioreg_dev->reg_list.block[j].name &&
+			    !strcmp(ioreg_dev->reg_list.block[j].name, name)) {
+				ioreg_dev->reg_list.block[j].wide_access = true;
+				break;
+			}
+		}
+		if (j == blocks) {
+			dev_warn(ioreg_dev->base_dev.dev, "Wide access block %s not found\n", name);
+		}
+	}
+
+	/* Blocks that need no ordering against the others, e.g. statistics
+	 * windows, accessed under their own lock instead of reg_rw_lock */
+	count = of_property_count_strings(dev_node, "independent-reg-names");
+	for (i = 0; i < count; ++i) {
+		of_property_read_string_index(dev_node, "independent-reg-names", i, &name);
+		for (j = 0; j < blocks && j < 64; ++j) {
+			if (ioreg_dev->reg_list.block[j].name &&
+			    !strcmp(ioreg_dev->reg_list.block[j].name, name)) {
+				ioreg_dev->base_dev.independent_block_mask |= BIT_ULL(j);
+				break;
+			}
+		}
+		if (j == blocks || j == 64) {
+			dev_warn(ioreg_dev->base_dev.dev, "Independent block %s not found\n", name);
+		}
+	}
+	if (hweight64(ioreg_dev->base_dev.independent_block_mask) > MAX_LOCKDEP_SUBCLASSES) {
+		dev_err(ioreg_dev->base_dev.dev, "At most %lu independent blocks are supported\n",
+			MAX_LOCKDEP_SUBCLASSES);
+		ret = -EINVAL;
+		goto error_ioreg;
+	}
+	if (ioreg_dev->base_dev.independent_block_mask) {
+		count = fls64(ioreg_dev->base_dev.independent_block_mask);
+		ioreg_dev->base_dev.block_locks = kcalloc(count, sizeof(struct mutex), GFP_KERNEL);
+		if (!ioreg_dev->base_dev.block_locks) {
+			ret = -ENOMEM;
+			goto error_ioreg;
+		}
+		for (i = 0; i < count; ++i) {
+			mutex_init(&ioreg_dev->base_dev.block_locks[i]);
+		}
+	}
+
+	/* Optional dmaengine channel for large batches, CPU copies otherwise */
+	if (of_property_match_string(dev_node, "dma-names", "batch") >= 0) {
+		dma_min_bytes = DEFAULT_DMA_MIN_BATCH_BYTES;
+		of_property_read_u32(dev_node, "dma-min-batch-bytes", &dma_min_bytes);
+		ret = lwis_ioreg_dma_get(ioreg_dev, "batch", dma_min_bytes);
+		if (ret) {
+			dev_warn(ioreg_dev->base_dev.dev,
+				 "Batch DMA channel unavailable, using CPU copies (%d)\n", ret);
+		}
+	}
+
 	return 0;
 
 error_ioreg:
+	ioreg_dev->base_dev.independent_block_mask = 0;
 	for (i = 0; i < blocks; ++i) {
 		lwis_ioreg_put_by_idx(ioreg_dev, i);
 	}
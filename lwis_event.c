@@ -11,15 +11,30 @@
 #define pr_fmt(fmt) KBUILD_MODNAME "-event: " fmt
 
 #include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/mempool.h>
+#include <linux/mm.h>
+#include <linux/sizes.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 
 #include "lwis_device.h"
+#include "lwis_device_dpm.h"
 #include "lwis_event.h"
+#include "lwis_periodic_io.h"
+#include "lwis_trace.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
 
-/* Maximum number of pending events in the event queues */
-#define MAX_NUM_PENDING_EVENTS 2048
+/* Maximum size of the record area of a client event ring */
+#define MAX_EVENT_RING_DATA_SIZE SZ_4M
+
+/* Maximum number of clients snapshotted from an event state when emitting,
+ * beyond which all the clients of the device are visited instead */
+#define MAX_NUM_EVENT_CLIENTS 16
+
+/* Largest span of event codes indexed directly by the device event state table */
+#define MAX_EVENT_STATE_TABLE_SIZE 1024
 
 /* Exposes the device id embedded in the event id */
 #define EVENT_OWNER_DEVICE_ID(x) ((x >> LWIS_EVENT_ID_EVENT_CODE_LEN) & 0xFFFF)
@@ -33,6 +48,9 @@
 		}								\
 	}
 
+static enum hrtimer_restart event_coalesce_timer_func(struct hrtimer *timer);
+static void event_coalesce_mask_work_func(struct work_struct *work);
+
 /*
  * lwis_client_event_state_find_locked: Looks through the provided client's
  * event state list and tries to find a lwis_client_event_state object with the
@@ -122,6 +140,19 @@ lwis_client_event_state_find_or_create(struct lwis_client *lwis_client, int64_t
 		 */
 		new_state->event_control.event_id = event_id;
 		new_state->event_control.flags = 0;
+		new_state->event_control.coalesce_count = 0;
+		new_state->event_control.coalesce_window_ns = 0;
+		new_state->event_control.decimation_factor = 0;
+		new_state->event_control.min_interval_ns = 0;
+		new_state->decimation_skip = 0;
+		new_state->last_queued_ns = 0;
+		new_state->client = lwis_client;
+		memset(&new_state->coalesced, 0, sizeof(new_state->coalesced));
+		new_state->coalesced_counter = 0;
+		hrtimer_init(&new_state->coalesce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+		new_state->coalesce_timer.function = event_coalesce_timer_func;
+		new_state->coalesce_masked = false;
+		INIT_WORK(&new_state->coalesce_mask_work, event_coalesce_mask_work_func);
 
 		/* Critical section for adding to the hash table */
 		spin_lock_irqsave(&lwis_client->event_lock, flags);
@@ -148,6 +179,26 @@ lwis_client_event_state_find_or_create(struct lwis_client *lwis_client, int64_t
 	}
 	return state;
 }
+
+/*
+ * event_state_table_slot_locked: Returns the slot of event_id in the direct
+ * index of the device event states, NULL if event_id is not indexed.
+ *
+ * Assumes: lwis_dev->lock is locked
+ * Alloc: No
+ */
+static struct lwis_device_event_state **event_state_table_slot_locked(struct lwis_device *lwis_dev,
+								      int64_t event_id)
+{
+	int64_t index = event_id - lwis_dev->event_state_table_base;
+
+	if (!lwis_dev->event_state_table || index < 0 ||
+	    index >= lwis_dev->event_state_table_size) {
+		return NULL;
+	}
+	return &lwis_dev->event_state_table[index];
+}
+
 /*
  * lwis_device_event_state_find_locked: Looks through the provided device's
  * event state list and tries to find a lwis_device_event_state object with the
@@ -162,11 +213,19 @@ lwis_device_event_state_find_locked(struct lwis_device *lwis_dev, int64_t event_
 {
 	/* Our hash iterator */
 	struct lwis_device_event_state *p;
+	struct lwis_device_event_state **slot = event_state_table_slot_locked(lwis_dev, event_id);
+
+	if (slot && *slot) {
+		return *slot;
+	}
 
 	/* Iterate through the hash bucket for this event_id */
 	hash_for_each_possible (lwis_dev->event_states, p, node, event_id) {
 		/* If it's indeed the right one, return it */
 		if (p->event_id == event_id) {
+			if (slot) {
+				*slot = p;
+			}
 			return p;
 		}
 	}
@@ -174,6 +233,74 @@ lwis_device_event_state_find_locked(struct lwis_device *lwis_dev, int64_t event_
 	return NULL;
 }
 
+int lwis_device_event_state_table_reserve(struct lwis_device *lwis_dev, int64_t event_id)
+{
+	struct lwis_device_event_state **new_table;
+	struct lwis_device_event_state **old_table;
+	int64_t base;
+	int64_t end;
+	int64_t old_base;
+	int old_size;
+	unsigned long flags;
+
+	/* Only the events generated by this device itself are indexed, whatever
+	 * their flags, e.g. LWIS_HW_IRQ_EVENT_FLAG */
+	if (EVENT_OWNER_DEVICE_ID(event_id) != lwis_dev->id) {
+		return 0;
+	}
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	old_base = lwis_dev->event_state_table_base;
+	old_size = lwis_dev->event_state_table_size;
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+
+	if (old_size > 0 && event_id >= old_base && event_id < old_base + old_size) {
+		return 0;
+	}
+	base = (old_size > 0) ? min(old_base, event_id) : event_id;
+	end = (old_size > 0) ? max(old_base + old_size, event_id + 1) : event_id + 1;
+	if (end - base > MAX_EVENT_STATE_TABLE_SIZE) {
+		/* Too sparse to be indexed, the hash table still finds it */
+		return 0;
+	}
+
+	new_table = kcalloc(end - base, sizeof(*new_table), GFP_KERNEL);
+	if (!new_table) {
+		dev_err(lwis_dev->dev, "Could not allocate the event state table\n");
+		return -ENOMEM;
+	}
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	old_table = lwis_dev->event_state_table;
+	if (lwis_dev->event_state_table_base != old_base ||
+	    lwis_dev->event_state_table_size != old_size) {
+		/* Resized concurrently, let the lookups fill the slots back */
+		old_base = lwis_dev->event_state_table_base;
+		old_size = 0;
+	}
+	if (old_table && old_size > 0) {
+		memcpy(&new_table[old_base - base], old_table, old_size * sizeof(*new_table));
+	}
+	lwis_dev->event_state_table = new_table;
+	lwis_dev->event_state_table_base = base;
+	lwis_dev->event_state_table_size = end - base;
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+
+	kfree(old_table);
+	return 0;
+}
+
+bool lwis_device_event_state_table_covers(struct lwis_device *lwis_dev, int64_t event_id)
+{
+	unsigned long flags;
+	bool covered;
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	covered = event_state_table_slot_locked(lwis_dev, event_id) != NULL;
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+	return covered;
+}
+
 /*
  * save_device_event_state_to_history_locked: Saves the emitted events in a
  * history buffer for better debugability.
@@ -221,10 +348,27 @@ struct lwis_device_event_state *lwis_device_event_state_find(struct lwis_device
 	return state;
 }
 
+int64_t lwis_device_event_counter_get(struct lwis_device *lwis_dev, int64_t event_id)
+{
+	struct lwis_device_event_state *state;
+	int64_t event_counter = -ENOENT;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	state = lwis_device_event_state_find_locked(lwis_dev, event_id);
+	if (state) {
+		event_counter = state->event_counter;
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+
+	return event_counter;
+}
+
 struct lwis_device_event_state *lwis_device_event_state_find_or_create(struct lwis_device *lwis_dev,
 								       int64_t event_id)
 {
 	struct lwis_device_event_state *new_state;
+	struct lwis_device_event_state **slot;
 	/* Flags for IRQ disable */
 	unsigned long flags;
 
@@ -247,6 +391,7 @@ struct lwis_device_event_state *lwis_device_event_state_find_or_create(struct lw
 		new_state->enable_counter = 0;
 		new_state->event_counter = 0;
 		new_state->has_subscriber = false;
+		INIT_LIST_HEAD(&new_state->clients);
 
 		/* Critical section for adding to the hash table */
 		spin_lock_irqsave(&lwis_dev->lock, flags);
@@ -259,6 +404,10 @@ struct lwis_device_event_state *lwis_device_event_state_find_or_create(struct lw
 		if (state == NULL) {
 			/* Let's add the new state object */
 			hash_add(lwis_dev->event_states, &new_state->node, event_id);
+			slot = event_state_table_slot_locked(lwis_dev, event_id);
+			if (slot) {
+				*slot = new_state;
+			}
 			state = new_state;
 		} else {
 			/* Ok, we now suddenly have a valid state so we need to
@@ -371,12 +520,74 @@ static int check_event_control_flags(struct lwis_client *lwis_client, int64_t ev
 	return 0;
 }
 
+static int check_event_control_coalesce(struct lwis_client *lwis_client,
+					const struct lwis_event_control_v2 *control)
+{
+	const uint64_t flags = control->flags;
+
+	if (!(flags & LWIS_EVENT_CONTROL_FLAG_COALESCE)) {
+		if (flags & LWIS_EVENT_CONTROL_FLAG_COALESCE_MASK_IRQ) {
+			dev_err(lwis_client->lwis_dev->dev,
+				"COALESCE_MASK_IRQ without COALESCE for event: 0x%llx\n",
+				control->event_id);
+			return -EINVAL;
+		}
+		return 0;
+	}
+
+	if (control->coalesce_window_ns < 0 ||
+	    (control->coalesce_count == 0 && control->coalesce_window_ns == 0)) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"Invalid coalescing count %u window %lld for event: 0x%llx\n",
+			control->coalesce_count, control->coalesce_window_ns, control->event_id);
+		return -EINVAL;
+	}
+
+	if ((flags & LWIS_EVENT_CONTROL_FLAG_COALESCE_MASK_IRQ) &&
+	    (control->coalesce_count == 0 || control->coalesce_window_ns == 0)) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"COALESCE_MASK_IRQ needs both a count and a window for event: 0x%llx\n",
+			control->event_id);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * event_coalesce_reset: Drops the occurrences aggregated so far, stops the
+ * coalescing window and unmasks the IRQ if the window masked it.
+ *
+ * Assumes: Process context
+ * Locks: lwis_client->event_lock
+ */
+static void event_coalesce_reset(struct lwis_client_event_state *state)
+{
+	struct lwis_client *lwis_client = state->client;
+	unsigned long flags;
+	bool was_masked;
+
+	hrtimer_cancel(&state->coalesce_timer);
+	cancel_work_sync(&state->coalesce_mask_work);
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	state->coalesced.count = 0;
+	was_masked = state->coalesce_masked;
+	state->coalesce_masked = false;
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	if (was_masked && lwis_client->lwis_dev->irqs) {
+		lwis_interrupt_event_mask(lwis_client->lwis_dev->irqs,
+					  state->event_control.event_id, /*masked=*/false);
+	}
+}
+
 int lwis_client_event_control_set(struct lwis_client *lwis_client,
-				  const struct lwis_event_control *control)
+				  const struct lwis_event_control_v2 *control)
 {
 	int ret = 0;
 	struct lwis_client_event_state *state;
 	uint64_t old_flags, new_flags;
+	unsigned long flags;
 	/* Find, or create, a client event state objcet for this event_id */
 	state = lwis_client_event_state_find_or_create(lwis_client, control->event_id);
 	if (IS_ERR_OR_NULL(state)) {
@@ -385,6 +596,18 @@ int lwis_client_event_control_set(struct lwis_client *lwis_client,
 		return -ENOMEM;
 	}
 
+	ret = check_event_control_coalesce(lwis_client, control);
+	if (ret) {
+		return ret;
+	}
+
+	if (control->min_interval_ns < 0) {
+		dev_err(lwis_client->lwis_dev->dev, "Invalid min interval %lld for event: 0x%llx\n",
+			control->min_interval_ns, control->event_id);
+		return -EINVAL;
+	}
+
+	/* Validate everything before applying any of the new configuration */
 	old_flags = state->event_control.flags;
 	new_flags = control->flags;
 	if (old_flags != new_flags) {
@@ -393,7 +616,32 @@ int lwis_client_event_control_set(struct lwis_client *lwis_client,
 		if (ret) {
 			return ret;
 		}
+	}
+
+	if (state->event_control.decimation_factor != control->decimation_factor ||
+	    state->event_control.min_interval_ns != control->min_interval_ns) {
+		/* Decimation starts over, so the next occurrence is queued */
+		spin_lock_irqsave(&lwis_client->event_lock, flags);
+		state->event_control.decimation_factor = control->decimation_factor;
+		state->event_control.min_interval_ns = control->min_interval_ns;
+		state->decimation_skip = 0;
+		state->last_queued_ns = 0;
+		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+	}
+
+	if (((old_flags ^ new_flags) &
+	     (LWIS_EVENT_CONTROL_FLAG_COALESCE | LWIS_EVENT_CONTROL_FLAG_COALESCE_MASK_IRQ)) ||
+	    state->event_control.coalesce_count != control->coalesce_count ||
+	    state->event_control.coalesce_window_ns != control->coalesce_window_ns) {
+		/* Coalescing starts over with the new configuration */
+		event_coalesce_reset(state);
+		spin_lock_irqsave(&lwis_client->event_lock, flags);
+		state->event_control.coalesce_count = control->coalesce_count;
+		state->event_control.coalesce_window_ns = control->coalesce_window_ns;
+		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+	}
 
+	if (old_flags != new_flags) {
 		state->event_control.flags = new_flags;
 		ret = lwis_device_event_flags_updated(lwis_client->lwis_dev, control->event_id,
 						      old_flags, new_flags);
@@ -403,6 +651,18 @@ int lwis_client_event_control_set(struct lwis_client *lwis_client,
 			return ret;
 		}
 
+		if ((old_flags ^ new_flags) & LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE) {
+			ret = lwis_device_event_client_update(
+				lwis_client->lwis_dev, lwis_client, control->event_id,
+				LWIS_EVENT_CLIENT_INTEREST_QUEUE,
+				new_flags & LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE);
+			if (ret) {
+				dev_err(lwis_client->lwis_dev->dev,
+					"Updating event clients failed: %d\n", ret);
+				return ret;
+			}
+		}
+
 		if (EVENT_OWNER_DEVICE_ID(control->event_id) != lwis_client->lwis_dev->id) {
 			if (new_flags != 0) {
 				ret = lwis_client_event_subscribe(lwis_client, control->event_id);
@@ -424,7 +684,7 @@ int lwis_client_event_control_set(struct lwis_client *lwis_client,
 }
 
 int lwis_client_event_control_get(struct lwis_client *lwis_client, int64_t event_id,
-				  struct lwis_event_control *control)
+				  struct lwis_event_control_v2 *control)
 {
 	struct lwis_client_event_state *state;
 
@@ -436,10 +696,145 @@ int lwis_client_event_control_get(struct lwis_client *lwis_client, int64_t event
 	}
 
 	control->flags = state->event_control.flags;
+	control->coalesce_count = state->event_control.coalesce_count;
+	control->coalesce_window_ns = state->event_control.coalesce_window_ns;
+	control->decimation_factor = state->event_control.decimation_factor;
+	control->min_interval_ns = state->event_control.min_interval_ns;
 
 	return 0;
 }
 
+/* Event entries kept in reserve, so that emitting from IRQ context does not
+ * fail under memory pressure */
+#define EVENT_ENTRY_POOL_MIN 64
+/* Pending events with payloads of up to this size come from the pending
+ * event pool, larger ones are allocated individually */
+#define PENDING_EVENT_POOL_PAYLOAD_SIZE 256
+#define PENDING_EVENT_POOL_MIN 32
+
+static struct kmem_cache *event_entry_cache;
+static mempool_t *event_entry_pool;
+static struct kmem_cache *pending_event_cache;
+static mempool_t *pending_event_pool;
+
+int lwis_event_caches_init(void)
+{
+	event_entry_cache = KMEM_CACHE(lwis_event_entry, 0);
+	if (!event_entry_cache) {
+		goto error_event_entry_cache;
+	}
+	event_entry_pool = mempool_create_slab_pool(EVENT_ENTRY_POOL_MIN, event_entry_cache);
+	if (!event_entry_pool) {
+		goto error_event_entry_pool;
+	}
+	pending_event_cache = kmem_cache_create(
+		"lwis_pending_event",
+		sizeof(struct lwis_event_entry) + PENDING_EVENT_POOL_PAYLOAD_SIZE, 0, 0, NULL);
+	if (!pending_event_cache) {
+		goto error_pending_event_cache;
+	}
+	pending_event_pool =
+		mempool_create_slab_pool(PENDING_EVENT_POOL_MIN, pending_event_cache);
+	if (!pending_event_pool) {
+		goto error_pending_event_pool;
+	}
+	return 0;
+
+error_pending_event_pool:
+	kmem_cache_destroy(pending_event_cache);
+error_pending_event_cache:
+	mempool_destroy(event_entry_pool);
+error_event_entry_pool:
+	kmem_cache_destroy(event_entry_cache);
+error_event_entry_cache:
+	pr_err("Failed to create event entry caches\n");
+	return -ENOMEM;
+}
+
+void lwis_event_caches_deinit(void)
+{
+	mempool_destroy(pending_event_pool);
+	kmem_cache_destroy(pending_event_cache);
+	mempool_destroy(event_entry_pool);
+	kmem_cache_destroy(event_entry_cache);
+}
+
+static void event_payload_release(struct kref *kref)
+{
+	kfree(container_of(kref, struct lwis_event_payload, refcount));
+}
+
+/*
+ * event_payload_create: Allocates a payload to be shared among the entries
+ * of all the clients an event is emitted to. The caller owns the initial
+ * reference.
+ *
+ * Alloc: Yes (GFP_ATOMIC)
+ * Returns: payload on success, NULL if out of memory
+ */
+static struct lwis_event_payload *event_payload_create(void *payload, size_t payload_size)
+{
+	struct lwis_event_payload *shared_payload;
+
+	shared_payload = kmalloc(sizeof(struct lwis_event_payload) + payload_size, GFP_ATOMIC);
+	if (!shared_payload) {
+		return NULL;
+	}
+	kref_init(&shared_payload->refcount);
+	shared_payload->size = payload_size;
+	memcpy(shared_payload->data, payload, payload_size);
+
+	return shared_payload;
+}
+
+static void event_payload_put(struct lwis_event_payload *shared_payload)
+{
+	if (shared_payload) {
+		kref_put(&shared_payload->refcount, event_payload_release);
+	}
+}
+
+/*
+ * event_entry_create: Allocates an event entry. If shared_payload is given,
+ * the entry takes a reference to it instead of copying the payload.
+ *
+ * Alloc: Yes (GFP_ATOMIC)
+ * Returns: event entry on success, NULL if out of memory
+ */
+static struct lwis_event_entry *event_entry_create(int64_t event_id, int64_t event_counter,
+						   int64_t timestamp,
+						   struct lwis_event_payload *shared_payload)
+{
+	struct lwis_event_entry *event;
+
+	event = mempool_alloc(event_entry_pool, GFP_ATOMIC);
+	if (!event) {
+		return NULL;
+	}
+
+	event->event_info.event_id = event_id;
+	event->event_info.event_counter = event_counter;
+	event->event_info.timestamp_ns = timestamp;
+	if (shared_payload) {
+		kref_get(&shared_payload->refcount);
+		event->shared_payload = shared_payload;
+		event->event_info.payload_size = shared_payload->size;
+		event->event_info.payload_buffer = shared_payload->data;
+	} else {
+		event->shared_payload = NULL;
+		event->event_info.payload_size = 0;
+		event->event_info.payload_buffer = NULL;
+	}
+
+	return event;
+}
+
+void lwis_event_entry_free(struct lwis_event_entry *event)
+{
+	event_payload_put(event->shared_payload);
+	mempool_free(event, event_entry_pool);
+}
+
 static int event_queue_get_front(struct lwis_client *lwis_client, struct list_head *event_queue,
 				 size_t *event_queue_size, bool should_remove_entry,
 				 struct lwis_event_entry **event_out)
@@ -469,7 +864,7 @@ static int event_queue_get_front(struct lwis_client *lwis_client, struct list_he
 		/* The caller did not request ownership of the event,
 		 * and this is a "pop" operation, we can just free the
 		 * event here. */
-		kfree(event);
+		lwis_event_entry_free(event);
 	}
 	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
 
@@ -487,7 +882,7 @@ static void event_queue_clear(struct lwis_client *lwis_client, struct list_head
 	list_for_each_safe (it_event, it_tmp, event_queue) {
 		event = list_entry(it_event, struct lwis_event_entry, node);
 		list_del(&event->node);
-		kfree(event);
+		lwis_event_entry_free(event);
 	}
 	*event_queue_size = 0;
 	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
@@ -536,108 +931,386 @@ void lwis_client_error_event_queue_clear(struct lwis_client *lwis_client)
 			  &lwis_client->error_event_queue_size);
 }
 
-/*
- * lwis_client_event_push_back: Inserts new event into the client event queue
- * to be later consumed by userspace. Takes ownership of *event (does not copy,
- * will be freed on the other side)
- *
- * Also wakes up any readers for this client (select() callers, etc.)
- *
- * Locks: lwis_client->event_lock
- *
- * Alloc: No
- * Returns: 0 on success
- */
-static int lwis_client_event_push_back(struct lwis_client *lwis_client,
-				       struct lwis_event_entry *event)
+bool lwis_client_event_queues_have_events(struct lwis_client *lwis_client)
 {
+	bool has_events;
 	unsigned long flags;
-	int64_t timestamp_diff;
-	int64_t current_timestamp;
-	struct lwis_event_entry *first_event;
 
-	if (!event) {
-		dev_err(lwis_client->lwis_dev->dev, "NULL event provided\n");
-		return -EINVAL;
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	has_events = !list_empty(&lwis_client->error_event_queue) ||
+		     !list_empty(&lwis_client->event_queue);
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	return has_events;
+}
+
+int lwis_client_event_ring_setup(struct lwis_client *lwis_client, size_t data_size,
+				 size_t *mmap_size)
+{
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	struct lwis_event_ring *ring;
+	unsigned long flags;
+
+	if (lwis_client->event_ring) {
+		dev_err(lwis_dev->dev, "Event ring is already set up\n");
+		return -EBUSY;
 	}
 
-	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	if (data_size == 0 || data_size > MAX_EVENT_RING_DATA_SIZE) {
+		dev_err(lwis_dev->dev, "Invalid event ring size %zu, maximum is %d\n", data_size,
+			MAX_EVENT_RING_DATA_SIZE);
+		return -EINVAL;
+	}
 
-	if (lwis_client->event_queue_size >= MAX_NUM_PENDING_EVENTS) {
-		/* Get the front of the list */
-		first_event =
-			list_first_entry(&lwis_client->event_queue, struct lwis_event_entry, node);
-		current_timestamp = lwis_get_time();
-		timestamp_diff = ktime_sub(current_timestamp, first_event->event_info.timestamp_ns);
-		lwis_dev_err_ratelimited(lwis_client->lwis_dev->dev,
-			"First event in queue ID: 0x%llx, current timestamp %lld ns, diff: %lld ns\n",
-			event->event_info.event_id, current_timestamp, timestamp_diff);
-		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
-		/* Send an error event to userspace to handle the overflow */
-		lwis_device_error_event_emit(lwis_client->lwis_dev,
-					     LWIS_ERROR_EVENT_ID_EVENT_QUEUE_OVERFLOW,
-					     /*payload=*/NULL, /*payload_size=*/0);
-		return -EOVERFLOW;
+	ring = kzalloc(sizeof(struct lwis_event_ring), GFP_KERNEL);
+	if (!ring) {
+		dev_err(lwis_dev->dev, "Failed to allocate event ring\n");
+		return -ENOMEM;
 	}
 
-	list_add_tail(&event->node, &lwis_client->event_queue);
-	lwis_client->event_queue_size++;
+	/* Header takes the first page, the record area starts on the next. */
+	ring->data_size = roundup_pow_of_two(max_t(size_t, data_size, PAGE_SIZE));
+	ring->mmap_size = PAGE_SIZE + ring->data_size;
+	ring->vaddr = vmalloc_user(ring->mmap_size);
+	if (!ring->vaddr) {
+		dev_err(lwis_dev->dev, "Failed to allocate %zu bytes for event ring\n",
+			ring->mmap_size);
+		kfree(ring);
+		return -ENOMEM;
+	}
+	ring->header = ring->vaddr;
+	ring->data = (uint8_t *)ring->vaddr + PAGE_SIZE;
+	ring->header->data_offset = PAGE_SIZE;
+	ring->header->data_size = ring->data_size;
 
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	lwis_client->event_ring = ring;
 	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
 
-	wake_up_interruptible(&lwis_client->event_wait_queue);
-
+	*mmap_size = ring->mmap_size;
 	return 0;
 }
 
-static int lwis_client_error_event_push_back(struct lwis_client *lwis_client,
-					     struct lwis_event_entry *event)
+int lwis_client_event_ring_mmap(struct lwis_client *lwis_client, struct vm_area_struct *vma)
 {
-	unsigned long flags;
+	struct lwis_event_ring *ring = lwis_client->event_ring;
 
-	if (!event) {
-		pr_err("NULL event provided\n");
-		return -EINVAL;
+	if (!ring) {
+		dev_err(lwis_client->lwis_dev->dev, "Event ring is not set up\n");
+		return -ENOENT;
 	}
 
-	spin_lock_irqsave(&lwis_client->event_lock, flags);
-
-	if (lwis_client->error_event_queue_size >= MAX_NUM_PENDING_EVENTS) {
-		dev_warn_ratelimited(
-			lwis_client->lwis_dev->dev,
-			"Failed to push to error event queue, exceeded size limit of %d\n",
-			MAX_NUM_PENDING_EVENTS);
-		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
-		return -EOVERFLOW;
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > ring->mmap_size) {
+		dev_err(lwis_client->lwis_dev->dev, "Invalid event ring mapping\n");
+		return -EINVAL;
 	}
 
-	list_add_tail(&event->node, &lwis_client->error_event_queue);
-	lwis_client->error_event_queue_size++;
+	return remap_vmalloc_range(vma, ring->vaddr, 0);
+}
 
-	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+bool lwis_client_event_ring_has_events(struct lwis_client *lwis_client)
+{
+	bool has_events = false;
+	unsigned long flags;
 
-	wake_up_interruptible(&lwis_client->event_wait_queue);
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	if (lwis_client->event_ring) {
+		has_events = lwis_client->event_ring->head !=
+			     READ_ONCE(lwis_client->event_ring->header->tail);
+	}
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
 
-	return 0;
+	return has_events;
 }
 
-int lwis_client_event_states_clear(struct lwis_client *lwis_client)
+void lwis_client_event_ring_free(struct lwis_client *lwis_client)
 {
-	/* Our hash table iterator */
-	struct lwis_client_event_state *state;
-	/* Temporary vars for hash table traversal */
-	struct hlist_node *n;
-	int i;
-	struct list_head *it_event, *it_tmp;
-	/* Events to be cleared */
-	struct list_head events_to_clear;
-	/* Flags for irqsave */
+	struct lwis_event_ring *ring;
 	unsigned long flags;
 
-	INIT_LIST_HEAD(&events_to_clear);
-	/* Disable IRQs and lock the event lock */
 	spin_lock_irqsave(&lwis_client->event_lock, flags);
-	/* Iterate over the entire hash table */
+	ring = lwis_client->event_ring;
+	lwis_client->event_ring = NULL;
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	if (ring) {
+		vfree(ring->vaddr);
+		kfree(ring);
+	}
+}
+
+/*
+ * event_ring_push_locked: Writes the event as a record into the event ring.
+ * The tail is written by userspace, so it is only used to compute the free
+ * space and never to compute an address.
+ *
+ * Assumes: lwis_client->event_lock is locked
+ * Alloc: No
+ * Returns: 0 on success, -EOVERFLOW if the ring is full
+ */
+static int event_ring_push_locked(struct lwis_event_ring *ring, struct lwis_event_info *info)
+{
+	struct lwis_event_ring_record *record;
+	const size_t record_size = ALIGN(sizeof(struct lwis_event_ring_record) + info->payload_size,
+					 LWIS_EVENT_RING_RECORD_ALIGN);
+	const uint64_t mask = ring->data_size - 1;
+	uint64_t tail = smp_load_acquire(&ring->header->tail);
+	uint64_t head = ring->head;
+	size_t contiguous = ring->data_size - (head & mask);
+	size_t skip = (contiguous < record_size) ? contiguous : 0;
+
+	if (record_size > ring->data_size) {
+		return -E2BIG;
+	}
+
+	if (head - tail > ring->data_size ||
+	    head - tail + skip + record_size > ring->data_size) {
+		ring->header->num_dropped++;
+		return -EOVERFLOW;
+	}
+
+	/* Consumer skips to the start by itself if a header does not fit. */
+	if (skip >= sizeof(struct lwis_event_ring_record)) {
+		record = (struct lwis_event_ring_record *)(ring->data + (head & mask));
+		record->record_size = skip;
+		record->payload_size = 0;
+		record->flags = LWIS_EVENT_RING_RECORD_FLAG_PADDING;
+	}
+	head += skip;
+
+	record = (struct lwis_event_ring_record *)(ring->data + (head & mask));
+	record->event_id = info->event_id;
+	record->event_counter = info->event_counter;
+	record->timestamp_ns = info->timestamp_ns;
+	record->record_size = record_size;
+	record->payload_size = info->payload_size;
+	record->flags = 0;
+	if (info->payload_size > 0) {
+		memcpy((uint8_t *)record + sizeof(struct lwis_event_ring_record),
+		       info->payload_buffer, info->payload_size);
+	}
+
+	ring->head = head + record_size;
+	/* Make the record visible before publishing the new head */
+	smp_store_release(&ring->header->head, ring->head);
+
+	return 0;
+}
+
+/*
+ * event_queue_find_last_locked: Returns the entry of event_id closest to the
+ * back of the client queue, NULL if none is queued.
+ *
+ * Locks: lwis_client->event_lock
+ */
+static struct lwis_event_entry *event_queue_find_last_locked(struct lwis_client *lwis_client,
+							     int64_t event_id)
+{
+	struct lwis_event_entry *event;
+
+	list_for_each_entry_reverse (event, &lwis_client->event_queue, node) {
+		if (event->event_info.event_id == event_id) {
+			return event;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * lwis_client_event_push_back: Inserts new event into the client event queue
+ * to be later consumed by userspace. Takes ownership of *event (does not copy,
+ * will be freed on the other side)
+ *
+ * Also wakes up any readers for this client (select() callers, etc.)
+ *
+ * If the client has set up an event ring, the event is copied into the ring
+ * and freed here instead.
+ *
+ * A full queue is handled as the LWIS_EVENT_CONTROL_FLAG_OVERFLOW_* flags in
+ * control_flags ask, the new event being dropped by default.
+ *
+ * Locks: lwis_client->event_lock
+ *
+ * Alloc: No
+ * Returns: 0 on success, including an event coalesced into a queued entry
+ */
+static int lwis_client_event_push_back(struct lwis_client *lwis_client,
+				       struct lwis_event_entry *event, uint64_t control_flags)
+{
+	unsigned long flags;
+	int64_t timestamp_diff;
+	int64_t current_timestamp;
+	struct lwis_event_entry *first_event;
+	struct lwis_event_entry *queued_event;
+	struct list_head dropped_events;
+	int num_dropped = 0;
+	int ret;
+
+	if (!event) {
+		dev_err(lwis_client->lwis_dev->dev, "NULL event provided\n");
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+
+	if (lwis_client->event_ring) {
+		ret = event_ring_push_locked(lwis_client->event_ring, &event->event_info);
+		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+		if (ret) {
+			lwis_dev_err_ratelimited(lwis_client->lwis_dev->dev,
+				"Failed to write event ID 0x%llx to event ring (%d)\n",
+				event->event_info.event_id, ret);
+			if (ret == -EOVERFLOW) {
+				atomic64_inc(&lwis_client->stats.events_dropped);
+				lwis_device_error_event_emit(lwis_client->lwis_dev,
+							     LWIS_ERROR_EVENT_ID_EVENT_QUEUE_OVERFLOW,
+							     /*payload=*/NULL, /*payload_size=*/0);
+			}
+			return ret;
+		}
+		/* The record has been copied into the ring */
+		atomic64_inc(&lwis_client->stats.events_queued);
+		lwis_event_entry_free(event);
+		wake_up_interruptible(&lwis_client->event_wait_queue);
+		return 0;
+	}
+
+	if (lwis_client->event_queue_size >= lwis_client->event_queue_depth &&
+	    (control_flags & LWIS_EVENT_CONTROL_FLAG_OVERFLOW_COALESCE)) {
+		queued_event =
+			event_queue_find_last_locked(lwis_client, event->event_info.event_id);
+		if (queued_event) {
+			/* The queued entry stands for the new occurrence too */
+			queued_event->event_info.event_counter = event->event_info.event_counter;
+			queued_event->event_info.timestamp_ns = event->event_info.timestamp_ns;
+			spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+			lwis_event_entry_free(event);
+			return 0;
+		}
+	}
+
+	INIT_LIST_HEAD(&dropped_events);
+	if (control_flags & LWIS_EVENT_CONTROL_FLAG_OVERFLOW_DROP_OLDEST) {
+		/* The depth may have been lowered below the queue size */
+		while (lwis_client->event_queue_size >= lwis_client->event_queue_depth) {
+			first_event = list_first_entry(&lwis_client->event_queue,
+						       struct lwis_event_entry, node);
+			list_move_tail(&first_event->node, &dropped_events);
+			lwis_client->event_queue_size--;
+			num_dropped++;
+		}
+	}
+
+	if (lwis_client->event_queue_size >= lwis_client->event_queue_depth) {
+		/* Get the front of the list */
+		first_event =
+			list_first_entry(&lwis_client->event_queue, struct lwis_event_entry, node);
+		current_timestamp = lwis_get_time();
+		timestamp_diff = ktime_sub(current_timestamp, first_event->event_info.timestamp_ns);
+		lwis_dev_err_ratelimited(lwis_client->lwis_dev->dev,
+			"First event in queue ID: 0x%llx, current timestamp %lld ns, diff: %lld ns\n",
+			event->event_info.event_id, current_timestamp, timestamp_diff);
+		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+		atomic64_inc(&lwis_client->stats.events_dropped);
+		/* Send an error event to userspace to handle the overflow */
+		lwis_device_error_event_emit(lwis_client->lwis_dev,
+					     LWIS_ERROR_EVENT_ID_EVENT_QUEUE_OVERFLOW,
+					     /*payload=*/NULL, /*payload_size=*/0);
+		return -EOVERFLOW;
+	}
+
+	list_add_tail(&event->node, &lwis_client->event_queue);
+	lwis_client->event_queue_size++;
+	atomic64_inc(&lwis_client->stats.events_queued);
+	if (lwis_client->event_queue_size >
+	    atomic64_read(&lwis_client->stats.event_queue_high_water)) {
+		atomic64_set(&lwis_client->stats.event_queue_high_water,
+			     lwis_client->event_queue_size);
+	}
+
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	wake_up_interruptible(&lwis_client->event_wait_queue);
+
+	if (num_dropped > 0) {
+		list_for_each_entry_safe (first_event, queued_event, &dropped_events, node) {
+			list_del(&first_event->node);
+			lwis_event_entry_free(first_event);
+		}
+		atomic64_add(num_dropped, &lwis_client->stats.events_dropped);
+		/* Userspace still learns that the queue overflowed */
+		lwis_device_error_event_emit(lwis_client->lwis_dev,
+					     LWIS_ERROR_EVENT_ID_EVENT_QUEUE_OVERFLOW,
+					     /*payload=*/NULL, /*payload_size=*/0);
+	}
+
+	return 0;
+}
+
+int lwis_client_event_queue_depth_set(struct lwis_client *lwis_client, uint32_t depth)
+{
+	unsigned long flags;
+
+	if (depth == 0 || depth > MAX_EVENT_QUEUE_DEPTH) {
+		dev_err(lwis_client->lwis_dev->dev, "Invalid event queue depth %u, max %d\n",
+			depth, MAX_EVENT_QUEUE_DEPTH);
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	lwis_client->event_queue_depth = depth;
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+	return 0;
+}
+
+static int lwis_client_error_event_push_back(struct lwis_client *lwis_client,
+					     struct lwis_event_entry *event)
+{
+	unsigned long flags;
+
+	if (!event) {
+		pr_err("NULL event provided\n");
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+
+	if (lwis_client->error_event_queue_size >= MAX_NUM_PENDING_EVENTS) {
+		dev_warn_ratelimited(
+			lwis_client->lwis_dev->dev,
+			"Failed to push to error event queue, exceeded size limit of %d\n",
+			MAX_NUM_PENDING_EVENTS);
+		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+		return -EOVERFLOW;
+	}
+
+	list_add_tail(&event->node, &lwis_client->error_event_queue);
+	lwis_client->error_event_queue_size++;
+
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	wake_up_interruptible(&lwis_client->event_wait_queue);
+
+	return 0;
+}
+
+int lwis_client_event_states_clear(struct lwis_client *lwis_client)
+{
+	/* Our hash table iterator */
+	struct lwis_client_event_state *state;
+	/* Temporary vars for hash table traversal */
+	struct hlist_node *n;
+	int i;
+	struct list_head *it_event, *it_tmp;
+	/* Events to be cleared */
+	struct list_head events_to_clear;
+	/* Flags for irqsave */
+	unsigned long flags;
+
+	INIT_LIST_HEAD(&events_to_clear);
+	/* Disable IRQs and lock the event lock */
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	/* Iterate over the entire hash table */
 	hash_for_each_safe (lwis_client->event_states, i, n, state, node) {
 		/* Delete the node from the client's hash table */
 		hash_del(&state->node);
@@ -651,10 +1324,15 @@ int lwis_client_event_states_clear(struct lwis_client *lwis_client)
 	list_for_each_safe (it_event, it_tmp, &events_to_clear) {
 		state = list_entry(it_event, struct lwis_client_event_state, clearance_node);
 		list_del(&state->clearance_node);
+		/* Stop coalescing before the event gets disabled */
+		event_coalesce_reset(state);
 		/* Update the device state with zero flags */
 		lwis_device_event_flags_updated(lwis_client->lwis_dev,
 						state->event_control.event_id,
 						state->event_control.flags, 0);
+		lwis_device_event_client_update(lwis_client->lwis_dev, lwis_client,
+						state->event_control.event_id,
+						LWIS_EVENT_CLIENT_INTEREST_QUEUE, /*enable=*/false);
 		/* Free the object */
 		kfree(state);
 	}
@@ -665,10 +1343,19 @@ int lwis_client_event_states_clear(struct lwis_client *lwis_client)
 int lwis_device_event_states_clear_locked(struct lwis_device *lwis_dev)
 {
 	struct lwis_device_event_state *state;
+	struct lwis_device_event_state **slot;
 	struct hlist_node *n;
 	int i;
 
 	hash_for_each_safe (lwis_dev->event_states, i, n, state, node) {
+		/* Keep the states that other clients are still using */
+		if (!list_empty(&state->clients)) {
+			continue;
+		}
+		slot = event_state_table_slot_locked(lwis_dev, state->event_id);
+		if (slot) {
+			*slot = NULL;
+		}
 		hash_del(&state->node);
 		kfree(state);
 	}
@@ -728,6 +1415,14 @@ int lwis_device_event_flags_updated(struct lwis_device *lwis_dev, int64_t event_
 		}
 	}
 
+	/* Let the ISR know which bits to mask after they first trigger */
+	if (((old_flags ^ new_flags) & LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE) &&
+	    (event_id & LWIS_TRANSACTION_EVENT_FLAG) == 0 && lwis_dev->irqs) {
+		lwis_interrupt_event_enable_once(
+			lwis_dev->irqs, event_id,
+			new_flags & LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE);
+	}
+
 	/* Reset sw event counter when it's going to disable */
 	if ((event_id & LWIS_TRANSACTION_EVENT_FLAG ||
 	     event_id & LWIS_TRANSACTION_FAILURE_EVENT_FLAG) &&
@@ -812,17 +1507,369 @@ int lwis_device_event_enable(struct lwis_device *lwis_dev, int64_t event_id, boo
 	return err ? err : ret;
 }
 
-static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t event_id,
-				       void *payload, size_t payload_size,
-				       struct list_head *pending_events, bool in_irq)
+/*
+ * event_clients_snapshot_locked: Copies the clients interested in the event
+ * so they can be visited after lwis_dev->lock is released.
+ *
+ * Assumes: lwis_dev->lock is locked
+ * Alloc: No
+ * Returns: number of clients, -E2BIG if there are more than
+ *          MAX_NUM_EVENT_CLIENTS
+ */
+static int event_clients_snapshot_locked(struct lwis_device_event_state *state,
+					 struct lwis_client **clients)
+{
+	struct lwis_device_event_client *event_client;
+	int num_clients = 0;
+
+	list_for_each_entry (event_client, &state->clients, node) {
+		if (num_clients >= MAX_NUM_EVENT_CLIENTS) {
+			return -E2BIG;
+		}
+		clients[num_clients++] = event_client->client;
+	}
+
+	return num_clients;
+}
+
+/*
+ * event_decimate_locked: Applies decimation_factor and min_interval_ns to an
+ * occurrence of the event. Returns true if the occurrence is to be skipped.
+ *
+ * Assumes: lwis_client->event_lock is locked
+ */
+static bool event_decimate_locked(struct lwis_client_event_state *state, int64_t timestamp)
+{
+	const struct lwis_event_control_v2 *control = &state->event_control;
+
+	if (control->min_interval_ns > 0 && state->last_queued_ns != 0 &&
+	    timestamp - state->last_queued_ns < control->min_interval_ns) {
+		return true;
+	}
+
+	if (control->decimation_factor > 1) {
+		if (state->decimation_skip > 0) {
+			state->decimation_skip--;
+			return true;
+		}
+		state->decimation_skip = control->decimation_factor - 1;
+	}
+
+	state->last_queued_ns = timestamp;
+	return false;
+}
+
+/*
+ * event_coalesce_locked: Aggregates an occurrence of a coalesced event.
+ * Returns true, with the aggregate in *coalesced, if the event is due to be
+ * queued to the client.
+ *
+ * Assumes: lwis_client->event_lock is locked
+ */
+static bool event_coalesce_locked(struct lwis_client_event_state *state, int64_t event_counter,
+				  int64_t timestamp, struct lwis_event_coalesced_payload *coalesced)
+{
+	const struct lwis_event_control_v2 *control = &state->event_control;
+
+	if (state->coalesced.count == 0) {
+		state->coalesced.first_timestamp_ns = timestamp;
+		/* The window is counted from the first occurrence */
+		if (control->coalesce_window_ns > 0 && !hrtimer_active(&state->coalesce_timer)) {
+			hrtimer_start(&state->coalesce_timer,
+				      ns_to_ktime(control->coalesce_window_ns), HRTIMER_MODE_REL);
+		}
+	}
+	state->coalesced.count++;
+	state->coalesced.last_timestamp_ns = timestamp;
+	state->coalesced_counter = event_counter;
+
+	if (control->coalesce_count == 0 || state->coalesced.count < control->coalesce_count) {
+		return false;
+	}
+
+	*coalesced = state->coalesced;
+	state->coalesced.count = 0;
+	if (control->flags & LWIS_EVENT_CONTROL_FLAG_COALESCE_MASK_IRQ) {
+		/* Keep the window running, it unmasks the IRQ when it ends */
+		state->coalesce_masked = true;
+		schedule_work(&state->coalesce_mask_work);
+	} else {
+		/* The next occurrence starts a new window */
+		hrtimer_try_to_cancel(&state->coalesce_timer);
+	}
+	return true;
+}
+
+/* Queues the occurrences aggregated during the coalescing window */
+static enum hrtimer_restart event_coalesce_timer_func(struct hrtimer *timer)
 {
+	struct lwis_client_event_state *state =
+		container_of(timer, struct lwis_client_event_state, coalesce_timer);
+	struct lwis_client *lwis_client = state->client;
+	struct lwis_event_coalesced_payload coalesced;
+	struct lwis_event_info ring_info;
+	struct lwis_event_entry *event;
+	struct lwis_event_payload *shared_payload;
+	int64_t event_counter;
+	unsigned long flags;
+	bool flush = false;
+	bool streamed = false;
+	int ret = 0;
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	if (state->coalesced.count > 0) {
+		coalesced = state->coalesced;
+		event_counter = state->coalesced_counter;
+		state->coalesced.count = 0;
+		flush = true;
+	}
+	if (state->coalesce_masked) {
+		state->coalesce_masked = false;
+		schedule_work(&state->coalesce_mask_work);
+	}
+	if (flush && lwis_client->event_ring) {
+		ring_info.event_id = state->event_control.event_id;
+		ring_info.event_counter = event_counter;
+		ring_info.timestamp_ns = coalesced.last_timestamp_ns;
+		ring_info.payload_size = sizeof(coalesced);
+		ring_info.payload_buffer = &coalesced;
+		ret = event_ring_push_locked(lwis_client->event_ring, &ring_info);
+		streamed = true;
+	}
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	if (!flush) {
+		return HRTIMER_NORESTART;
+	}
+
+	if (!streamed) {
+		shared_payload = event_payload_create(&coalesced, sizeof(coalesced));
+		if (!shared_payload) {
+			return HRTIMER_NORESTART;
+		}
+		event = event_entry_create(state->event_control.event_id, event_counter,
+					   coalesced.last_timestamp_ns, shared_payload);
+		event_payload_put(shared_payload);
+		if (!event) {
+			return HRTIMER_NORESTART;
+		}
+		ret = lwis_client_event_push_back(lwis_client, event, state->event_control.flags);
+		if (ret) {
+			lwis_event_entry_free(event);
+		}
+	} else if (ret == 0) {
+		wake_up_interruptible(&lwis_client->event_wait_queue);
+	}
+
+	if (ret) {
+		lwis_dev_err_ratelimited(lwis_client->lwis_dev->dev,
+			"Failed to queue coalesced event ID 0x%llx (%d)\n",
+			state->event_control.event_id, ret);
+	}
+	return HRTIMER_NORESTART;
+}
+
+/* Applies coalesce_masked to the IRQ of the event */
+static void event_coalesce_mask_work_func(struct work_struct *work)
+{
+	struct lwis_client_event_state *state =
+		container_of(work, struct lwis_client_event_state, coalesce_mask_work);
+	struct lwis_client *lwis_client = state->client;
+	unsigned long flags;
+	bool masked;
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	masked = state->coalesce_masked;
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	if (lwis_client->lwis_dev->irqs) {
+		lwis_interrupt_event_mask(lwis_client->lwis_dev->irqs,
+					  state->event_control.event_id, masked);
+	}
+}
+
+/*
+ * event_emit_to_client: Queues the event to the client if it has queueing
+ * enabled, and triggers the transactions of the client waiting on the event.
+ * The payload is only copied once into *shared_payload, which is created on
+ * first use and shared by all the clients.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: May allocate (GFP_ATOMIC)
+ * Returns: 0 on success, the error otherwise, once the transactions of the
+ * client have been triggered regardless
+ */
+static int event_emit_to_client(struct lwis_client *lwis_client, int64_t event_id,
+				int64_t event_counter, int64_t timestamp, void *payload,
+				size_t payload_size, struct lwis_event_payload **shared_payload,
+				struct list_head *pending_events, bool in_irq)
+{
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
 	struct lwis_client_event_state *client_event_state;
-	struct lwis_device_event_state *device_event_state;
 	struct lwis_event_entry *event;
+	struct lwis_event_info ring_info;
+	struct lwis_event_coalesced_payload coalesced;
+	struct lwis_event_payload *coalesced_payload = NULL;
+	/* Flags for IRQ disable */
+	unsigned long flags;
+	uint64_t control_flags = 0;
+	bool emit = false;
+	bool streamed = false;
+	int ret = 0;
+
+	/* Lock the event lock instead */
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	client_event_state = lwis_client_event_state_find_locked(lwis_client, event_id);
+
+	if (!IS_ERR_OR_NULL(client_event_state)) {
+		control_flags = client_event_state->event_control.flags;
+		if (control_flags & LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE) {
+			emit = true;
+		}
+		/* Skipped occurrences are not queued, but the event counter has
+		 * moved on and the transactions below still see them */
+		if (emit && event_decimate_locked(client_event_state, timestamp)) {
+			emit = false;
+		}
+		/* Coalesced events are queued with the aggregate as their payload,
+		 * which is not shared with the other clients */
+		if (emit &&
+		    (client_event_state->event_control.flags & LWIS_EVENT_CONTROL_FLAG_COALESCE)) {
+			emit = event_coalesce_locked(client_event_state, event_counter, timestamp,
+						     &coalesced);
+			payload = &coalesced;
+			payload_size = sizeof(coalesced);
+			shared_payload = &coalesced_payload;
+		}
+	}
+
+	/* Clients with an event ring get the payload copied straight into the
+	 * ring, without allocating an entry to queue */
+	if (emit && lwis_client->event_ring) {
+		ring_info.event_id = event_id;
+		ring_info.event_counter = event_counter;
+		ring_info.timestamp_ns = timestamp;
+		ring_info.payload_size = payload_size;
+		ring_info.payload_buffer = payload;
+		ret = event_ring_push_locked(lwis_client->event_ring, &ring_info);
+		streamed = true;
+	}
+
+	/* Restore the event lock */
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+	if (streamed) {
+		if (ret) {
+			lwis_dev_err_ratelimited(lwis_dev->dev,
+				"Failed to write event ID 0x%llx to event ring (%d)\n",
+				event_id, ret);
+			if (ret == -EOVERFLOW) {
+				atomic64_inc(&lwis_client->stats.events_dropped);
+				lwis_device_error_event_emit(lwis_dev,
+					LWIS_ERROR_EVENT_ID_EVENT_QUEUE_OVERFLOW,
+					/*payload=*/NULL, /*payload_size=*/0);
+			}
+			goto trigger;
+		}
+		atomic64_inc(&lwis_client->stats.events_queued);
+		wake_up_interruptible(&lwis_client->event_wait_queue);
+	} else if (emit) {
+		if (payload_size > 0 && !*shared_payload) {
+			*shared_payload = event_payload_create(payload, payload_size);
+			if (!*shared_payload) {
+				dev_err(lwis_dev->dev, "Failed to allocate event payload\n");
+				lwis_client_stats_alloc_failure(lwis_client);
+				ret = -ENOMEM;
+				goto trigger;
+			}
+		}
+		event = event_entry_create(event_id, event_counter, timestamp, *shared_payload);
+		/* The entry holds its own reference to a coalesced payload */
+		event_payload_put(coalesced_payload);
+		if (!event) {
+			dev_err(lwis_dev->dev, "Failed to allocate event entry\n");
+			lwis_client_stats_alloc_failure(lwis_client);
+			ret = -ENOMEM;
+			goto trigger;
+		}
+		ret = lwis_client_event_push_back(lwis_client, event, control_flags);
+		if (ret) {
+			lwis_dev_err_ratelimited(lwis_dev->dev,
+				"Failed to push event to queue: ID 0x%llx Counter %lld\n",
+				event_id, event_counter);
+			lwis_event_entry_free(event);
+		}
+	}
+
+trigger:
+	/* A failure to queue the event does not keep it from triggering the
+	 * transactions, if there's any that matches this event ID and counter */
+	if (lwis_transaction_event_trigger(lwis_client, event_id, event_counter, pending_events,
+					   in_irq)) {
+		dev_warn(lwis_dev->dev,
+			 "Failed to process transactions: Event ID: 0x%llx Counter: %lld\n",
+			 event_id, event_counter);
+	}
+
+	/* Re-anchor periodic ios that are phase locked to this event */
+	lwis_periodic_io_event_trigger(lwis_client, event_id, timestamp);
+
+	return ret;
+}
+
+/*
+ * event_emit_to_clients: Emits the event to the snapshotted clients, or to all
+ * the clients of the device if the snapshot overflowed. A client failing to
+ * queue the event does not keep it from the clients after it.
+ *
+ * Returns: 0 on success, the first client error otherwise
+ */
+static int event_emit_to_clients(struct lwis_device *lwis_dev, struct lwis_client **clients,
+				 int num_clients, int64_t event_id, int64_t event_counter,
+				 int64_t timestamp, void *payload, size_t payload_size,
+				 struct list_head *pending_events, bool in_irq)
+{
+	/* Payload shared by all the client entries, allocated on first use */
+	struct lwis_event_payload *shared_payload = NULL;
 	/* Our iterators */
 	struct lwis_client *lwis_client;
 	struct list_head *p, *n;
-	int64_t timestamp;
+	int client_ret;
+	int ret = 0;
+	int i;
+
+	if (num_clients >= 0) {
+		for (i = 0; i < num_clients; ++i) {
+			client_ret = event_emit_to_client(clients[i], event_id, event_counter,
+							  timestamp, payload, payload_size,
+							  &shared_payload, pending_events, in_irq);
+			if (client_ret && !ret) {
+				ret = client_ret;
+			}
+		}
+	} else {
+		list_for_each_safe (p, n, &lwis_dev->clients) {
+			lwis_client = list_entry(p, struct lwis_client, node);
+			client_ret = event_emit_to_client(lwis_client, event_id, event_counter,
+							  timestamp, payload, payload_size,
+							  &shared_payload, pending_events, in_irq);
+			if (client_ret && !ret) {
+				ret = client_ret;
+			}
+		}
+	}
+
+	/* Drop our reference, the payload now belongs to the queued entries */
+	event_payload_put(shared_payload);
+	return ret;
+}
+
+static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t event_id,
+				       void *payload, size_t payload_size, int64_t timestamp,
+				       struct list_head *pending_events, bool in_irq)
+{
+	struct lwis_device_event_state *device_event_state;
+	struct lwis_client *clients[MAX_NUM_EVENT_CLIENTS];
+	int num_clients;
 	int64_t event_counter;
 	/* Flags for IRQ disable */
 	unsigned long flags;
@@ -841,18 +1888,26 @@ static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t eve
 
 	/* Increment the event counter */
 	device_event_state->event_counter++;
+	atomic64_inc(&lwis_dev->stats.events_emitted);
 	/* Save event counter to local variable */
 	event_counter = device_event_state->event_counter;
-	/* Latch timestamp */
-	timestamp = ktime_to_ns(lwis_get_time());
 	/* Saves this event to history buffer */
 	save_device_event_state_to_history_locked(lwis_dev, device_event_state, timestamp);
+	trace_lwis_event_emit(lwis_dev, event_id, event_counter, timestamp);
 
 	has_subscriber = device_event_state->has_subscriber;
 
+	/* Only the clients interested in this event need to be notified */
+	num_clients = event_clients_snapshot_locked(device_event_state, clients);
+
 	/* Unlock and restore device lock */
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 
+	/* Wake up POLL entries waiting for an event of this device */
+	if (wq_has_sleeper(&lwis_dev->event_wait_queue)) {
+		wake_up_all(&lwis_dev->event_wait_queue);
+	}
+
 	/* Emit event to subscriber via top device */
 	if (has_subscriber) {
 		lwis_dev->top_dev->subscribe_ops.notify_event_subscriber(
@@ -867,68 +1922,26 @@ static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t eve
 		}
 	}
 
-	/* Notify clients */
-	list_for_each_safe (p, n, &lwis_dev->clients) {
-		bool emit = false;
-		lwis_client = list_entry(p, struct lwis_client, node);
-
-		/* Lock the event lock instead */
-		spin_lock_irqsave(&lwis_client->event_lock, flags);
-		client_event_state = lwis_client_event_state_find_locked(lwis_client, event_id);
-
-		if (!IS_ERR_OR_NULL(client_event_state)) {
-			if (client_event_state->event_control.flags &
-			    LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE) {
-				emit = true;
-			}
-		}
-
-		/* Restore the event lock */
-		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
-		if (emit) {
-			event = kmalloc(sizeof(struct lwis_event_entry) + payload_size, GFP_ATOMIC);
-			if (!event) {
-				dev_err(lwis_dev->dev, "Failed to allocate event entry\n");
-				return -ENOMEM;
-			}
-
-			event->event_info.event_id = event_id;
-			event->event_info.event_counter = event_counter;
-			event->event_info.timestamp_ns = timestamp;
-			event->event_info.payload_size = payload_size;
-			if (payload_size > 0) {
-				event->event_info.payload_buffer =
-					(void *)((uint8_t *)event +
-						 sizeof(struct lwis_event_entry));
-				memcpy(event->event_info.payload_buffer, payload, payload_size);
-			} else {
-				event->event_info.payload_buffer = NULL;
-			}
-			ret = lwis_client_event_push_back(lwis_client, event);
-			if (ret) {
-				lwis_dev_err_ratelimited(lwis_dev->dev,
-					"Failed to push event to queue: ID 0x%llx Counter %lld\n",
-					event_id, event_counter);
-				kfree(event);
-				return ret;
-			}
-		}
-
-		/* Trigger transactions, if there's any that matches this event
-		   ID and counter */
-		if (lwis_transaction_event_trigger(lwis_client, event_id, event_counter,
-						   pending_events, in_irq)) {
-			dev_warn(lwis_dev->dev,
-				 "Failed to process transactions: Event ID: 0x%llx Counter: %lld\n",
-				 event_id, event_counter);
-		}
+	/* Sample traffic counters for closed-loop bandwidth voting */
+	if (lwis_dev->bts_auto) {
+		lwis_dpm_bts_auto_event(lwis_dev, event_id);
 	}
 
-	return 0;
+	/* Notify clients */
+	return event_emit_to_clients(lwis_dev, clients, num_clients, event_id, event_counter,
+				     timestamp, payload, payload_size, pending_events, in_irq);
 }
 
 int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void *payload,
 			   size_t payload_size, bool in_irq)
+{
+	return lwis_device_event_emit_timestamped(lwis_dev, event_id, payload, payload_size,
+						  ktime_to_ns(lwis_get_time()), in_irq);
+}
+
+int lwis_device_event_emit_timestamped(struct lwis_device *lwis_dev, int64_t event_id,
+				       void *payload, size_t payload_size, int64_t timestamp,
+				       bool in_irq)
 {
 	int ret;
 	struct list_head pending_events;
@@ -938,7 +1951,7 @@ int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void
 	INIT_LIST_HEAD(&pending_events);
 
 	/* Emit the original event */
-	ret = lwis_device_event_emit_impl(lwis_dev, event_id, payload, payload_size,
+	ret = lwis_device_event_emit_impl(lwis_dev, event_id, payload, payload_size, timestamp,
 					  &pending_events, in_irq);
 	if (ret) {
 		lwis_dev_err_ratelimited(lwis_dev->dev,
@@ -953,14 +1966,30 @@ int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void
 
 int lwis_pending_event_push(struct list_head *pending_events, int64_t event_id, void *payload,
 			    size_t payload_size)
+{
+	return lwis_pending_event_push_tracked(pending_events, event_id, payload, payload_size,
+					       /*delivery_hist=*/NULL, /*produced_ns=*/0);
+}
+
+int lwis_pending_event_push_tracked(struct list_head *pending_events, int64_t event_id,
+				    void *payload, size_t payload_size,
+				    struct lwis_latency_histogram *delivery_hist,
+				    int64_t produced_ns)
 {
 	struct lwis_event_entry *event;
+	bool pooled = payload_size <= PENDING_EVENT_POOL_PAYLOAD_SIZE;
 
-	event = kzalloc(sizeof(struct lwis_event_entry) + payload_size, GFP_ATOMIC);
+	if (pooled) {
+		event = mempool_alloc(pending_event_pool, GFP_ATOMIC);
+	} else {
+		event = kmalloc(sizeof(struct lwis_event_entry) + payload_size, GFP_ATOMIC);
+	}
 	if (!event) {
 		pr_err("Failed to allocate event entry\n");
 		return -ENOMEM;
 	}
+	memset(event, 0, sizeof(struct lwis_event_entry));
+	event->pooled = pooled;
 	event->event_info.event_id = event_id;
 	event->event_info.payload_size = payload_size;
 	if (payload_size > 0) {
@@ -970,6 +1999,8 @@ int lwis_pending_event_push(struct list_head *pending_events, int64_t event_id,
 	} else {
 		event->event_info.payload_buffer = NULL;
 	}
+	event->delivery_hist = delivery_hist;
+	event->produced_ns = produced_ns;
 
 	list_add_tail(&event->node, pending_events);
 
@@ -987,6 +2018,7 @@ int lwis_pending_events_emit(struct lwis_device *lwis_dev, struct list_head *pen
 		emit_result = lwis_device_event_emit_impl(lwis_dev, event->event_info.event_id,
 							  event->event_info.payload_buffer,
 							  event->event_info.payload_size,
+							  ktime_to_ns(lwis_get_time()),
 							  pending_events, in_irq);
 		if (emit_result) {
 			return_val = emit_result;
@@ -994,12 +2026,88 @@ int lwis_pending_events_emit(struct lwis_device *lwis_dev, struct list_head *pen
 				 "lwis_device_pending_event_emit error on ID 0x%llx\n",
 				 event->event_info.event_id);
 		}
+		if (event->delivery_hist) {
+			lwis_latency_histogram_record(event->delivery_hist,
+						      ktime_to_ns(lwis_get_time()) - event->produced_ns);
+		}
 		list_del(&event->node);
-		kfree(event);
+		lwis_pending_event_free(event);
 	}
 	return return_val;
 }
 
+void lwis_pending_event_free(struct lwis_event_entry *event)
+{
+	if (event->pooled) {
+		mempool_free(event, pending_event_pool);
+	} else {
+		kfree(event);
+	}
+}
+
+int lwis_device_event_client_update(struct lwis_device *lwis_dev, struct lwis_client *lwis_client,
+				    int64_t event_id, uint32_t interest, bool enable)
+{
+	struct lwis_device_event_state *event_state;
+	struct lwis_device_event_client *event_client;
+	struct lwis_device_event_client *new_event_client = NULL;
+	struct lwis_device_event_client *found = NULL;
+	unsigned long flags;
+
+	if (enable) {
+		event_state = lwis_device_event_state_find_or_create(lwis_dev, event_id);
+		if (IS_ERR_OR_NULL(event_state)) {
+			dev_err(lwis_dev->dev, "Could not find or create device event state\n");
+			return PTR_ERR(event_state);
+		}
+		new_event_client = kmalloc(sizeof(struct lwis_device_event_client), GFP_ATOMIC);
+		if (!new_event_client) {
+			dev_err(lwis_dev->dev, "Could not allocate lwis_device_event_client\n");
+			return -ENOMEM;
+		}
+	}
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	event_state = lwis_device_event_state_find_locked(lwis_dev, event_id);
+	if (event_state == NULL) {
+		spin_unlock_irqrestore(&lwis_dev->lock, flags);
+		kfree(new_event_client);
+		return enable ? -EINVAL : 0;
+	}
+
+	list_for_each_entry (event_client, &event_state->clients, node) {
+		if (event_client->client == lwis_client) {
+			found = event_client;
+			break;
+		}
+	}
+
+	if (enable) {
+		if (!found) {
+			found = new_event_client;
+			new_event_client = NULL;
+			found->client = lwis_client;
+			found->interests = 0;
+			list_add_tail(&found->node, &event_state->clients);
+		}
+		found->interests |= interest;
+		found = NULL;
+	} else if (found) {
+		found->interests &= ~interest;
+		if (found->interests == 0) {
+			list_del(&found->node);
+		} else {
+			found = NULL;
+		}
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+
+	/* Free whichever entry is not in use anymore */
+	kfree(new_event_client);
+	kfree(found);
+	return 0;
+}
+
 int lwis_device_event_update_subscriber(struct lwis_device *lwis_dev, int64_t event_id,
 					bool has_subscriber)
 {
@@ -1027,16 +2135,12 @@ out:
 void lwis_device_external_event_emit(struct lwis_device *lwis_dev, int64_t event_id,
 				     int64_t event_counter, int64_t timestamp, bool in_irq)
 {
-	struct lwis_client_event_state *client_event_state;
 	struct lwis_device_event_state *device_event_state;
-	struct lwis_event_entry *event;
-	/* Our iterators */
-	struct lwis_client *lwis_client;
-	struct list_head *p, *n;
+	struct lwis_client *clients[MAX_NUM_EVENT_CLIENTS];
+	int num_clients;
 	struct list_head pending_events;
 	/* Flags for IRQ disable */
 	unsigned long flags;
-	bool emit = false;
 
 	INIT_LIST_HEAD(&pending_events);
 
@@ -1050,57 +2154,22 @@ void lwis_device_external_event_emit(struct lwis_device *lwis_dev, int64_t event
 
 	/* Update event counter */
 	device_event_state->event_counter = event_counter;
+	trace_lwis_event_emit(lwis_dev, event_id, event_counter, timestamp);
+
+	num_clients = event_clients_snapshot_locked(device_event_state, clients);
 
 	/* Unlock and restore device lock */
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 
-	/* Notify clients */
-	list_for_each_safe (p, n, &lwis_dev->clients) {
-		emit = false;
-		lwis_client = list_entry(p, struct lwis_client, node);
-
-		/* Lock the event lock instead */
-		spin_lock_irqsave(&lwis_client->event_lock, flags);
-		client_event_state = lwis_client_event_state_find_locked(lwis_client, event_id);
-
-		if (!IS_ERR_OR_NULL(client_event_state)) {
-			if (client_event_state->event_control.flags &
-			    LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE) {
-				emit = true;
-			}
-		}
-		/* Restore the event lock */
-		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
-
-		if (emit) {
-			event = kmalloc(sizeof(struct lwis_event_entry), GFP_ATOMIC);
-			if (!event) {
-				dev_err(lwis_dev->dev, "Failed to allocate event entry\n");
-				return;
-			}
-
-			event->event_info.event_id = event_id;
-			event->event_info.event_counter = event_counter;
-			event->event_info.timestamp_ns = timestamp;
-			event->event_info.payload_size = 0;
-			event->event_info.payload_buffer = NULL;
-			if (lwis_client_event_push_back(lwis_client, event)) {
-				lwis_dev_err_ratelimited(lwis_dev->dev,
-					"Failed to push event to queue: ID 0x%llx Counter %lld\n",
-					event_id, event_counter);
-				kfree(event);
-				return;
-			}
-		}
-
-		if (lwis_transaction_event_trigger(lwis_client, event_id, event_counter,
-						   &pending_events, in_irq))
-			dev_warn(
-				lwis_dev->dev,
-				"Failed to process transactions: external event ID: 0x%llx counter: %lld\n",
-				event_id, event_counter);
+	/* Wake up POLL entries waiting for an event of this device */
+	if (wq_has_sleeper(&lwis_dev->event_wait_queue)) {
+		wake_up_all(&lwis_dev->event_wait_queue);
 	}
 
+	/* Notify clients */
+	event_emit_to_clients(lwis_dev, clients, num_clients, event_id, event_counter, timestamp,
+			      /*payload=*/NULL, /*payload_size=*/0, &pending_events, in_irq);
+
 	lwis_pending_events_emit(lwis_dev, &pending_events, in_irq);
 }
 
@@ -1108,6 +2177,7 @@ void lwis_device_error_event_emit(struct lwis_device *lwis_dev, int64_t event_id
 				  size_t payload_size)
 {
 	struct lwis_event_entry *event;
+	struct lwis_event_payload *shared_payload = NULL;
 	/* Our iterators */
 	struct lwis_client *lwis_client;
 	struct list_head *p, *n;
@@ -1122,32 +2192,32 @@ void lwis_device_error_event_emit(struct lwis_device *lwis_dev, int64_t event_id
 	/* Latch timestamp */
 	timestamp = ktime_to_ns(lwis_get_time());
 
+	if (payload_size > 0) {
+		shared_payload = event_payload_create(payload, payload_size);
+		if (!shared_payload) {
+			dev_err(lwis_dev->dev, "Failed to allocate event payload\n");
+			return;
+		}
+	}
+
 	/* Notify clients */
 	list_for_each_safe (p, n, &lwis_dev->clients) {
 		lwis_client = list_entry(p, struct lwis_client, node);
 
-		event = kmalloc(sizeof(struct lwis_event_entry) + payload_size, GFP_ATOMIC);
+		event = event_entry_create(event_id, /*event_counter=*/0, timestamp,
+					   shared_payload);
 		if (!event) {
 			dev_err(lwis_dev->dev, "Failed to allocate event entry\n");
-			return;
-		}
-		event->event_info.event_id = event_id;
-		event->event_info.event_counter = 0;
-		event->event_info.timestamp_ns = timestamp;
-		event->event_info.payload_size = payload_size;
-		if (payload_size > 0) {
-			event->event_info.payload_buffer =
-				(void *)((uint8_t *)event + sizeof(struct lwis_event_entry));
-			memcpy(event->event_info.payload_buffer, payload, payload_size);
-		} else {
-			event->event_info.payload_buffer = NULL;
+			break;
 		}
 		if (lwis_client_error_event_push_back(lwis_client, event)) {
 			lwis_dev_err_ratelimited(lwis_dev->dev,
 				"Failed to push error event to queue: ID 0x%llx\n",
 				event_id);
-			kfree(event);
-			return;
+			lwis_event_entry_free(event);
+			break;
 		}
 	}
+
+	event_payload_put(shared_payload);
 }
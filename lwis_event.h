@@ -11,7 +11,10 @@
 #ifndef LWIS_EVENT_H_
 #define LWIS_EVENT_H_
 
+#include <linux/hrtimer.h>
+#include <linux/kref.h>
 #include <linux/list.h>
+#include <linux/workqueue.h>
 
 #include "lwis_commands.h"
 
@@ -19,11 +22,19 @@
  *  LWIS Event Defines
  */
 
+/* Depth of the event queue of a client unless set otherwise, and depth of its
+ * error event queue */
+#define MAX_NUM_PENDING_EVENTS 2048
+/* Upper bound of the depth set by LWIS_EVENT_QUEUE_DEPTH_SET or the device tree */
+#define MAX_EVENT_QUEUE_DEPTH 65536
+
 /*
  *  LWIS Forward Declarations
  */
 struct lwis_client;
 struct lwis_device;
+struct lwis_latency_histogram;
+struct vm_area_struct;
 
 /*
  *  LWIS Event Structures
@@ -37,9 +48,28 @@ struct lwis_device_event_state {
 	int64_t enable_counter;
 	int64_t event_counter;
 	bool has_subscriber;
+	/* List of lwis_device_event_client to visit when the event is emitted */
+	struct list_head clients;
 	struct hlist_node node;
 };
 
+/*
+ *  struct lwis_device_event_client
+ *  This struct keeps track of a client that needs to be visited when the
+ *  device event is emitted, either because the client has queueing enabled
+ *  for the event or because it has transactions triggered by the event.
+ */
+#define LWIS_EVENT_CLIENT_INTEREST_QUEUE (1U << 0)
+#define LWIS_EVENT_CLIENT_INTEREST_TRANSACTION (1U << 1)
+#define LWIS_EVENT_CLIENT_INTEREST_PERIODIC_IO (1U << 2)
+
+struct lwis_device_event_client {
+	struct lwis_client *client;
+	/* Bitmask of LWIS_EVENT_CLIENT_INTEREST_* */
+	uint32_t interests;
+	struct list_head node;
+};
+
 /*
  * struct lwis_device_event_state_history
  * For debugging purposes, keeps track of event states and the time an event
@@ -56,9 +86,31 @@ struct lwis_device_event_state_history {
  *  This struct keeps track of client-specific event state and controls
  */
 struct lwis_client_event_state {
-	struct lwis_event_control event_control;
+	struct lwis_event_control_v2 event_control;
 	struct hlist_node node;
 	struct list_head clearance_node;
+	/* Client the state belongs to, for the coalescing timer and work */
+	struct lwis_client *client;
+	/* Occurrences aggregated for LWIS_EVENT_CONTROL_FLAG_COALESCE */
+	/* GUARDED_BY(client->event_lock) */
+	struct lwis_event_coalesced_payload coalesced;
+	/* GUARDED_BY(client->event_lock) */
+	int64_t coalesced_counter;
+	/* Ends the coalescing window */
+	struct hrtimer coalesce_timer;
+	/* Whether the IRQ should be masked for the rest of the window */
+	/* GUARDED_BY(client->event_lock) */
+	bool coalesce_masked;
+	/* Applies coalesce_masked from process context */
+	struct work_struct coalesce_mask_work;
+	/* Occurrences left to skip before the next one is queued, for
+	 * decimation_factor */
+	/* GUARDED_BY(client->event_lock) */
+	uint32_t decimation_skip;
+	/* Timestamp of the last queued occurrence, 0 if none, for
+	 * min_interval_ns */
+	/* GUARDED_BY(client->event_lock) */
+	int64_t last_queued_ns;
 };
 
 /*
@@ -71,6 +123,42 @@ struct lwis_client_event_state {
 struct lwis_event_entry {
 	struct lwis_event_info event_info;
 	struct list_head node;
+	/* Payload shared with other entries, NULL if payload is stored inline */
+	struct lwis_event_payload *shared_payload;
+	/* Pending events only: histogram recording the time from produced_ns
+	 * until the event is emitted, NULL if not tracked */
+	struct lwis_latency_histogram *delivery_hist;
+	int64_t produced_ns;
+	/* Pending events only: the entry and its payload come from the
+	 * pending event pool */
+	bool pooled;
+};
+
+/*
+ *  struct lwis_event_payload
+ *  Payload of an emitted event, shared by the queue entries of all the clients
+ *  the event is delivered to. Freed when the last entry referencing it is
+ *  freed.
+ */
+struct lwis_event_payload {
+	struct kref refcount;
+	size_t size;
+	uint8_t data[];
+};
+
+/*
+ *  struct lwis_event_ring
+ *  This struct keeps track of the optional per-client event ring that is
+ *  mapped into userspace. head is the kernel copy of the write position, the
+ *  one in the shared header is only ever written and never trusted.
+ */
+struct lwis_event_ring {
+	void *vaddr;
+	size_t mmap_size;
+	struct lwis_event_ring_header *header;
+	uint8_t *data;
+	size_t data_size;
+	uint64_t head;
 };
 
 /*
@@ -91,7 +179,7 @@ struct lwis_event_entry {
  * Returns: 0 on success
  */
 int lwis_client_event_control_set(struct lwis_client *lwisclient,
-				  const struct lwis_event_control *control);
+				  const struct lwis_event_control_v2 *control);
 
 /*
  * lwis_client_event_control_get: Finds and returns the current event state
@@ -103,7 +191,18 @@ int lwis_client_event_control_set(struct lwis_client *lwisclient,
  * Returns: 0 on success
  */
 int lwis_client_event_control_get(struct lwis_client *lwisclient, int64_t event_id,
-				  struct lwis_event_control *control);
+				  struct lwis_event_control_v2 *control);
+
+/*
+ * lwis_client_event_queue_depth_set: Sets the number of events the client
+ * queue holds before the overflow policy of the new events applies. Events
+ * already queued beyond a smaller depth stay queued.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: No
+ * Returns: 0 on success, -EINVAL if depth is out of range
+ */
+int lwis_client_event_queue_depth_set(struct lwis_client *lwis_client, uint32_t depth);
 
 /*
  * lwis_client_event_pop_front: Removes an event from the client event queue
@@ -130,6 +229,15 @@ int lwis_client_event_pop_front(struct lwis_client *lwis_client, struct lwis_eve
  */
 int lwis_client_event_peek_front(struct lwis_client *lwis_client, struct lwis_event_entry **event);
 
+/*
+ * lwis_event_entry_free: Frees an event entry and drops its reference to the
+ * shared payload, if any.
+ *
+ * Alloc: Free only
+ * Returns: void
+ */
+void lwis_event_entry_free(struct lwis_event_entry *event);
+
 /*
  * lwis_client_event_queue_clear: Clear all entries inside the event queue.
  *
@@ -178,6 +286,61 @@ int lwis_client_error_event_peek_front(struct lwis_client *lwis_client,
  */
 void lwis_client_error_event_queue_clear(struct lwis_client *lwis_client);
 
+/*
+ * lwis_client_event_ring_setup: Allocates the event ring of the client. Once
+ * set up, events for this client are written to the ring instead of the event
+ * queue. data_size is rounded up to a power of 2 pages, and the size that
+ * userspace needs to mmap is returned in mmap_size.
+ *
+ * Locks: lwis_client->event_lock
+ * Assumes: lwis_client->lock is locked
+ * Alloc: Yes
+ * Returns: 0 on success, -EBUSY if the ring is already set up
+ */
+int lwis_client_event_ring_setup(struct lwis_client *lwis_client, size_t data_size,
+				 size_t *mmap_size);
+
+/*
+ * lwis_client_event_ring_mmap: Maps the event ring of the client into the
+ * given vma.
+ *
+ * Assumes: lwis_client->lock is locked
+ * Alloc: No
+ * Returns: 0 on success, -ENOENT if the ring is not set up
+ */
+int lwis_client_event_ring_mmap(struct lwis_client *lwis_client, struct vm_area_struct *vma);
+
+/*
+ * lwis_client_event_queues_have_events: Checks whether the error event queue
+ * or the event queue of the client holds any event.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: No
+ * Returns: true if there are queued events
+ */
+bool lwis_client_event_queues_have_events(struct lwis_client *lwis_client);
+
+/*
+ * lwis_client_event_ring_has_events: Checks whether there are records in the
+ * event ring that userspace has not consumed yet.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: No
+ * Returns: true if there are pending records
+ */
+bool lwis_client_event_ring_has_events(struct lwis_client *lwis_client);
+
+/*
+ * lwis_client_event_ring_free: Frees the event ring of the client. Must only
+ * be called when there are no more userspace mappings of the ring, i.e. on
+ * client release.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: Free only
+ * Returns: void
+ */
+void lwis_client_event_ring_free(struct lwis_client *lwis_client);
+
 /*
  * lwis_client_event_states_clear: Frees all items in lwisclient->event_states
  * and clears the hash table. Used for client shutdown only.
@@ -192,13 +355,35 @@ int lwis_client_event_states_clear(struct lwis_client *lwisclient);
 
 /*
  * lwis_device_event_states_clear: Frees all items in lwisdev->event_states
- * and clears the hash table. Used for device shutdown only.
+ * that no client is interested in anymore. Used for device shutdown only.
  *
  * Assumes: lwisdev->lock is locked
  * Returns: 0 on success
  */
 int lwis_device_event_states_clear_locked(struct lwis_device *lwisdev);
 
+/*
+ * lwis_device_event_state_table_reserve: Extends the direct index of the
+ * device event states to cover event_id, so that its lookups skip the hash
+ * table. Events of other devices, or too far from the indexed ones, stay in
+ * the hash table only.
+ *
+ * Assumes: Process context
+ * Locks: lwis_dev->lock
+ * Alloc: Yes
+ * Returns: 0 on success, including event_id not being indexed
+ */
+int lwis_device_event_state_table_reserve(struct lwis_device *lwis_dev, int64_t event_id);
+
+/*
+ * lwis_device_event_state_table_covers: Returns whether event_id has a slot in
+ * the direct index of the device event states.
+ *
+ * Locks: lwis_dev->lock
+ * Alloc: No
+ */
+bool lwis_device_event_state_table_covers(struct lwis_device *lwis_dev, int64_t event_id);
+
 /*
  * lwis_device_event_flags_updated: Notifies the device that the given event_id
  * has new flags, which allows the device to register/unregister IRQs, and
@@ -234,6 +419,19 @@ int lwis_device_event_enable(struct lwis_device *lwis_dev, int64_t event_id, boo
 int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void *payload,
 			   size_t payload_size, bool in_irq);
 
+/*
+ * lwis_device_event_emit_timestamped: Same as lwis_device_event_emit, with
+ * the time the event happened captured by the caller, in the lwis_get_time
+ * clock, e.g. at ISR entry.
+ *
+ * Locks: lwis_dev->lock and then lwis_client->event_lock
+ * Alloc: May allocate (GFP_ATOMIC or GFP_NOWAIT only)
+ * Returns: 0 on success
+ */
+int lwis_device_event_emit_timestamped(struct lwis_device *lwis_dev, int64_t event_id,
+				       void *payload, size_t payload_size, int64_t timestamp,
+				       bool in_irq);
+
 /*
  * lwis_device_external_event_emit: Emits an subscribed event to device.
  * The difference to lwis_device_event_emit is
@@ -269,6 +467,16 @@ void lwis_device_error_event_emit(struct lwis_device *lwis_dev, int64_t event_id
 struct lwis_device_event_state *lwis_device_event_state_find(struct lwis_device *lwis_dev,
 							     int64_t event_id);
 
+/*
+ * lwis_device_event_counter_get: Returns the number of times the event with
+ * the matching event_id was emitted by the device.
+ *
+ * Locks: lwis_dev->lock
+ * Alloc: No
+ * Returns: event counter if the event state exists, -ENOENT otherwise.
+ */
+int64_t lwis_device_event_counter_get(struct lwis_device *lwis_dev, int64_t event_id);
+
 /*
  * lwis_device_event_state_find_or_create: Looks through the provided device's
  * event state list and tries to find a lwis_device_event_state object with the
@@ -295,6 +503,19 @@ struct lwis_device_event_state *lwis_device_event_state_find_or_create(struct lw
 struct lwis_client_event_state *
 lwis_client_event_state_find_or_create(struct lwis_client *lwis_client, int64_t event_id);
 
+/*
+ * lwis_pending_event_push_tracked: Same as lwis_pending_event_push, and
+ * records into delivery_hist the time between produced_ns and the event being
+ * emitted by lwis_pending_events_emit.
+ *
+ * Alloc: Maybe
+ * Returns: 0 on success
+ */
+int lwis_pending_event_push_tracked(struct list_head *pending_events, int64_t event_id,
+				    void *payload, size_t payload_size,
+				    struct lwis_latency_histogram *delivery_hist,
+				    int64_t produced_ns);
+
 /*
  * lwis_pending_event_push: Push triggered event into a local pending queue to
  * defer processing until all the current event is done
@@ -305,6 +526,32 @@ lwis_client_event_state_find_or_create(struct lwis_client *lwis_client, int64_t
 int lwis_pending_event_push(struct list_head *pending_events, int64_t event_id, void *payload,
 			    size_t payload_size);
 
+/*
+ * lwis_pending_event_free: Frees an event created by lwis_pending_event_push
+ *
+ * Alloc: Free only
+ * Returns: void
+ */
+void lwis_pending_event_free(struct lwis_event_entry *event);
+
+/*
+ * lwis_event_caches_init: Creates the caches and reserves that event entries
+ * are allocated from. Called once on module init.
+ *
+ * Alloc: Yes
+ * Returns: 0 on success
+ */
+int lwis_event_caches_init(void);
+
+/*
+ * lwis_event_caches_deinit: Destroys the caches created by
+ * lwis_event_caches_init. Called once on module exit.
+ *
+ * Alloc: Free only
+ * Returns: void
+ */
+void lwis_event_caches_deinit(void);
+
 /*
  * lwis_pending_events_emit: If pending queue is not empty, start processing
  * and emitting the events in queue
@@ -314,6 +561,18 @@ int lwis_pending_event_push(struct list_head *pending_events, int64_t event_id,
 int lwis_pending_events_emit(struct lwis_device *lwis_dev, struct list_head *pending_events,
 			     bool in_irq);
 
+/*
+ * lwis_device_event_client_update: Adds or removes an interest of the client
+ * on the device event. Emitting an event only visits the clients that have
+ * at least one interest on it.
+ *
+ * Locks: lwis_dev->lock
+ * Alloc: Maybe (GFP_ATOMIC)
+ * Returns: 0 on success
+ */
+int lwis_device_event_client_update(struct lwis_device *lwis_dev, struct lwis_client *lwis_client,
+				    int64_t event_id, uint32_t interest, bool enable);
+
 /*
  * lwis_device_event_update_subscriber: The function to notify an event has been subscribed/unsubscribed.
  * Returns: 0 on success, -EINVAL if event id not found in trigger device.
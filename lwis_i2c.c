@@ -14,11 +14,14 @@
 
 #include <linux/bits.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/string.h>
 
+#include "lwis_reg_cache.h"
+
 #define I2C_DEVICE_NAME "LWIS_I2C"
 
 /* Max bit width for register and data that is supported by this
@@ -28,6 +31,10 @@
 #define MIN_DATA_BITS 8
 #define MAX_DATA_BITS 32
 
+/* Initial size of the transfer scratch buffer, enough for any single register
+   access and small batches */
+#define SCRATCH_INITIAL_SIZE 256
+
 static inline bool check_bitwidth(const int bitwidth, const int min, const int max)
 {
 	return (bitwidth >= min) && (bitwidth <= max) && ((bitwidth % 8) == 0);
@@ -108,6 +115,51 @@ static int perform_write_batch_transfer(struct i2c_client *client, struct i2c_ms
 	return (ret == num_msg) ? 0 : ret;
 }
 
+/* Returns the scratch buffer of the device, grown to hold at least size bytes.
+   Must be called with scratch_lock held. */
+static uint8_t *scratch_reserve(struct lwis_i2c_device *i2c, size_t size)
+{
+	uint8_t *buf;
+
+	lockdep_assert_held(&i2c->scratch_lock);
+
+	if (size <= i2c->scratch_size) {
+		return i2c->scratch_buf;
+	}
+
+	size = roundup_pow_of_two(size);
+	buf = kmalloc(size, GFP_KERNEL);
+	if (!buf) {
+		dev_err(i2c->base_dev.dev, "Failed to grow i2c scratch buffer to %zu bytes\n",
+			size);
+		return NULL;
+	}
+	kfree(i2c->scratch_buf);
+	i2c->scratch_buf = buf;
+	i2c->scratch_size = size;
+	return buf;
+}
+
+int lwis_i2c_scratch_init(struct lwis_i2c_device *i2c)
+{
+	mutex_init(&i2c->scratch_lock);
+	i2c->scratch_buf = kmalloc(SCRATCH_INITIAL_SIZE, GFP_KERNEL);
+	if (!i2c->scratch_buf) {
+		dev_err(i2c->base_dev.dev, "Failed to allocate i2c scratch buffer\n");
+		i2c->scratch_size = 0;
+		return -ENOMEM;
+	}
+	i2c->scratch_size = SCRATCH_INITIAL_SIZE;
+	return 0;
+}
+
+void lwis_i2c_scratch_free(struct lwis_i2c_device *i2c)
+{
+	kfree(i2c->scratch_buf);
+	i2c->scratch_buf = NULL;
+	i2c->scratch_size = 0;
+}
+
 int lwis_i2c_set_state(struct lwis_i2c_device *i2c, const char *state_str)
 {
 	int ret;
@@ -168,18 +220,13 @@ static int i2c_read(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *valu
 		return -EINVAL;
 	}
 
-	wbuf = kmalloc(offset_bytes, GFP_KERNEL);
+	mutex_lock(&i2c->scratch_lock);
+	wbuf = scratch_reserve(i2c, offset_bytes + value_bytes);
 	if (!wbuf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c write buffer\n");
-		return -ENOMEM;
-	}
-
-	rbuf = kmalloc(value_bytes, GFP_KERNEL);
-	if (!rbuf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c read buffer\n");
 		ret = -ENOMEM;
-		goto error_rbuf_alloc;
+		goto error_unlock;
 	}
+	rbuf = wbuf + offset_bytes;
 
 	msg[0].addr = client->addr;
 	msg[0].flags = 0;
@@ -195,15 +242,13 @@ static int i2c_read(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *valu
 
 	if (ret) {
 		dev_err(i2c->base_dev.dev, "I2C Read failed: Offset 0x%llx (%d)\n", offset, ret);
-		goto error_transfer;
+		goto error_unlock;
 	}
 
 	*value = buf_to_value(rbuf, value_bytes);
 
-error_transfer:
-	kfree(rbuf);
-error_rbuf_alloc:
-	kfree(wbuf);
+error_unlock:
+	mutex_unlock(&i2c->scratch_lock);
 
 	return ret;
 }
@@ -246,9 +291,10 @@ static int i2c_write(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t valu
 	}
 
 	msg_bytes = offset_bytes + value_bytes;
-	buf = kmalloc(msg_bytes, GFP_KERNEL);
+	mutex_lock(&i2c->scratch_lock);
+	buf = scratch_reserve(i2c, msg_bytes);
 	if (!buf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c buffer\n");
+		mutex_unlock(&i2c->scratch_lock);
 		return -ENOMEM;
 	}
 
@@ -264,7 +310,7 @@ static int i2c_write(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t valu
 			offset, value, ret);
 	}
 
-	kfree(buf);
+	mutex_unlock(&i2c->scratch_lock);
 
 	return ret;
 }
@@ -292,9 +338,10 @@ static int i2c_read_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, ui
 		return -EINVAL;
 	}
 
-	wbuf = kmalloc(offset_bytes, GFP_KERNEL);
+	mutex_lock(&i2c->scratch_lock);
+	wbuf = scratch_reserve(i2c, offset_bytes);
 	if (!wbuf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c write buffer\n");
+		mutex_unlock(&i2c->scratch_lock);
 		return -ENOMEM;
 	}
 
@@ -315,7 +362,7 @@ static int i2c_read_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, ui
 			start_offset, ret);
 	}
 
-	kfree(wbuf);
+	mutex_unlock(&i2c->scratch_lock);
 	return ret;
 }
 
@@ -349,9 +396,10 @@ static int i2c_write_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, u
 	}
 
 	msg_bytes = offset_bytes + write_buf_size;
-	buf = kmalloc(msg_bytes, GFP_KERNEL);
+	mutex_lock(&i2c->scratch_lock);
+	buf = scratch_reserve(i2c, msg_bytes);
 	if (!buf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c buffer\n");
+		mutex_unlock(&i2c->scratch_lock);
 		return -ENOMEM;
 	}
 
@@ -368,7 +416,7 @@ static int i2c_write_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, u
 			start_offset, ret);
 	}
 
-	kfree(buf);
+	mutex_unlock(&i2c->scratch_lock);
 
 	return ret;
 }
@@ -377,6 +425,7 @@ int lwis_i2c_io_entry_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entr
 {
 	int ret;
 	uint64_t reg_value;
+	struct lwis_device *base_dev = &i2c->base_dev;
 
 	if (!entry) {
 		dev_err(i2c->base_dev.dev, "IO entry is NULL.\n");
@@ -384,28 +433,263 @@ int lwis_i2c_io_entry_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entr
 	}
 
 	if (entry->type == LWIS_IO_ENTRY_READ) {
-		return i2c_read(i2c, entry->rw.offset, &entry->rw.val);
+		ret = i2c_read(i2c, entry->rw.offset, &entry->rw.val);
+		if (!ret) {
+			lwis_reg_cache_update(base_dev, entry->rw.bid, entry->rw.offset,
+					      entry->rw.val);
+		}
+		return ret;
 	}
 	if (entry->type == LWIS_IO_ENTRY_WRITE) {
-		return i2c_write(i2c, entry->rw.offset, entry->rw.val);
-	}
-	if (entry->type == LWIS_IO_ENTRY_MODIFY) {
-		ret = i2c_read(i2c, entry->mod.offset, &reg_value);
+		/* Skip writes of the value the register already holds */
+		if (!lwis_reg_cache_write_needed(base_dev, entry->rw.bid, entry->rw.offset,
+						 entry->rw.val)) {
+			return 0;
+		}
+		ret = i2c_write(i2c, entry->rw.offset, entry->rw.val);
 		if (ret) {
+			lwis_reg_cache_invalidate(base_dev, entry->rw.bid, entry->rw.offset, 1);
 			return ret;
 		}
+		lwis_reg_cache_update(base_dev, entry->rw.bid, entry->rw.offset, entry->rw.val);
+		return 0;
+	}
+	if (entry->type == LWIS_IO_ENTRY_MODIFY) {
+		if (!lwis_reg_cache_read(base_dev, entry->mod.bid, entry->mod.offset, &reg_value)) {
+			ret = i2c_read(i2c, entry->mod.offset, &reg_value);
+			if (ret) {
+				return ret;
+			}
+		}
 		reg_value &= ~entry->mod.val_mask;
 		reg_value |= entry->mod.val_mask & entry->mod.val;
-		return i2c_write(i2c, entry->mod.offset, reg_value);
+		if (!lwis_reg_cache_write_needed(base_dev, entry->mod.bid, entry->mod.offset,
+						 reg_value)) {
+			return 0;
+		}
+		ret = i2c_write(i2c, entry->mod.offset, reg_value);
+		if (ret) {
+			lwis_reg_cache_invalidate(base_dev, entry->mod.bid, entry->mod.offset, 1);
+			return ret;
+		}
+		lwis_reg_cache_update(base_dev, entry->mod.bid, entry->mod.offset, reg_value);
+		return 0;
 	}
 	if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
 		return i2c_read_batch(i2c, entry->rw_batch.offset, entry->rw_batch.buf,
 				      entry->rw_batch.size_in_bytes);
 	}
 	if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+		lwis_reg_cache_invalidate(base_dev, entry->rw_batch.bid, entry->rw_batch.offset,
+					  entry->rw_batch.size_in_bytes);
 		return i2c_write_batch(i2c, entry->rw_batch.offset, entry->rw_batch.buf,
 				       entry->rw_batch.size_in_bytes);
 	}
 	dev_err(i2c->base_dev.dev, "Invalid IO entry type: %d\n", entry->type);
 	return -EINVAL;
 }
+
+static int io_entry_msg_count(struct lwis_io_entry *entry)
+{
+	/* Reads send the offset first, then read the values back */
+	if (entry->type == LWIS_IO_ENTRY_READ || entry->type == LWIS_IO_ENTRY_READ_BATCH) {
+		return 2;
+	}
+	return 1;
+}
+
+static int io_entry_scratch_bytes(struct lwis_io_entry *entry, int offset_bytes, int value_bytes)
+{
+	switch (entry->type) {
+	case LWIS_IO_ENTRY_READ:
+	case LWIS_IO_ENTRY_WRITE:
+		return offset_bytes + value_bytes;
+	case LWIS_IO_ENTRY_READ_BATCH:
+		return offset_bytes;
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		return offset_bytes + entry->rw_batch.size_in_bytes;
+	default:
+		return -EINVAL;
+	}
+}
+
+int lwis_i2c_io_entries_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+			   int num_entries)
+{
+	int i;
+	int ret = 0;
+	int bytes;
+	int num_msgs = 0;
+	size_t scratch_bytes = 0;
+	uint8_t *scratch;
+	uint8_t *buf;
+	struct i2c_msg *msgs;
+	struct i2c_msg *msg;
+	struct i2c_client *client;
+	struct lwis_io_entry *entry;
+	struct lwis_device *base_dev;
+	unsigned int offset_bits;
+	unsigned int offset_bytes;
+	unsigned int value_bits;
+	unsigned int value_bytes;
+
+	if (!i2c || !i2c->client) {
+		pr_err("Cannot find i2c instance\n");
+		return -ENODEV;
+	}
+	client = i2c->client;
+	base_dev = &i2c->base_dev;
+
+	offset_bits = i2c->base_dev.native_addr_bitwidth;
+	offset_bytes = offset_bits / BITS_PER_BYTE;
+	if (!check_bitwidth(offset_bits, MIN_OFFSET_BITS, MAX_OFFSET_BITS)) {
+		dev_err(i2c->base_dev.dev, "Invalid offset bitwidth %d\n", offset_bits);
+		return -EINVAL;
+	}
+
+	value_bits = i2c->base_dev.native_value_bitwidth;
+	value_bytes = value_bits / BITS_PER_BYTE;
+	if (!check_bitwidth(value_bits, MIN_DATA_BITS, MAX_DATA_BITS)) {
+		dev_err(i2c->base_dev.dev, "Invalid value bitwidth %d\n", value_bits);
+		return -EINVAL;
+	}
+
+	/* Adapters with message restrictions may reject the combined transfer */
+	if (client->adapter->quirks) {
+		for (i = 0; i < num_entries; ++i) {
+			ret = lwis_i2c_io_entry_rw(i2c, &entries[i]);
+			if (ret) {
+				return ret;
+			}
+		}
+		return 0;
+	}
+
+	for (i = 0; i < num_entries; ++i) {
+		entry = &entries[i];
+		bytes = io_entry_scratch_bytes(entry, offset_bytes, value_bytes);
+		if (bytes < 0) {
+			dev_err(i2c->base_dev.dev, "Invalid IO entry type: %d\n", entry->type);
+			return -EINVAL;
+		}
+		if (i2c->base_dev.is_read_only && (entry->type == LWIS_IO_ENTRY_WRITE ||
+						   entry->type == LWIS_IO_ENTRY_WRITE_BATCH)) {
+			dev_err(i2c->base_dev.dev, "Device is read only\n");
+			return -EPERM;
+		}
+		scratch_bytes += bytes;
+		num_msgs += io_entry_msg_count(entry);
+	}
+
+	/* The message vector lives at the start of the scratch buffer, followed
+	 * by the offsets and values it points to. */
+	mutex_lock(&i2c->scratch_lock);
+	msgs = (struct i2c_msg *)scratch_reserve(i2c, num_msgs * sizeof(struct i2c_msg) +
+							       scratch_bytes);
+	if (!msgs) {
+		ret = -ENOMEM;
+		goto error_unlock;
+	}
+	scratch = (uint8_t *)(msgs + num_msgs);
+
+	/* Every io_entry becomes one write message carrying the offset, followed
+	 * by a read message for reads, all sent as a single combined transfer. */
+	msg = msgs;
+	buf = scratch;
+	for (i = 0; i < num_entries; ++i) {
+		entry = &entries[i];
+		/* Skip writes of the value the register already holds */
+		if (entry->type == LWIS_IO_ENTRY_WRITE &&
+		    !lwis_reg_cache_write_needed(base_dev, entry->rw.bid, entry->rw.offset,
+						 entry->rw.val)) {
+			buf += io_entry_scratch_bytes(entry, offset_bytes, value_bytes);
+			continue;
+		}
+		msg->addr = client->addr;
+		msg->flags = 0;
+		msg->buf = buf;
+		switch (entry->type) {
+		case LWIS_IO_ENTRY_READ:
+			value_to_buf(entry->rw.offset, buf, offset_bytes);
+			msg->len = offset_bytes;
+			msg++;
+			msg->addr = client->addr;
+			msg->flags = I2C_M_RD;
+			msg->len = value_bytes;
+			msg->buf = buf + offset_bytes;
+			break;
+		case LWIS_IO_ENTRY_WRITE:
+			value_to_buf(entry->rw.offset, buf, offset_bytes);
+			value_to_buf(entry->rw.val, buf + offset_bytes, value_bytes);
+			msg->len = offset_bytes + value_bytes;
+			break;
+		case LWIS_IO_ENTRY_READ_BATCH:
+			value_to_buf(entry->rw_batch.offset, buf, offset_bytes);
+			msg->len = offset_bytes;
+			msg++;
+			msg->addr = client->addr;
+			msg->flags = I2C_M_RD;
+			msg->len = entry->rw_batch.size_in_bytes;
+			msg->buf = entry->rw_batch.buf;
+			break;
+		case LWIS_IO_ENTRY_WRITE_BATCH:
+			value_to_buf(entry->rw_batch.offset, buf, offset_bytes);
+			memcpy(buf + offset_bytes, entry->rw_batch.buf,
+			       entry->rw_batch.size_in_bytes);
+			msg->len = offset_bytes + entry->rw_batch.size_in_bytes;
+			break;
+		default:
+			break;
+		}
+		msg++;
+		buf += io_entry_scratch_bytes(entry, offset_bytes, value_bytes);
+	}
+
+	num_msgs = msg - msgs;
+	if (num_msgs > 0) {
+		ret = i2c_transfer(client->adapter, msgs, num_msgs);
+		if (ret != num_msgs) {
+			dev_err(i2c->base_dev.dev, "I2C Transfer of %d io_entries failed (%d)\n",
+				num_entries, ret);
+			ret = ret < 0 ? ret : -EIO;
+			goto error_transfer;
+		}
+	}
+
+	buf = scratch;
+	for (i = 0; i < num_entries; ++i) {
+		entry = &entries[i];
+		if (entry->type == LWIS_IO_ENTRY_READ) {
+			entry->rw.val = buf_to_value(buf + offset_bytes, value_bytes);
+			lwis_reg_cache_update(base_dev, entry->rw.bid, entry->rw.offset,
+					      entry->rw.val);
+		} else if (entry->type == LWIS_IO_ENTRY_WRITE) {
+			lwis_reg_cache_update(base_dev, entry->rw.bid, entry->rw.offset,
+					      entry->rw.val);
+		} else if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			lwis_reg_cache_invalidate(base_dev, entry->rw_batch.bid,
+						  entry->rw_batch.offset,
+						  entry->rw_batch.size_in_bytes);
+		}
+		buf += io_entry_scratch_bytes(entry, offset_bytes, value_bytes);
+	}
+	mutex_unlock(&i2c->scratch_lock);
+	return 0;
+
+error_transfer:
+	/* Some of the writes may have gone through */
+	for (i = 0; i < num_entries; ++i) {
+		entry = &entries[i];
+		if (entry->type == LWIS_IO_ENTRY_WRITE) {
+			lwis_reg_cache_invalidate(base_dev, entry->rw.bid, entry->rw.offset, 1);
+		} else if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			lwis_reg_cache_invalidate(base_dev, entry->rw_batch.bid,
+						  entry->rw_batch.offset,
+						  entry->rw_batch.size_in_bytes);
+		}
+	}
+
+error_unlock:
+	mutex_unlock(&i2c->scratch_lock);
+	return ret;
+}
@@ -29,10 +29,29 @@
  */
 int lwis_i2c_set_state(struct lwis_i2c_device *i2c, const char *state_str);
 
+/*
+ *  lwis_i2c_scratch_init: Allocate the buffer reused by all transfers of the
+ *  i2c device, so that register accesses do not allocate memory.
+ */
+int lwis_i2c_scratch_init(struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_scratch_free: Free the transfer scratch buffer of the i2c device.
+ */
+void lwis_i2c_scratch_free(struct lwis_i2c_device *i2c);
+
 /*
  *  lwis_i2c_io_entry_rw: Read/Write from i2c bus via io_entry request.
  *  The readback values will be stored in the entry.
  */
 int lwis_i2c_io_entry_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entry);
 
+/*
+ *  lwis_i2c_io_entries_rw: Execute a sequence of READ, WRITE, READ_BATCH and
+ *  WRITE_BATCH io_entries as a single combined i2c transfer.
+ *  The readback values will be stored in the entries.
+ */
+int lwis_i2c_io_entries_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+			   int num_entries);
+
 #endif /* LWIS_I2C_H_ */
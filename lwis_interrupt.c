@@ -12,12 +12,14 @@
 
 #include "lwis_interrupt.h"
 
+#include <linux/bitmap.h>
 #include <linux/kernel.h>
 #include <linux/slab.h>
 
 #include "lwis_device.h"
 #include "lwis_event.h"
 #include "lwis_platform.h"
+#include "lwis_trace.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
 
@@ -30,13 +32,16 @@ struct lwis_single_event_info {
 	bool is_critical;
 	/* Reference to the device event state */
 	struct lwis_device_event_state *state;
+	/* Number of clients with LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE set */
+	int enable_once_count;
 	/* Node in the lwis_interrupt->event_infos hash table */
 	struct hlist_node node;
-	/* Node in the lwis_interrupt->enabled_event_infos list */
+	/* Node in the lwis_interrupt->enabled_event_infos list of its bit */
 	struct list_head node_enabled;
 };
 
 static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data);
+static irqreturn_t lwis_interrupt_event_thread(int irq_number, void *data);
 static irqreturn_t lwis_interrupt_gpios_event_isr(int irq_number, void *data);
 
 struct lwis_interrupt_list *lwis_interrupt_list_alloc(struct lwis_device *lwis_dev, int count)
@@ -80,13 +85,14 @@ void lwis_interrupt_list_free(struct lwis_interrupt_list *list)
 	}
 
 	for (i = 0; i < list->count; ++i) {
+		irq_set_affinity_hint(list->irq[i].irq, NULL);
 		free_irq(list->irq[i].irq, &list->irq[i]);
 	}
 	kfree(list->irq);
 }
 
 int lwis_interrupt_get(struct lwis_interrupt_list *list, int index, char *name,
-		       struct platform_device *plat_dev)
+		       struct platform_device *plat_dev, bool threaded, int cpu)
 {
 	int irq;
 	int ret = 0;
@@ -95,6 +101,11 @@ int lwis_interrupt_get(struct lwis_interrupt_list *list, int index, char *name,
 		return -EINVAL;
 	}
 
+	if (cpu >= 0 && (cpu >= nr_cpu_ids || !cpu_possible(cpu))) {
+		dev_err(list->lwis_dev->dev, "Invalid CPU %d for interrupt %s\n", cpu, name);
+		return -EINVAL;
+	}
+
 	irq = platform_get_irq(plat_dev, index);
 	if (irq <= 0) {
 		pr_err("Error retriving interrupt %s at %d\n", name, index);
@@ -109,15 +120,30 @@ int lwis_interrupt_get(struct lwis_interrupt_list *list, int index, char *name,
 		 list->lwis_dev->name, name);
 	list->irq[index].has_events = false;
 	list->irq[index].lwis_dev = list->lwis_dev;
-
-	ret = request_irq(irq, lwis_interrupt_event_isr, IRQF_SHARED, list->irq[index].full_name,
-			  &list->irq[index]);
+	list->irq[index].threaded = threaded;
+	spin_lock_init(&list->irq[index].latch_lock);
+	list->irq[index].latched_status = 0;
+	list->irq[index].latched_timestamp = 0;
+	list->irq[index].timestamp_source = LWIS_INTERRUPT_TIMESTAMP_ENTRY;
+	list->irq[index].irq_timestamp_reg = 0;
+
+	/* The hard handler clears the status register before waking the thread,
+	 * so the line does not need to stay masked (no IRQF_ONESHOT) */
+	ret = request_threaded_irq(irq, lwis_interrupt_event_isr,
+				   threaded ? lwis_interrupt_event_thread : NULL, IRQF_SHARED,
+				   list->irq[index].full_name, &list->irq[index]);
 	if (ret) {
 		dev_err(list->lwis_dev->dev, "Failed to request IRQ %d\n", irq);
 		return ret;
 	}
 
-	if (lwis_plaform_set_default_irq_affinity(list->irq[index].irq) != 0) {
+	/* The IRQ thread follows the affinity of its interrupt */
+	if (cpu >= 0) {
+		ret = irq_set_affinity_hint(irq, cpumask_of(cpu));
+	} else {
+		ret = lwis_plaform_set_default_irq_affinity(irq);
+	}
+	if (ret != 0) {
 		dev_warn(list->lwis_dev->dev, "Interrupt %s cannot set affinity.\n",
 			 list->irq[index].full_name);
 	}
@@ -142,6 +168,8 @@ int lwis_interrupt_get_gpio_irq(struct lwis_interrupt_list *list, int index, cha
 		 list->lwis_dev->name, name);
 	list->irq[index].has_events = false;
 	list->irq[index].lwis_dev = list->lwis_dev;
+	list->irq[index].threaded = false;
+	list->irq[index].timestamp_source = LWIS_INTERRUPT_TIMESTAMP_ENTRY;
 
 	ret = request_irq(gpio_irq, lwis_interrupt_gpios_event_isr, IRQF_SHARED,
 			  list->irq[index].full_name, &list->irq[index]);
@@ -216,55 +244,34 @@ static int lwis_interrupt_set_mask(struct lwis_interrupt *irq, int int_reg_bit,
 	return ret;
 }
 
-static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
+/*
+ * Emits the enabled events of the bits set in source_value, stamped with
+ * timestamp.
+ */
+static void lwis_interrupt_event_dispatch(struct lwis_interrupt *irq, uint64_t source_value,
+					  int64_t timestamp)
 {
-	int ret;
-	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
-	struct lwis_client_event_state *event_state;
+	unsigned int bit;
 	struct lwis_single_event_info *event;
 	struct list_head *p;
-	uint64_t source_value, reset_value = 0;
-	struct lwis_client *lwis_client;
-	struct list_head *t, *n;
+	uint64_t reset_value, enable_once_value;
+	DECLARE_BITMAP(triggered_bits, LWIS_INTERRUPT_MAX_BITS);
 #ifdef LWIS_INTERRUPT_DEBUG
 	uint64_t mask_value;
 #endif
 	unsigned long flags;
 
-	/* Read the mask register */
-	ret = lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid, irq->irq_src_reg,
-					       &source_value, irq->irq_reg_access_size);
-	if (ret) {
-		dev_err(irq->lwis_dev->dev, "%s: Failed to read IRQ status register: %d\n",
-			irq->name, ret);
-		goto error;
-	}
-
-	/* Write back to the reset register */
-	ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid, irq->irq_reset_reg,
-						source_value, irq->irq_reg_access_size);
-	if (ret) {
-		dev_err(irq->lwis_dev->dev, "%s: Failed to write IRQ reset register: %d\n",
-			irq->name, ret);
-		goto error;
-	}
-
-	/* Nothing is triggered, just return */
-	if (source_value == 0) {
-		return IRQ_HANDLED;
-	}
-
 	spin_lock_irqsave(&irq->lock, flags);
-	list_for_each (p, &irq->enabled_event_infos) {
-		event = list_entry(p, struct lwis_single_event_info, node_enabled);
-
-		/* Check if this event needs to be emitted */
-		if ((source_value >> event->int_reg_bit) & 0x1) {
+	/* Only visit the bits that triggered and have enabled events */
+	reset_value = source_value & irq->enabled_mask;
+	enable_once_value = reset_value & irq->enable_once_mask;
+	bitmap_from_u64(triggered_bits, reset_value);
+	for_each_set_bit (bit, triggered_bits, LWIS_INTERRUPT_MAX_BITS) {
+		list_for_each (p, &irq->enabled_event_infos[bit]) {
+			event = list_entry(p, struct lwis_single_event_info, node_enabled);
 			/* Emit the event */
-			lwis_device_event_emit(irq->lwis_dev, event->event_id, NULL, 0,
-					       /*in_irq=*/true);
-			/* Clear this interrupt */
-			reset_value |= (1ULL << event->int_reg_bit);
+			lwis_device_event_emit_timestamped(irq->lwis_dev, event->event_id, NULL,
+							   0, timestamp, /*in_irq=*/true);
 
 			/* If considered critical, print the event */
 			if (event->is_critical) {
@@ -272,28 +279,13 @@ static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
 						    "Caught critical IRQ(%s) event(0x%llx)\n",
 						    irq->name, event->event_id);
 			}
-			/* If enabled once, set interrupt mask to false */
-			list_for_each_safe (t, n, &irq->lwis_dev->clients) {
-				lwis_client = list_entry(t, struct lwis_client, node);
-				hash_for_each_possible (lwis_client->event_states, event_state,
-							node, event->event_id) {
-					if (event_state->event_control.event_id ==
-						    event->event_id &&
-					    event_state->event_control.flags &
-						    LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE) {
-						dev_err(irq->lwis_dev->dev,
-							"IRQ(%s) event(0x%llx) enabled once\n",
-							irq->name, event->event_id);
-						lwis_interrupt_set_mask(irq, event->int_reg_bit,
-									false);
-					}
-				}
-			}
 		}
 
-		/* All enabled and triggered interrupts are handled */
-		if (source_value == reset_value) {
-			break;
+		/* If enabled once, set interrupt mask to false */
+		if ((enable_once_value >> bit) & 0x1) {
+			dev_err(irq->lwis_dev->dev, "IRQ(%s) bit %u enabled once\n", irq->name,
+				bit);
+			lwis_interrupt_set_mask(irq, bit, false);
 		}
 	}
 	spin_unlock_irqrestore(&irq->lock, flags);
@@ -320,28 +312,167 @@ static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
 		}
 	}
 #endif
+}
+
+/*
+ * Converts the time sampled at ISR entry into the event timestamp, reading
+ * the timestamp register if the interrupt has one.
+ */
+static int64_t lwis_interrupt_event_timestamp(struct lwis_interrupt *irq, int64_t entry_time,
+					      uint64_t entry_counter)
+{
+	uint64_t timestamp_value;
+
+	switch (irq->timestamp_source) {
+	case LWIS_INTERRUPT_TIMESTAMP_COUNTER:
+		return ktime_to_ns(lwis_counter_to_time(entry_counter, 64));
+	case LWIS_INTERRUPT_TIMESTAMP_REGISTER:
+		if (lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid,
+						     irq->irq_timestamp_reg, &timestamp_value,
+						     irq->irq_reg_access_size)) {
+			dev_err_ratelimited(irq->lwis_dev->dev,
+					    "%s: Failed to read IRQ timestamp register\n",
+					    irq->name);
+			return entry_time;
+		}
+		return ktime_to_ns(lwis_counter_to_time(
+			timestamp_value, irq->irq_reg_access_size * BITS_PER_BYTE));
+	default:
+		return entry_time;
+	}
+}
+
+static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
+{
+	int ret;
+	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
+	uint64_t source_value;
+	uint64_t entry_counter = 0;
+	int64_t entry_time = 0;
+	int64_t timestamp;
+
+	/* Sample the time first, the register accesses below can be slow */
+	if (irq->timestamp_source == LWIS_INTERRUPT_TIMESTAMP_COUNTER) {
+		entry_counter = lwis_counter_read();
+	} else {
+		entry_time = ktime_to_ns(lwis_get_time());
+	}
+
+	trace_lwis_irq_enter(irq->lwis_dev, irq_number);
+
+	/* Read the mask register */
+	ret = lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid, irq->irq_src_reg,
+					       &source_value, irq->irq_reg_access_size);
+	if (ret) {
+		dev_err(irq->lwis_dev->dev, "%s: Failed to read IRQ status register: %d\n",
+			irq->name, ret);
+		goto error;
+	}
+
+	/* Write back to the reset register */
+	ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid, irq->irq_reset_reg,
+						source_value, irq->irq_reg_access_size);
+	if (ret) {
+		dev_err(irq->lwis_dev->dev, "%s: Failed to write IRQ reset register: %d\n",
+			irq->name, ret);
+		goto error;
+	}
+
+	/* Nothing is triggered, just return */
+	if (source_value == 0) {
+		trace_lwis_irq_exit(irq->lwis_dev, irq_number, source_value);
+		return IRQ_HANDLED;
+	}
+
+	timestamp = lwis_interrupt_event_timestamp(irq, entry_time, entry_counter);
+
+	/* Leave the event dispatch to the IRQ thread. Bits accumulate until
+	 * the thread picks them up, stamped with the oldest interrupt. */
+	if (irq->threaded) {
+		spin_lock(&irq->latch_lock);
+		if (irq->latched_status == 0) {
+			irq->latched_timestamp = timestamp;
+		}
+		irq->latched_status |= source_value;
+		spin_unlock(&irq->latch_lock);
+		trace_lwis_irq_exit(irq->lwis_dev, irq_number, source_value);
+		return IRQ_WAKE_THREAD;
+	}
+
+	lwis_interrupt_event_dispatch(irq, source_value, timestamp);
+	trace_lwis_irq_exit(irq->lwis_dev, irq_number, source_value);
+	return IRQ_HANDLED;
+
 error:
+	trace_lwis_irq_exit(irq->lwis_dev, irq_number, 0);
+	return IRQ_HANDLED;
+}
+
+static irqreturn_t lwis_interrupt_event_thread(int irq_number, void *data)
+{
+	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
+	uint64_t source_value;
+	int64_t timestamp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&irq->latch_lock, flags);
+	source_value = irq->latched_status;
+	timestamp = irq->latched_timestamp;
+	irq->latched_status = 0;
+	spin_unlock_irqrestore(&irq->latch_lock, flags);
+	if (source_value != 0) {
+		lwis_interrupt_event_dispatch(irq, source_value, timestamp);
+	}
+
 	return IRQ_HANDLED;
 }
 
 static irqreturn_t lwis_interrupt_gpios_event_isr(int irq_number, void *data)
 {
 	unsigned long flags;
+	unsigned int bit;
 	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
 	struct lwis_single_event_info *event;
 	struct list_head *p;
+	DECLARE_BITMAP(enabled_bits, LWIS_INTERRUPT_MAX_BITS);
+	int64_t timestamp = ktime_to_ns(lwis_get_time());
 
+	trace_lwis_irq_enter(irq->lwis_dev, irq_number);
 	spin_lock_irqsave(&irq->lock, flags);
-	list_for_each (p, &irq->enabled_event_infos) {
-		event = list_entry(p, struct lwis_single_event_info, node_enabled);
-		/* Emit the event */
-		lwis_device_event_emit(irq->lwis_dev, event->event_id, NULL, 0, /*in_irq=*/true);
+	bitmap_from_u64(enabled_bits, irq->enabled_mask);
+	for_each_set_bit (bit, enabled_bits, LWIS_INTERRUPT_MAX_BITS) {
+		list_for_each (p, &irq->enabled_event_infos[bit]) {
+			event = list_entry(p, struct lwis_single_event_info, node_enabled);
+			/* Emit the event */
+			lwis_device_event_emit_timestamped(irq->lwis_dev, event->event_id, NULL,
+							   0, timestamp, /*in_irq=*/true);
+		}
 	}
 	spin_unlock_irqrestore(&irq->lock, flags);
+	trace_lwis_irq_exit(irq->lwis_dev, irq_number, 0);
 
 	return IRQ_HANDLED;
 }
 
+/*
+ * Resets the event tables of the interrupt before its events are filled in.
+ *
+ * Assumes: irq->lock is locked
+ */
+static void lwis_interrupt_event_tables_init_locked(struct lwis_interrupt *irq)
+{
+	int bit;
+
+	/* Empty hash table for event infos */
+	hash_init(irq->event_infos);
+	/* Initialize empty lists for enabled events */
+	for (bit = 0; bit < LWIS_INTERRUPT_MAX_BITS; bit++) {
+		INIT_LIST_HEAD(&irq->enabled_event_infos[bit]);
+	}
+	irq->enabled_mask = 0;
+	irq->enable_once_mask = 0;
+}
+
 int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 				  const char *irq_reg_space, int irq_reg_bid, int64_t *irq_events,
 				  size_t irq_events_num, uint32_t *int_reg_bits,
@@ -368,16 +499,20 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 	list->irq[index].irq_mask_reg = irq_mask_reg;
 	list->irq[index].mask_toggled = mask_toggled;
 	list->irq[index].irq_reg_access_size = irq_reg_access_size;
-	/* Empty hash table for event infos */
-	hash_init(list->irq[index].event_infos);
-	/* Initialize an empty list for enabled events */
-	INIT_LIST_HEAD(&list->irq[index].enabled_event_infos);
+	lwis_interrupt_event_tables_init_locked(&list->irq[index]);
 	spin_unlock_irqrestore(&list->irq[index].lock, flags);
 
 	/* Build the hash table of events we can emit */
 	for (i = 0; i < irq_events_num; i++) {
-		struct lwis_single_event_info *new_event =
-			kzalloc(sizeof(struct lwis_single_event_info), GFP_KERNEL);
+		struct lwis_single_event_info *new_event;
+
+		if (int_reg_bits[i] >= LWIS_INTERRUPT_MAX_BITS) {
+			dev_err(list->lwis_dev->dev, "Invalid int-reg-bit %u for IRQ: %s\n",
+				int_reg_bits[i], list->irq[index].name);
+			return -EINVAL;
+		}
+
+		new_event = kzalloc(sizeof(struct lwis_single_event_info), GFP_KERNEL);
 		if (!new_event) {
 			return -ENOMEM;
 		}
@@ -393,6 +528,12 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 
 		/* Fill the device id info in event id bit[47..32] */
 		irq_events[i] |= (int64_t)(list->lwis_dev->id & 0xFFFF) << 32;
+		lwis_device_event_state_table_reserve(list->lwis_dev, irq_events[i]);
+		if (!lwis_device_event_state_table_covers(list->lwis_dev, irq_events[i])) {
+			dev_warn(list->lwis_dev->dev,
+				 "IRQ event 0x%llx is not in the event state table\n",
+				 irq_events[i]);
+		}
 		/* Grab the device state outside of the spinlock */
 		new_event->state =
 			lwis_device_event_state_find_or_create(list->lwis_dev, irq_events[i]);
@@ -426,6 +567,25 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 	return 0;
 }
 
+int lwis_interrupt_set_timestamp_source(struct lwis_interrupt_list *list, int index,
+					enum lwis_interrupt_timestamp_source source,
+					int64_t timestamp_reg)
+{
+	if (!list || index < 0 || index >= list->count) {
+		return -EINVAL;
+	}
+
+	if (source != LWIS_INTERRUPT_TIMESTAMP_ENTRY && !lwis_counter_available()) {
+		dev_err(list->lwis_dev->dev, "No system counter for IRQ %s timestamps\n",
+			list->irq[index].name);
+		return -EOPNOTSUPP;
+	}
+
+	list->irq[index].timestamp_source = source;
+	list->irq[index].irq_timestamp_reg = timestamp_reg;
+	return 0;
+}
+
 int lwis_interrupt_set_gpios_event_info(struct lwis_interrupt_list *list, int index,
 					int64_t irq_event)
 {
@@ -434,10 +594,7 @@ int lwis_interrupt_set_gpios_event_info(struct lwis_interrupt_list *list, int in
 
 	/* Protect the structure */
 	spin_lock_irqsave(&list->irq[index].lock, flags);
-	/* Empty hash table for event infos */
-	hash_init(list->irq[index].event_infos);
-	/* Initialize an empty list for enabled events */
-	INIT_LIST_HEAD(&list->irq[index].enabled_event_infos);
+	lwis_interrupt_event_tables_init_locked(&list->irq[index]);
 	spin_unlock_irqrestore(&list->irq[index].lock, flags);
 
 	/* Build the hash table of events we can emit */
@@ -450,6 +607,11 @@ int lwis_interrupt_set_gpios_event_info(struct lwis_interrupt_list *list, int in
 
 	/* Fill the device id info in event id bit[47..32] */
 	irq_event |= (int64_t)(list->lwis_dev->id & 0xFFFF) << 32;
+	lwis_device_event_state_table_reserve(list->lwis_dev, irq_event);
+	if (!lwis_device_event_state_table_covers(list->lwis_dev, irq_event)) {
+		dev_warn(list->lwis_dev->dev, "IRQ event 0x%llx is not in the event state table\n",
+			 irq_event);
+	}
 	/* Grab the device state outside of the spinlock */
 	new_event->state = lwis_device_event_state_find_or_create(list->lwis_dev, irq_event);
 	new_event->event_id = irq_event;
@@ -497,9 +659,13 @@ static int lwis_interrupt_single_event_enable_locked(struct lwis_interrupt *irq,
 	}
 
 	if (enabled) {
-		list_add_tail(&event->node_enabled, &irq->enabled_event_infos);
+		list_add_tail(&event->node_enabled, &irq->enabled_event_infos[event->int_reg_bit]);
+		irq->enabled_mask |= (1ULL << event->int_reg_bit);
 	} else {
 		list_del(&event->node_enabled);
+		if (list_empty(&irq->enabled_event_infos[event->int_reg_bit])) {
+			irq->enabled_mask &= ~(1ULL << event->int_reg_bit);
+		}
 	}
 
 	/* If mask_toggled is set, reverse the enable/disable logic. */
@@ -532,6 +698,81 @@ int lwis_interrupt_event_enable(struct lwis_interrupt_list *list, int64_t event_
 	return ret;
 }
 
+/*
+ * Recomputes whether the bit of the event needs masking once it triggers.
+ *
+ * Assumes: irq->lock is locked
+ */
+static void lwis_interrupt_enable_once_update_locked(struct lwis_interrupt *irq, int int_reg_bit)
+{
+	int i;
+	struct lwis_single_event_info *p;
+
+	irq->enable_once_mask &= ~(1ULL << int_reg_bit);
+	hash_for_each (irq->event_infos, i, p, node) {
+		if (p->int_reg_bit == int_reg_bit && p->enable_once_count > 0) {
+			irq->enable_once_mask |= (1ULL << int_reg_bit);
+			return;
+		}
+	}
+}
+
+int lwis_interrupt_event_enable_once(struct lwis_interrupt_list *list, int64_t event_id,
+				     bool enabled)
+{
+	int index, ret = -EINVAL;
+	unsigned long flags;
+	struct lwis_single_event_info *event;
+
+	if (!list) {
+		pr_err("Interrupt list is NULL.\n");
+		return -EINVAL;
+	}
+
+	for (index = 0; index < list->count; index++) {
+		spin_lock_irqsave(&list->irq[index].lock, flags);
+		event = lwis_interrupt_get_single_event_info_locked(&list->irq[index], event_id);
+		if (event) {
+			if (enabled) {
+				event->enable_once_count++;
+			} else if (event->enable_once_count > 0) {
+				event->enable_once_count--;
+			}
+			lwis_interrupt_enable_once_update_locked(&list->irq[index],
+								 event->int_reg_bit);
+			ret = 0;
+		}
+		spin_unlock_irqrestore(&list->irq[index].lock, flags);
+	}
+	return ret;
+}
+
+int lwis_interrupt_event_mask(struct lwis_interrupt_list *list, int64_t event_id, bool masked)
+{
+	int index, ret = -EINVAL;
+	unsigned long flags;
+	bool is_set;
+	struct lwis_single_event_info *event;
+
+	if (!list) {
+		pr_err("Interrupt list is NULL.\n");
+		return -EINVAL;
+	}
+
+	for (index = 0; index < list->count; index++) {
+		spin_lock_irqsave(&list->irq[index].lock, flags);
+		event = lwis_interrupt_get_single_event_info_locked(&list->irq[index], event_id);
+		if (event) {
+			/* If mask_toggled is set, reverse the enable/disable logic. */
+			is_set = (!list->irq[index].mask_toggled) ? !masked : masked;
+			ret = lwis_interrupt_set_mask(&list->irq[index], event->int_reg_bit,
+						      is_set);
+		}
+		spin_unlock_irqrestore(&list->irq[index].lock, flags);
+	}
+	return ret;
+}
+
 void lwis_interrupt_print(struct lwis_interrupt_list *list)
 {
 	int i;
@@ -11,6 +11,7 @@
 #ifndef LWIS_INTERRUPT_H_
 #define LWIS_INTERRUPT_H_
 
+#include <linux/atomic.h>
 #include <linux/hashtable.h>
 #include <linux/interrupt.h>
 #include <linux/list.h>
@@ -18,6 +19,22 @@
 
 #define EVENT_INFO_HASH_BITS 8
 #define IRQ_FULL_NAME_LENGTH 32
+/* Width of the status/reset/mask registers */
+#define LWIS_INTERRUPT_MAX_BITS 64
+
+/*
+ * Where the timestamp of the events emitted by an interrupt comes from. They
+ * are all converted to the lwis_get_time clock.
+ */
+enum lwis_interrupt_timestamp_source {
+	/* lwis_get_time at ISR entry */
+	LWIS_INTERRUPT_TIMESTAMP_ENTRY = 0,
+	/* System counter sampled at ISR entry */
+	LWIS_INTERRUPT_TIMESTAMP_COUNTER,
+	/* Hardware register latching the system counter when the interrupt
+	 * fired */
+	LWIS_INTERRUPT_TIMESTAMP_REGISTER,
+};
 
 struct lwis_interrupt {
 	int irq;
@@ -31,6 +48,21 @@ struct lwis_interrupt {
 	spinlock_t lock;
 	/* Flag if the event info has been set */
 	bool has_events;
+	/* Dispatch events from an IRQ thread, leaving only the status read and
+	 * reset to the hard IRQ handler */
+	bool threaded;
+	/* Protects the status and timestamp latched for the IRQ thread */
+	spinlock_t latch_lock;
+	/* Status bits latched by the hard IRQ handler for the IRQ thread */
+	/* GUARDED_BY(latch_lock) */
+	uint64_t latched_status;
+	/* Timestamp of the oldest interrupt in latched_status */
+	/* GUARDED_BY(latch_lock) */
+	int64_t latched_timestamp;
+	/* Source of the event timestamps */
+	enum lwis_interrupt_timestamp_source timestamp_source;
+	/* Offset of the timestamp register, for LWIS_INTERRUPT_TIMESTAMP_REGISTER */
+	int64_t irq_timestamp_reg;
 	/* BID of the register space where the status/reset/mask for this ISR
 	 * can be accessed */
 	int irq_reg_bid;
@@ -48,9 +80,16 @@ struct lwis_interrupt {
 	/* Hash table of event info */
 	/* GUARDED_BY(lock) */
 	DECLARE_HASHTABLE(event_infos, EVENT_INFO_HASH_BITS);
-	/* List of enabled events */
+	/* Lists of enabled events, indexed by their bit in the status register */
 	/* GUARDED_BY(lock) */
-	struct list_head enabled_event_infos;
+	struct list_head enabled_event_infos[LWIS_INTERRUPT_MAX_BITS];
+	/* Bits that have at least one enabled event */
+	/* GUARDED_BY(lock) */
+	uint64_t enabled_mask;
+	/* Bits to be masked the first time they trigger, because a client
+	 * enabled one of their events with LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE */
+	/* GUARDED_BY(lock) */
+	uint64_t enable_once_mask;
 };
 
 /*
@@ -77,11 +116,13 @@ struct lwis_interrupt_list *lwis_interrupt_list_alloc(struct lwis_device *lwis_d
 void lwis_interrupt_list_free(struct lwis_interrupt_list *list);
 
 /*
- *  lwis_interrupt_get: Register the interrupt by index.
+ *  lwis_interrupt_get: Register the interrupt by index. If threaded is set,
+ *  events are dispatched from an IRQ thread. A cpu >= 0 pins the interrupt,
+ *  and its thread, to that CPU instead of the platform default.
  *  Returns: 0 if success, -ve if error
  */
 int lwis_interrupt_get(struct lwis_interrupt_list *list, int index, char *name,
-		       struct platform_device *plat_dev);
+		       struct platform_device *plat_dev, bool threaded, int cpu);
 
 /*
  *  lwis_interrupt_get_gpio_irq: Register the GPIO interrupt by index
@@ -106,6 +147,18 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 				  int irq_reg_access_size, int64_t *critical_events,
 				  size_t critical_events_num);
 
+/*
+ * lwis_interrupt_set_timestamp_source: Selects where the timestamps of the
+ * events of the interrupt at index come from. timestamp_reg is only used with
+ * LWIS_INTERRUPT_TIMESTAMP_REGISTER, it is read with the same access size as
+ * the status register, from the same register space.
+ *
+ * Returns: 0 on success
+ */
+int lwis_interrupt_set_timestamp_source(struct lwis_interrupt_list *list, int index,
+					enum lwis_interrupt_timestamp_source source,
+					int64_t timestamp_reg);
+
 /*
  * lwis_interrupt_set_gpios_event_info: Provides event-info structure for a given
  * interrupt based on index
@@ -126,6 +179,31 @@ int lwis_interrupt_set_gpios_event_info(struct lwis_interrupt_list *list, int in
  */
 int lwis_interrupt_event_enable(struct lwis_interrupt_list *list, int64_t event_id, bool enabled);
 
+/*
+ * lwis_interrupt_event_enable_once: Tracks a client turning
+ * LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE_ONCE on or off for an event, so that the
+ * ISR masks the event's bit after it first triggers without looking at the
+ * clients.
+ *
+ * Locks: May lock list->irq[index].lock
+ * Alloc: No
+ * Returns: 0 on success
+ *          -EINVAL if event not known to this list
+ */
+int lwis_interrupt_event_enable_once(struct lwis_interrupt_list *list, int64_t event_id,
+				     bool enabled);
+
+/*
+ * lwis_interrupt_event_mask: Masks or unmasks the interrupt of an enabled
+ * event in the mask register only, leaving the event enabled.
+ *
+ * Locks: May lock list->irq[index].lock
+ * Alloc: No
+ * Returns: 0 on success
+ *          -EINVAL if event not known to this list
+ */
+int lwis_interrupt_event_mask(struct lwis_interrupt_list *list, int64_t event_id, bool masked);
+
 /*
  *  lwis_interrupt_print: Debug function to print all the interrupts in the
  *  supplied list.
@@ -10,56 +10,195 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME "-ioentry: " fmt
 
+#include <linux/bitops.h>
 #include <linux/delay.h>
+#include <linux/jiffies.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
 
+#include "lwis_event.h"
 #include "lwis_io_entry.h"
 #include "lwis_util.h"
 
+/* POLL entries spin on the register for this long before sleeping */
+#define POLL_SPIN_US 20
+/* First sleep between two reads, doubled every time up to the longest one */
+#define POLL_MIN_INTERVAL_US 10
+#define POLL_MAX_INTERVAL_US 1000
+
+static int io_entry_read_assert(struct lwis_device *lwis_dev,
+				const struct lwis_io_entry_read_assert *read_assert)
+{
+	uint64_t val;
+	int ret = 0;
+
+	ret = lwis_device_single_register_read(lwis_dev, read_assert->bid, read_assert->offset,
+					       &val, lwis_dev->native_value_bitwidth);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to read registers: block %d offset 0x%llx\n",
+			read_assert->bid, read_assert->offset);
+		return ret;
+	}
+	if ((val & read_assert->mask) == (read_assert->val & read_assert->mask)) {
+		return 0;
+	}
+	return -EINVAL;
+}
+
 int lwis_io_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry, bool non_blocking)
 {
-	uint64_t val, start;
-	uint64_t timeout_ms = entry->read_assert.timeout_ms;
+	ktime_t start;
+	ktime_t now;
+	ktime_t deadline;
+	struct lwis_io_entry_read_assert poll;
+	int64_t event_id = LWIS_EVENT_ID_NONE;
+	int64_t event_counter = 0;
+	uint64_t interval_us = POLL_MIN_INTERVAL_US;
+	uint64_t remaining_us;
 	int ret = 0;
 
-	/* Only read and check once if non_blocking */
-	if (non_blocking) {
-		timeout_ms = 0;
+	if (entry->type == LWIS_IO_ENTRY_POLL_EVENT) {
+		poll.bid = entry->poll_event.bid;
+		poll.offset = entry->poll_event.offset;
+		poll.val = entry->poll_event.val;
+		poll.mask = entry->poll_event.mask;
+		poll.timeout_ms = entry->poll_event.timeout_ms;
+		event_id = entry->poll_event.event_id;
+	} else {
+		poll = entry->read_assert;
+	}
+
+	if (!non_blocking && event_id != LWIS_EVENT_ID_NONE) {
+		event_counter = lwis_device_event_counter_get(lwis_dev, event_id);
+		if (event_counter < 0) {
+			dev_err(lwis_dev->dev, "Polling on unknown event 0x%llx\n", event_id);
+			return -EINVAL;
+		}
 	}
 
 	/* Read until getting the expected value or timeout */
-	val = ~entry->read_assert.val;
-	start = ktime_to_ms(lwis_get_time());
-	while (val != entry->read_assert.val) {
-		ret = lwis_io_entry_read_assert(lwis_dev, entry);
+	start = lwis_get_time();
+	deadline = ktime_add_ms(start, poll.timeout_ms);
+	while (true) {
+		ret = io_entry_read_assert(lwis_dev, &poll);
 		if (ret == 0) {
 			break;
 		}
-		if (ktime_to_ms(lwis_get_time()) - start > timeout_ms) {
+		now = lwis_get_time();
+		/* Only read and check once if non_blocking */
+		if (non_blocking || ktime_after(now, deadline)) {
 			dev_err(lwis_dev->dev, "Polling timed out: block %d offset 0x%llx\n",
-				entry->read_assert.bid, entry->read_assert.offset);
+				poll.bid, poll.offset);
 			return -ETIMEDOUT;
 		}
-		/* Sleep for 1ms */
-		usleep_range(1000, 1000);
+		remaining_us = ktime_us_delta(deadline, now) + 1;
+
+		if (event_id != LWIS_EVENT_ID_NONE) {
+			/* Read again once the device emitted the event, e.g. an IRQ
+			 * signalling the status change */
+			wait_event_timeout(lwis_dev->event_wait_queue,
+					   lwis_device_event_counter_get(lwis_dev, event_id) !=
+						   event_counter,
+					   usecs_to_jiffies(remaining_us));
+			event_counter = lwis_device_event_counter_get(lwis_dev, event_id);
+			continue;
+		}
+
+		/* Spin briefly for bits that clear right away, then sleep with
+		 * an interval growing up to POLL_MAX_INTERVAL_US */
+		if (ktime_us_delta(now, start) < POLL_SPIN_US) {
+			cpu_relax();
+			continue;
+		}
+		interval_us = min(interval_us, remaining_us);
+		usleep_range(interval_us, interval_us + interval_us / 4);
+		interval_us = min_t(uint64_t, interval_us * 2, POLL_MAX_INTERVAL_US);
 	}
 	return ret;
 }
 
 int lwis_io_entry_read_assert(struct lwis_device *lwis_dev, struct lwis_io_entry *entry)
 {
-	uint64_t val;
-	int ret = 0;
+	return io_entry_read_assert(lwis_dev, &entry->read_assert);
+}
 
-	ret = lwis_device_single_register_read(lwis_dev, entry->read_assert.bid,
-					       entry->read_assert.offset, &val,
-					       lwis_dev->native_value_bitwidth);
-	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to read registers: block %d offset 0x%llx\n",
-			entry->read_assert.bid, entry->read_assert.offset);
-		return ret;
+/* Block accessed by a register io_entry, -1 for entries without registers */
+static int io_entry_bid(const struct lwis_io_entry *entry)
+{
+	switch (entry->type) {
+	case LWIS_IO_ENTRY_READ:
+	case LWIS_IO_ENTRY_WRITE:
+		return entry->rw.bid;
+	case LWIS_IO_ENTRY_READ_BATCH:
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		return entry->rw_batch.bid;
+	case LWIS_IO_ENTRY_MODIFY:
+		return entry->mod.bid;
+	case LWIS_IO_ENTRY_POLL:
+	case LWIS_IO_ENTRY_READ_ASSERT:
+		return entry->read_assert.bid;
+	case LWIS_IO_ENTRY_POLL_EVENT:
+		return entry->poll_event.bid;
+	case LWIS_IO_ENTRY_READ_BATCH_TO_BUFFER:
+		return entry->read_to_buffer.bid;
+	default:
+		return -1;
 	}
-	if ((val & entry->read_assert.mask) == (entry->read_assert.val & entry->read_assert.mask)) {
-		return 0;
+}
+
+bool lwis_io_entry_locks_get(struct lwis_device *lwis_dev, const struct lwis_io_entry *entries,
+			     int num_entries, uint64_t *block_mask)
+{
+	int i;
+	int bid;
+	bool device_lock = false;
+
+	*block_mask = 0;
+	for (i = 0; i < num_entries; ++i) {
+		if (entries[i].type == LWIS_IO_ENTRY_CLOCK_SET ||
+		    entries[i].type == LWIS_IO_ENTRY_QOS_VOTE) {
+			continue;
+		}
+		bid = io_entry_bid(&entries[i]);
+		if (bid >= 0 && bid < 64 && (lwis_dev->independent_block_mask & BIT_ULL(bid))) {
+			*block_mask |= BIT_ULL(bid);
+		} else {
+			device_lock = true;
+		}
+	}
+	/* Nothing to serialize against, keep the usual lock */
+	return device_lock || *block_mask == 0;
+}
+
+void lwis_io_entry_lock(struct lwis_device *lwis_dev, bool device_lock, uint64_t block_mask)
+{
+	int bid;
+	uint64_t mask = block_mask & lwis_dev->independent_block_mask;
+
+	if (device_lock) {
+		mutex_lock(&lwis_dev->reg_rw_lock);
+	}
+	/* Always in bid order, the subclass being the rank among the independent
+	 * blocks of the device */
+	while (mask) {
+		bid = __ffs64(mask);
+		mutex_lock_nested(&lwis_dev->block_locks[bid],
+				  hweight64(lwis_dev->independent_block_mask & (BIT_ULL(bid) - 1)));
+		mask &= mask - 1;
+	}
+}
+
+void lwis_io_entry_unlock(struct lwis_device *lwis_dev, bool device_lock, uint64_t block_mask)
+{
+	int bid;
+	uint64_t mask = block_mask & lwis_dev->independent_block_mask;
+
+	while (mask) {
+		bid = __ffs64(mask);
+		mutex_unlock(&lwis_dev->block_locks[bid]);
+		mask &= mask - 1;
+	}
+	if (device_lock) {
+		mutex_unlock(&lwis_dev->reg_rw_lock);
 	}
-	return -EINVAL;
 }
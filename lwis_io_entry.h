@@ -17,6 +17,8 @@
 /*
  * lwis_io_entry_poll:
  * Polls a register for a specified time or until it reaches the expected value.
+ * Reads are spaced out with a sleep growing up to 1ms, or paced by the event
+ * of LWIS_IO_ENTRY_POLL_EVENT entries.
  */
 int lwis_io_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 		       bool non_blocking);
@@ -27,4 +29,26 @@ int lwis_io_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry
  */
 int lwis_io_entry_read_assert(struct lwis_device *lwis_dev, struct lwis_io_entry *entry);
 
+/*
+ * lwis_io_entry_locks_get:
+ * Computes the register locks needed to run the io_entries. block_mask is set
+ * to the independent blocks they touch. Returns whether reg_rw_lock is needed
+ * as well, i.e. unless the entries only touch independent blocks.
+ */
+bool lwis_io_entry_locks_get(struct lwis_device *lwis_dev, const struct lwis_io_entry *entries,
+			     int num_entries, uint64_t *block_mask);
+
+/*
+ * lwis_io_entry_lock:
+ * Takes reg_rw_lock if device_lock is set, then the locks of the independent
+ * blocks in block_mask.
+ */
+void lwis_io_entry_lock(struct lwis_device *lwis_dev, bool device_lock, uint64_t block_mask);
+
+/*
+ * lwis_io_entry_unlock:
+ * Releases the locks taken by lwis_io_entry_lock.
+ */
+void lwis_io_entry_unlock(struct lwis_device *lwis_dev, bool device_lock, uint64_t block_mask);
+
 #endif /* LWIS_IO_ENTRY_H_ */
\ No newline at end of file
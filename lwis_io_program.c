@@ -0,0 +1,155 @@
+/*
+ * Google LWIS Registered I/O Entry Programs
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-io-program: " fmt
+
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "lwis_allocator.h"
+#include "lwis_io_program.h"
+
+static void io_program_release(struct kref *ref)
+{
+	size_t i;
+	struct lwis_io_program *program = container_of(ref, struct lwis_io_program, ref);
+
+	for (i = 0; i < program->num_io_entries; ++i) {
+		if (program->io_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			lwis_allocator_free(program->lwis_dev, program->io_entries[i].rw_batch.buf);
+		}
+	}
+	lwis_allocator_free(program->lwis_dev, program->io_entries);
+	kfree(program);
+}
+
+int lwis_io_program_register(struct lwis_client *lwis_client, const char *name,
+			     struct lwis_io_entry *io_entries, size_t num_io_entries,
+			     int32_t *handle)
+{
+	struct lwis_io_program *program;
+
+	program = kzalloc(sizeof(*program), GFP_KERNEL);
+	if (!program) {
+		dev_err(lwis_client->lwis_dev->dev, "Failed to allocate io_entry program\n");
+		return -ENOMEM;
+	}
+
+	strlcpy(program->name, name, sizeof(program->name));
+	program->lwis_dev = lwis_client->lwis_dev;
+	program->num_io_entries = num_io_entries;
+	program->io_entries = io_entries;
+	kref_init(&program->ref);
+
+	program->handle = ++lwis_client->io_program_counter;
+	hash_add(lwis_client->io_programs, &program->node, program->handle);
+	*handle = program->handle;
+
+	return 0;
+}
+
+struct lwis_io_program *lwis_io_program_find(struct lwis_client *lwis_client, int32_t handle)
+{
+	struct lwis_io_program *p;
+
+	hash_for_each_possible (lwis_client->io_programs, p, node, handle) {
+		if (p->handle == handle) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+int lwis_io_program_unregister(struct lwis_client *lwis_client, int32_t handle)
+{
+	struct lwis_io_program *program;
+
+	program = lwis_io_program_find(lwis_client, handle);
+	if (!program) {
+		dev_err(lwis_client->lwis_dev->dev, "Cannot find io_entry program %d\n", handle);
+		return -ENOENT;
+	}
+
+	hash_del(&program->node);
+	kref_put(&program->ref, io_program_release);
+	return 0;
+}
+
+int lwis_io_program_instantiate(struct lwis_io_program *program,
+				struct lwis_io_entry_patch *patches, size_t num_patches,
+				struct lwis_io_entry **io_entries)
+{
+	size_t i;
+	struct lwis_io_entry *k_entries;
+	struct lwis_io_entry *entry;
+
+	/* Validate the patches before copying anything */
+	for (i = 0; i < num_patches; ++i) {
+		if (patches[i].index >= program->num_io_entries) {
+			dev_err(program->lwis_dev->dev,
+				"Patch index %u out of range of program %s (%zu entries)\n",
+				patches[i].index, program->name, program->num_io_entries);
+			return -EINVAL;
+		}
+		entry = &program->io_entries[patches[i].index];
+		if (entry->type != LWIS_IO_ENTRY_WRITE && entry->type != LWIS_IO_ENTRY_MODIFY) {
+			dev_err(program->lwis_dev->dev,
+				"Entry %u of program %s has no value to patch (type %d)\n",
+				patches[i].index, program->name, entry->type);
+			return -EINVAL;
+		}
+	}
+
+	k_entries = lwis_allocator_allocate(program->lwis_dev,
+					    program->num_io_entries * sizeof(struct lwis_io_entry));
+	if (!k_entries) {
+		dev_err(program->lwis_dev->dev, "Failed to allocate io entries of program %s\n",
+			program->name);
+		return -ENOMEM;
+	}
+	memcpy(k_entries, program->io_entries,
+	       program->num_io_entries * sizeof(struct lwis_io_entry));
+
+	for (i = 0; i < num_patches; ++i) {
+		entry = &k_entries[patches[i].index];
+		if (entry->type == LWIS_IO_ENTRY_WRITE) {
+			entry->rw.val = patches[i].val;
+		} else {
+			entry->mod.val = patches[i].val;
+		}
+	}
+
+	kref_get(&program->ref);
+	*io_entries = k_entries;
+	return 0;
+}
+
+void lwis_io_program_put(struct lwis_io_program *program)
+{
+	kref_put(&program->ref, io_program_release);
+}
+
+int lwis_client_io_programs_clear(struct lwis_client *lwis_client)
+{
+	struct lwis_io_program *program;
+	struct hlist_node *n;
+	int i;
+
+	if (!lwis_client) {
+		pr_err("lwis_client_io_programs_clear: LWIS client is NULL\n");
+		return -ENODEV;
+	}
+
+	hash_for_each_safe (lwis_client->io_programs, i, n, program, node) {
+		hash_del(&program->node);
+		kref_put(&program->ref, io_program_release);
+	}
+	return 0;
+}
@@ -0,0 +1,103 @@
+/*
+ * Google LWIS Registered I/O Entry Programs
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_IO_PROGRAM_H_
+#define LWIS_IO_PROGRAM_H_
+
+#include <linux/kref.h>
+#include <linux/list.h>
+
+#include "lwis_commands.h"
+#include "lwis_device.h"
+
+/*
+ *  struct lwis_io_program
+ *  io_entries copied into the kernel once, together with their write batch
+ *  buffers, so that transactions can run them by handle. Transactions built
+ *  from a program hold a reference and share its write batch buffers.
+ */
+struct lwis_io_program {
+	int32_t handle;
+	char name[LWIS_MAX_NAME_STRING_LEN];
+	struct lwis_device *lwis_dev;
+	size_t num_io_entries;
+	struct lwis_io_entry *io_entries;
+	struct kref ref;
+	struct hlist_node node;
+};
+
+/*
+ * lwis_io_program_register: Takes ownership of io_entries, which must have
+ * been copied into the kernel, and returns the handle of the new program in
+ * handle.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Yes
+ * Returns: 0 on success
+ */
+int lwis_io_program_register(struct lwis_client *lwis_client, const char *name,
+			     struct lwis_io_entry *io_entries, size_t num_io_entries,
+			     int32_t *handle);
+
+/*
+ * lwis_io_program_unregister: Removes the program represented by handle. It
+ * is freed once no transaction uses it anymore.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Free only
+ * Returns: 0 on success
+ */
+int lwis_io_program_unregister(struct lwis_client *lwis_client, int32_t handle);
+
+/*
+ * lwis_io_program_find: Finds the registered program based on the handle
+ * passed, and returns it
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: No
+ * Returns: Pointer on success, NULL otherwise
+ */
+struct lwis_io_program *lwis_io_program_find(struct lwis_client *lwis_client, int32_t handle);
+
+/*
+ * lwis_io_program_instantiate: Copies the io_entries of the program into
+ * io_entries, applies the patches to the copy and takes a reference on the
+ * program. Write batch buffers are not copied, they stay owned by the
+ * program.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Yes
+ * Returns: 0 on success
+ */
+int lwis_io_program_instantiate(struct lwis_io_program *program,
+				struct lwis_io_entry_patch *patches, size_t num_patches,
+				struct lwis_io_entry **io_entries);
+
+/*
+ * lwis_io_program_put: Drops a reference taken by
+ * lwis_io_program_instantiate.
+ *
+ * Assumes: Can be called in any context
+ * Alloc: Free only
+ * Returns: None
+ */
+void lwis_io_program_put(struct lwis_io_program *program);
+
+/*
+ * lwis_client_io_programs_clear: Unregisters all items in
+ * lwisclient->io_programs. Used for client shutdown only.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Free only
+ * Returns: 0 on success
+ */
+int lwis_client_io_programs_clear(struct lwis_client *lwis_client);
+
+#endif /* LWIS_IO_PROGRAM_H_ */
@@ -12,6 +12,13 @@
 
 #include "lwis_ioctl.h"
 
+#if LWIS_URING_CMD_SUPPORTED
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <linux/io_uring/cmd.h>
+#else
+#include <linux/io_uring.h>
+#endif
+#endif
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/slab.h>
@@ -19,6 +26,7 @@
 
 #include "lwis_allocator.h"
 #include "lwis_buffer.h"
+#include "lwis_cmd_buffer.h"
 #include "lwis_commands.h"
 #include "lwis_device.h"
 #include "lwis_device_dpm.h"
@@ -27,9 +35,12 @@
 #include "lwis_event.h"
 #include "lwis_i2c.h"
 #include "lwis_io_entry.h"
+#include "lwis_io_program.h"
 #include "lwis_ioreg.h"
 #include "lwis_periodic_io.h"
 #include "lwis_platform.h"
+#include "lwis_reg_cache.h"
+#include "lwis_reg_capture.h"
 #include "lwis_regulator.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
@@ -38,6 +49,12 @@
 #include <linux/uci/uci.h>
 #endif
 
+/* Maximum number of transactions submitted by one LWIS_TRANSACTION_SUBMIT_BATCH */
+#define MAX_TRANSACTION_BATCH_SIZE 128
+#define MAX_BUFFER_BATCH_SIZE 64
+/* Maximum number of per-device programs in one transaction group */
+#define MAX_TRANSACTION_GROUP_PROGRAMS 16
+
 #define IOCTL_TO_ENUM(x) _IOC_NR(x)
 #define IOCTL_ARG_SIZE(x) _IOC_SIZE(x)
 #define STRINGIFY(x) #x
@@ -69,10 +86,22 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_DISENROLL), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_DISENROLL);
 		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_ENROLL_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_ENROLL_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_ENROLL_BATCH);
+		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_DISENROLL_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_DISENROLL_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_DISENROLL_BATCH);
+		break;
 	case IOCTL_TO_ENUM(LWIS_BUFFER_CPU_ACCESS):
 		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_CPU_ACCESS), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_CPU_ACCESS);
 		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_CPU_ACCESS_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_CPU_ACCESS_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_CPU_ACCESS_BATCH);
+		break;
 	case IOCTL_TO_ENUM(LWIS_REG_IO):
 		strlcpy(type_name, STRINGIFY(LWIS_REG_IO), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_REG_IO);
@@ -81,6 +110,10 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_ENABLE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_ENABLE);
 		break;
+	case IOCTL_TO_ENUM(LWIS_DEVICE_ENABLE_ASYNC):
+		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_ENABLE_ASYNC), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_ENABLE_ASYNC);
+		break;
 	case IOCTL_TO_ENUM(LWIS_DEVICE_DISABLE):
 		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_DISABLE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_DISABLE);
@@ -89,6 +122,26 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_RESET), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_RESET);
 		break;
+	case IOCTL_TO_ENUM(LWIS_CMD_BUFFER_REGISTER):
+		strlcpy(type_name, STRINGIFY(LWIS_CMD_BUFFER_REGISTER), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_CMD_BUFFER_REGISTER);
+		break;
+	case IOCTL_TO_ENUM(LWIS_CMD_BUFFER_UNREGISTER):
+		strlcpy(type_name, STRINGIFY(LWIS_CMD_BUFFER_UNREGISTER), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_CMD_BUFFER_UNREGISTER);
+		break;
+	case IOCTL_TO_ENUM(LWIS_CMD_BUFFER_EXECUTE):
+		strlcpy(type_name, STRINGIFY(LWIS_CMD_BUFFER_EXECUTE), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_CMD_BUFFER_EXECUTE);
+		break;
+	case IOCTL_TO_ENUM(LWIS_IO_PROGRAM_REGISTER):
+		strlcpy(type_name, STRINGIFY(LWIS_IO_PROGRAM_REGISTER), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_IO_PROGRAM_REGISTER);
+		break;
+	case IOCTL_TO_ENUM(LWIS_IO_PROGRAM_UNREGISTER):
+		strlcpy(type_name, STRINGIFY(LWIS_IO_PROGRAM_UNREGISTER), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_IO_PROGRAM_UNREGISTER);
+		break;
 	case IOCTL_TO_ENUM(LWIS_EVENT_CONTROL_GET):
 		strlcpy(type_name, STRINGIFY(LWIS_EVENT_CONTROL_GET), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_CONTROL_GET);
@@ -97,10 +150,34 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 		strlcpy(type_name, STRINGIFY(LWIS_EVENT_CONTROL_SET), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_CONTROL_SET);
 		break;
+	case IOCTL_TO_ENUM(LWIS_EVENT_CONTROL_GET_V2):
+		strlcpy(type_name, STRINGIFY(LWIS_EVENT_CONTROL_GET_V2), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_CONTROL_GET_V2);
+		break;
+	case IOCTL_TO_ENUM(LWIS_EVENT_CONTROL_SET_V2):
+		strlcpy(type_name, STRINGIFY(LWIS_EVENT_CONTROL_SET_V2), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_CONTROL_SET_V2);
+		break;
 	case IOCTL_TO_ENUM(LWIS_EVENT_DEQUEUE):
 		strlcpy(type_name, STRINGIFY(LWIS_EVENT_DEQUEUE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_DEQUEUE);
 		break;
+	case IOCTL_TO_ENUM(LWIS_EVENT_RING_SETUP):
+		strlcpy(type_name, STRINGIFY(LWIS_EVENT_RING_SETUP), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_RING_SETUP);
+		break;
+	case IOCTL_TO_ENUM(LWIS_EVENT_DEQUEUE_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_EVENT_DEQUEUE_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_DEQUEUE_BATCH);
+		break;
+	case IOCTL_TO_ENUM(LWIS_GET_STATS):
+		strlcpy(type_name, STRINGIFY(LWIS_GET_STATS), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_GET_STATS);
+		break;
+	case IOCTL_TO_ENUM(LWIS_EVENT_QUEUE_DEPTH_SET):
+		strlcpy(type_name, STRINGIFY(LWIS_EVENT_QUEUE_DEPTH_SET), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_QUEUE_DEPTH_SET);
+		break;
 	case IOCTL_TO_ENUM(LWIS_TIME_QUERY):
 		strlcpy(type_name, STRINGIFY(LWIS_TIME_QUERY), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_TIME_QUERY);
@@ -117,6 +194,14 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 		strlcpy(type_name, STRINGIFY(LWIS_TRANSACTION_REPLACE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_TRANSACTION_REPLACE);
 		break;
+	case IOCTL_TO_ENUM(LWIS_TRANSACTION_SUBMIT_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_TRANSACTION_SUBMIT_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_TRANSACTION_SUBMIT_BATCH);
+		break;
+	case IOCTL_TO_ENUM(LWIS_TRANSACTION_GROUP_SUBMIT):
+		strlcpy(type_name, STRINGIFY(LWIS_TRANSACTION_GROUP_SUBMIT), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_TRANSACTION_GROUP_SUBMIT);
+		break;
 	case IOCTL_TO_ENUM(LWIS_DPM_CLK_UPDATE):
 		strlcpy(type_name, STRINGIFY(LWIS_DPM_CLK_UPDATE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DPM_CLK_UPDATE);
@@ -133,6 +218,10 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 		strlcpy(type_name, STRINGIFY(LWIS_DPM_GET_CLOCK), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DPM_GET_CLOCK);
 		break;
+	case IOCTL_TO_ENUM(LWIS_DPM_BTS_AUTO):
+		strlcpy(type_name, STRINGIFY(LWIS_DPM_BTS_AUTO), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_DPM_BTS_AUTO);
+		break;
 	case IOCTL_TO_ENUM(LWIS_PERIODIC_IO_SUBMIT):
 		strlcpy(type_name, STRINGIFY(LWIS_PERIODIC_IO_SUBMIT), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_PERIODIC_IO_SUBMIT);
@@ -141,6 +230,10 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 		strlcpy(type_name, STRINGIFY(LWIS_PERIODIC_IO_CANCEL), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_PERIODIC_IO_CANCEL);
 		break;
+	case IOCTL_TO_ENUM(LWIS_REG_IO_REPLAY):
+		strlcpy(type_name, STRINGIFY(LWIS_REG_IO_REPLAY), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_REG_IO_REPLAY);
+		break;
 	default:
 		strlcpy(type_name, "UNDEFINED", sizeof(type_name));
 		exp_size = 0;
@@ -158,9 +251,10 @@ static void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_t
 	}
 }
 
-static int ioctl_get_device_info(struct lwis_device *lwis_dev, struct lwis_device_info *msg)
+static int ioctl_get_device_info(struct lwis_client *lwis_client, struct lwis_device_info *msg)
 {
 	int i;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
 	struct lwis_device_info k_info = { .id = lwis_dev->id,
 					   .type = lwis_dev->type,
 					   .num_clks = 0,
@@ -204,7 +298,10 @@ static int ioctl_get_device_info(struct lwis_device *lwis_dev, struct lwis_devic
 		}
 	}
 
-	if (lwis_dev->transaction_worker_thread) {
+	/* Report the worker running this client's transactions */
+	if (lwis_client->transaction_worker != &lwis_dev->transaction_worker) {
+		k_info.transaction_worker_thread_pid = lwis_client->transaction_worker->task->pid;
+	} else if (lwis_dev->transaction_worker_thread) {
 		k_info.transaction_worker_thread_pid = lwis_dev->transaction_worker_thread->pid;
 	}
 
@@ -390,6 +487,9 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 					  struct lwis_io_entry *user_msg)
 {
 	int ret = 0, i = 0;
+	uint64_t block_mask;
+	bool device_lock;
+	int64_t capture_ns;
 
 	/* Use write memory barrier at the beginning of I/O entries if the access protocol
 	 * allows it */
@@ -398,8 +498,10 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 						   /*use_read_barrier=*/false,
 						   /*use_write_barrier=*/true);
 	}
-	mutex_lock(&lwis_dev->reg_rw_lock);
+	device_lock = lwis_io_entry_locks_get(lwis_dev, io_entries, num_io_entries, &block_mask);
+	lwis_io_entry_lock(lwis_dev, device_lock, block_mask);
 	for (i = 0; i < num_io_entries; i++) {
+		capture_ns = lwis_reg_capture_begin(lwis_dev);
 		switch (io_entries[i].type) {
 		case LWIS_IO_ENTRY_MODIFY:
 			ret = register_modify(lwis_dev, &io_entries[i]);
@@ -413,6 +515,7 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 			ret = register_write(lwis_dev, &io_entries[i]);
 			break;
 		case LWIS_IO_ENTRY_POLL:
+		case LWIS_IO_ENTRY_POLL_EVENT:
 			ret = lwis_io_entry_poll(lwis_dev, &io_entries[i], /*non_blocking=*/false);
 			break;
 		case LWIS_IO_ENTRY_READ_ASSERT:
@@ -422,13 +525,15 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 			dev_err(lwis_dev->dev, "Unknown io_entry operation\n");
 			ret = -EINVAL;
 		}
+		lwis_reg_capture_end(lwis_dev, &io_entries[i], LWIS_REG_CAPTURE_SOURCE_IOCTL, 0,
+				     capture_ns, ret);
 		if (ret) {
 			dev_err(lwis_dev->dev, "Register io_entry failed\n");
 			goto exit;
 		}
 	}
 exit:
-	mutex_unlock(&lwis_dev->reg_rw_lock);
+	lwis_io_entry_unlock(lwis_dev, device_lock, block_mask);
 	/* Use read memory barrier at the end of I/O entries if the access protocol
 	 * allows it */
 	if (lwis_dev->vops.register_io_barrier != NULL) {
@@ -468,6 +573,215 @@ reg_io_exit:
 	return ret;
 }
 
+static int ioctl_reg_io_replay(struct lwis_device *lwis_dev, struct lwis_reg_io_replay *user_msg)
+{
+	int ret = 0;
+	struct lwis_reg_io_replay k_msg;
+	struct lwis_reg_capture_record *k_records;
+	size_t buf_size;
+	int64_t start_ns;
+
+	if (copy_from_user(&k_msg, (void __user *)user_msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy replay header from userspace.\n");
+		return -EFAULT;
+	}
+	if (k_msg.num_records == 0 || k_msg.num_records > MAX_REG_CAPTURE_RECORDS) {
+		dev_err(lwis_dev->dev, "Invalid number of replay records %u\n", k_msg.num_records);
+		return -EINVAL;
+	}
+	buf_size = sizeof(struct lwis_reg_capture_record) * k_msg.num_records;
+	k_records = lwis_allocator_allocate(lwis_dev, buf_size);
+	if (!k_records) {
+		dev_err(lwis_dev->dev, "Failed to allocate replay records buffer\n");
+		return -ENOMEM;
+	}
+	if (copy_from_user(k_records, (void __user *)k_msg.records, buf_size)) {
+		dev_err(lwis_dev->dev, "Failed to copy replay records from userspace.\n");
+		ret = -EFAULT;
+		goto exit;
+	}
+
+	start_ns = ktime_to_ns(lwis_get_time());
+	ret = lwis_reg_capture_replay(lwis_dev, k_records, k_msg.num_records, k_msg.flags,
+				      &k_msg.num_failed);
+	if (ret) {
+		goto exit;
+	}
+	k_msg.duration_ns = ktime_to_ns(lwis_get_time()) - start_ns;
+
+	if (copy_to_user((void __user *)user_msg, &k_msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy replay results to userspace.\n");
+		ret = -EFAULT;
+	}
+exit:
+	lwis_allocator_free(lwis_dev, k_records);
+	return ret;
+}
+
+/* Points the batch data of an entry, given as an offset, into the command buffer */
+static int cmd_buffer_resolve_batch(struct lwis_device *lwis_dev,
+				    struct lwis_cmd_buffer *cmd_buffer, struct lwis_io_entry *entry)
+{
+	uint64_t offset = (uintptr_t)entry->rw_batch.buf;
+
+	if (offset > cmd_buffer->size ||
+	    entry->rw_batch.size_in_bytes > cmd_buffer->size - offset) {
+		dev_err_ratelimited(lwis_dev->dev, "Batch data is outside of the command buffer\n");
+		return -EINVAL;
+	}
+	entry->rw_batch.buf = cmd_buffer->buf + offset;
+	return 0;
+}
+
+static int cmd_buffer_process_io_entries(struct lwis_device *lwis_dev,
+					 struct lwis_cmd_buffer *cmd_buffer,
+					 struct lwis_io_entry *io_entries, uint32_t num_io_entries)
+{
+	int ret = 0;
+	uint32_t i;
+	struct lwis_io_entry entry;
+	int64_t capture_ns;
+
+	if (lwis_dev->vops.register_io_barrier != NULL) {
+		lwis_dev->vops.register_io_barrier(lwis_dev,
+						   /*use_read_barrier=*/false,
+						   /*use_write_barrier=*/true);
+	}
+	/* Entries may change under us, lock all independent blocks as well */
+	lwis_io_entry_lock(lwis_dev, /*device_lock=*/true, U64_MAX);
+	for (i = 0; i < num_io_entries; i++) {
+		/* Userspace may change the buffer at any time, only use a snapshot */
+		memcpy(&entry, &io_entries[i], sizeof(entry));
+		if (entry.type == LWIS_IO_ENTRY_READ_BATCH ||
+		    entry.type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			ret = cmd_buffer_resolve_batch(lwis_dev, cmd_buffer, &entry);
+			if (ret) {
+				goto exit;
+			}
+		}
+
+		switch (entry.type) {
+		case LWIS_IO_ENTRY_READ:
+		case LWIS_IO_ENTRY_READ_BATCH:
+		case LWIS_IO_ENTRY_WRITE:
+		case LWIS_IO_ENTRY_WRITE_BATCH:
+		case LWIS_IO_ENTRY_MODIFY:
+			capture_ns = lwis_reg_capture_begin(lwis_dev);
+			ret = lwis_dev->vops.register_io(lwis_dev, &entry,
+							 lwis_dev->native_value_bitwidth);
+			lwis_reg_capture_end(lwis_dev, &entry, LWIS_REG_CAPTURE_SOURCE_IOCTL, 0,
+					     capture_ns, ret);
+			if (!ret && entry.type == LWIS_IO_ENTRY_READ) {
+				WRITE_ONCE(io_entries[i].rw.val, entry.rw.val);
+			}
+			break;
+		case LWIS_IO_ENTRY_POLL:
+		case LWIS_IO_ENTRY_POLL_EVENT:
+			ret = lwis_io_entry_poll(lwis_dev, &entry, /*non_blocking=*/false);
+			break;
+		case LWIS_IO_ENTRY_READ_ASSERT:
+			ret = lwis_io_entry_read_assert(lwis_dev, &entry);
+			break;
+		default:
+			dev_err(lwis_dev->dev, "Unknown io_entry operation\n");
+			ret = -EINVAL;
+		}
+		if (ret) {
+			dev_err_ratelimited(lwis_dev->dev, "Command buffer io_entry %u failed\n",
+					    i);
+			goto exit;
+		}
+	}
+exit:
+	lwis_io_entry_unlock(lwis_dev, /*device_lock=*/true, U64_MAX);
+	if (lwis_dev->vops.register_io_barrier != NULL) {
+		lwis_dev->vops.register_io_barrier(lwis_dev,
+						   /*use_read_barrier=*/true,
+						   /*use_write_barrier=*/false);
+	}
+	return ret;
+}
+
+static int ioctl_cmd_buffer_register(struct lwis_client *lwis_client,
+				     struct lwis_cmd_buffer_info __user *msg)
+{
+	int ret = 0;
+	struct lwis_cmd_buffer_info info;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&info, (void __user *)msg, sizeof(info))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(info));
+		return -EFAULT;
+	}
+
+	ret = lwis_cmd_buffer_register(lwis_client, &info);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to register command buffer\n");
+		return ret;
+	}
+
+	if (copy_to_user((void __user *)msg, (void *)&info, sizeof(info))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(info));
+		lwis_cmd_buffer_unregister(lwis_client, info.handle);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static int ioctl_cmd_buffer_unregister(struct lwis_client *lwis_client, int32_t __user *msg)
+{
+	int32_t handle;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&handle, (void __user *)msg, sizeof(handle))) {
+		dev_err(lwis_dev->dev, "Failed to copy command buffer handle from user\n");
+		return -EFAULT;
+	}
+
+	return lwis_cmd_buffer_unregister(lwis_client, handle);
+}
+
+static int ioctl_cmd_buffer_execute(struct lwis_client *lwis_client,
+				    struct lwis_cmd_buffer_exec __user *msg)
+{
+	struct lwis_cmd_buffer_exec k_exec;
+	struct lwis_cmd_buffer *cmd_buffer;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (!lwis_dev->vops.register_io) {
+		dev_err(lwis_dev->dev, "Register IO not supported on this LWIS device\n");
+		return -EINVAL;
+	}
+
+	if (copy_from_user((void *)&k_exec, (void __user *)msg, sizeof(k_exec))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(k_exec));
+		return -EFAULT;
+	}
+
+	cmd_buffer = lwis_cmd_buffer_find(lwis_client, k_exec.handle);
+	if (!cmd_buffer) {
+		dev_err(lwis_dev->dev, "Cannot find command buffer %d\n", k_exec.handle);
+		return -ENOENT;
+	}
+
+	if (k_exec.entries_offset > cmd_buffer->size ||
+	    k_exec.num_io_entries >
+		    (cmd_buffer->size - k_exec.entries_offset) / sizeof(struct lwis_io_entry) ||
+	    (uintptr_t)(cmd_buffer->buf + k_exec.entries_offset) %
+			    __alignof__(struct lwis_io_entry) !=
+		    0) {
+		dev_err(lwis_dev->dev, "Invalid io_entries range in command buffer %d\n",
+			k_exec.handle);
+		return -EINVAL;
+	}
+
+	return cmd_buffer_process_io_entries(
+		lwis_dev, cmd_buffer,
+		(struct lwis_io_entry *)(cmd_buffer->buf + k_exec.entries_offset),
+		k_exec.num_io_entries);
+}
+
 static int ioctl_buffer_alloc(struct lwis_client *lwis_client,
 			      struct lwis_alloc_buffer_info __user *msg)
 {
@@ -614,6 +928,151 @@ static int ioctl_buffer_disenroll(struct lwis_client *lwis_client,
 	return 0;
 }
 
+static int ioctl_buffer_enroll_batch(struct lwis_client *lwis_client,
+				     struct lwis_buffer_enroll_batch __user *msg)
+{
+	int i;
+	int ret = 0;
+	struct lwis_buffer_enroll_batch k_batch;
+	struct lwis_enrolled_buffer **k_buffers = NULL;
+	struct lwis_buffer_info *k_infos = NULL;
+	int32_t *k_error_codes = NULL;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&k_batch, (void __user *)msg, sizeof(k_batch))) {
+		dev_err(lwis_dev->dev, "Failed to copy buffer enroll batch from user\n");
+		return -EFAULT;
+	}
+
+	if (k_batch.num_buffers == 0 || k_batch.num_buffers > MAX_BUFFER_BATCH_SIZE) {
+		dev_err(lwis_dev->dev, "Invalid buffer batch size %zu\n", k_batch.num_buffers);
+		return -EINVAL;
+	}
+
+	k_buffers = kcalloc(k_batch.num_buffers, sizeof(struct lwis_enrolled_buffer *), GFP_KERNEL);
+	k_infos = kcalloc(k_batch.num_buffers, sizeof(struct lwis_buffer_info), GFP_KERNEL);
+	k_error_codes = kcalloc(k_batch.num_buffers, sizeof(int32_t), GFP_KERNEL);
+	if (!k_buffers || !k_infos || !k_error_codes) {
+		dev_err(lwis_dev->dev, "Failed to allocate buffer enroll batch\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user((void *)k_infos, (void __user *)k_batch.buffers,
+			   sizeof(struct lwis_buffer_info) * k_batch.num_buffers)) {
+		dev_err(lwis_dev->dev, "Failed to copy buffer infos from user\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < k_batch.num_buffers; ++i) {
+		k_buffers[i] = kmalloc(sizeof(struct lwis_enrolled_buffer), GFP_KERNEL);
+		if (!k_buffers[i]) {
+			k_error_codes[i] = -ENOMEM;
+			continue;
+		}
+		k_buffers[i]->info = k_infos[i];
+		k_error_codes[i] = lwis_buffer_enroll(lwis_client, k_buffers[i]);
+		if (k_error_codes[i]) {
+			dev_err(lwis_dev->dev, "Failed to enroll buffer fd %d of batch\n",
+				k_infos[i].fd);
+			kfree(k_buffers[i]);
+			k_buffers[i] = NULL;
+			continue;
+		}
+		k_infos[i] = k_buffers[i]->info;
+	}
+
+	if (copy_to_user((void __user *)k_batch.buffers, (void *)k_infos,
+			 sizeof(struct lwis_buffer_info) * k_batch.num_buffers) ||
+	    copy_to_user((void __user *)k_batch.error_codes, (void *)k_error_codes,
+			 sizeof(int32_t) * k_batch.num_buffers)) {
+		dev_err(lwis_dev->dev, "Failed to copy buffer enroll batch results to user\n");
+		/* Userspace cannot learn the addresses, so undo the whole batch */
+		for (i = 0; i < k_batch.num_buffers; ++i) {
+			if (k_buffers[i]) {
+				lwis_buffer_disenroll(lwis_client, k_buffers[i]);
+				kfree(k_buffers[i]);
+			}
+		}
+		ret = -EFAULT;
+	}
+
+out:
+	kfree(k_error_codes);
+	kfree(k_infos);
+	kfree(k_buffers);
+	return ret;
+}
+
+static int ioctl_buffer_disenroll_batch(struct lwis_client *lwis_client,
+					struct lwis_buffer_disenroll_batch __user *msg)
+{
+	int i;
+	int ret = 0;
+	struct lwis_buffer_disenroll_batch k_batch;
+	struct lwis_enrolled_buffer_info *k_infos = NULL;
+	struct lwis_enrolled_buffer *buffer;
+	int32_t *k_error_codes = NULL;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&k_batch, (void __user *)msg, sizeof(k_batch))) {
+		dev_err(lwis_dev->dev, "Failed to copy buffer disenroll batch from user\n");
+		return -EFAULT;
+	}
+
+	if (k_batch.num_buffers == 0 || k_batch.num_buffers > MAX_BUFFER_BATCH_SIZE) {
+		dev_err(lwis_dev->dev, "Invalid buffer batch size %zu\n", k_batch.num_buffers);
+		return -EINVAL;
+	}
+
+	k_infos = kcalloc(k_batch.num_buffers, sizeof(struct lwis_enrolled_buffer_info),
+			  GFP_KERNEL);
+	k_error_codes = kcalloc(k_batch.num_buffers, sizeof(int32_t), GFP_KERNEL);
+	if (!k_infos || !k_error_codes) {
+		dev_err(lwis_dev->dev, "Failed to allocate buffer disenroll batch\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user((void *)k_infos, (void __user *)k_batch.buffers,
+			   sizeof(struct lwis_enrolled_buffer_info) * k_batch.num_buffers)) {
+		dev_err(lwis_dev->dev, "Failed to copy enrolled buffer infos from user\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < k_batch.num_buffers; ++i) {
+		buffer = lwis_client_enrolled_buffer_find(lwis_client, k_infos[i].fd,
+							  k_infos[i].dma_vaddr);
+		if (!buffer) {
+			dev_err(lwis_dev->dev, "Failed to find dma buffer for fd %d vaddr %pad\n",
+				k_infos[i].fd, &k_infos[i].dma_vaddr);
+			k_error_codes[i] = -ENOENT;
+			continue;
+		}
+		k_error_codes[i] = lwis_buffer_disenroll(lwis_client, buffer);
+		if (k_error_codes[i]) {
+			dev_err(lwis_dev->dev,
+				"Failed to disenroll dma buffer for fd %d vaddr %pad\n",
+				k_infos[i].fd, &k_infos[i].dma_vaddr);
+			continue;
+		}
+		kfree(buffer);
+	}
+
+	if (copy_to_user((void __user *)k_batch.error_codes, (void *)k_error_codes,
+			 sizeof(int32_t) * k_batch.num_buffers)) {
+		dev_err(lwis_dev->dev, "Failed to copy buffer disenroll error codes to user\n");
+		ret = -EFAULT;
+	}
+
+out:
+	kfree(k_error_codes);
+	kfree(k_infos);
+	return ret;
+}
+
 static int ioctl_buffer_cpu_access(struct lwis_client *lwis_client,
 				   struct lwis_buffer_cpu_access_op __user *msg)
 {
@@ -635,7 +1094,64 @@ static int ioctl_buffer_cpu_access(struct lwis_client *lwis_client,
 	return 0;
 }
 
-static int ioctl_device_enable(struct lwis_client *lwis_client)
+static int ioctl_buffer_cpu_access_batch(struct lwis_client *lwis_client,
+					 struct lwis_buffer_cpu_access_batch __user *msg)
+{
+	int i;
+	int ret = 0;
+	struct lwis_buffer_cpu_access_batch k_batch;
+	struct lwis_buffer_cpu_access_op *k_ops = NULL;
+	int32_t *k_error_codes = NULL;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&k_batch, (void __user *)msg, sizeof(k_batch))) {
+		dev_err(lwis_dev->dev, "Failed to copy buffer CPU access batch from user\n");
+		return -EFAULT;
+	}
+
+	if (k_batch.num_ops == 0 || k_batch.num_ops > MAX_BUFFER_BATCH_SIZE) {
+		dev_err(lwis_dev->dev, "Invalid buffer CPU access batch size %zu\n",
+			k_batch.num_ops);
+		return -EINVAL;
+	}
+
+	k_ops = kcalloc(k_batch.num_ops, sizeof(struct lwis_buffer_cpu_access_op), GFP_KERNEL);
+	k_error_codes = kcalloc(k_batch.num_ops, sizeof(int32_t), GFP_KERNEL);
+	if (!k_ops || !k_error_codes) {
+		dev_err(lwis_dev->dev, "Failed to allocate buffer CPU access batch\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user((void *)k_ops, (void __user *)k_batch.ops,
+			   sizeof(struct lwis_buffer_cpu_access_op) * k_batch.num_ops)) {
+		dev_err(lwis_dev->dev, "Failed to copy buffer CPU access operations from user\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < k_batch.num_ops; ++i) {
+		k_error_codes[i] = lwis_buffer_cpu_access(lwis_client, &k_ops[i]);
+		if (k_error_codes[i]) {
+			dev_err_ratelimited(lwis_dev->dev,
+					    "Failed to prepare for cpu access for fd %d\n",
+					    k_ops[i].fd);
+		}
+	}
+
+	if (copy_to_user((void __user *)k_batch.error_codes, (void *)k_error_codes,
+			 sizeof(int32_t) * k_batch.num_ops)) {
+		dev_err(lwis_dev->dev, "Failed to copy buffer CPU access error codes to user\n");
+		ret = -EFAULT;
+	}
+
+out:
+	kfree(k_error_codes);
+	kfree(k_ops);
+	return ret;
+}
+
+static int device_enable(struct lwis_client *lwis_client)
 {
 	int ret = 0;
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
@@ -660,7 +1176,7 @@ static int ioctl_device_enable(struct lwis_client *lwis_client)
 	lwis_client_event_queue_clear(lwis_client);
 	lwis_client_error_event_queue_clear(lwis_client);
 
-	ret = lwis_dev_power_up_locked(lwis_dev);
+	ret = lwis_dev_power_acquire_locked(lwis_dev);
 	if (ret < 0) {
 		dev_err(lwis_dev->dev, "Failed to power up device\n");
 		goto error_locked;
@@ -679,11 +1195,45 @@ error_locked:
 	return ret;
 }
 
+static int ioctl_device_enable(struct lwis_client *lwis_client)
+{
+	/* Wait for a pending asynchronous enable to settle first */
+	flush_work(&lwis_client->enable_work);
+	return device_enable(lwis_client);
+}
+
+void lwis_ioctl_device_enable_work(struct work_struct *work)
+{
+	struct lwis_client *lwis_client = container_of(work, struct lwis_client, enable_work);
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	struct lwis_device_enable_event_payload payload;
+	int64_t event_id = LWIS_EVENT_ID_DEVICE_ENABLE_DONE |
+			   (int64_t)lwis_dev->id << LWIS_EVENT_ID_EVENT_CODE_LEN;
+
+	payload.result = device_enable(lwis_client);
+	lwis_device_event_emit(lwis_dev, event_id, &payload, sizeof(payload),
+			       /*in_irq=*/false);
+}
+
+static int ioctl_device_enable_async(struct lwis_client *lwis_client)
+{
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	/* Power up runs on an unbound worker so that the settle delays of
+	 * several devices enabled back to back overlap */
+	if (!queue_work(system_unbound_wq, &lwis_client->enable_work)) {
+		dev_err(lwis_dev->dev, "Asynchronous enable already pending\n");
+		return -EALREADY;
+	}
+	return 0;
+}
+
 static int ioctl_device_disable(struct lwis_client *lwis_client)
 {
 	int ret = 0;
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
 
+	flush_work(&lwis_client->enable_work);
 	if (!lwis_client->is_enabled) {
 		return ret;
 	}
@@ -720,7 +1270,7 @@ static int ioctl_device_disable(struct lwis_client *lwis_client)
 		goto error_locked;
 	}
 
-	ret = lwis_dev_power_down_locked(lwis_dev);
+	ret = lwis_dev_power_release_locked(lwis_dev);
 	if (ret < 0) {
 		dev_err(lwis_dev->dev, "Failed to power down device\n");
 		goto error_locked;
@@ -808,6 +1358,9 @@ static int ioctl_device_reset(struct lwis_client *lwis_client, struct lwis_io_en
 		dev_err(lwis_dev->dev, "Failed to flush all pending transactions\n");
 	}
 
+	/* Registers go back to their reset values */
+	lwis_reg_cache_clear(lwis_dev);
+
 	/* Perform reset routine defined by the io_entries */
 	if (device_enabled) {
 		ret = synchronous_process_io_entries(lwis_dev, k_msg.num_io_entries, k_entries,
@@ -832,6 +1385,7 @@ static int ioctl_event_control_get(struct lwis_client *lwis_client,
 {
 	unsigned long ret = 0;
 	struct lwis_event_control control;
+	struct lwis_event_control_v2 control_v2;
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
 
 	if (copy_from_user((void *)&control, (void __user *)msg, sizeof(control))) {
@@ -839,13 +1393,14 @@ static int ioctl_event_control_get(struct lwis_client *lwis_client,
 		return -EFAULT;
 	}
 
-	ret = lwis_client_event_control_get(lwis_client, control.event_id, &control);
+	ret = lwis_client_event_control_get(lwis_client, control.event_id, &control_v2);
 
 	if (ret) {
 		dev_err(lwis_dev->dev, "Failed to get event: %lld (err:%ld)\n", control.event_id,
 			ret);
 		return -EINVAL;
 	}
+	control.flags = control_v2.flags;
 
 	if (copy_to_user((void __user *)msg, (void *)&control, sizeof(control))) {
 		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(control));
@@ -855,38 +1410,129 @@ static int ioctl_event_control_get(struct lwis_client *lwis_client,
 	return 0;
 }
 
-static int ioctl_event_control_set(struct lwis_client *lwis_client,
-				   struct lwis_event_control_list __user *msg)
+static int ioctl_event_control_get_v2(struct lwis_client *lwis_client,
+				      struct lwis_event_control_v2 __user *msg)
 {
-	struct lwis_event_control_list k_msg;
-	struct lwis_event_control *k_event_controls;
+	unsigned long ret = 0;
+	struct lwis_event_control_v2 control;
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
-	int ret = 0;
-	int i;
-	size_t buf_size;
 
-	if (copy_from_user((void *)&k_msg, (void __user *)msg,
-			   sizeof(struct lwis_event_control_list))) {
-		ret = -EFAULT;
-		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
-		return ret;
+	if (copy_from_user((void *)&control, (void __user *)msg, sizeof(control))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(control));
+		return -EFAULT;
 	}
 
-	/*  Copy event controls from user buffer. */
-	buf_size = sizeof(struct lwis_event_control) * k_msg.num_event_controls;
-	if (buf_size / sizeof(struct lwis_event_control) != k_msg.num_event_controls) {
+	ret = lwis_client_event_control_get(lwis_client, control.event_id, &control);
+
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to get event: %lld (err:%ld)\n", control.event_id,
+			ret);
+		return -EINVAL;
+	}
+
+	if (copy_to_user((void __user *)msg, (void *)&control, sizeof(control))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(control));
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+/*
+ * Copies an array of num_event_controls event controls of elem_size bytes each
+ * from userspace, into an allocated buffer to be freed with kfree.
+ */
+static void *event_controls_copy_from_user(struct lwis_device *lwis_dev, const void __user *user,
+					   size_t num_event_controls, size_t elem_size)
+{
+	void *k_event_controls;
+	size_t buf_size;
+
+	buf_size = elem_size * num_event_controls;
+	if (buf_size / elem_size != num_event_controls) {
 		dev_err(lwis_dev->dev, "Failed to copy event controls due to integer overflow.\n");
-		return -EOVERFLOW;
+		return ERR_PTR(-EOVERFLOW);
 	}
 	k_event_controls = kmalloc(buf_size, GFP_KERNEL);
 	if (!k_event_controls) {
 		dev_err(lwis_dev->dev, "Failed to allocate event controls\n");
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 	}
-	if (copy_from_user(k_event_controls, (void __user *)k_msg.event_controls, buf_size)) {
-		ret = -EFAULT;
+	if (copy_from_user(k_event_controls, user, buf_size)) {
 		dev_err(lwis_dev->dev, "Failed to copy event controls from user\n");
-		goto out;
+		kfree(k_event_controls);
+		return ERR_PTR(-EFAULT);
+	}
+	return k_event_controls;
+}
+
+static int ioctl_event_control_set(struct lwis_client *lwis_client,
+				   struct lwis_event_control_list __user *msg)
+{
+	struct lwis_event_control_list k_msg;
+	struct lwis_event_control *k_event_controls;
+	struct lwis_event_control_v2 control_v2;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	int ret = 0;
+	int i;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg,
+			   sizeof(struct lwis_event_control_list))) {
+		ret = -EFAULT;
+		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
+		return ret;
+	}
+
+	/*  Copy event controls from user buffer. */
+	k_event_controls = event_controls_copy_from_user(lwis_dev, k_msg.event_controls,
+							 k_msg.num_event_controls,
+							 sizeof(struct lwis_event_control));
+	if (IS_ERR(k_event_controls)) {
+		return PTR_ERR(k_event_controls);
+	}
+
+	for (i = 0; i < k_msg.num_event_controls; i++) {
+		/* Options only set through the v2 struct are kept as they are */
+		ret = lwis_client_event_control_get(lwis_client, k_event_controls[i].event_id,
+						    &control_v2);
+		if (ret) {
+			goto out;
+		}
+		control_v2.event_id = k_event_controls[i].event_id;
+		control_v2.flags = k_event_controls[i].flags;
+		ret = lwis_client_event_control_set(lwis_client, &control_v2);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to apply event control 0x%llx\n",
+				k_event_controls[i].event_id);
+			goto out;
+		}
+	}
+out:
+	kfree(k_event_controls);
+	return ret;
+}
+
+static int ioctl_event_control_set_v2(struct lwis_client *lwis_client,
+				      struct lwis_event_control_list_v2 __user *msg)
+{
+	struct lwis_event_control_list_v2 k_msg;
+	struct lwis_event_control_v2 *k_event_controls;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	int ret = 0;
+	int i;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg,
+			   sizeof(struct lwis_event_control_list_v2))) {
+		ret = -EFAULT;
+		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
+		return ret;
+	}
+
+	k_event_controls = event_controls_copy_from_user(lwis_dev, k_msg.event_controls,
+							 k_msg.num_event_controls,
+							 sizeof(struct lwis_event_control_v2));
+	if (IS_ERR(k_event_controls)) {
+		return PTR_ERR(k_event_controls);
 	}
 
 	for (i = 0; i < k_msg.num_event_controls; i++) {
@@ -996,6 +1642,167 @@ static int ioctl_event_dequeue(struct lwis_client *lwis_client, struct lwis_even
 	return err;
 }
 
+/*
+ * Copies the event into the batch buffer as a record. Returns -ENOSPC if the
+ * record does not fit into the space left.
+ */
+static int event_dequeue_batch_copy(struct lwis_device *lwis_dev,
+				    struct lwis_event_dequeue_batch *batch,
+				    struct lwis_event_entry *event)
+{
+	struct lwis_event_ring_record record;
+	uint8_t __user *dst = (uint8_t __user *)batch->buffer + batch->bytes_used;
+	size_t record_size = ALIGN(sizeof(record) + event->event_info.payload_size,
+				   LWIS_EVENT_RING_RECORD_ALIGN);
+
+	if (record_size > batch->buffer_size - batch->bytes_used) {
+		if (batch->num_events == 0) {
+			batch->required_size = record_size;
+		}
+		return -ENOSPC;
+	}
+
+	record.event_id = event->event_info.event_id;
+	record.event_counter = event->event_info.event_counter;
+	record.timestamp_ns = event->event_info.timestamp_ns;
+	record.record_size = record_size;
+	record.payload_size = event->event_info.payload_size;
+	record.flags = 0;
+	record.reserved = 0;
+	if (copy_to_user(dst, &record, sizeof(record))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(record));
+		return -EFAULT;
+	}
+	if (event->event_info.payload_size > 0 &&
+	    copy_to_user(dst + sizeof(record), event->event_info.payload_buffer,
+			 event->event_info.payload_size)) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n",
+			event->event_info.payload_size);
+		return -EFAULT;
+	}
+
+	batch->bytes_used += record_size;
+	batch->num_events++;
+	return 0;
+}
+
+static int ioctl_event_dequeue_batch(struct lwis_client *lwis_client,
+				     struct lwis_event_dequeue_batch __user *msg)
+{
+	int ret = 0;
+	long wait_ret;
+	long timeout;
+	struct lwis_event_entry *event;
+	struct lwis_event_dequeue_batch batch;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	bool is_error_event;
+
+	if (copy_from_user((void *)&batch, (void __user *)msg, sizeof(batch))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(batch));
+		return -EFAULT;
+	}
+
+	if (batch.buffer_size > 0 && !batch.buffer) {
+		dev_err(lwis_dev->dev, "Event batch buffer is NULL\n");
+		return -EINVAL;
+	}
+	batch.num_events = 0;
+	batch.bytes_used = 0;
+	batch.required_size = 0;
+
+	if (batch.timeout_ns != 0) {
+		if (batch.timeout_ns < 0) {
+			timeout = MAX_SCHEDULE_TIMEOUT;
+		} else {
+			timeout = min_t(u64, nsecs_to_jiffies64(batch.timeout_ns),
+					MAX_SCHEDULE_TIMEOUT - 1);
+		}
+		wait_ret = wait_event_interruptible_timeout(
+			lwis_client->event_wait_queue,
+			lwis_client_event_queues_have_events(lwis_client), timeout);
+		if (wait_ret < 0) {
+			return wait_ret;
+		}
+		if (wait_ret == 0) {
+			return -ETIMEDOUT;
+		}
+	}
+
+	mutex_lock(&lwis_dev->client_lock);
+	while (true) {
+		/* Error events always go first */
+		is_error_event = true;
+		ret = lwis_client_error_event_peek_front(lwis_client, &event);
+		if (ret == -ENOENT) {
+			is_error_event = false;
+			ret = lwis_client_event_peek_front(lwis_client, &event);
+		}
+		if (ret) {
+			break;
+		}
+
+		ret = event_dequeue_batch_copy(lwis_dev, &batch, event);
+		if (ret) {
+			break;
+		}
+
+		if (is_error_event) {
+			ret = lwis_client_error_event_pop_front(lwis_client, NULL);
+		} else {
+			ret = lwis_client_event_pop_front(lwis_client, NULL);
+		}
+		if (ret) {
+			dev_err(lwis_dev->dev, "Error dequeueing event: %d\n", ret);
+			break;
+		}
+	}
+	mutex_unlock(&lwis_dev->client_lock);
+
+	if (ret == -EFAULT) {
+		return ret;
+	}
+	if (batch.num_events > 0) {
+		ret = 0;
+	} else if (ret == -ENOSPC) {
+		/* Nothing was dequeued, userspace should try again with a
+		 * buffer of at least required_size */
+		ret = -EAGAIN;
+	}
+
+	if (copy_to_user((void __user *)msg, (void *)&batch, sizeof(batch))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(batch));
+		return -EFAULT;
+	}
+	return ret;
+}
+
+static int ioctl_event_ring_setup(struct lwis_client *lwis_client,
+				  struct lwis_event_ring_info __user *msg)
+{
+	int ret = 0;
+	struct lwis_event_ring_info ring_info;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&ring_info, (void __user *)msg, sizeof(ring_info))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(ring_info));
+		return -EFAULT;
+	}
+
+	ret = lwis_client_event_ring_setup(lwis_client, ring_info.data_size,
+					   &ring_info.mmap_size);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to set up event ring (%d)\n", ret);
+		return ret;
+	}
+
+	if (copy_to_user((void __user *)msg, (void *)&ring_info, sizeof(ring_info))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(ring_info));
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 static int ioctl_time_query(struct lwis_client *client, int64_t __user *msg)
 {
 	int ret = 0;
@@ -1009,6 +1816,33 @@ static int ioctl_time_query(struct lwis_client *client, int64_t __user *msg)
 	return ret;
 }
 
+static int ioctl_event_queue_depth_set(struct lwis_client *client, uint32_t __user *msg)
+{
+	uint32_t depth;
+
+	if (copy_from_user((void *)&depth, (void __user *)msg, sizeof(depth))) {
+		dev_err(client->lwis_dev->dev, "Failed to copy %zu bytes from user\n",
+			sizeof(depth));
+		return -EFAULT;
+	}
+
+	return lwis_client_event_queue_depth_set(client, depth);
+}
+
+static int ioctl_get_stats(struct lwis_client *client, struct lwis_stats __user *msg)
+{
+	struct lwis_stats stats;
+
+	lwis_client_stats_get(client, &stats);
+	if (copy_to_user((void __user *)msg, &stats, sizeof(stats))) {
+		dev_err(client->lwis_dev->dev, "Failed to copy %zu bytes to user\n",
+			sizeof(stats));
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 static int construct_io_entry(struct lwis_client *client, struct lwis_io_entry *user_entries,
 			      size_t num_io_entries, struct lwis_io_entry **io_entries)
 {
@@ -1081,16 +1915,129 @@ error_free_entries:
 	return ret;
 }
 
+static int ioctl_io_program_register(struct lwis_client *lwis_client,
+				     struct lwis_io_program_info __user *msg)
+{
+	int i;
+	int ret = 0;
+	struct lwis_io_program_info info;
+	struct lwis_io_entry *k_entries;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&info, (void __user *)msg, sizeof(info))) {
+		dev_err(lwis_dev->dev, "Failed to copy io_entry program info from user\n");
+		return -EFAULT;
+	}
+	info.name[LWIS_MAX_NAME_STRING_LEN - 1] = '\0';
+
+	if (info.num_io_entries == 0) {
+		dev_err(lwis_dev->dev, "io_entry program %s has no entries\n", info.name);
+		return -EINVAL;
+	}
+
+	ret = construct_io_entry(lwis_client, info.io_entries, info.num_io_entries, &k_entries);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to prepare io entries of program %s\n", info.name);
+		return ret;
+	}
+
+	ret = lwis_io_program_register(lwis_client, info.name, k_entries, info.num_io_entries,
+				       &info.handle);
+	if (ret) {
+		for (i = 0; i < info.num_io_entries; ++i) {
+			if (k_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
+				lwis_allocator_free(lwis_dev, k_entries[i].rw_batch.buf);
+			}
+		}
+		lwis_allocator_free(lwis_dev, k_entries);
+		return ret;
+	}
+
+	if (copy_to_user((void __user *)&msg->handle, (void *)&info.handle, sizeof(info.handle))) {
+		dev_err(lwis_dev->dev, "Failed to copy io_entry program handle to user\n");
+		lwis_io_program_unregister(lwis_client, info.handle);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static int ioctl_io_program_unregister(struct lwis_client *lwis_client, int32_t __user *msg)
+{
+	int32_t handle;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&handle, (void __user *)msg, sizeof(handle))) {
+		dev_err(lwis_dev->dev, "Failed to copy io_entry program handle from user\n");
+		return -EFAULT;
+	}
+
+	return lwis_io_program_unregister(lwis_client, handle);
+}
+
+/* Builds the io_entries of a transaction from a registered io_entry program,
+ * copying only the patches from userspace */
+static int construct_program_io_entry(struct lwis_client *client,
+				      struct lwis_transaction_info *info,
+				      struct lwis_io_program **program)
+{
+	int ret;
+	struct lwis_io_program *k_program;
+	struct lwis_io_entry_patch *k_patches = NULL;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	k_program = lwis_io_program_find(client, info->program_handle);
+	if (!k_program) {
+		dev_err(lwis_dev->dev, "Cannot find io_entry program %d\n", info->program_handle);
+		return -ENOENT;
+	}
+
+	if (info->num_patches > k_program->num_io_entries) {
+		dev_err(lwis_dev->dev, "Too many patches (%zu) for program %s of %zu entries\n",
+			info->num_patches, k_program->name, k_program->num_io_entries);
+		return -EINVAL;
+	}
+
+	if (info->num_patches > 0) {
+		k_patches = kmalloc_array(info->num_patches, sizeof(struct lwis_io_entry_patch),
+					  GFP_KERNEL);
+		if (!k_patches) {
+			dev_err(lwis_dev->dev, "Failed to allocate io_entry patches\n");
+			return -ENOMEM;
+		}
+		if (copy_from_user((void *)k_patches, (void __user *)info->patches,
+				   info->num_patches * sizeof(struct lwis_io_entry_patch))) {
+			dev_err(lwis_dev->dev, "Failed to copy io_entry patches from user\n");
+			ret = -EFAULT;
+			goto out;
+		}
+	}
+
+	ret = lwis_io_program_instantiate(k_program, k_patches, info->num_patches,
+					  &info->io_entries);
+	if (ret) {
+		goto out;
+	}
+	info->num_io_entries = k_program->num_io_entries;
+	*program = k_program;
+
+out:
+	kfree(k_patches);
+	return ret;
+}
+
+/* A replacement is built without the iterations of a repeating transaction,
+ * as it reuses those of the transaction it replaces when swapped in place */
 static int construct_transaction(struct lwis_client *client,
 				 struct lwis_transaction_info __user *msg,
-				 struct lwis_transaction **transaction)
+				 struct lwis_transaction **transaction, bool replacement)
 {
 	int ret;
 	struct lwis_transaction *k_transaction;
 	struct lwis_transaction_info *user_transaction;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 
-	k_transaction = kmalloc(sizeof(struct lwis_transaction), GFP_KERNEL);
+	k_transaction = lwis_transaction_alloc(GFP_KERNEL);
 	if (!k_transaction) {
 		dev_err(lwis_dev->dev, "Failed to allocate transaction info\n");
 		return -ENOMEM;
@@ -1104,9 +2051,15 @@ static int construct_transaction(struct lwis_client *client,
 		goto error_free_transaction;
 	}
 
-	ret = construct_io_entry(client, k_transaction->info.io_entries,
-				 k_transaction->info.num_io_entries,
-				 &k_transaction->info.io_entries);
+	k_transaction->program = NULL;
+	if (k_transaction->info.program_handle) {
+		ret = construct_program_io_entry(client, &k_transaction->info,
+						 &k_transaction->program);
+	} else {
+		ret = construct_io_entry(client, k_transaction->info.io_entries,
+					 k_transaction->info.num_io_entries,
+					 &k_transaction->info.io_entries);
+	}
 	if (ret) {
 		dev_err(lwis_dev->dev, "Failed to prepare lwis io entries for transaction\n");
 		goto error_free_transaction;
@@ -1116,11 +2069,23 @@ static int construct_transaction(struct lwis_client *client,
 	INIT_LIST_HEAD(&k_transaction->event_list_node);
 	INIT_LIST_HEAD(&k_transaction->process_queue_node);
 
+	/* Validate and decode the io entries once, instead of on every execution */
+	if (replacement) {
+		ret = lwis_transaction_replacement_prepare(client, k_transaction);
+	} else {
+		ret = lwis_transaction_prepare(client, k_transaction);
+	}
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to prepare transaction ops\n");
+		lwis_transaction_free(lwis_dev, k_transaction);
+		return ret;
+	}
+
 	*transaction = k_transaction;
 	return 0;
 
 error_free_transaction:
-	kfree(k_transaction);
+	lwis_transaction_dealloc(k_transaction);
 	return ret;
 }
 
@@ -1133,7 +2098,7 @@ static int ioctl_transaction_submit(struct lwis_client *client,
 	struct lwis_transaction_info k_transaction_info;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 
-	ret = construct_transaction(client, msg, &k_transaction);
+	ret = construct_transaction(client, msg, &k_transaction, /*replacement=*/false);
 	if (ret) {
 		return ret;
 	}
@@ -1164,19 +2129,33 @@ static int ioctl_transaction_replace(struct lwis_client *client,
 	int ret = 0;
 	unsigned long flags;
 	struct lwis_transaction *k_transaction = NULL;
+	struct lwis_transaction *superseded = NULL;
 	struct lwis_transaction_info k_transaction_info;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 
-	ret = construct_transaction(client, msg, &k_transaction);
+	ret = construct_transaction(client, msg, &k_transaction, /*replacement=*/true);
 	if (ret) {
 		return ret;
 	}
 
 	spin_lock_irqsave(&client->transaction_lock, flags);
-	ret = lwis_transaction_replace_locked(client, k_transaction);
+	ret = lwis_transaction_replace_locked(client, k_transaction, &superseded);
+	if (ret == -EAGAIN) {
+		/* Not replaced in place, the transaction needs its own iterations */
+		spin_unlock_irqrestore(&client->transaction_lock, flags);
+		ret = lwis_transaction_iterations_prepare(client, k_transaction);
+		spin_lock_irqsave(&client->transaction_lock, flags);
+		if (!ret) {
+			ret = lwis_transaction_replace_locked(client, k_transaction, &superseded);
+		}
+	}
 	k_transaction_info = k_transaction->info;
 	spin_unlock_irqrestore(&client->transaction_lock, flags);
 
+	/* Armed by an earlier replace, never swapped in */
+	if (superseded) {
+		lwis_transaction_free(lwis_dev, superseded);
+	}
 	if (ret) {
 		k_transaction_info.id = LWIS_ID_INVALID;
 		lwis_transaction_free(lwis_dev, k_transaction);
@@ -1192,6 +2171,292 @@ static int ioctl_transaction_replace(struct lwis_client *client,
 	return ret;
 }
 
+static int ioctl_transaction_submit_batch(struct lwis_client *client,
+					  struct lwis_transaction_batch __user *msg)
+{
+	int i;
+	int num_constructed = 0;
+	int ret = 0;
+	unsigned long flags;
+	struct lwis_transaction_batch k_batch;
+	struct lwis_transaction **k_transactions = NULL;
+	struct lwis_transaction_info *k_infos = NULL;
+	int32_t *k_error_codes = NULL;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (copy_from_user((void *)&k_batch, (void __user *)msg,
+			   sizeof(struct lwis_transaction_batch))) {
+		dev_err(lwis_dev->dev, "Failed to copy transaction batch from user\n");
+		return -EFAULT;
+	}
+
+	if (k_batch.num_transactions == 0 ||
+	    k_batch.num_transactions > MAX_TRANSACTION_BATCH_SIZE) {
+		dev_err(lwis_dev->dev, "Invalid transaction batch size %zu\n",
+			k_batch.num_transactions);
+		return -EINVAL;
+	}
+
+	k_transactions = kcalloc(k_batch.num_transactions, sizeof(struct lwis_transaction *),
+				 GFP_KERNEL);
+	k_infos = kcalloc(k_batch.num_transactions, sizeof(struct lwis_transaction_info),
+			  GFP_KERNEL);
+	k_error_codes = kcalloc(k_batch.num_transactions, sizeof(int32_t), GFP_KERNEL);
+	if (!k_transactions || !k_infos || !k_error_codes) {
+		dev_err(lwis_dev->dev, "Failed to allocate transaction batch\n");
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < k_batch.num_transactions; ++i) {
+		k_error_codes[i] = -ECANCELED;
+	}
+
+	for (i = 0; i < k_batch.num_transactions; ++i) {
+		ret = construct_transaction(client, &k_batch.transactions[i], &k_transactions[i],
+					    /*replacement=*/false);
+		if (ret) {
+			k_error_codes[i] = ret;
+			goto error_free_transactions;
+		}
+		num_constructed++;
+	}
+
+	spin_lock_irqsave(&client->transaction_lock, flags);
+	ret = lwis_transaction_submit_batch_locked(client, k_transactions,
+						   k_batch.num_transactions, k_error_codes);
+	/* Submitted transactions may be processed and freed once the lock is released */
+	for (i = 0; i < k_batch.num_transactions; ++i) {
+		k_infos[i] = k_transactions[i]->info;
+	}
+	spin_unlock_irqrestore(&client->transaction_lock, flags);
+
+	if (ret) {
+		goto error_free_transactions;
+	}
+
+	for (i = 0; i < k_batch.num_transactions; ++i) {
+		if (copy_to_user((void __user *)&k_batch.transactions[i], &k_infos[i],
+				 sizeof(struct lwis_transaction_info))) {
+			ret = -EFAULT;
+			dev_err_ratelimited(lwis_dev->dev,
+					    "Failed to copy transaction results to userspace\n");
+			break;
+		}
+	}
+	goto out_copy_error_codes;
+
+error_free_transactions:
+	for (i = 0; i < num_constructed; ++i) {
+		lwis_transaction_free(lwis_dev, k_transactions[i]);
+	}
+	for (i = 0; i < k_batch.num_transactions; ++i) {
+		if (put_user(LWIS_ID_INVALID, &k_batch.transactions[i].id)) {
+			dev_err_ratelimited(lwis_dev->dev,
+					    "Failed to copy transaction results to userspace\n");
+			break;
+		}
+	}
+
+out_copy_error_codes:
+	if (copy_to_user((void __user *)k_batch.error_codes, k_error_codes,
+			 sizeof(int32_t) * k_batch.num_transactions)) {
+		ret = -EFAULT;
+		dev_err_ratelimited(lwis_dev->dev,
+				    "Failed to copy transaction error codes to userspace\n");
+	}
+
+out:
+	kfree(k_error_codes);
+	kfree(k_infos);
+	kfree(k_transactions);
+	return ret;
+}
+
+static int construct_transaction_group(struct lwis_client *client,
+				       struct lwis_transaction_group_info *k_group,
+				       struct lwis_transaction **transaction)
+{
+	int i;
+	int j;
+	int ret = 0;
+	size_t num_io_entries = 0;
+	size_t num_constructed = 0;
+	struct lwis_transaction *k_transaction = NULL;
+	struct lwis_transaction_program *k_programs = NULL;
+	struct lwis_io_entry *k_entries = NULL;
+	struct lwis_io_entry *program_entries;
+	struct lwis_device **entry_devs = NULL;
+	struct lwis_device *target_dev;
+	bool target_disabled;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (k_group->num_programs == 0 || k_group->num_programs > MAX_TRANSACTION_GROUP_PROGRAMS) {
+		dev_err(lwis_dev->dev, "Invalid number of transaction group programs %zu\n",
+			k_group->num_programs);
+		return -EINVAL;
+	}
+
+	k_programs = kcalloc(k_group->num_programs, sizeof(struct lwis_transaction_program),
+			     GFP_KERNEL);
+	if (!k_programs) {
+		dev_err(lwis_dev->dev, "Failed to allocate transaction group programs\n");
+		return -ENOMEM;
+	}
+	if (copy_from_user((void *)k_programs, (void __user *)k_group->programs,
+			   sizeof(struct lwis_transaction_program) * k_group->num_programs)) {
+		dev_err(lwis_dev->dev, "Failed to copy transaction group programs from user\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < k_group->num_programs; ++i) {
+		if (k_programs[i].num_io_entries > SIZE_MAX - num_io_entries) {
+			dev_err(lwis_dev->dev, "Too many io entries in transaction group\n");
+			ret = -EOVERFLOW;
+			goto out;
+		}
+		num_io_entries += k_programs[i].num_io_entries;
+	}
+	if (num_io_entries == 0 ||
+	    num_io_entries > SIZE_MAX / sizeof(struct lwis_io_entry)) {
+		dev_err(lwis_dev->dev, "Invalid number of transaction group io entries %zu\n",
+			num_io_entries);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	k_transaction = lwis_transaction_alloc(GFP_KERNEL);
+	entry_devs = kcalloc(num_io_entries, sizeof(struct lwis_device *), GFP_KERNEL);
+	k_entries = lwis_allocator_allocate(lwis_dev, num_io_entries * sizeof(struct lwis_io_entry));
+	if (!k_transaction || !entry_devs || !k_entries) {
+		dev_err(lwis_dev->dev, "Failed to allocate transaction group\n");
+		ret = -ENOMEM;
+		goto error_free_entries;
+	}
+
+	/* Flatten the programs into a single list of io_entries, each of them
+	 * tagged with the device it executes on */
+	for (i = 0; i < k_group->num_programs; ++i) {
+		if (k_programs[i].num_io_entries == 0) {
+			continue;
+		}
+		target_dev = lwis_find_dev_by_id(k_programs[i].device_id);
+		if (!target_dev) {
+			dev_err(lwis_dev->dev, "Transaction group device %d not found\n",
+				k_programs[i].device_id);
+			ret = -ENODEV;
+			goto error_free_entries;
+		}
+		mutex_lock(&target_dev->client_lock);
+		target_disabled = (target_dev->enabled == 0);
+		mutex_unlock(&target_dev->client_lock);
+		if (target_disabled) {
+			dev_err(lwis_dev->dev, "Transaction group device %s is disabled\n",
+				target_dev->name);
+			ret = -EBADFD;
+			goto error_free_entries;
+		}
+
+		ret = construct_io_entry(client, k_programs[i].io_entries,
+					 k_programs[i].num_io_entries, &program_entries);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to prepare io entries of program %d\n", i);
+			goto error_free_entries;
+		}
+		memcpy(&k_entries[num_constructed], program_entries,
+		       k_programs[i].num_io_entries * sizeof(struct lwis_io_entry));
+		lwis_allocator_free(lwis_dev, program_entries);
+		for (j = 0; j < k_programs[i].num_io_entries; ++j) {
+			entry_devs[num_constructed++] = target_dev;
+		}
+	}
+
+	k_transaction->info.trigger_event_id = k_group->trigger_event_id;
+	k_transaction->info.trigger_event_counter = k_group->trigger_event_counter;
+	k_transaction->info.num_io_entries = num_io_entries;
+	k_transaction->info.io_entries = k_entries;
+	k_transaction->info.emit_success_event_id = k_group->emit_success_event_id;
+	k_transaction->info.emit_error_event_id = k_group->emit_error_event_id;
+	k_transaction->info.allow_counter_eq = k_group->allow_counter_eq;
+	k_transaction->info.priority = k_group->priority;
+	k_transaction->info.deadline_ns = k_group->deadline_ns;
+	k_transaction->info.program_handle = 0;
+	k_transaction->info.num_patches = 0;
+	k_transaction->info.patches = NULL;
+	k_transaction->program = NULL;
+	k_transaction->resp = NULL;
+	INIT_LIST_HEAD(&k_transaction->event_list_node);
+	INIT_LIST_HEAD(&k_transaction->process_queue_node);
+
+	ret = lwis_transaction_group_prepare(client, k_transaction, entry_devs);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to prepare transaction group ops\n");
+		lwis_transaction_free(lwis_dev, k_transaction);
+		goto out;
+	}
+
+	*transaction = k_transaction;
+	goto out;
+
+error_free_entries:
+	for (i = 0; i < num_constructed; ++i) {
+		if (k_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			lwis_allocator_free(lwis_dev, k_entries[i].rw_batch.buf);
+		}
+	}
+	if (k_entries) {
+		lwis_allocator_free(lwis_dev, k_entries);
+	}
+	lwis_transaction_dealloc(k_transaction);
+out:
+	kfree(entry_devs);
+	kfree(k_programs);
+	return ret;
+}
+
+static int ioctl_transaction_group_submit(struct lwis_client *client,
+					  struct lwis_transaction_group_info __user *msg)
+{
+	int ret = 0;
+	unsigned long flags;
+	struct lwis_transaction *k_transaction = NULL;
+	struct lwis_transaction_group_info k_group;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (copy_from_user((void *)&k_group, (void __user *)msg,
+			   sizeof(struct lwis_transaction_group_info))) {
+		dev_err(lwis_dev->dev, "Failed to copy transaction group info from user\n");
+		return -EFAULT;
+	}
+
+	ret = construct_transaction_group(client, &k_group, &k_transaction);
+	if (ret) {
+		return ret;
+	}
+
+	spin_lock_irqsave(&client->transaction_lock, flags);
+	ret = lwis_transaction_submit_locked(client, k_transaction);
+	k_group.id = k_transaction->info.id;
+	k_group.current_trigger_event_counter = k_transaction->info.current_trigger_event_counter;
+	k_group.submission_timestamp_ns = k_transaction->info.submission_timestamp_ns;
+	spin_unlock_irqrestore(&client->transaction_lock, flags);
+
+	if (ret) {
+		k_group.id = LWIS_ID_INVALID;
+		lwis_transaction_free(lwis_dev, k_transaction);
+	}
+
+	if (copy_to_user((void __user *)msg, &k_group,
+			 sizeof(struct lwis_transaction_group_info))) {
+		ret = -EFAULT;
+		dev_err_ratelimited(lwis_dev->dev,
+				    "Failed to copy transaction group results to userspace\n");
+	}
+
+	return ret;
+}
+
 static int ioctl_transaction_cancel(struct lwis_client *client, int64_t __user *msg)
 {
 	int ret = 0;
@@ -1350,7 +2615,6 @@ static int ioctl_dpm_qos_update(struct lwis_device *lwis_dev,
 	struct lwis_dpm_qos_requirements k_msg;
 	struct lwis_qos_setting *k_qos_settings;
 	int ret = 0;
-	int i;
 	size_t buf_size;
 
 	if (lwis_dev->type != DEVICE_TYPE_DPM) {
@@ -1381,13 +2645,7 @@ static int ioctl_dpm_qos_update(struct lwis_device *lwis_dev,
 		goto out;
 	}
 
-	for (i = 0; i < k_msg.num_settings; i++) {
-		ret = lwis_dpm_update_qos(lwis_dev, &k_qos_settings[i]);
-		if (ret) {
-			dev_err(lwis_dev->dev, "Failed to apply qos setting, ret: %d\n", ret);
-			goto out;
-		}
-	}
+	ret = lwis_dpm_update_qos_batch(lwis_dev, k_qos_settings, k_msg.num_settings);
 out:
 	kfree(k_qos_settings);
 	return ret;
@@ -1430,6 +2688,25 @@ static int ioctl_dpm_get_clock(struct lwis_device *lwis_dev, struct lwis_qos_set
 	return 0;
 }
 
+static int ioctl_dpm_bts_auto(struct lwis_client *lwis_client,
+			      struct lwis_dpm_bts_auto_setting __user *msg)
+{
+	struct lwis_dpm_bts_auto_setting k_setting;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (lwis_dev->type != DEVICE_TYPE_DPM) {
+		dev_err(lwis_dev->dev, "not supported device type: %d\n", lwis_dev->type);
+		return -EINVAL;
+	}
+
+	if (copy_from_user((void *)&k_setting, (void __user *)msg, sizeof(k_setting))) {
+		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
+		return -EFAULT;
+	}
+
+	return lwis_dpm_bts_auto_set(lwis_client, &k_setting);
+}
+
 #ifdef CONFIG_UCI
 struct lwis_device *lwis_dev_flash = NULL;
 struct lwis_client *lwis_client_flash = NULL;
@@ -1444,7 +2721,8 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 
 	// Skip the lock for LWIS_EVENT_DEQUEUE because we want to emit events ASAP. The internal
 	// handler function of LWIS_EVENT_DEQUEUE will acquire the necessary lock.
-	if (type != LWIS_EVENT_DEQUEUE) {
+	// LWIS_EVENT_DEQUEUE_BATCH may block waiting for events, so it skips the lock as well.
+	if (type != LWIS_EVENT_DEQUEUE && type != LWIS_EVENT_DEQUEUE_BATCH) {
 		mutex_lock(&lwis_client->lock);
 	}
 
@@ -1454,11 +2732,19 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 	/* Buffer dis/enroll is added here temporarily. Will need a proper
 	   fix to ensure buffer enrollment when device is enabled. */
 	if (lwis_dev->type != DEVICE_TYPE_TOP && device_disabled && type != LWIS_GET_DEVICE_INFO &&
-	    type != LWIS_DEVICE_ENABLE && type != LWIS_DEVICE_RESET &&
-	    type != LWIS_EVENT_CONTROL_GET && type != LWIS_TIME_QUERY &&
-	    type != LWIS_EVENT_DEQUEUE && type != LWIS_BUFFER_ENROLL &&
-	    type != LWIS_BUFFER_DISENROLL && type != LWIS_BUFFER_FREE &&
-	    type != LWIS_DPM_QOS_UPDATE && type != LWIS_DPM_GET_CLOCK) {
+	    type != LWIS_DEVICE_ENABLE && type != LWIS_DEVICE_ENABLE_ASYNC &&
+	    type != LWIS_DEVICE_RESET &&
+	    type != LWIS_EVENT_CONTROL_GET && type != LWIS_EVENT_CONTROL_GET_V2 &&
+	    type != LWIS_TIME_QUERY &&
+	    type != LWIS_EVENT_DEQUEUE && type != LWIS_EVENT_DEQUEUE_BATCH &&
+	    type != LWIS_EVENT_RING_SETUP && type != LWIS_GET_STATS &&
+	    type != LWIS_EVENT_QUEUE_DEPTH_SET &&
+	    type != LWIS_BUFFER_ENROLL && type != LWIS_BUFFER_DISENROLL &&
+	    type != LWIS_BUFFER_ENROLL_BATCH && type != LWIS_BUFFER_DISENROLL_BATCH &&
+	    type != LWIS_BUFFER_FREE && type != LWIS_CMD_BUFFER_REGISTER &&
+	    type != LWIS_CMD_BUFFER_UNREGISTER && type != LWIS_IO_PROGRAM_REGISTER &&
+	    type != LWIS_IO_PROGRAM_UNREGISTER && type != LWIS_DPM_QOS_UPDATE &&
+	    type != LWIS_DPM_GET_CLOCK && type != LWIS_DPM_BTS_AUTO) {
 		ret = -EBADFD;
 		dev_err_ratelimited(lwis_dev->dev, "Unsupported IOCTL on disabled device.\n");
 		goto out;
@@ -1491,7 +2777,7 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 #endif
 	switch (type) {
 	case LWIS_GET_DEVICE_INFO:
-		ret = ioctl_get_device_info(lwis_dev, (struct lwis_device_info *)param);
+		ret = ioctl_get_device_info(lwis_client, (struct lwis_device_info *)param);
 		break;
 	case LWIS_BUFFER_ALLOC:
 		ret = ioctl_buffer_alloc(lwis_client, (struct lwis_alloc_buffer_info *)param);
@@ -1506,16 +2792,31 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 		ret = ioctl_buffer_disenroll(lwis_client,
 					     (struct lwis_enrolled_buffer_info *)param);
 		break;
+	case LWIS_BUFFER_ENROLL_BATCH:
+		ret = ioctl_buffer_enroll_batch(lwis_client,
+						(struct lwis_buffer_enroll_batch *)param);
+		break;
+	case LWIS_BUFFER_DISENROLL_BATCH:
+		ret = ioctl_buffer_disenroll_batch(lwis_client,
+						   (struct lwis_buffer_disenroll_batch *)param);
+		break;
 	case LWIS_BUFFER_CPU_ACCESS:
 		ret = ioctl_buffer_cpu_access(lwis_client,
 					      (struct lwis_buffer_cpu_access_op *)param);
 		break;
+	case LWIS_BUFFER_CPU_ACCESS_BATCH:
+		ret = ioctl_buffer_cpu_access_batch(lwis_client,
+						    (struct lwis_buffer_cpu_access_batch *)param);
+		break;
 	case LWIS_REG_IO:
 		ret = ioctl_reg_io(lwis_dev, (struct lwis_io_entries *)param);
 		break;
 	case LWIS_DEVICE_ENABLE:
 		ret = ioctl_device_enable(lwis_client);
 		break;
+	case LWIS_DEVICE_ENABLE_ASYNC:
+		ret = ioctl_device_enable_async(lwis_client);
+		break;
 	case LWIS_DEVICE_DISABLE:
 		ret = ioctl_device_disable(lwis_client);
 		break;
@@ -1525,18 +2826,54 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 	case LWIS_DEVICE_RESET:
 		ret = ioctl_device_reset(lwis_client, (struct lwis_io_entries *)param);
 		break;
+	case LWIS_CMD_BUFFER_REGISTER:
+		ret = ioctl_cmd_buffer_register(lwis_client, (struct lwis_cmd_buffer_info *)param);
+		break;
+	case LWIS_CMD_BUFFER_UNREGISTER:
+		ret = ioctl_cmd_buffer_unregister(lwis_client, (int32_t *)param);
+		break;
+	case LWIS_CMD_BUFFER_EXECUTE:
+		ret = ioctl_cmd_buffer_execute(lwis_client, (struct lwis_cmd_buffer_exec *)param);
+		break;
+	case LWIS_IO_PROGRAM_REGISTER:
+		ret = ioctl_io_program_register(lwis_client, (struct lwis_io_program_info *)param);
+		break;
+	case LWIS_IO_PROGRAM_UNREGISTER:
+		ret = ioctl_io_program_unregister(lwis_client, (int32_t *)param);
+		break;
 	case LWIS_EVENT_CONTROL_GET:
 		ret = ioctl_event_control_get(lwis_client, (struct lwis_event_control *)param);
 		break;
 	case LWIS_EVENT_CONTROL_SET:
 		ret = ioctl_event_control_set(lwis_client, (struct lwis_event_control_list *)param);
 		break;
+	case LWIS_EVENT_CONTROL_GET_V2:
+		ret = ioctl_event_control_get_v2(lwis_client,
+						 (struct lwis_event_control_v2 *)param);
+		break;
+	case LWIS_EVENT_CONTROL_SET_V2:
+		ret = ioctl_event_control_set_v2(lwis_client,
+						 (struct lwis_event_control_list_v2 *)param);
+		break;
 	case LWIS_EVENT_DEQUEUE:
 		ret = ioctl_event_dequeue(lwis_client, (struct lwis_event_info *)param);
 		break;
+	case LWIS_EVENT_RING_SETUP:
+		ret = ioctl_event_ring_setup(lwis_client, (struct lwis_event_ring_info *)param);
+		break;
+	case LWIS_EVENT_DEQUEUE_BATCH:
+		ret = ioctl_event_dequeue_batch(lwis_client,
+						(struct lwis_event_dequeue_batch *)param);
+		break;
 	case LWIS_TIME_QUERY:
 		ret = ioctl_time_query(lwis_client, (int64_t *)param);
 		break;
+	case LWIS_GET_STATS:
+		ret = ioctl_get_stats(lwis_client, (struct lwis_stats *)param);
+		break;
+	case LWIS_EVENT_QUEUE_DEPTH_SET:
+		ret = ioctl_event_queue_depth_set(lwis_client, (uint32_t *)param);
+		break;
 	case LWIS_TRANSACTION_SUBMIT:
 		ret = ioctl_transaction_submit(lwis_client, (struct lwis_transaction_info *)param);
 		break;
@@ -1546,6 +2883,14 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 	case LWIS_TRANSACTION_REPLACE:
 		ret = ioctl_transaction_replace(lwis_client, (struct lwis_transaction_info *)param);
 		break;
+	case LWIS_TRANSACTION_SUBMIT_BATCH:
+		ret = ioctl_transaction_submit_batch(lwis_client,
+						     (struct lwis_transaction_batch *)param);
+		break;
+	case LWIS_TRANSACTION_GROUP_SUBMIT:
+		ret = ioctl_transaction_group_submit(lwis_client,
+						     (struct lwis_transaction_group_info *)param);
+		break;
 	case LWIS_PERIODIC_IO_SUBMIT:
 		ret = ioctl_periodic_io_submit(lwis_client, (struct lwis_periodic_io_info *)param);
 		break;
@@ -1561,22 +2906,85 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 	case LWIS_DPM_GET_CLOCK:
 		ret = ioctl_dpm_get_clock(lwis_dev, (struct lwis_qos_setting *)param);
 		break;
+	case LWIS_DPM_BTS_AUTO:
+		ret = ioctl_dpm_bts_auto(lwis_client, (struct lwis_dpm_bts_auto_setting *)param);
+		break;
+	case LWIS_REG_IO_REPLAY:
+		ret = ioctl_reg_io_replay(lwis_dev, (struct lwis_reg_io_replay *)param);
+		break;
 	default:
 		dev_err_ratelimited(lwis_dev->dev, "Unknown IOCTL operation\n");
 		ret = -EINVAL;
 	};
 
 out:
-	if (type != LWIS_EVENT_DEQUEUE) {
+	if (type != LWIS_EVENT_DEQUEUE && type != LWIS_EVENT_DEQUEUE_BATCH) {
 		mutex_unlock(&lwis_client->lock);
 	}
 
-	if (ret && ret != -ENOENT && ret != -ETIMEDOUT && ret != -EAGAIN) {
+	if (ret && ret != -ENOENT && ret != -ETIMEDOUT && ret != -EAGAIN && ret != -ERESTARTSYS) {
 		lwis_ioctl_pr_err(lwis_dev, type, ret);
 	}
 
 	return ret;
 }
+
+#if LWIS_URING_CMD_SUPPORTED
+static const struct lwis_uring_cmd *uring_cmd_payload(struct io_uring_cmd *ioucmd)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	return io_uring_sqe_cmd(ioucmd->sqe);
+#else
+	return ioucmd->cmd;
+#endif
+}
+
+int lwis_ioctl_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+	int ret;
+	struct lwis_client *lwis_client = ioucmd->file->private_data;
+	/* The SQE is shared with userspace, read the argument only once */
+	uint64_t arg = READ_ONCE(uring_cmd_payload(ioucmd)->arg);
+
+	if (!lwis_client) {
+		pr_err("Cannot find client instance\n");
+		return -ENODEV;
+	}
+
+	switch (ioucmd->cmd_op) {
+	case LWIS_EVENT_DEQUEUE_BATCH:
+		/* Waiting for events is left to an io_uring worker, rather than
+		 * blocking the submission of the other commands */
+		if ((issue_flags & IO_URING_F_NONBLOCK) &&
+		    !lwis_client_event_queues_have_events(lwis_client)) {
+			return -EAGAIN;
+		}
+		break;
+	case LWIS_TRANSACTION_SUBMIT:
+	case LWIS_TRANSACTION_SUBMIT_BATCH:
+	case LWIS_TRANSACTION_CANCEL:
+	case LWIS_TRANSACTION_REPLACE:
+	case LWIS_REG_IO:
+	case LWIS_EVENT_DEQUEUE:
+	case LWIS_BUFFER_ENROLL:
+	case LWIS_BUFFER_DISENROLL:
+	case LWIS_BUFFER_ENROLL_BATCH:
+	case LWIS_BUFFER_DISENROLL_BATCH:
+		break;
+	default:
+		dev_err_ratelimited(lwis_client->lwis_dev->dev,
+				    "IOCTL %#x not supported through io_uring\n", ioucmd->cmd_op);
+		return -EOPNOTSUPP;
+	}
+
+	/* Completed inline, the result is posted as the CQE */
+	ret = lwis_ioctl_handler(lwis_client, ioucmd->cmd_op, (unsigned long)arg);
+	/* The dequeue ioctls return -EAGAIN for a buffer too small for the front
+	 * event, which io_uring would take as a request to issue them again */
+	return ret == -EAGAIN ? -ENOBUFS : ret;
+}
+#endif
+
 #ifdef CONFIG_UCI
 
 /*
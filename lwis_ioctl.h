@@ -11,11 +11,37 @@
 #ifndef LWIS_IOCTL_H_
 #define LWIS_IOCTL_H_
 
+#include <linux/version.h>
+
 #include "lwis_device.h"
 
+/* Commands can be submitted through io_uring, see struct lwis_uring_cmd */
+#if IS_ENABLED(CONFIG_IO_URING) && LINUX_VERSION_CODE >= KERNEL_VERSION(6, 1, 0)
+#define LWIS_URING_CMD_SUPPORTED 1
+#else
+#define LWIS_URING_CMD_SUPPORTED 0
+#endif
+
 /*
  *  lwis_ioctl_handler: Handle all IOCTL commands via the file descriptor.
  */
 int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsigned long param);
 
+/*
+ *  lwis_ioctl_device_enable_work: Powers up the device for
+ *  LWIS_DEVICE_ENABLE_ASYNC and emits LWIS_EVENT_ID_DEVICE_ENABLE_DONE to
+ *  report the result.
+ */
+void lwis_ioctl_device_enable_work(struct work_struct *work);
+
+#if LWIS_URING_CMD_SUPPORTED
+struct io_uring_cmd;
+
+/*
+ *  lwis_ioctl_uring_cmd: Handle the commands submitted through io_uring on
+ *  the device file, with the same arguments as their ioctl.
+ */
+int lwis_ioctl_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags);
+#endif
+
 #endif /* LWIS_IOCTL_H_ */
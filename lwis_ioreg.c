@@ -11,12 +11,22 @@
 #define pr_fmt(fmt) KBUILD_MODNAME "-ioreg: " fmt
 
 #include <linux/bitops.h>
+#include <linux/completion.h>
+#include <linux/dma-mapping.h>
+#include <linux/dmaengine.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/mm.h>
 #include <linux/slab.h>
 
 #include "lwis_device.h"
 #include "lwis_ioreg.h"
+#include "lwis_reg_cache.h"
+
+/* Batches from this size on use bulk copies on blocks that allow wide access */
+#define WIDE_ACCESS_MIN_BYTES 32
+/* Time allowed for a batch transfer offloaded to the dmaengine channel */
+#define DMA_TIMEOUT_MS 100
 
 static int find_block_idx_by_name(struct lwis_ioreg_list *list, char *name)
 {
@@ -153,6 +163,7 @@ int lwis_ioreg_get(struct lwis_ioreg_device *ioreg_dev, int index, char *name)
 
 	block = &list->block[index];
 	block->name = name;
+	block->wide_access = false;
 	block->start = res->start;
 	block->size = resource_size(res);
 	block->base = devm_ioremap(&plat_dev->dev, res->start, resource_size(res));
@@ -215,7 +226,7 @@ int lwis_ioreg_put_by_name(struct lwis_ioreg_device *ioreg_dev, char *name)
 }
 
 static int ioreg_read_batch_internal(void __iomem *base, uint64_t offset, int value_bits,
-				     size_t size_in_bytes, uint8_t *buf)
+				     size_t size_in_bytes, uint8_t *buf, bool wide_access)
 {
 	int i;
 	uint8_t *addr = (uint8_t *)base + offset;
@@ -226,6 +237,13 @@ static int ioreg_read_batch_internal(void __iomem *base, uint64_t offset, int va
 		return -EINVAL;
 	}
 
+	/* memcpy_fromio handles the unaligned head and tail and moves the rest
+	 * with the widest accesses the bus supports */
+	if (wide_access && size_in_bytes >= WIDE_ACCESS_MIN_BYTES) {
+		memcpy_fromio(buf, (void __iomem *)addr, size_in_bytes);
+		return 0;
+	}
+
 	switch (value_bits) {
 	case 8:
 		for (i = 0; i < size_in_bytes; ++i) {
@@ -255,7 +273,8 @@ static int ioreg_read_batch_internal(void __iomem *base, uint64_t offset, int va
 }
 
 static int ioreg_write_batch_internal(void __iomem *base, uint64_t offset, int value_bits,
-				      size_t size_in_bytes, uint8_t *buf, bool is_offset_fixed)
+				      size_t size_in_bytes, uint8_t *buf, bool is_offset_fixed,
+				      bool wide_access)
 {
 	int i;
 	uint8_t *addr = (uint8_t *)base + offset;
@@ -266,6 +285,12 @@ static int ioreg_write_batch_internal(void __iomem *base, uint64_t offset, int v
 		return -EINVAL;
 	}
 
+	/* Writes to a fixed offset, e.g. a FIFO, keep the native access width */
+	if (wide_access && !is_offset_fixed && size_in_bytes >= WIDE_ACCESS_MIN_BYTES) {
+		memcpy_toio((void __iomem *)addr, buf, size_in_bytes);
+		return 0;
+	}
+
 	switch (value_bits) {
 	case 8:
 		for (i = 0; i < size_in_bytes; ++i) {
@@ -301,6 +326,112 @@ static int ioreg_write_batch_internal(void __iomem *base, uint64_t offset, int v
 	return 0;
 }
 
+int lwis_ioreg_dma_get(struct lwis_ioreg_device *ioreg_dev, const char *name, size_t min_bytes)
+{
+	struct dma_chan *chan;
+
+	chan = dma_request_chan(&ioreg_dev->base_dev.plat_dev->dev, name);
+	if (IS_ERR(chan)) {
+		return PTR_ERR(chan);
+	}
+	if (!dma_has_cap(DMA_MEMCPY, chan->device->cap_mask)) {
+		dev_err(ioreg_dev->base_dev.dev, "DMA channel %s does not support memcpy\n", name);
+		dma_release_channel(chan);
+		return -EINVAL;
+	}
+	mutex_init(&ioreg_dev->dma_lock);
+	ioreg_dev->dma_chan = chan;
+	ioreg_dev->dma_min_bytes = min_bytes;
+	return 0;
+}
+
+void lwis_ioreg_dma_put(struct lwis_ioreg_device *ioreg_dev)
+{
+	if (ioreg_dev->dma_chan) {
+		dma_release_channel(ioreg_dev->dma_chan);
+		ioreg_dev->dma_chan = NULL;
+	}
+}
+
+static bool use_dma(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entry)
+{
+	/* Waiting for the transfer sleeps, event context keeps the CPU copy */
+	return ioreg_dev->dma_chan && entry->rw_batch.size_in_bytes >= ioreg_dev->dma_min_bytes &&
+	       !entry->rw_batch.is_offset_fixed && !in_interrupt() && !irqs_disabled();
+}
+
+static void ioreg_dma_complete(void *param)
+{
+	complete((struct completion *)param);
+}
+
+/* Copies a batch between a register block and buf with the dmaengine channel.
+ * Returns -EOPNOTSUPP if the batch has to fall back to a CPU copy. */
+static int ioreg_dma_batch(struct lwis_ioreg_device *ioreg_dev, struct lwis_ioreg *block,
+			   uint64_t offset, size_t size_in_bytes, uint8_t *buf, bool is_write)
+{
+	int ret = 0;
+	struct dma_chan *chan = ioreg_dev->dma_chan;
+	struct device *dma_dev = chan->device->dev;
+	struct dma_async_tx_descriptor *desc;
+	dma_addr_t reg_addr;
+	dma_addr_t buf_addr;
+	dma_cookie_t cookie;
+	enum dma_data_direction buf_dir = is_write ? DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	DECLARE_COMPLETION_ONSTACK(done);
+
+	/* Only linearly mapped memory can be handed to the DMA engine */
+	if (!virt_addr_valid(buf) || !virt_addr_valid(buf + size_in_bytes - 1)) {
+		return -EOPNOTSUPP;
+	}
+
+	reg_addr = dma_map_resource(dma_dev, block->start + offset, size_in_bytes,
+				    DMA_BIDIRECTIONAL, 0);
+	if (dma_mapping_error(dma_dev, reg_addr)) {
+		return -EOPNOTSUPP;
+	}
+	buf_addr = dma_map_single(dma_dev, buf, size_in_bytes, buf_dir);
+	if (dma_mapping_error(dma_dev, buf_addr)) {
+		ret = -EOPNOTSUPP;
+		goto error_map_buf;
+	}
+
+	/* Independent blocks run concurrently, but share the channel */
+	mutex_lock(&ioreg_dev->dma_lock);
+	desc = dmaengine_prep_dma_memcpy(chan, is_write ? reg_addr : buf_addr,
+					 is_write ? buf_addr : reg_addr, size_in_bytes,
+					 DMA_PREP_INTERRUPT);
+	if (!desc) {
+		ret = -EOPNOTSUPP;
+		goto error_prep;
+	}
+	desc->callback = ioreg_dma_complete;
+	desc->callback_param = &done;
+
+	cookie = dmaengine_submit(desc);
+	ret = dma_submit_error(cookie);
+	if (ret) {
+		dev_err(ioreg_dev->base_dev.dev, "Failed to submit DMA transfer (%d)\n", ret);
+		ret = -EOPNOTSUPP;
+		goto error_prep;
+	}
+	dma_async_issue_pending(chan);
+
+	if (!wait_for_completion_timeout(&done, msecs_to_jiffies(DMA_TIMEOUT_MS))) {
+		dev_err(ioreg_dev->base_dev.dev, "DMA transfer of %zu bytes at 0x%llx timed out\n",
+			size_in_bytes, offset);
+		dmaengine_terminate_sync(chan);
+		ret = -ETIMEDOUT;
+	}
+
+error_prep:
+	mutex_unlock(&ioreg_dev->dma_lock);
+	dma_unmap_single(dma_dev, buf_addr, size_in_bytes, buf_dir);
+error_map_buf:
+	dma_unmap_resource(dma_dev, reg_addr, size_in_bytes, DMA_BIDIRECTIONAL, 0);
+	return ret;
+}
+
 static int ioreg_read_internal(void __iomem *base, uint64_t offset, int value_bits, uint64_t *value)
 {
 	void __iomem *addr = (void __iomem *)((uint8_t *)base + offset);
@@ -348,6 +479,15 @@ static int ioreg_write_internal(void __iomem *base, uint64_t offset, int value_b
 	return 0;
 }
 
+/* Drops the cached value of the register containing offset */
+static void invalidate_cached_register(struct lwis_ioreg_device *ioreg_dev, int32_t bid,
+				       uint64_t offset)
+{
+	const uint64_t reg_bytes = ioreg_dev->base_dev.native_value_bitwidth / BITS_PER_BYTE;
+
+	lwis_reg_cache_invalidate(&ioreg_dev->base_dev, bid, offset & ~(reg_bytes - 1), reg_bytes);
+}
+
 int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entry,
 			   int access_size)
 {
@@ -355,6 +495,8 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 	int index;
 	struct lwis_ioreg *block;
 	uint64_t reg_value;
+	struct lwis_device *base_dev;
+	bool use_cache;
 
 	if (!ioreg_dev) {
 		pr_err("LWIS IOREG device is NULL\n");
@@ -366,6 +508,11 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 		return -EINVAL;
 	}
 
+	/* The register cache holds whole registers, sub-register accesses only
+	 * invalidate them */
+	base_dev = &ioreg_dev->base_dev;
+	use_cache = base_dev->reg_cache && access_size == base_dev->native_value_bitwidth;
+
 	/* Non-blocking because we already locked here */
 	if (entry->type == LWIS_IO_ENTRY_READ) {
 		ret = lwis_ioreg_read(ioreg_dev, entry->rw.bid, entry->rw.offset, &entry->rw.val,
@@ -374,6 +521,9 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 			dev_err(ioreg_dev->base_dev.dev,
 				"ioreg read failed at: Bid: %d, Offset: 0x%llx\n", entry->rw.bid,
 				entry->rw.offset);
+		} else if (use_cache) {
+			lwis_reg_cache_update(base_dev, entry->rw.bid, entry->rw.offset,
+					      entry->rw.val);
 		}
 	} else if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
 		index = entry->rw_batch.bid;
@@ -392,15 +542,30 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 			return ret;
 		}
 
+		if (use_dma(ioreg_dev, entry)) {
+			ret = ioreg_dma_batch(ioreg_dev, block, entry->rw_batch.offset,
+					      entry->rw_batch.size_in_bytes, entry->rw_batch.buf,
+					      /*is_write=*/false);
+			if (ret != -EOPNOTSUPP) {
+				return ret;
+			}
+		}
+
 		ret = ioreg_read_batch_internal(block->base, entry->rw_batch.offset,
 						ioreg_dev->base_dev.native_value_bitwidth,
-						entry->rw_batch.size_in_bytes, entry->rw_batch.buf);
+						entry->rw_batch.size_in_bytes, entry->rw_batch.buf,
+						block->wide_access);
 		if (ret) {
 			dev_err(ioreg_dev->base_dev.dev, "Invalid ioreg batch read at:\n");
 			dev_err(ioreg_dev->base_dev.dev, "Offset: 0x%llx, Base: %pK\n",
 				entry->rw_batch.offset, block->base);
 		}
 	} else if (entry->type == LWIS_IO_ENTRY_WRITE) {
+		/* Skip writes of the value the register already holds */
+		if (use_cache && !lwis_reg_cache_write_needed(base_dev, entry->rw.bid,
+							      entry->rw.offset, entry->rw.val)) {
+			return 0;
+		}
 		ret = lwis_ioreg_write(ioreg_dev, entry->rw.bid, entry->rw.offset, entry->rw.val,
 				       access_size);
 		if (ret) {
@@ -408,12 +573,21 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 				"ioreg write failed at: Bid: %d, Offset: 0x%llx\n", entry->rw.bid,
 				entry->rw.offset);
 		}
+		if (use_cache && !ret) {
+			lwis_reg_cache_update(base_dev, entry->rw.bid, entry->rw.offset,
+					      entry->rw.val);
+		} else {
+			invalidate_cached_register(ioreg_dev, entry->rw.bid, entry->rw.offset);
+		}
 	} else if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
 		if (ioreg_dev->base_dev.is_read_only) {
 			dev_err(ioreg_dev->base_dev.dev, "Device is read only\n");
 			return -EPERM;
 		}
 
+		lwis_reg_cache_invalidate(base_dev, entry->rw_batch.bid, entry->rw_batch.offset,
+					  entry->rw_batch.size_in_bytes);
+
 		index = entry->rw_batch.bid;
 		block = get_block_by_idx(ioreg_dev, index);
 		if (IS_ERR_OR_NULL(block)) {
@@ -429,26 +603,42 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 				entry->rw_batch.offset);
 			return ret;
 		}
+		if (use_dma(ioreg_dev, entry)) {
+			ret = ioreg_dma_batch(ioreg_dev, block, entry->rw_batch.offset,
+					      entry->rw_batch.size_in_bytes, entry->rw_batch.buf,
+					      /*is_write=*/true);
+			if (ret != -EOPNOTSUPP) {
+				return ret;
+			}
+		}
 		ret = ioreg_write_batch_internal(block->base, entry->rw_batch.offset,
 						 ioreg_dev->base_dev.native_value_bitwidth,
 						 entry->rw_batch.size_in_bytes, entry->rw_batch.buf,
-						 entry->rw_batch.is_offset_fixed);
+						 entry->rw_batch.is_offset_fixed,
+						 block->wide_access);
 		if (ret) {
 			dev_err(ioreg_dev->base_dev.dev, "Invalid ioreg batch write at:\n");
 			dev_err(ioreg_dev->base_dev.dev, "Offset: 0x%08llx, Base: %pK\n",
 				entry->rw_batch.offset, block->base);
 		}
 	} else if (entry->type == LWIS_IO_ENTRY_MODIFY) {
-		ret = lwis_ioreg_read(ioreg_dev, entry->mod.bid, entry->mod.offset, &reg_value,
-				      access_size);
-		if (ret) {
-			dev_err(ioreg_dev->base_dev.dev,
-				"ioreg modify read failed at: Bid: %d, Offset: 0x%llx\n",
-				entry->mod.bid, entry->mod.offset);
-			return ret;
+		if (!use_cache ||
+		    !lwis_reg_cache_read(base_dev, entry->mod.bid, entry->mod.offset, &reg_value)) {
+			ret = lwis_ioreg_read(ioreg_dev, entry->mod.bid, entry->mod.offset,
+					      &reg_value, access_size);
+			if (ret) {
+				dev_err(ioreg_dev->base_dev.dev,
+					"ioreg modify read failed at: Bid: %d, Offset: 0x%llx\n",
+					entry->mod.bid, entry->mod.offset);
+				return ret;
+			}
 		}
 		reg_value &= ~entry->mod.val_mask;
 		reg_value |= entry->mod.val_mask & entry->mod.val;
+		if (use_cache && !lwis_reg_cache_write_needed(base_dev, entry->mod.bid,
+							      entry->mod.offset, reg_value)) {
+			return 0;
+		}
 		ret = lwis_ioreg_write(ioreg_dev, entry->mod.bid, entry->mod.offset, reg_value,
 				       access_size);
 		if (ret) {
@@ -456,6 +646,12 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 			dev_err(ioreg_dev->base_dev.dev, "Bid: %d, Offset: 0x%llx, Value: 0x%llx",
 				entry->mod.bid, entry->mod.offset, reg_value);
 		}
+		if (use_cache && !ret) {
+			lwis_reg_cache_update(base_dev, entry->mod.bid, entry->mod.offset,
+					      reg_value);
+		} else {
+			invalidate_cached_register(ioreg_dev, entry->mod.bid, entry->mod.offset);
+		}
 	} else {
 		dev_err(ioreg_dev->base_dev.dev, "Invalid IO entry type: %d\n", entry->type);
 		return -EINVAL;
@@ -464,6 +660,120 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 	return ret;
 }
 
+int lwis_ioreg_io_entry_prepare(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entry,
+				int access_size, void __iomem **addr)
+{
+	int ret;
+	int index;
+	uint64_t offset;
+	size_t size_in_bytes;
+	bool is_write;
+	struct lwis_ioreg *block;
+	const int value_bits = ioreg_dev->base_dev.native_value_bitwidth;
+
+	/* Sub-register accesses need a read-modify-write, leave them to
+	 * lwis_ioreg_io_entry_rw */
+	if (access_size != value_bits) {
+		return -EOPNOTSUPP;
+	}
+
+	switch (entry->type) {
+	case LWIS_IO_ENTRY_READ:
+	case LWIS_IO_ENTRY_WRITE:
+		index = entry->rw.bid;
+		offset = entry->rw.offset;
+		size_in_bytes = value_bits / 8;
+		break;
+	case LWIS_IO_ENTRY_MODIFY:
+		index = entry->mod.bid;
+		offset = entry->mod.offset;
+		size_in_bytes = value_bits / 8;
+		break;
+	case LWIS_IO_ENTRY_READ_BATCH:
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		index = entry->rw_batch.bid;
+		offset = entry->rw_batch.offset;
+		size_in_bytes = entry->rw_batch.size_in_bytes;
+		if (size_in_bytes & ((value_bits / 8) - 1)) {
+			dev_err(ioreg_dev->base_dev.dev,
+				"Batch size (%zu) not divisible by %d (bitwidth = %d)\n",
+				size_in_bytes, value_bits / 8, value_bits);
+			return -EINVAL;
+		}
+		break;
+	default:
+		return -EOPNOTSUPP;
+	}
+
+	is_write = entry->type == LWIS_IO_ENTRY_WRITE || entry->type == LWIS_IO_ENTRY_MODIFY ||
+		   entry->type == LWIS_IO_ENTRY_WRITE_BATCH;
+	if (is_write && ioreg_dev->base_dev.is_read_only) {
+		dev_err(ioreg_dev->base_dev.dev, "Device is read only\n");
+		return -EPERM;
+	}
+
+	block = get_block_by_idx(ioreg_dev, index);
+	if (IS_ERR_OR_NULL(block)) {
+		dev_err(ioreg_dev->base_dev.dev, "Invalid block index %d\n", index);
+		return PTR_ERR(block);
+	}
+
+	ret = validate_offset(ioreg_dev, block, offset, size_in_bytes,
+			      ioreg_dev->base_dev.native_addr_bitwidth / 8);
+	if (ret) {
+		return ret;
+	}
+
+	/* Cached registers go through lwis_ioreg_io_entry_rw */
+	if (ioreg_dev->base_dev.reg_cache) {
+		return -EOPNOTSUPP;
+	}
+
+	/* Bulk and DMA batches go through lwis_ioreg_io_entry_rw */
+	if ((entry->type == LWIS_IO_ENTRY_READ_BATCH || entry->type == LWIS_IO_ENTRY_WRITE_BATCH) &&
+	    (block->wide_access ||
+	     (ioreg_dev->dma_chan && size_in_bytes >= ioreg_dev->dma_min_bytes))) {
+		return -EOPNOTSUPP;
+	}
+
+	*addr = (void __iomem *)((uint8_t *)block->base + offset);
+	return 0;
+}
+
+int lwis_ioreg_io_entry_rw_prepared(struct lwis_ioreg_device *ioreg_dev,
+				    struct lwis_io_entry *entry, void __iomem *addr)
+{
+	int ret;
+	uint64_t reg_value;
+	const int value_bits = ioreg_dev->base_dev.native_value_bitwidth;
+
+	switch (entry->type) {
+	case LWIS_IO_ENTRY_READ:
+		return ioreg_read_internal(addr, 0, value_bits, &entry->rw.val);
+	case LWIS_IO_ENTRY_WRITE:
+		return ioreg_write_internal(addr, 0, value_bits, entry->rw.val);
+	case LWIS_IO_ENTRY_MODIFY:
+		ret = ioreg_read_internal(addr, 0, value_bits, &reg_value);
+		if (ret) {
+			return ret;
+		}
+		reg_value &= ~entry->mod.val_mask;
+		reg_value |= entry->mod.val_mask & entry->mod.val;
+		return ioreg_write_internal(addr, 0, value_bits, reg_value);
+	case LWIS_IO_ENTRY_READ_BATCH:
+		return ioreg_read_batch_internal(addr, 0, value_bits, entry->rw_batch.size_in_bytes,
+						 entry->rw_batch.buf, /*wide_access=*/false);
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		return ioreg_write_batch_internal(addr, 0, value_bits,
+						  entry->rw_batch.size_in_bytes, entry->rw_batch.buf,
+						  entry->rw_batch.is_offset_fixed,
+						  /*wide_access=*/false);
+	default:
+		dev_err(ioreg_dev->base_dev.dev, "Invalid IO entry type: %d\n", entry->type);
+		return -EINVAL;
+	}
+}
+
 int lwis_ioreg_read(struct lwis_ioreg_device *ioreg_dev, int index, uint64_t offset,
 		    uint64_t *value, int access_size)
 {
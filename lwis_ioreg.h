@@ -34,6 +34,17 @@ void lwis_ioreg_list_free(struct lwis_ioreg_device *ioreg_dev);
  */
 int lwis_ioreg_get(struct lwis_ioreg_device *ioreg_dev, int index, char *name);
 
+/*
+ *  lwis_ioreg_dma_get: Request the named dmaengine channel of the device, used
+ *  for READ_BATCH and WRITE_BATCH transfers of at least min_bytes.
+ */
+int lwis_ioreg_dma_get(struct lwis_ioreg_device *ioreg_dev, const char *name, size_t min_bytes);
+
+/*
+ *  lwis_ioreg_dma_put: Release the dmaengine channel of the device, if any.
+ */
+void lwis_ioreg_dma_put(struct lwis_ioreg_device *ioreg_dev);
+
 /*
  *  lwis_ioreg_put_by_idx: Deinitialize the content of a lwis_ioreg entry
  *  by index.
@@ -52,6 +63,22 @@ int lwis_ioreg_put_by_name(struct lwis_ioreg_device *ioreg_dev, char *name);
 int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entry,
 			   int access_size);
 
+/*
+ *  lwis_ioreg_io_entry_prepare: Validate an io_entry once and resolve the
+ *  register address it accesses, so it can later be executed with
+ *  lwis_ioreg_io_entry_rw_prepared. Returns -EOPNOTSUPP for entries that need
+ *  to go through lwis_ioreg_io_entry_rw.
+ */
+int lwis_ioreg_io_entry_prepare(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entry,
+				int access_size, void __iomem **addr);
+
+/*
+ *  lwis_ioreg_io_entry_rw_prepared: Read/write registers via an io_entry that
+ *  was validated by lwis_ioreg_io_entry_prepare.
+ */
+int lwis_ioreg_io_entry_rw_prepared(struct lwis_ioreg_device *ioreg_dev,
+				    struct lwis_io_entry *entry, void __iomem *addr);
+
 /*
  *  lwis_ioreg_read: Read single register.
  */
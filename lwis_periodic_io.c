@@ -21,55 +21,200 @@
 #include "lwis_event.h"
 #include "lwis_io_entry.h"
 #include "lwis_ioreg.h"
+#include "lwis_reg_capture.h"
+#include "lwis_trace.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
 
-static enum hrtimer_restart periodic_io_timer_func(struct hrtimer *timer)
+/*
+ * Queues the active periodic ios of the list for the worker. Returns true if
+ * there is any, false if the list can stop ticking.
+ */
+static bool periodic_io_list_tick(struct lwis_periodic_io_list *periodic_io_list)
 {
-	ktime_t interval;
 	unsigned long flags;
 	struct list_head *it_period, *it_period_tmp;
-	struct lwis_periodic_io_list *periodic_io_list;
 	struct lwis_periodic_io *periodic_io;
-	struct lwis_periodic_io_proxy *periodic_io_proxy;
-	struct lwis_client *client;
+	struct lwis_client *client = periodic_io_list->client;
 	bool active_periodic_io_present = false;
-
-	periodic_io_list = container_of(timer, struct lwis_periodic_io_list, hr_timer);
-	client = periodic_io_list->client;
+	int num_queued = 0;
 
 	/* Go through all periodic io under the chosen periodic list */
 	spin_lock_irqsave(&client->periodic_io_lock, flags);
 	list_for_each_safe (it_period, it_period_tmp, &periodic_io_list->list) {
 		periodic_io = list_entry(it_period, struct lwis_periodic_io, timer_list_node);
 		if (periodic_io->active) {
-			periodic_io_proxy =
-				kmalloc(sizeof(struct lwis_periodic_io_proxy), GFP_NOWAIT);
-			if (!periodic_io_proxy) {
-				/* Non-fatal, skip this period */
-				pr_warn("Cannot allocate new periodic io proxy.\n");
-			} else {
-				periodic_io_proxy->periodic_io = periodic_io;
-				list_add_tail(&periodic_io_proxy->process_queue_node,
+			/* A periodic io already waiting for the worker runs once
+			 * more per elapsed period instead of queueing again */
+			if (periodic_io->num_pending_periods++ == 0) {
+				list_add_tail(&periodic_io->proxy.process_queue_node,
 					      &client->periodic_io_process_queue);
-				active_periodic_io_present = true;
+			} else {
+				atomic64_inc(&client->stats.periodic_io_ticks_missed);
 			}
+			active_periodic_io_present = true;
+			num_queued++;
 		}
 	}
+	/* Work queued by several lists within one expiration is processed in a
+	 * single pass of the worker */
 	if (active_periodic_io_present) {
 		kthread_queue_work(&client->lwis_dev->periodic_io_worker,
 				   &client->periodic_io_work);
 	}
 	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
-	if (!active_periodic_io_present) {
-		periodic_io_list->hr_timer_state = LWIS_HRTIMER_INACTIVE;
+	trace_lwis_periodic_io_tick(client->lwis_dev, periodic_io_list->period_ns, num_queued);
+
+	return active_periodic_io_present;
+}
+
+/* Timer of a periodic io list that is phase locked to an event */
+static enum hrtimer_restart periodic_io_timer_func(struct hrtimer *timer)
+{
+	ktime_t interval;
+	u64 overruns = 0;
+	unsigned long flags;
+	struct lwis_periodic_io_list *periodic_io_list;
+	struct lwis_client *client;
+	bool active;
+	bool restart = false;
+
+	periodic_io_list = container_of(timer, struct lwis_periodic_io_list, hr_timer);
+	client = periodic_io_list->client;
+
+	active = periodic_io_list_tick(periodic_io_list);
+
+	/* Serialized with lwis_periodic_io_event_trigger restarting the timer */
+	spin_lock_irqsave(&client->periodic_io_lock, flags);
+	if (hrtimer_is_queued(timer)) {
+		/* The phase event restarted the timer meanwhile, keep its expiry */
+		spin_unlock_irqrestore(&client->periodic_io_lock, flags);
 		return HRTIMER_NORESTART;
 	}
+	if (!active) {
+		periodic_io_list->hr_timer_state = LWIS_HRTIMER_INACTIVE;
+	} else {
+		/* Phase locked timers wait for the next event after their samples */
+		restart = --periodic_io_list->samples_remaining > 0;
+		if (restart) {
+			interval = ktime_set(0, periodic_io_list->period_ns);
+			overruns = hrtimer_forward_now(timer, interval);
+		}
+	}
+	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
+
+	if (overruns > 1) {
+		atomic64_add(overruns - 1, &client->stats.periodic_io_ticks_missed);
+	}
+
+	return restart ? HRTIMER_RESTART : HRTIMER_NORESTART;
+}
+
+/*
+ * Programs the device timer for the earliest expiration among the free-running
+ * periodic io lists of all clients. The timer may fire late by up to the
+ * smallest slack, so that lists expiring close together share one expiration.
+ *
+ * Assumes: lwis_dev->periodic_io_timer_lock is locked
+ */
+static void periodic_io_device_timer_program_locked(struct lwis_device *lwis_dev)
+{
+	struct lwis_periodic_io_list *periodic_io_list;
+	int64_t expiry_ns;
+	int64_t soft_ns = S64_MAX;
+	int64_t hard_ns = S64_MAX;
+
+	list_for_each_entry (periodic_io_list, &lwis_dev->periodic_io_timer_lists, device_node) {
+		expiry_ns = periodic_io_list->next_expiry_ns;
+		soft_ns = min(soft_ns, expiry_ns);
+		hard_ns = min(hard_ns, expiry_ns + periodic_io_list->slack_ns);
+	}
+
+	if (soft_ns == S64_MAX) {
+		hrtimer_try_to_cancel(&lwis_dev->periodic_io_timer);
+		return;
+	}
+	hrtimer_start_range_ns(&lwis_dev->periodic_io_timer, ns_to_ktime(soft_ns),
+			       hard_ns - soft_ns, HRTIMER_MODE_ABS);
+}
+
+/* Timer shared by the free-running periodic io lists of all clients */
+static enum hrtimer_restart periodic_io_device_timer_func(struct hrtimer *timer)
+{
+	unsigned long flags;
+	int64_t now_ns;
+	struct lwis_periodic_io_list *periodic_io_list, *tmp;
+	struct lwis_device *lwis_dev = container_of(timer, struct lwis_device, periodic_io_timer);
+
+	spin_lock_irqsave(&lwis_dev->periodic_io_timer_lock, flags);
+	now_ns = ktime_to_ns(ktime_get());
+	list_for_each_entry_safe (periodic_io_list, tmp, &lwis_dev->periodic_io_timer_lists,
+				  device_node) {
+		if (periodic_io_list->next_expiry_ns > now_ns) {
+			continue;
+		}
+		if (!periodic_io_list_tick(periodic_io_list)) {
+			list_del_init(&periodic_io_list->device_node);
+			periodic_io_list->hr_timer_state = LWIS_HRTIMER_INACTIVE;
+			continue;
+		}
+		/* Missed periods are skipped, as hrtimer_forward_now would */
+		periodic_io_list->next_expiry_ns += periodic_io_list->period_ns;
+		while (periodic_io_list->next_expiry_ns <= now_ns) {
+			periodic_io_list->next_expiry_ns += periodic_io_list->period_ns;
+			atomic64_inc(&periodic_io_list->client->stats.periodic_io_ticks_missed);
+		}
+	}
+	/* Restarting from the callback is allowed and keeps the programming
+	 * serialized with periodic_io_device_timer_add */
+	periodic_io_device_timer_program_locked(lwis_dev);
+	spin_unlock_irqrestore(&lwis_dev->periodic_io_timer_lock, flags);
+
+	return HRTIMER_NORESTART;
+}
+
+/* Starts serving a free-running periodic io list from the device timer */
+static void periodic_io_device_timer_add(struct lwis_periodic_io_list *periodic_io_list,
+					 int64_t slack_ns)
+{
+	unsigned long flags;
+	struct lwis_device *lwis_dev = periodic_io_list->client->lwis_dev;
+
+	spin_lock_irqsave(&lwis_dev->periodic_io_timer_lock, flags);
+	/* Never more than a period late */
+	slack_ns = min(slack_ns, periodic_io_list->period_ns);
+	periodic_io_list->slack_ns = min(periodic_io_list->slack_ns, slack_ns);
+	if (periodic_io_list->hr_timer_state != LWIS_HRTIMER_ACTIVE) {
+		periodic_io_list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
+		periodic_io_list->next_expiry_ns =
+			ktime_to_ns(ktime_get()) + periodic_io_list->period_ns;
+		list_add_tail(&periodic_io_list->device_node, &lwis_dev->periodic_io_timer_lists);
+	}
+	periodic_io_device_timer_program_locked(lwis_dev);
+	spin_unlock_irqrestore(&lwis_dev->periodic_io_timer_lock, flags);
+}
+
+/* Stops serving a free-running periodic io list from the device timer */
+static void periodic_io_device_timer_remove(struct lwis_periodic_io_list *periodic_io_list)
+{
+	unsigned long flags;
+	struct lwis_device *lwis_dev = periodic_io_list->client->lwis_dev;
 
-	interval = ktime_set(0, periodic_io_list->period_ns);
-	hrtimer_forward_now(timer, interval);
+	spin_lock_irqsave(&lwis_dev->periodic_io_timer_lock, flags);
+	if (periodic_io_list->hr_timer_state == LWIS_HRTIMER_ACTIVE) {
+		list_del_init(&periodic_io_list->device_node);
+		periodic_io_device_timer_program_locked(lwis_dev);
+	}
+	periodic_io_list->hr_timer_state = LWIS_HRTIMER_INACTIVE;
+	spin_unlock_irqrestore(&lwis_dev->periodic_io_timer_lock, flags);
+}
 
-	return HRTIMER_RESTART;
+void lwis_periodic_io_device_init(struct lwis_device *lwis_dev)
+{
+	spin_lock_init(&lwis_dev->periodic_io_timer_lock);
+	INIT_LIST_HEAD(&lwis_dev->periodic_io_timer_lists);
+	hrtimer_init(&lwis_dev->periodic_io_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	lwis_dev->periodic_io_timer.function = &periodic_io_device_timer_func;
 }
 
 static struct lwis_periodic_io_list *periodic_io_list_find(struct lwis_client *client,
@@ -77,7 +222,8 @@ static struct lwis_periodic_io_list *periodic_io_list_find(struct lwis_client *c
 {
 	struct lwis_periodic_io_list *list;
 	hash_for_each_possible (client->timer_list, list, node, period_ns) {
-		if (list->period_ns == period_ns) {
+		/* Phase locked timers are never shared */
+		if (list->period_ns == period_ns && list->phase_event_id == LWIS_EVENT_ID_NONE) {
 			return list;
 		}
 	}
@@ -85,10 +231,9 @@ static struct lwis_periodic_io_list *periodic_io_list_find(struct lwis_client *c
 }
 
 /* Calling this function requires holding the client's periodic_io_lock */
-static struct lwis_periodic_io_list *periodic_io_list_create_locked(struct lwis_client *client,
-								    int64_t period_ns)
+static struct lwis_periodic_io_list *
+periodic_io_list_create_locked(struct lwis_client *client, struct lwis_periodic_io_info *info)
 {
-	ktime_t ktime;
 	struct lwis_periodic_io_list *periodic_io_list =
 		kmalloc(sizeof(struct lwis_periodic_io_list), GFP_ATOMIC);
 	if (!periodic_io_list) {
@@ -97,41 +242,50 @@ static struct lwis_periodic_io_list *periodic_io_list_create_locked(struct lwis_
 	}
 
 	periodic_io_list->client = client;
-	periodic_io_list->period_ns = period_ns;
-	periodic_io_list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
+	periodic_io_list->period_ns = info->period_ns;
+	periodic_io_list->phase_event_id = info->phase_event_id;
+	periodic_io_list->phase_offset_ns = info->phase_offset_ns;
+	periodic_io_list->samples_per_event = info->samples_per_event;
+	periodic_io_list->samples_remaining = 0;
+	INIT_LIST_HEAD(&periodic_io_list->phase_node);
+	periodic_io_list->next_expiry_ns = 0;
+	periodic_io_list->slack_ns = S64_MAX;
+	INIT_LIST_HEAD(&periodic_io_list->device_node);
 
 	/* Initialize the periodic io list and add this timer/periodic_io_list
 	 * into the client timer list */
 	INIT_LIST_HEAD(&periodic_io_list->list);
-	hash_add(client->timer_list, &periodic_io_list->node, period_ns);
-	pr_info("Created hrtimer with timeout time %lldns", period_ns);
+	hash_add(client->timer_list, &periodic_io_list->node, info->period_ns);
+	pr_info("Created periodic io list with timeout time %lldns", info->period_ns);
 
-	/* Initialize and start the hrtimer for this periodic io list */
+	/* Free-running lists are served by the device timer once the periodic
+	 * io is queued, phase locked lists own a timer started by their event */
+	if (info->phase_event_id == LWIS_EVENT_ID_NONE) {
+		periodic_io_list->hr_timer_state = LWIS_HRTIMER_INACTIVE;
+		return periodic_io_list;
+	}
+	periodic_io_list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
 	hrtimer_init(&periodic_io_list->hr_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 	periodic_io_list->hr_timer.function = &periodic_io_timer_func;
-	ktime = ktime_set(0, periodic_io_list->period_ns);
-	hrtimer_start(&periodic_io_list->hr_timer, ktime, HRTIMER_MODE_REL);
+	list_add_tail(&periodic_io_list->phase_node, &client->phase_locked_timer_list);
 
 	return periodic_io_list;
 }
 
 /* Calling this function requires holding the client's periodic_io_lock */
 static struct lwis_periodic_io_list *
-periodic_io_list_find_or_create_locked(struct lwis_client *client, int64_t period_ns)
+periodic_io_list_find_or_create_locked(struct lwis_client *client,
+				       struct lwis_periodic_io_info *info)
 {
-	struct lwis_periodic_io_list *list = periodic_io_list_find(client, period_ns);
+	struct lwis_periodic_io_list *list;
 
-	if (list == NULL) {
-		return periodic_io_list_create_locked(client, period_ns);
+	if (info->phase_event_id != LWIS_EVENT_ID_NONE) {
+		return periodic_io_list_create_locked(client, info);
 	}
 
-	/* If there is already a timer with the same period and it is inactive,
-	 * then restart the timer */
-	if (list->hr_timer_state == LWIS_HRTIMER_INACTIVE) {
-		list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
-		/* If this does not restart the hrtimer properly, consider
-		 * repeating the steps when starting a new timer. */
-		hrtimer_restart(&list->hr_timer);
+	list = periodic_io_list_find(client, info->period_ns);
+	if (list == NULL) {
+		return periodic_io_list_create_locked(client, info);
 	}
 	return list;
 }
@@ -171,6 +325,7 @@ static int process_io_entries(struct lwis_client *client,
 	struct lwis_periodic_io_result *io_result;
 	const int reg_value_bytewidth = lwis_dev->native_value_bitwidth / 8;
 	unsigned long flags;
+	int64_t capture_ns;
 
 	read_buf = (uint8_t *)resp + sizeof(struct lwis_periodic_io_response_header) +
 		   periodic_io->batch_count * (resp->results_size_bytes / info->batch_size);
@@ -183,7 +338,14 @@ static int process_io_entries(struct lwis_client *client,
 						   /*use_write_barrier=*/true);
 	}
 
-	mutex_lock(&lwis_dev->reg_rw_lock);
+	lwis_io_entry_lock(lwis_dev, !periodic_io->block_locks_only, periodic_io->block_mask);
+	/* Periods falling while the device sleeps with its registers saved are
+	 * skipped, the device comes back as it was */
+	if (lwis_dev->enabled == 0 && lwis_dev->suspend_saved_enabled > 0) {
+		lwis_io_entry_unlock(lwis_dev, !periodic_io->block_locks_only,
+				     periodic_io->block_mask);
+		return 0;
+	}
 	reinit_completion(&periodic_io->io_done);
 	for (i = 0; i < info->num_io_entries; ++i) {
 		/* Abort if periodic io is deactivated during processing.
@@ -198,8 +360,11 @@ static int process_io_entries(struct lwis_client *client,
 		if (entry->type == LWIS_IO_ENTRY_WRITE ||
 		    entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
 		    entry->type == LWIS_IO_ENTRY_MODIFY) {
+			capture_ns = lwis_reg_capture_begin(lwis_dev);
 			ret = lwis_dev->vops.register_io(lwis_dev, entry,
 							 lwis_dev->native_value_bitwidth);
+			lwis_reg_capture_end(lwis_dev, entry, LWIS_REG_CAPTURE_SOURCE_PERIODIC_IO,
+					     info->id, capture_ns, ret);
 			if (ret) {
 				resp->error_code = ret;
 				goto event_push;
@@ -210,8 +375,11 @@ static int process_io_entries(struct lwis_client *client,
 			io_result->io_result.offset = entry->rw.offset;
 			io_result->io_result.num_value_bytes = reg_value_bytewidth;
 			io_result->timestamp_ns = ktime_to_ns(lwis_get_time());
+			capture_ns = lwis_reg_capture_begin(lwis_dev);
 			ret = lwis_dev->vops.register_io(lwis_dev, entry,
 							 lwis_dev->native_value_bitwidth);
+			lwis_reg_capture_end(lwis_dev, entry, LWIS_REG_CAPTURE_SOURCE_PERIODIC_IO,
+					     info->id, capture_ns, ret);
 			if (ret) {
 				resp->error_code = ret;
 				goto event_push;
@@ -226,15 +394,19 @@ static int process_io_entries(struct lwis_client *client,
 			io_result->io_result.num_value_bytes = entry->rw_batch.size_in_bytes;
 			entry->rw_batch.buf = io_result->io_result.values;
 			io_result->timestamp_ns = ktime_to_ns(lwis_get_time());
+			capture_ns = lwis_reg_capture_begin(lwis_dev);
 			ret = lwis_dev->vops.register_io(lwis_dev, entry,
 							 lwis_dev->native_value_bitwidth);
+			lwis_reg_capture_end(lwis_dev, entry, LWIS_REG_CAPTURE_SOURCE_PERIODIC_IO,
+					     info->id, capture_ns, ret);
 			if (ret) {
 				resp->error_code = ret;
 				goto event_push;
 			}
 			read_buf += sizeof(struct lwis_periodic_io_result) +
 				    io_result->io_result.num_value_bytes;
-		} else if (entry->type == LWIS_IO_ENTRY_POLL) {
+		} else if (entry->type == LWIS_IO_ENTRY_POLL ||
+			   entry->type == LWIS_IO_ENTRY_POLL_EVENT) {
 			ret = lwis_io_entry_poll(lwis_dev, entry, /*non_blocking=*/false);
 			if (ret) {
 				resp->error_code = ret;
@@ -257,7 +429,7 @@ static int process_io_entries(struct lwis_client *client,
 
 event_push:
 	complete(&periodic_io->io_done);
-	mutex_unlock(&lwis_dev->reg_rw_lock);
+	lwis_io_entry_unlock(lwis_dev, !periodic_io->block_locks_only, periodic_io->block_mask);
 	/* Use read memory barrier at the beginning of I/O entries if the access protocol
 	 * allows it */
 	if (lwis_dev->vops.register_io_barrier != NULL) {
@@ -291,8 +463,11 @@ event_push:
 		spin_unlock_irqrestore(&client->periodic_io_lock, flags);
 	} else {
 		if (periodic_io->batch_count == info->batch_size) {
-			lwis_pending_event_push(pending_events, info->emit_success_event_id,
-						(void *)resp, resp_size);
+			/* Emit straight from the response buffer, which is reused
+			 * by the next batch. Clients with an event ring receive it
+			 * without any allocation. */
+			lwis_device_event_emit(lwis_dev, info->emit_success_event_id,
+					       (void *)resp, resp_size, /*in_irq=*/false);
 			periodic_io->batch_count = 0;
 			resp->batch_size = 0;
 		}
@@ -303,32 +478,40 @@ event_push:
 static void periodic_io_work_func(struct kthread_work *work)
 {
 	int error_code;
+	int num_periods;
 	unsigned long flags;
 	struct lwis_periodic_io *periodic_io;
 	struct lwis_periodic_io_proxy *periodic_io_proxy;
-	struct list_head *it_period, *it_period_tmp;
 	struct lwis_client *client = container_of(work, struct lwis_client, periodic_io_work);
 	struct list_head pending_events;
 	INIT_LIST_HEAD(&pending_events);
 
 	spin_lock_irqsave(&client->periodic_io_lock, flags);
-	list_for_each_safe (it_period, it_period_tmp, &client->periodic_io_process_queue) {
-		periodic_io_proxy =
-			list_entry(it_period, struct lwis_periodic_io_proxy, process_queue_node);
+	while (!list_empty(&client->periodic_io_process_queue)) {
+		periodic_io_proxy = list_first_entry(&client->periodic_io_process_queue,
+						     struct lwis_periodic_io_proxy,
+						     process_queue_node);
 		periodic_io = periodic_io_proxy->periodic_io;
 		list_del(&periodic_io_proxy->process_queue_node);
-		/* Error indicates the cancellation of the periodic io */
-		if (periodic_io->resp->error_code || !periodic_io->active) {
-			error_code = periodic_io->resp->error_code ? periodic_io->resp->error_code :
-									   -ECANCELED;
-			push_periodic_io_error_event_locked(periodic_io, error_code,
-							    &pending_events);
-		} else {
-			spin_unlock_irqrestore(&client->periodic_io_lock, flags);
-			process_io_entries(client, periodic_io_proxy, &pending_events);
-			spin_lock_irqsave(&client->periodic_io_lock, flags);
+		/* Periods elapsing from here on queue the proxy again */
+		num_periods = periodic_io->num_pending_periods;
+		periodic_io->num_pending_periods = 0;
+		for (; num_periods > 0; num_periods--) {
+			/* Error indicates the cancellation of the periodic io */
+			if (periodic_io->resp->error_code || !periodic_io->active) {
+				error_code = periodic_io->resp->error_code ?
+						     periodic_io->resp->error_code :
+						     -ECANCELED;
+				/* Reported once, however many periods were pending */
+				push_periodic_io_error_event_locked(periodic_io, error_code,
+								    &pending_events);
+				break;
+			} else {
+				spin_unlock_irqrestore(&client->periodic_io_lock, flags);
+				process_io_entries(client, periodic_io_proxy, &pending_events);
+				spin_lock_irqsave(&client->periodic_io_lock, flags);
+			}
 		}
-		kfree(periodic_io_proxy);
 	}
 	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
 
@@ -410,11 +593,9 @@ static int prepare_response(struct lwis_client *client, struct lwis_periodic_io
 static int queue_periodic_io_locked(struct lwis_client *client,
 				    struct lwis_periodic_io *periodic_io)
 {
-	int64_t period_ns;
 	struct lwis_periodic_io_list *periodic_io_list;
 	struct lwis_periodic_io_info *info = &periodic_io->info;
-	period_ns = info->period_ns;
-	periodic_io_list = periodic_io_list_find_or_create_locked(client, period_ns);
+	periodic_io_list = periodic_io_list_find_or_create_locked(client, info);
 	if (!periodic_io_list) {
 		pr_err_ratelimited("Cannot create timer/periodic io list\n");
 		kfree(periodic_io->resp);
@@ -451,6 +632,7 @@ int lwis_periodic_io_init(struct lwis_client *client)
 	kthread_init_work(&client->periodic_io_work, periodic_io_work_func);
 	client->periodic_io_counter = 0;
 	hash_init(client->timer_list);
+	INIT_LIST_HEAD(&client->phase_locked_timer_list);
 	return 0;
 }
 
@@ -475,6 +657,18 @@ int lwis_periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io
 		}
 	}
 
+	if (info->timer_slack_ns < 0) {
+		pr_err_ratelimited("Invalid timer slack for periodic io\n");
+		return -EINVAL;
+	}
+
+	if (info->phase_event_id != LWIS_EVENT_ID_NONE) {
+		if (info->samples_per_event <= 0 || info->phase_offset_ns < 0) {
+			pr_err_ratelimited("Invalid phase lock for periodic io\n");
+			return -EINVAL;
+		}
+	}
+
 	ret = prepare_emit_events(client, periodic_io);
 	if (ret)
 		return ret;
@@ -483,14 +677,50 @@ int lwis_periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io
 	if (ret)
 		return ret;
 
+	periodic_io->proxy.periodic_io = periodic_io;
+	periodic_io->num_pending_periods = 0;
+	periodic_io->block_locks_only = !lwis_io_entry_locks_get(
+		client->lwis_dev, info->io_entries, info->num_io_entries, &periodic_io->block_mask);
+
 	/* Initialize but mark io as complete as it is not run yet  */
 	init_completion(&periodic_io->io_done);
 	complete(&periodic_io->io_done);
 	periodic_io->active = true;
+
+	/*
+	 * Make sure the phase event visits this client when it is emitted. The
+	 * interest is dropped again with the phase locked list on cleanup, so it
+	 * is registered last and undone if the periodic io cannot be queued.
+	 */
+	if (info->phase_event_id != LWIS_EVENT_ID_NONE) {
+		ret = lwis_device_event_client_update(client->lwis_dev, client,
+						      info->phase_event_id,
+						      LWIS_EVENT_CLIENT_INTEREST_PERIODIC_IO,
+						      /*enable=*/true);
+		if (ret) {
+			pr_err_ratelimited("Cannot register client for event 0x%llx\n",
+					   info->phase_event_id);
+			return ret;
+		}
+	}
+
 	spin_lock_irqsave(&client->periodic_io_lock, flags);
 	ret = queue_periodic_io_locked(client, periodic_io);
 	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
-	return ret;
+	if (ret) {
+		if (info->phase_event_id != LWIS_EVENT_ID_NONE) {
+			lwis_device_event_client_update(client->lwis_dev, client,
+							info->phase_event_id,
+							LWIS_EVENT_CLIENT_INTEREST_PERIODIC_IO,
+							/*enable=*/false);
+		}
+		return ret;
+	}
+
+	if (info->phase_event_id == LWIS_EVENT_ID_NONE) {
+		periodic_io_device_timer_add(periodic_io->periodic_io_list, info->timer_slack_ns);
+	}
+	return 0;
 }
 
 int lwis_periodic_io_client_flush(struct lwis_client *client)
@@ -511,8 +741,12 @@ int lwis_periodic_io_client_flush(struct lwis_client *client)
 			periodic_io->active = false;
 		}
 		spin_unlock_irqrestore(&client->periodic_io_lock, flags);
-		it_periodic_io_list->hr_timer_state = LWIS_HRTIMER_INACTIVE;
-		hrtimer_cancel(&it_periodic_io_list->hr_timer);
+		if (it_periodic_io_list->phase_event_id == LWIS_EVENT_ID_NONE) {
+			periodic_io_device_timer_remove(it_periodic_io_list);
+		} else {
+			it_periodic_io_list->hr_timer_state = LWIS_HRTIMER_INACTIVE;
+			hrtimer_cancel(&it_periodic_io_list->hr_timer);
+		}
 	}
 
 	/* Wait until all workload in process queue are processed */
@@ -537,6 +771,7 @@ int lwis_periodic_io_client_flush(struct lwis_client *client)
 int lwis_periodic_io_client_cleanup(struct lwis_client *client)
 {
 	int i, ret;
+	int64_t phase_event_id;
 	struct hlist_node *tmp;
 	struct lwis_periodic_io_list *it_periodic_io_list;
 	unsigned long flags;
@@ -551,10 +786,57 @@ int lwis_periodic_io_client_cleanup(struct lwis_client *client)
 	hash_for_each_safe (client->timer_list, i, tmp, it_periodic_io_list, node) {
 		hash_del(&it_periodic_io_list->node);
 	}
+	while (!list_empty(&client->phase_locked_timer_list)) {
+		it_periodic_io_list = list_first_entry(&client->phase_locked_timer_list,
+						       struct lwis_periodic_io_list, phase_node);
+		list_del(&it_periodic_io_list->phase_node);
+		phase_event_id = it_periodic_io_list->phase_event_id;
+		spin_unlock_irqrestore(&client->periodic_io_lock, flags);
+		lwis_device_event_client_update(client->lwis_dev, client, phase_event_id,
+						LWIS_EVENT_CLIENT_INTEREST_PERIODIC_IO,
+						/*enable=*/false);
+		spin_lock_irqsave(&client->periodic_io_lock, flags);
+	}
 	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
 	return 0;
 }
 
+void lwis_periodic_io_event_trigger(struct lwis_client *client, int64_t event_id,
+				    int64_t timestamp_ns)
+{
+	unsigned long flags;
+	int64_t delay_ns;
+	struct lwis_periodic_io_list *periodic_io_list;
+	struct lwis_periodic_io *periodic_io;
+	bool active;
+
+	if (list_empty(&client->phase_locked_timer_list)) {
+		return;
+	}
+
+	spin_lock_irqsave(&client->periodic_io_lock, flags);
+	list_for_each_entry (periodic_io_list, &client->phase_locked_timer_list, phase_node) {
+		if (periodic_io_list->phase_event_id != event_id) {
+			continue;
+		}
+		active = false;
+		list_for_each_entry (periodic_io, &periodic_io_list->list, timer_list_node) {
+			active |= periodic_io->active;
+		}
+		if (!active) {
+			continue;
+		}
+		/* Count the offset from the event, not from now */
+		delay_ns = timestamp_ns + periodic_io_list->phase_offset_ns -
+			   ktime_to_ns(lwis_get_time());
+		periodic_io_list->samples_remaining = periodic_io_list->samples_per_event;
+		periodic_io_list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
+		hrtimer_start(&periodic_io_list->hr_timer, ns_to_ktime(max_t(int64_t, delay_ns, 0)),
+			      HRTIMER_MODE_REL);
+	}
+	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
+}
+
 /* Calling this function requires holding the client's periodic_io_lock */
 static int mark_periodic_io_resp_error_locked(struct lwis_periodic_io *periodic_io)
 {
@@ -23,6 +23,18 @@ enum lwis_hrtimer_state {
 	LWIS_HRTIMER_ERROR,
 };
 
+// This is a proxy of the Periodic IO. The proxy of a periodic io is inserted
+// into the periodic io process queue on every period. When it is its turn to
+// be processed, it redirects the processing to the info and resp in the real
+// periodic io.
+struct lwis_periodic_io_proxy {
+	/* The real periodic io in the timer periodic io list which this process
+	 * queue proxy node is for */
+	struct lwis_periodic_io *periodic_io;
+	/* The node in the periodic io process queue */
+	struct list_head process_queue_node;
+};
+
 // This represents a Periodic IO submitted and exists in the timer periodic io
 // list until the client is released. The priodic io is deactivated when it is
 // cancelled explicitly or an error occurred druing executing it. A deactivated
@@ -45,25 +57,30 @@ struct lwis_periodic_io {
 	 * This will be used on the cancellation policy to prevent partial write
 	 * during cancellation */
 	bool contains_multiple_writes;
-};
-
-// This is a proxy of the Periodic IO. A proxy of the actual periodic io will be
-// created and inserted into the periodic io process queue. When it is their
-// turn to be processed, it redirect the processing to the info and resp in the
-// real periodic io.
-struct lwis_periodic_io_proxy {
-	/* The real periodic io in the timer periodic io list which this process
-	 * queue proxy node is for */
-	struct lwis_periodic_io *periodic_io;
-	/* The node in the periodic io process queue */
-	struct list_head process_queue_node;
+	/* Process queue node of this periodic io, so that the timer never
+	 * allocates */
+	struct lwis_periodic_io_proxy proxy;
+	/* Number of periods elapsed that the worker has not processed yet, the
+	 * proxy is in the process queue whenever this is non-zero */
+	int num_pending_periods;
+	/* Independent register blocks touched, computed at submit. Without any
+	 * other block touched, reg_rw_lock is not taken. */
+	uint64_t block_mask;
+	bool block_locks_only;
 };
 
 // An entry in the lwis client timer list. It also manages a list of Periodic
-// IOs which share the same timer.
+// IOs which share the same period. Free-running lists of all clients are
+// served by the timer of the device, phase locked lists have their own.
 struct lwis_periodic_io_list {
-	/* High resolution timer */
+	/* High resolution timer, phase locked lists only */
 	struct hrtimer hr_timer;
+	/* Next expiration on the device timer, in CLOCK_MONOTONIC */
+	int64_t next_expiry_ns;
+	/* How late the device timer may serve this list, to share expirations */
+	int64_t slack_ns;
+	/* Node in the list of the device timer */
+	struct list_head device_node;
 	/* Time out time in nanosecond */
 	int64_t period_ns;
 	/* State of the timer */
@@ -74,13 +91,36 @@ struct lwis_periodic_io_list {
 	struct list_head list;
 	/* Node in the timer hash table held by the LWIS client */
 	struct hlist_node node;
+	/* Event that restarts the timer, LWIS_EVENT_ID_NONE for free-running
+	 * timers. Phase locked timers serve a single periodic io. */
+	int64_t phase_event_id;
+	int64_t phase_offset_ns;
+	int samples_per_event;
+	/* Expirations left until the next event */
+	int samples_remaining;
+	/* Node in the phase locked timer list held by the LWIS client */
+	struct list_head phase_node;
 };
 
+/*
+ * lwis_periodic_io_device_init: Initializes the timer shared by the periodic
+ * ios of all clients of the device.
+ */
+void lwis_periodic_io_device_init(struct lwis_device *lwis_dev);
 int lwis_periodic_io_init(struct lwis_client *client);
 int lwis_periodic_io_client_flush(struct lwis_client *client);
 int lwis_periodic_io_client_cleanup(struct lwis_client *client);
 int lwis_periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io *periodic_io);
 int lwis_periodic_io_cancel(struct lwis_client *client, int64_t id);
+/*
+ * lwis_periodic_io_event_trigger: Re-anchors the timers phase locked to
+ * event_id, emitted at timestamp_ns.
+ *
+ * Locks: client->periodic_io_lock
+ * Assumes: Can be called in any context
+ */
+void lwis_periodic_io_event_trigger(struct lwis_client *client, int64_t event_id,
+				    int64_t timestamp_ns);
 void lwis_periodic_io_free(struct lwis_device *lwis_dev, struct lwis_periodic_io *periodic_io);
 
 #endif /* LWIS_PERIODIC_IO_H_ */
\ No newline at end of file
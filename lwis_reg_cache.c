@@ -0,0 +1,182 @@
+/*
+ * Google LWIS Shadow Register Cache
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-reg-cache: " fmt
+
+#include "lwis_reg_cache.h"
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+/* Offsets are packed with the block id into the xarray index */
+#define REG_CACHE_MAX_OFFSET U32_MAX
+
+static unsigned long cache_index(int32_t bid, uint64_t offset)
+{
+	return ((unsigned long)(uint32_t)bid << 32) | (unsigned long)offset;
+}
+
+static bool is_cacheable(struct lwis_reg_cache *cache, int32_t bid, uint64_t offset)
+{
+	int i;
+	bool bid_cached = cache->num_bids == 0;
+
+	if (offset > REG_CACHE_MAX_OFFSET) {
+		return false;
+	}
+	for (i = 0; i < cache->num_bids; ++i) {
+		if (cache->bids[i] == bid) {
+			bid_cached = true;
+			break;
+		}
+	}
+	if (!bid_cached) {
+		return false;
+	}
+	for (i = 0; i < cache->num_volatile_ranges; ++i) {
+		if (cache->volatile_ranges[i].bid == bid && offset >= cache->volatile_ranges[i].start &&
+		    offset <= cache->volatile_ranges[i].end) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct lwis_reg_cache *lwis_reg_cache_create(struct lwis_device *lwis_dev, int num_bids,
+					     int num_volatile_ranges)
+{
+	struct lwis_reg_cache *cache;
+
+	cache = kzalloc(sizeof(struct lwis_reg_cache), GFP_KERNEL);
+	if (!cache) {
+		dev_err(lwis_dev->dev, "Failed to allocate register cache\n");
+		return ERR_PTR(-ENOMEM);
+	}
+	/* Register io happens in IRQ context for some devices */
+	xa_init_flags(&cache->values, XA_FLAGS_LOCK_IRQ);
+
+	if (num_bids > 0) {
+		cache->bids = kcalloc(num_bids, sizeof(int32_t), GFP_KERNEL);
+		if (!cache->bids) {
+			goto error_alloc;
+		}
+		cache->num_bids = num_bids;
+	}
+	if (num_volatile_ranges > 0) {
+		cache->volatile_ranges = kcalloc(num_volatile_ranges,
+						 sizeof(struct lwis_reg_cache_range), GFP_KERNEL);
+		if (!cache->volatile_ranges) {
+			goto error_alloc;
+		}
+		cache->num_volatile_ranges = num_volatile_ranges;
+	}
+
+	lwis_dev->reg_cache = cache;
+	return cache;
+
+error_alloc:
+	dev_err(lwis_dev->dev, "Failed to allocate register cache ranges\n");
+	kfree(cache->bids);
+	kfree(cache);
+	return ERR_PTR(-ENOMEM);
+}
+
+void lwis_reg_cache_destroy(struct lwis_device *lwis_dev)
+{
+	struct lwis_reg_cache *cache = lwis_dev->reg_cache;
+
+	if (!cache) {
+		return;
+	}
+	lwis_dev->reg_cache = NULL;
+	xa_destroy(&cache->values);
+	kfree(cache->volatile_ranges);
+	kfree(cache->bids);
+	kfree(cache);
+}
+
+bool lwis_reg_cache_read(struct lwis_device *lwis_dev, int32_t bid, uint64_t offset,
+			 uint64_t *value)
+{
+	void *entry;
+	struct lwis_reg_cache *cache = lwis_dev->reg_cache;
+
+	if (!cache || !is_cacheable(cache, bid, offset)) {
+		return false;
+	}
+	entry = xa_load(&cache->values, cache_index(bid, offset));
+	if (!xa_is_value(entry)) {
+		return false;
+	}
+	*value = xa_to_value(entry);
+	return true;
+}
+
+bool lwis_reg_cache_write_needed(struct lwis_device *lwis_dev, int32_t bid, uint64_t offset,
+				 uint64_t value)
+{
+	uint64_t cached;
+
+	return !lwis_reg_cache_read(lwis_dev, bid, offset, &cached) || cached != value;
+}
+
+void lwis_reg_cache_update(struct lwis_device *lwis_dev, int32_t bid, uint64_t offset,
+			   uint64_t value)
+{
+	unsigned long flags;
+	void *old;
+	struct lwis_reg_cache *cache = lwis_dev->reg_cache;
+
+	if (!cache || !is_cacheable(cache, bid, offset)) {
+		return;
+	}
+
+	xa_lock_irqsave(&cache->values, flags);
+	/* Values that do not fit an xarray value entry are simply not cached */
+	if (value > LONG_MAX) {
+		__xa_erase(&cache->values, cache_index(bid, offset));
+	} else {
+		old = __xa_store(&cache->values, cache_index(bid, offset), xa_mk_value(value),
+				 GFP_ATOMIC);
+		if (xa_is_err(old)) {
+			__xa_erase(&cache->values, cache_index(bid, offset));
+		}
+	}
+	xa_unlock_irqrestore(&cache->values, flags);
+}
+
+void lwis_reg_cache_invalidate(struct lwis_device *lwis_dev, int32_t bid, uint64_t offset,
+			       size_t size_in_bytes)
+{
+	unsigned long flags;
+	unsigned long index;
+	uint64_t last;
+	void *entry;
+	struct lwis_reg_cache *cache = lwis_dev->reg_cache;
+
+	if (!cache || offset > REG_CACHE_MAX_OFFSET || size_in_bytes == 0) {
+		return;
+	}
+	last = min_t(uint64_t, offset + size_in_bytes - 1, REG_CACHE_MAX_OFFSET);
+
+	xa_lock_irqsave(&cache->values, flags);
+	xa_for_each_range (&cache->values, index, entry, cache_index(bid, offset),
+			   cache_index(bid, last)) {
+		__xa_erase(&cache->values, index);
+	}
+	xa_unlock_irqrestore(&cache->values, flags);
+}
+
+void lwis_reg_cache_clear(struct lwis_device *lwis_dev)
+{
+	if (lwis_dev->reg_cache) {
+		xa_destroy(&lwis_dev->reg_cache->values);
+	}
+}
@@ -0,0 +1,89 @@
+/*
+ * Google LWIS Shadow Register Cache
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_REG_CACHE_H_
+#define LWIS_REG_CACHE_H_
+
+#include <linux/types.h>
+#include <linux/xarray.h>
+
+#include "lwis_device.h"
+
+/* Inclusive range of register offsets within a register block */
+struct lwis_reg_cache_range {
+	int32_t bid;
+	uint64_t start;
+	uint64_t end;
+};
+
+/*
+ *  struct lwis_reg_cache
+ *  Write-through copy of the last value written to or read from registers,
+ *  used to skip writes that would not change a register and the read half of
+ *  read-modify-writes.
+ */
+struct lwis_reg_cache {
+	/* Register values, indexed by block id and offset */
+	struct xarray values;
+	/* Blocks that are cached, all of them if num_bids is 0 */
+	int32_t *bids;
+	int num_bids;
+	/* Registers that change on their own, e.g. status and interrupt registers */
+	struct lwis_reg_cache_range *volatile_ranges;
+	int num_volatile_ranges;
+};
+
+/*
+ *  lwis_reg_cache_create: Allocate the register cache of the device, with room
+ *  for the given number of cached blocks and volatile ranges.
+ */
+struct lwis_reg_cache *lwis_reg_cache_create(struct lwis_device *lwis_dev, int num_bids,
+					     int num_volatile_ranges);
+
+/*
+ *  lwis_reg_cache_destroy: Free the register cache of the device, if any.
+ */
+void lwis_reg_cache_destroy(struct lwis_device *lwis_dev);
+
+/*
+ *  lwis_reg_cache_read: Look up the cached value of a register.
+ *  Returns true and fills value on a hit.
+ */
+bool lwis_reg_cache_read(struct lwis_device *lwis_dev, int32_t bid, uint64_t offset,
+			 uint64_t *value);
+
+/*
+ *  lwis_reg_cache_write_needed: Returns false if the register is known to
+ *  already hold value, so that writing it again can be skipped.
+ */
+bool lwis_reg_cache_write_needed(struct lwis_device *lwis_dev, int32_t bid, uint64_t offset,
+				 uint64_t value);
+
+/*
+ *  lwis_reg_cache_update: Record the value a register was read as or
+ *  successfully written with.
+ */
+void lwis_reg_cache_update(struct lwis_device *lwis_dev, int32_t bid, uint64_t offset,
+			   uint64_t value);
+
+/*
+ *  lwis_reg_cache_invalidate: Forget the cached values of the registers within
+ *  size_in_bytes from offset, e.g. after a batch write or a failed access.
+ */
+void lwis_reg_cache_invalidate(struct lwis_device *lwis_dev, int32_t bid, uint64_t offset,
+			       size_t size_in_bytes);
+
+/*
+ *  lwis_reg_cache_clear: Forget all cached values, when the device loses its
+ *  register state on power down or reset.
+ */
+void lwis_reg_cache_clear(struct lwis_device *lwis_dev);
+
+#endif /* LWIS_REG_CACHE_H_ */
@@ -0,0 +1,325 @@
+/*
+ * Google LWIS Register I/O Capture
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-reg-capture: " fmt
+
+#include "lwis_reg_capture.h"
+
+#include <linux/delay.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "lwis_allocator.h"
+#include "lwis_io_entry.h"
+
+/* Records moved out of the ring per copy to userspace */
+#define REG_CAPTURE_READ_RECORDS 8
+/* Largest batch access a replay executes */
+#define MAX_REG_REPLAY_BATCH_SIZE SZ_1M
+/* Lateness allowed to replayed accesses for the sleeps to be coalesced */
+#define REG_REPLAY_SLACK_US 10
+
+static bool record_from_entry(struct lwis_reg_capture_record *record,
+			      const struct lwis_io_entry *entry, uint32_t value_bytes)
+{
+	switch (entry->type) {
+	case LWIS_IO_ENTRY_READ:
+	case LWIS_IO_ENTRY_WRITE:
+		record->bid = entry->rw.bid;
+		record->offset = entry->rw.offset;
+		record->value = entry->rw.val;
+		record->size_in_bytes = value_bytes;
+		break;
+	case LWIS_IO_ENTRY_MODIFY:
+		record->bid = entry->mod.bid;
+		record->offset = entry->mod.offset;
+		record->value = entry->mod.val;
+		record->mask = entry->mod.val_mask;
+		record->size_in_bytes = value_bytes;
+		break;
+	case LWIS_IO_ENTRY_READ_BATCH:
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		record->bid = entry->rw_batch.bid;
+		record->offset = entry->rw_batch.offset;
+		record->size_in_bytes = entry->rw_batch.size_in_bytes;
+		break;
+	case LWIS_IO_ENTRY_READ_BATCH_TO_BUFFER:
+		/* The destination buffer makes no difference to the bus */
+		record->bid = entry->read_to_buffer.bid;
+		record->offset = entry->read_to_buffer.offset;
+		record->size_in_bytes = entry->read_to_buffer.size_in_bytes;
+		record->type = LWIS_IO_ENTRY_READ_BATCH;
+		return true;
+	default:
+		return false;
+	}
+	record->type = entry->type;
+	return true;
+}
+
+int lwis_reg_capture_start(struct lwis_device *lwis_dev, size_t num_records)
+{
+	struct lwis_reg_capture *capture;
+	struct lwis_reg_capture_record *records = NULL;
+	struct lwis_reg_capture_record *old_records;
+	unsigned long flags;
+
+	if (num_records > MAX_REG_CAPTURE_RECORDS) {
+		dev_err(lwis_dev->dev, "Capture of %zu register accesses exceeds the limit of %d\n",
+			num_records, MAX_REG_CAPTURE_RECORDS);
+		return -EINVAL;
+	}
+	if (num_records > 0) {
+		records = kvmalloc_array(num_records, sizeof(*records), GFP_KERNEL);
+		if (!records) {
+			dev_err(lwis_dev->dev, "Failed to allocate the register capture ring\n");
+			return -ENOMEM;
+		}
+	}
+
+	/* Serializes the creation of the capture */
+	mutex_lock(&lwis_dev->client_lock);
+	capture = lwis_dev->reg_capture;
+	if (!capture) {
+		if (!records) {
+			mutex_unlock(&lwis_dev->client_lock);
+			return 0;
+		}
+		capture = kzalloc(sizeof(struct lwis_reg_capture), GFP_KERNEL);
+		if (!capture) {
+			mutex_unlock(&lwis_dev->client_lock);
+			kvfree(records);
+			dev_err(lwis_dev->dev, "Failed to allocate the register capture\n");
+			return -ENOMEM;
+		}
+		spin_lock_init(&capture->lock);
+		WRITE_ONCE(lwis_dev->reg_capture, capture);
+	}
+	mutex_unlock(&lwis_dev->client_lock);
+
+	spin_lock_irqsave(&capture->lock, flags);
+	if (!records) {
+		WRITE_ONCE(capture->enabled, false);
+		spin_unlock_irqrestore(&capture->lock, flags);
+		return 0;
+	}
+	old_records = capture->records;
+	capture->records = records;
+	capture->num_records = num_records;
+	capture->head = 0;
+	capture->count = 0;
+	capture->num_overwritten = 0;
+	WRITE_ONCE(capture->enabled, true);
+	spin_unlock_irqrestore(&capture->lock, flags);
+
+	kvfree(old_records);
+	return 0;
+}
+
+void lwis_reg_capture_destroy(struct lwis_device *lwis_dev)
+{
+	struct lwis_reg_capture *capture = lwis_dev->reg_capture;
+
+	if (!capture) {
+		return;
+	}
+	lwis_dev->reg_capture = NULL;
+	kvfree(capture->records);
+	kfree(capture);
+}
+
+void lwis_reg_capture_add(struct lwis_device *lwis_dev, const struct lwis_io_entry *entry,
+			  enum lwis_reg_capture_source source, int64_t source_id,
+			  int64_t start_ns, int error_code)
+{
+	struct lwis_reg_capture *capture = lwis_dev->reg_capture;
+	struct lwis_reg_capture_record record = {};
+	int64_t end_ns = ktime_to_ns(lwis_get_time());
+	size_t index;
+	unsigned long flags;
+
+	if (!record_from_entry(&record, entry, lwis_dev->native_value_bitwidth / BITS_PER_BYTE)) {
+		return;
+	}
+	record.timestamp_ns = start_ns;
+	record.source_id = source_id;
+	record.error_code = error_code;
+	record.duration_ns = min_t(int64_t, end_ns - start_ns, U32_MAX);
+	record.source = source;
+
+	spin_lock_irqsave(&capture->lock, flags);
+	if (capture->enabled) {
+		index = (capture->head + capture->count) % capture->num_records;
+		capture->records[index] = record;
+		if (capture->count < capture->num_records) {
+			capture->count++;
+		} else {
+			capture->head = (capture->head + 1) % capture->num_records;
+			capture->num_overwritten++;
+		}
+	}
+	spin_unlock_irqrestore(&capture->lock, flags);
+}
+
+ssize_t lwis_reg_capture_read(struct lwis_device *lwis_dev, char __user *user_buf, size_t count)
+{
+	struct lwis_reg_capture *capture = READ_ONCE(lwis_dev->reg_capture);
+	struct lwis_reg_capture_record records[REG_CAPTURE_READ_RECORDS];
+	size_t copied = 0;
+	size_t num;
+	size_t i;
+	unsigned long flags;
+
+	if (!capture) {
+		return 0;
+	}
+	while (count - copied >= sizeof(struct lwis_reg_capture_record)) {
+		num = min_t(size_t, REG_CAPTURE_READ_RECORDS,
+			    (count - copied) / sizeof(struct lwis_reg_capture_record));
+
+		spin_lock_irqsave(&capture->lock, flags);
+		num = min(num, capture->count);
+		for (i = 0; i < num; ++i) {
+			records[i] = capture->records[capture->head];
+			capture->head = (capture->head + 1) % capture->num_records;
+		}
+		capture->count -= num;
+		spin_unlock_irqrestore(&capture->lock, flags);
+
+		if (num == 0) {
+			break;
+		}
+		if (copy_to_user(user_buf + copied, records, num * sizeof(records[0]))) {
+			dev_err_ratelimited(lwis_dev->dev, "Failed to copy register capture records\n");
+			return copied ? copied : -EFAULT;
+		}
+		copied += num * sizeof(records[0]);
+	}
+	return copied;
+}
+
+static void replay_wait_until(int64_t target_ns)
+{
+	int64_t remaining_us = div_s64(target_ns - ktime_to_ns(lwis_get_time()), NSEC_PER_USEC);
+
+	if (remaining_us > 0) {
+		usleep_range(remaining_us, remaining_us + REG_REPLAY_SLACK_US);
+	}
+}
+
+static void entry_from_record(struct lwis_io_entry *entry,
+			      const struct lwis_reg_capture_record *record, uint8_t *batch_buf)
+{
+	entry->type = record->type;
+	switch (record->type) {
+	case LWIS_IO_ENTRY_MODIFY:
+		entry->mod.bid = record->bid;
+		entry->mod.offset = record->offset;
+		entry->mod.val = record->value;
+		entry->mod.val_mask = record->mask;
+		break;
+	case LWIS_IO_ENTRY_READ_BATCH:
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		entry->rw_batch.bid = record->bid;
+		entry->rw_batch.offset = record->offset;
+		entry->rw_batch.size_in_bytes = record->size_in_bytes;
+		entry->rw_batch.buf = batch_buf;
+		entry->rw_batch.is_offset_fixed = false;
+		/* The data written is not captured */
+		if (record->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			memset(batch_buf, 0, record->size_in_bytes);
+		}
+		break;
+	default:
+		entry->rw.bid = record->bid;
+		entry->rw.offset = record->offset;
+		entry->rw.val = record->value;
+		break;
+	}
+}
+
+int lwis_reg_capture_replay(struct lwis_device *lwis_dev,
+			    const struct lwis_reg_capture_record *records, uint32_t num_records,
+			    uint32_t flags, uint32_t *num_failed)
+{
+	int ret = 0;
+	int io_ret;
+	uint32_t i;
+	size_t batch_size = 0;
+	uint8_t *batch_buf = NULL;
+	struct lwis_io_entry entry;
+	int64_t start_ns;
+	int64_t capture_ns;
+
+	if (!lwis_dev->vops.register_io) {
+		dev_err(lwis_dev->dev, "Register IO not supported on this LWIS device\n");
+		return -EINVAL;
+	}
+	for (i = 0; i < num_records; ++i) {
+		switch (records[i].type) {
+		case LWIS_IO_ENTRY_READ:
+		case LWIS_IO_ENTRY_WRITE:
+		case LWIS_IO_ENTRY_MODIFY:
+			break;
+		case LWIS_IO_ENTRY_READ_BATCH:
+		case LWIS_IO_ENTRY_WRITE_BATCH:
+			batch_size = max_t(size_t, batch_size, records[i].size_in_bytes);
+			break;
+		default:
+			dev_err(lwis_dev->dev, "Replay record %u has invalid type %d\n", i,
+				records[i].type);
+			return -EINVAL;
+		}
+	}
+	if (batch_size > MAX_REG_REPLAY_BATCH_SIZE) {
+		dev_err(lwis_dev->dev, "Replay batch of %zu bytes exceeds the limit of %d\n",
+			batch_size, MAX_REG_REPLAY_BATCH_SIZE);
+		return -EINVAL;
+	}
+	if (batch_size > 0) {
+		batch_buf = lwis_allocator_allocate(lwis_dev, batch_size);
+		if (!batch_buf) {
+			dev_err(lwis_dev->dev, "Failed to allocate replay batch buffer\n");
+			return -ENOMEM;
+		}
+	}
+
+	*num_failed = 0;
+	start_ns = ktime_to_ns(lwis_get_time());
+	for (i = 0; i < num_records; ++i) {
+		if (!(flags & LWIS_REG_IO_REPLAY_FLAG_NO_DELAY)) {
+			replay_wait_until(start_ns + records[i].timestamp_ns - records[0].timestamp_ns);
+		}
+		if (signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+		entry_from_record(&entry, &records[i], batch_buf);
+
+		/* Locked per access, other clients may run while the replay sleeps */
+		capture_ns = lwis_reg_capture_begin(lwis_dev);
+		lwis_io_entry_lock(lwis_dev, /*device_lock=*/true, U64_MAX);
+		io_ret = lwis_dev->vops.register_io(lwis_dev, &entry, lwis_dev->native_value_bitwidth);
+		lwis_io_entry_unlock(lwis_dev, /*device_lock=*/true, U64_MAX);
+		lwis_reg_capture_end(lwis_dev, &entry, LWIS_REG_CAPTURE_SOURCE_REPLAY, i, capture_ns,
+				     io_ret);
+		if (io_ret) {
+			(*num_failed)++;
+		}
+	}
+
+	if (batch_buf) {
+		lwis_allocator_free(lwis_dev, batch_buf);
+	}
+	return ret;
+}
@@ -0,0 +1,103 @@
+/*
+ * Google LWIS Register I/O Capture
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_REG_CAPTURE_H_
+#define LWIS_REG_CAPTURE_H_
+
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "lwis_commands.h"
+#include "lwis_device.h"
+#include "lwis_util.h"
+
+/* Largest capture ring and replay, 16MB of records */
+#define MAX_REG_CAPTURE_RECORDS (256 * 1024)
+
+/*
+ *  struct lwis_reg_capture
+ *  Ring of the last register accesses of a device, the oldest records are
+ *  overwritten once it is full.
+ */
+struct lwis_reg_capture {
+	/* Protects the ring, accesses are captured from IRQ context too */
+	spinlock_t lock;
+	struct lwis_reg_capture_record *records;
+	size_t num_records;
+	/* Index of the oldest record, and number of records to be read */
+	size_t head;
+	size_t count;
+	/* Records overwritten before being read */
+	uint64_t num_overwritten;
+	bool enabled;
+};
+
+/*
+ *  lwis_reg_capture_start: Start capturing the register accesses of the device
+ *  into a new ring of num_records, dropping the records not read yet. Stops the
+ *  capture if num_records is 0, the records left can still be read.
+ */
+int lwis_reg_capture_start(struct lwis_device *lwis_dev, size_t num_records);
+
+/*
+ *  lwis_reg_capture_destroy: Free the capture ring of the device, if any.
+ */
+void lwis_reg_capture_destroy(struct lwis_device *lwis_dev);
+
+/*
+ *  lwis_reg_capture_begin: Timestamp of the start of an access to be passed to
+ *  lwis_reg_capture_end, 0 if the device is not capturing.
+ */
+static inline int64_t lwis_reg_capture_begin(struct lwis_device *lwis_dev)
+{
+	struct lwis_reg_capture *capture = READ_ONCE(lwis_dev->reg_capture);
+
+	if (likely(!capture || !READ_ONCE(capture->enabled))) {
+		return 0;
+	}
+	return ktime_to_ns(lwis_get_time());
+}
+
+void lwis_reg_capture_add(struct lwis_device *lwis_dev, const struct lwis_io_entry *entry,
+			  enum lwis_reg_capture_source source, int64_t source_id,
+			  int64_t start_ns, int error_code);
+
+/*
+ *  lwis_reg_capture_end: Record the access of entry started at start_ns, unless
+ *  the capture was not running then.
+ */
+static inline void lwis_reg_capture_end(struct lwis_device *lwis_dev,
+					const struct lwis_io_entry *entry,
+					enum lwis_reg_capture_source source, int64_t source_id,
+					int64_t start_ns, int error_code)
+{
+	if (likely(start_ns == 0)) {
+		return;
+	}
+	lwis_reg_capture_add(lwis_dev, entry, source, source_id, start_ns, error_code);
+}
+
+/*
+ *  lwis_reg_capture_read: Move the oldest whole records that fit in count
+ *  bytes to the userspace buffer.
+ *  Returns the number of bytes copied, 0 if there is no record to read.
+ */
+ssize_t lwis_reg_capture_read(struct lwis_device *lwis_dev, char __user *user_buf, size_t count);
+
+/*
+ *  lwis_reg_capture_replay: Execute the register accesses of the records on
+ *  the device, spaced as they were captured unless LWIS_REG_IO_REPLAY_FLAG_NO_DELAY
+ *  is set. Failing accesses are counted in num_failed and skipped.
+ */
+int lwis_reg_capture_replay(struct lwis_device *lwis_dev,
+			    const struct lwis_reg_capture_record *records, uint32_t num_records,
+			    uint32_t flags, uint32_t *num_failed);
+
+#endif /* LWIS_REG_CAPTURE_H_ */
@@ -47,6 +47,119 @@ TRACE_EVENT(tracing_mark_write,
 		__entry->type, __entry->pid, LWIS_DEVICE_NAME, __get_str(func_name), __entry->value)
 );
 
+/*
+ * Structured events of the IRQ -> event -> transaction pipeline. These only
+ * record binary fields, devices are identified by their LWIS device id.
+ */
+TRACE_EVENT(lwis_event_emit,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t event_id, int64_t event_counter,
+		int64_t timestamp),
+	TP_ARGS(lwis_dev, event_id, event_counter, timestamp),
+	TP_STRUCT__entry(
+		__field(int, dev_id)
+		__field(int64_t, event_id)
+		__field(int64_t, event_counter)
+		__field(int64_t, timestamp)
+	),
+	TP_fast_assign(
+		__entry->dev_id = lwis_dev->id;
+		__entry->event_id = event_id;
+		__entry->event_counter = event_counter;
+		__entry->timestamp = timestamp;
+	),
+	TP_printk("dev=%d event=0x%llx counter=%lld timestamp=%lld",
+		__entry->dev_id, __entry->event_id, __entry->event_counter, __entry->timestamp)
+);
+
+DECLARE_EVENT_CLASS(lwis_transaction_class,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, size_t num_entries,
+		size_t results_size, int error),
+	TP_ARGS(lwis_dev, id, num_entries, results_size, error),
+	TP_STRUCT__entry(
+		__field(int, dev_id)
+		__field(int64_t, id)
+		__field(size_t, num_entries)
+		__field(size_t, results_size)
+		__field(int, error)
+	),
+	TP_fast_assign(
+		__entry->dev_id = lwis_dev->id;
+		__entry->id = id;
+		__entry->num_entries = num_entries;
+		__entry->results_size = results_size;
+		__entry->error = error;
+	),
+	TP_printk("dev=%d id=0x%llx entries=%zu results_bytes=%zu error=%d",
+		__entry->dev_id, __entry->id, __entry->num_entries, __entry->results_size,
+		__entry->error)
+);
+
+DEFINE_EVENT(lwis_transaction_class, lwis_transaction_queue,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, size_t num_entries,
+		size_t results_size, int error),
+	TP_ARGS(lwis_dev, id, num_entries, results_size, error)
+);
+
+DEFINE_EVENT(lwis_transaction_class, lwis_transaction_start,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, size_t num_entries,
+		size_t results_size, int error),
+	TP_ARGS(lwis_dev, id, num_entries, results_size, error)
+);
+
+DEFINE_EVENT(lwis_transaction_class, lwis_transaction_finish,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, size_t num_entries,
+		size_t results_size, int error),
+	TP_ARGS(lwis_dev, id, num_entries, results_size, error)
+);
+
+TRACE_EVENT(lwis_irq_enter,
+	TP_PROTO(struct lwis_device *lwis_dev, int irq_number),
+	TP_ARGS(lwis_dev, irq_number),
+	TP_STRUCT__entry(
+		__field(int, dev_id)
+		__field(int, irq_number)
+	),
+	TP_fast_assign(
+		__entry->dev_id = lwis_dev->id;
+		__entry->irq_number = irq_number;
+	),
+	TP_printk("dev=%d irq=%d", __entry->dev_id, __entry->irq_number)
+);
+
+TRACE_EVENT(lwis_irq_exit,
+	TP_PROTO(struct lwis_device *lwis_dev, int irq_number, uint64_t source_value),
+	TP_ARGS(lwis_dev, irq_number, source_value),
+	TP_STRUCT__entry(
+		__field(int, dev_id)
+		__field(int, irq_number)
+		__field(uint64_t, source_value)
+	),
+	TP_fast_assign(
+		__entry->dev_id = lwis_dev->id;
+		__entry->irq_number = irq_number;
+		__entry->source_value = source_value;
+	),
+	TP_printk("dev=%d irq=%d source=0x%llx", __entry->dev_id, __entry->irq_number,
+		__entry->source_value)
+);
+
+TRACE_EVENT(lwis_periodic_io_tick,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t period_ns, int num_queued),
+	TP_ARGS(lwis_dev, period_ns, num_queued),
+	TP_STRUCT__entry(
+		__field(int, dev_id)
+		__field(int64_t, period_ns)
+		__field(int, num_queued)
+	),
+	TP_fast_assign(
+		__entry->dev_id = lwis_dev->id;
+		__entry->period_ns = period_ns;
+		__entry->num_queued = num_queued;
+	),
+	TP_printk("dev=%d period_ns=%lld queued=%d", __entry->dev_id, __entry->period_ns,
+		__entry->num_queued)
+);
+
 #define LWIS_ATRACE_BEGIN(lwis_dev, func_name) \
 	trace_tracing_mark_write(lwis_dev, 'B', current->tgid, func_name, 0)
 #define LWIS_ATRACE_FUNC_BEGIN(lwis_dev) LWIS_ATRACE_BEGIN(lwis_dev, __func__)
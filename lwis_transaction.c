@@ -19,10 +19,14 @@
 #include <linux/workqueue.h>
 
 #include "lwis_allocator.h"
+#include "lwis_buffer.h"
 #include "lwis_device.h"
+#include "lwis_device_dpm.h"
 #include "lwis_event.h"
 #include "lwis_io_entry.h"
+#include "lwis_io_program.h"
 #include "lwis_ioreg.h"
+#include "lwis_reg_capture.h"
 #include "lwis_util.h"
 
 #define CREATE_TRACE_POINTS
@@ -31,6 +35,30 @@
 #define EXPLICIT_EVENT_COUNTER(x)                                                                  \
 	((x) != LWIS_EVENT_COUNTER_ON_NEXT_OCCURRENCE && (x) != LWIS_EVENT_COUNTER_EVERY_TIME)
 
+/* Number of iterations of a repeating transaction that can be in flight at
+ * the same time */
+#define TRANSACTION_NUM_ITERATIONS 4
+/* Longest run of io_entries coalesced into a single batch access */
+#define TRANSACTION_MAX_RUN_LENGTH 128
+
+/* Run of single-byte READs or WRITEs to consecutive offsets of one register
+ * block, executed as a single READ_BATCH or WRITE_BATCH. */
+struct lwis_transaction_run {
+	int32_t bid;
+	uint64_t offset;
+	int length;
+	/* WRITE runs: values of the io_entries, in order */
+	uint8_t values[];
+};
+
+/* Longest sequence of io_entries submitted as a single bus transaction */
+#define TRANSACTION_MAX_VECTOR_LENGTH 64
+
+/* Sequence of io_entries executed through vops.register_io_vector */
+struct lwis_transaction_vector {
+	int length;
+};
+
 static struct lwis_transaction_event_list *event_list_find(struct lwis_client *client,
 							   int64_t event_id)
 {
@@ -52,12 +80,31 @@ static struct lwis_transaction_event_list *event_list_create(struct lwis_client
 		dev_err(client->lwis_dev->dev, "Cannot allocate new event list\n");
 		return NULL;
 	}
+	/* Make sure the event visits this client when it is emitted */
+	if (lwis_device_event_client_update(client->lwis_dev, client, event_id,
+					    LWIS_EVENT_CLIENT_INTEREST_TRANSACTION,
+					    /*enable=*/true)) {
+		dev_err(client->lwis_dev->dev, "Cannot register client for event 0x%llx\n",
+			event_id);
+		kfree(event_list);
+		return NULL;
+	}
 	event_list->event_id = event_id;
 	INIT_LIST_HEAD(&event_list->list);
+	event_list->counter_queue = RB_ROOT_CACHED;
 	hash_add(client->transaction_list, &event_list->node, event_id);
 	return event_list;
 }
 
+static void event_list_free(struct lwis_client *client,
+			    struct lwis_transaction_event_list *event_list)
+{
+	lwis_device_event_client_update(client->lwis_dev, client, event_list->event_id,
+					LWIS_EVENT_CLIENT_INTEREST_TRANSACTION, /*enable=*/false);
+	hash_del(&event_list->node);
+	kfree(event_list);
+}
+
 static struct lwis_transaction_event_list *event_list_find_or_create(struct lwis_client *client,
 								     int64_t event_id)
 {
@@ -65,6 +112,76 @@ static struct lwis_transaction_event_list *event_list_find_or_create(struct lwis
 	return (list == NULL) ? event_list_create(client, event_id) : list;
 }
 
+/* Transactions targeting the same counter stay in submission order */
+static void counter_queue_insert_locked(struct lwis_transaction_event_list *event_list,
+					struct lwis_transaction *transaction)
+{
+	struct rb_node **link = &event_list->counter_queue.rb_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct lwis_transaction *entry;
+	int64_t counter = transaction->info.trigger_event_counter;
+	bool leftmost = true;
+
+	while (*link) {
+		parent = *link;
+		entry = rb_entry(parent, struct lwis_transaction, counter_node);
+		if (counter < entry->info.trigger_event_counter) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+	rb_link_node(&transaction->counter_node, parent, link);
+	rb_insert_color_cached(&transaction->counter_node, &event_list->counter_queue, leftmost);
+	transaction->in_counter_queue = true;
+}
+
+static void counter_queue_erase_locked(struct lwis_transaction_event_list *event_list,
+				       struct lwis_transaction *transaction)
+{
+	rb_erase_cached(&transaction->counter_node, &event_list->counter_queue);
+	transaction->in_counter_queue = false;
+}
+
+/* Moves the transactions whose trigger counter is reached into the event list,
+ * among the other transactions of the event in submission order. */
+static void counter_queue_pop_due_locked(struct lwis_transaction_event_list *event_list,
+					 int64_t event_counter)
+{
+	struct rb_node *node;
+	struct lwis_transaction *transaction;
+	struct lwis_transaction *it;
+
+	while ((node = rb_first_cached(&event_list->counter_queue)) != NULL) {
+		transaction = rb_entry(node, struct lwis_transaction, counter_node);
+		if (transaction->info.trigger_event_counter > event_counter) {
+			break;
+		}
+		counter_queue_erase_locked(event_list, transaction);
+		list_for_each_entry (it, &event_list->list, event_list_node) {
+			if (it->info.id > transaction->info.id) {
+				break;
+			}
+		}
+		list_add_tail(&transaction->event_list_node, &it->event_list_node);
+	}
+}
+
+/* Moves all the transactions of the counter queue to the tail of the event
+ * list, for the walks visiting every transaction of the event. */
+static void counter_queue_flatten_locked(struct lwis_transaction_event_list *event_list)
+{
+	struct rb_node *node;
+	struct lwis_transaction *transaction;
+
+	while ((node = rb_first_cached(&event_list->counter_queue)) != NULL) {
+		transaction = rb_entry(node, struct lwis_transaction, counter_node);
+		counter_queue_erase_locked(event_list, transaction);
+		list_add_tail(&transaction->event_list_node, &event_list->list);
+	}
+}
+
 static void save_transaction_to_history(struct lwis_client *client,
 					struct lwis_transaction_info *trans_info,
 					int64_t process_timestamp, int64_t process_duration_ns)
@@ -81,138 +198,895 @@ static void save_transaction_to_history(struct lwis_client *client,
 	}
 }
 
-void lwis_transaction_free(struct lwis_device *lwis_dev, struct lwis_transaction *transaction)
+static struct kmem_cache *transaction_cache;
+
+int lwis_transaction_cache_init(void)
+{
+	transaction_cache = KMEM_CACHE(lwis_transaction, 0);
+	if (!transaction_cache) {
+		pr_err("Failed to create transaction cache\n");
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void lwis_transaction_cache_deinit(void)
+{
+	kmem_cache_destroy(transaction_cache);
+	transaction_cache = NULL;
+}
+
+struct lwis_transaction *lwis_transaction_alloc(gfp_t flags)
+{
+	return kmem_cache_alloc(transaction_cache, flags);
+}
+
+void lwis_transaction_dealloc(struct lwis_transaction *transaction)
+{
+	if (transaction) {
+		kmem_cache_free(transaction_cache, transaction);
+	}
+}
+
+static void iteration_pool_destroy(struct lwis_transaction_iteration_pool *pool)
+{
+	struct list_head *it_tran, *it_tran_tmp;
+	struct lwis_transaction *iteration;
+
+	list_for_each_safe (it_tran, it_tran_tmp, &pool->free_list) {
+		iteration = list_entry(it_tran, struct lwis_transaction, process_queue_node);
+		list_del(&iteration->process_queue_node);
+		kfree(iteration->resp);
+		lwis_transaction_dealloc(iteration);
+	}
+	kfree(pool);
+}
+
+static int iteration_pool_create(struct lwis_client *client, struct lwis_transaction *transaction,
+				 size_t resp_size)
+{
+	int i;
+	struct lwis_transaction_iteration_pool *pool;
+	struct lwis_transaction *iteration;
+
+	pool = kzalloc(sizeof(struct lwis_transaction_iteration_pool), GFP_KERNEL);
+	if (!pool) {
+		dev_err(client->lwis_dev->dev, "Failed to allocate transaction iteration pool\n");
+		return -ENOMEM;
+	}
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->free_list);
+
+	for (i = 0; i < TRANSACTION_NUM_ITERATIONS; ++i) {
+		iteration = lwis_transaction_alloc(GFP_KERNEL | __GFP_ZERO);
+		if (!iteration) {
+			goto error_destroy_pool;
+		}
+		iteration->resp = kmalloc(resp_size, GFP_KERNEL);
+		if (!iteration->resp) {
+			lwis_transaction_dealloc(iteration);
+			goto error_destroy_pool;
+		}
+		iteration->parent = transaction;
+		INIT_LIST_HEAD(&iteration->event_list_node);
+		list_add_tail(&iteration->process_queue_node, &pool->free_list);
+	}
+
+	pool->resp_size = resp_size;
+	transaction->iteration_pool = pool;
+	return 0;
+
+error_destroy_pool:
+	dev_err(client->lwis_dev->dev, "Failed to allocate repeating transaction iterations\n");
+	iteration_pool_destroy(pool);
+	return -ENOMEM;
+}
+
+/* Releases what the ops resolved at prepare time. Needs the io_entries, to
+ * tell which ops hold a buffer kernel map. */
+static void transaction_ops_free(struct lwis_device *lwis_dev,
+				 struct lwis_transaction *transaction)
 {
 	int i;
 
+	if (!transaction->ops) {
+		return;
+	}
 	for (i = 0; i < transaction->info.num_io_entries; ++i) {
-		if (transaction->info.io_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
-			lwis_allocator_free(lwis_dev, transaction->info.io_entries[i].rw_batch.buf);
-			transaction->info.io_entries[i].rw_batch.buf = NULL;
+		if (transaction->ops[i].coalesced) {
+			kfree(transaction->ops[i].resolved);
+		} else if (transaction->info.io_entries[i].type ==
+				   LWIS_IO_ENTRY_READ_BATCH_TO_BUFFER &&
+			   transaction->ops[i].resolved) {
+			lwis_buffer_kernel_map_put(transaction->ops[i].resolved);
+		}
+	}
+	lwis_allocator_free(lwis_dev, transaction->ops);
+	transaction->ops = NULL;
+}
+
+static void transaction_free_resources(struct lwis_device *lwis_dev,
+				       struct lwis_transaction *transaction)
+{
+	int i;
+
+	if (transaction->iteration_pool) {
+		if (transaction->iteration_pool->retired) {
+			transaction_free_resources(lwis_dev, transaction->iteration_pool->retired);
 		}
+		iteration_pool_destroy(transaction->iteration_pool);
 	}
+	if (transaction->replacement) {
+		transaction_free_resources(lwis_dev, transaction->replacement);
+	}
+	if (transaction->program) {
+		lwis_io_program_put(transaction->program);
+	} else {
+		for (i = 0; i < transaction->info.num_io_entries; ++i) {
+			if (transaction->info.io_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
+				lwis_allocator_free(lwis_dev,
+						    transaction->info.io_entries[i].rw_batch.buf);
+				transaction->info.io_entries[i].rw_batch.buf = NULL;
+			}
+		}
+	}
+	transaction_ops_free(lwis_dev, transaction);
 	lwis_allocator_free(lwis_dev, transaction->info.io_entries);
 	if (transaction->resp) {
 		kfree(transaction->resp);
 	}
-	kfree(transaction);
+	lwis_transaction_dealloc(transaction);
+}
+
+static void iteration_release(struct lwis_device *lwis_dev, struct lwis_transaction *iteration)
+{
+	unsigned long flags;
+	bool free_parent;
+	struct lwis_transaction *parent = iteration->parent;
+	struct lwis_transaction_iteration_pool *pool = parent->iteration_pool;
+	struct lwis_transaction *retired = NULL;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	list_add_tail(&iteration->process_queue_node, &pool->free_list);
+	pool->num_in_use--;
+	if (pool->retired && iteration->generation != pool->generation &&
+	    --pool->num_retired_in_use == 0) {
+		retired = pool->retired;
+		pool->retired = NULL;
+	}
+	free_parent = pool->released && pool->num_in_use == 0;
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	/* Last iteration running the program swapped out by a replace */
+	if (retired) {
+		transaction_free_resources(lwis_dev, retired);
+	}
+	/* The repeating transaction was freed while this iteration was in flight */
+	if (free_parent) {
+		transaction_free_resources(lwis_dev, parent);
+	}
+}
+
+void lwis_transaction_free(struct lwis_device *lwis_dev, struct lwis_transaction *transaction)
+{
+	unsigned long flags;
+	bool in_use;
+	struct lwis_transaction_iteration_pool *pool = transaction->iteration_pool;
+
+	/* Iterations share io_entries and ops with their repeating transaction,
+	 * only hand them back to the pool. */
+	if (transaction->parent) {
+		iteration_release(lwis_dev, transaction);
+		return;
+	}
+
+	if (pool) {
+		spin_lock_irqsave(&pool->lock, flags);
+		pool->released = true;
+		in_use = pool->num_in_use > 0;
+		spin_unlock_irqrestore(&pool->lock, flags);
+		/* Last iteration returned to the pool completes the free */
+		if (in_use) {
+			return;
+		}
+	}
+
+	transaction_free_resources(lwis_dev, transaction);
+}
+
+static int op_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+			  void *resolved)
+{
+	if (resolved) {
+		return lwis_dev->vops.register_io_prepared(lwis_dev, entry,
+							   lwis_dev->native_value_bitwidth, resolved);
+	}
+	return lwis_dev->vops.register_io(lwis_dev, entry, lwis_dev->native_value_bitwidth);
+}
+
+static int op_write(struct lwis_device *lwis_dev, struct lwis_io_entry *entry, void *resolved,
+		    uint8_t **read_buf, bool in_irq)
+{
+	return op_register_io(lwis_dev, entry, resolved);
+}
+
+static int op_read(struct lwis_device *lwis_dev, struct lwis_io_entry *entry, void *resolved,
+		   uint8_t **read_buf, bool in_irq)
+{
+	int ret;
+	struct lwis_io_result *io_result = (struct lwis_io_result *)*read_buf;
+	const int reg_value_bytewidth = lwis_dev->native_value_bitwidth / 8;
+
+	io_result->bid = entry->rw.bid;
+	io_result->offset = entry->rw.offset;
+	io_result->num_value_bytes = reg_value_bytewidth;
+	ret = op_register_io(lwis_dev, entry, resolved);
+	if (ret) {
+		return ret;
+	}
+	memcpy(io_result->values, &entry->rw.val, reg_value_bytewidth);
+	*read_buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
+	return 0;
+}
+
+static int op_read_batch(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+			 void *resolved, uint8_t **read_buf, bool in_irq)
+{
+	int ret;
+	struct lwis_io_result *io_result = (struct lwis_io_result *)*read_buf;
+
+	io_result->bid = entry->rw_batch.bid;
+	io_result->offset = entry->rw_batch.offset;
+	io_result->num_value_bytes = entry->rw_batch.size_in_bytes;
+	entry->rw_batch.buf = io_result->values;
+	ret = op_register_io(lwis_dev, entry, resolved);
+	if (ret) {
+		return ret;
+	}
+	*read_buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
+	return 0;
+}
+
+/* Reads straight into the kernel mapping of a client buffer, the response only
+ * describes where the values went. */
+static int op_read_to_buffer(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+			     void *resolved, uint8_t **read_buf, bool in_irq)
+{
+	int ret;
+	struct lwis_buffer_kernel_map *map = resolved;
+	struct lwis_io_entry_read_to_buffer *read = &entry->read_to_buffer;
+	struct lwis_io_result *io_result = (struct lwis_io_result *)*read_buf;
+	struct lwis_io_result_buffer *desc = (struct lwis_io_result_buffer *)io_result->values;
+	struct lwis_io_entry batch = {
+		.type = LWIS_IO_ENTRY_READ_BATCH,
+		.rw_batch = {
+			.bid = read->bid,
+			.offset = read->offset,
+			.size_in_bytes = read->size_in_bytes,
+			.buf = (uint8_t *)map->vaddr + read->buffer_offset,
+			.is_offset_fixed = false,
+		},
+	};
+
+	io_result->bid = read->bid;
+	io_result->offset = read->offset;
+	io_result->num_value_bytes = sizeof(struct lwis_io_result_buffer);
+	desc->buffer_fd = read->buffer_fd;
+	desc->buffer_offset = read->buffer_offset;
+	desc->size_in_bytes = read->size_in_bytes;
+	ret = lwis_dev->vops.register_io(lwis_dev, &batch, lwis_dev->native_value_bitwidth);
+	if (ret) {
+		return ret;
+	}
+	lwis_buffer_kernel_map_sync(map, read->buffer_offset, read->size_in_bytes);
+	*read_buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
+	return 0;
+}
+
+static int op_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry, void *resolved,
+		   uint8_t **read_buf, bool in_irq)
+{
+	return lwis_io_entry_poll(lwis_dev, entry, in_irq);
+}
+
+static int op_read_assert(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+			  void *resolved, uint8_t **read_buf, bool in_irq)
+{
+	return lwis_io_entry_read_assert(lwis_dev, entry);
+}
+
+static int op_write_run(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+			void *resolved, uint8_t **read_buf, bool in_irq)
+{
+	struct lwis_transaction_run *run = resolved;
+	struct lwis_io_entry batch = {
+		.type = LWIS_IO_ENTRY_WRITE_BATCH,
+		.rw_batch = {
+			.bid = run->bid,
+			.offset = run->offset,
+			.size_in_bytes = run->length,
+			.buf = run->values,
+			.is_offset_fixed = false,
+		},
+	};
+
+	return lwis_dev->vops.register_io(lwis_dev, &batch, lwis_dev->native_value_bitwidth);
+}
+
+static int op_read_run(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+		       void *resolved, uint8_t **read_buf, bool in_irq)
+{
+	int i;
+	int ret;
+	uint8_t value;
+	struct lwis_transaction_run *run = resolved;
+	struct lwis_io_result *io_result;
+	const size_t result_size = sizeof(struct lwis_io_result) + 1;
+	/* Read the values at the tail of the results of the run, then spread
+	 * them into one lwis_io_result per io_entry, front to back. Result i
+	 * never reaches past value i, so no value is overwritten before use. */
+	uint8_t *values = *read_buf + result_size * run->length - run->length;
+	struct lwis_io_entry batch = {
+		.type = LWIS_IO_ENTRY_READ_BATCH,
+		.rw_batch = {
+			.bid = run->bid,
+			.offset = run->offset,
+			.size_in_bytes = run->length,
+			.buf = values,
+			.is_offset_fixed = false,
+		},
+	};
+
+	ret = lwis_dev->vops.register_io(lwis_dev, &batch, lwis_dev->native_value_bitwidth);
+	if (ret) {
+		return ret;
+	}
+	for (i = 0; i < run->length; ++i) {
+		value = values[i];
+		io_result = (struct lwis_io_result *)(*read_buf + result_size * i);
+		io_result->bid = run->bid;
+		io_result->offset = run->offset + i;
+		io_result->num_value_bytes = 1;
+		io_result->values[0] = value;
+		entry[i].rw.val = value;
+	}
+	*read_buf += result_size * run->length;
+	return 0;
+}
+
+static int op_io_vector(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+			void *resolved, uint8_t **read_buf, bool in_irq)
+{
+	int i;
+	int ret;
+	uint8_t *buf = *read_buf;
+	struct lwis_transaction_vector *vector = resolved;
+	struct lwis_io_result *io_result;
+	const int reg_value_bytewidth = lwis_dev->native_value_bitwidth / 8;
+
+	/* Batch reads land straight in their results, lay those out first */
+	for (i = 0; i < vector->length; ++i) {
+		io_result = (struct lwis_io_result *)buf;
+		if (entry[i].type == LWIS_IO_ENTRY_READ) {
+			io_result->bid = entry[i].rw.bid;
+			io_result->offset = entry[i].rw.offset;
+			io_result->num_value_bytes = reg_value_bytewidth;
+		} else if (entry[i].type == LWIS_IO_ENTRY_READ_BATCH) {
+			io_result->bid = entry[i].rw_batch.bid;
+			io_result->offset = entry[i].rw_batch.offset;
+			io_result->num_value_bytes = entry[i].rw_batch.size_in_bytes;
+			entry[i].rw_batch.buf = io_result->values;
+		} else {
+			continue;
+		}
+		buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
+	}
+
+	ret = lwis_dev->vops.register_io_vector(lwis_dev, entry, vector->length,
+						lwis_dev->native_value_bitwidth);
+	if (ret) {
+		return ret;
+	}
+
+	buf = *read_buf;
+	for (i = 0; i < vector->length; ++i) {
+		io_result = (struct lwis_io_result *)buf;
+		if (entry[i].type == LWIS_IO_ENTRY_READ) {
+			memcpy(io_result->values, &entry[i].rw.val, reg_value_bytewidth);
+		} else if (entry[i].type != LWIS_IO_ENTRY_READ_BATCH) {
+			continue;
+		}
+		buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
+	}
+	*read_buf = buf;
+	return 0;
+}
+
+static int op_clock_set(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+			void *resolved, uint8_t **read_buf, bool in_irq)
+{
+	struct lwis_clk_setting setting = {
+		.clk_index = entry->clk.clk_index,
+		.frequency = entry->clk.frequency,
+	};
+
+	return lwis_dpm_update_clock(lwis_dev, &setting, /*num_settings=*/1);
+}
+
+static int op_qos_vote(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+		       void *resolved, uint8_t **read_buf, bool in_irq)
+{
+	struct lwis_qos_setting setting = {
+		.frequency_hz = entry->qos.frequency_hz,
+		.device_id = entry->qos.device_id,
+		.clock_family = entry->qos.clock_family,
+		.read_bw = entry->qos.read_bw,
+		.write_bw = entry->qos.write_bw,
+		.peak_bw = entry->qos.peak_bw,
+		.rt_bw = entry->qos.rt_bw,
+	};
+
+	return lwis_dpm_update_qos(lwis_dev, &setting);
+}
+
+/* io_entries executed as part of the run started by a preceding entry */
+static int op_coalesced(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
+			void *resolved, uint8_t **read_buf, bool in_irq)
+{
+	return 0;
+}
+
+/* Dispatch table indexed by lwis_io_entry_types */
+static const lwis_transaction_op_handler op_handlers[] = {
+	[LWIS_IO_ENTRY_READ] = op_read,
+	[LWIS_IO_ENTRY_READ_BATCH] = op_read_batch,
+	[LWIS_IO_ENTRY_WRITE] = op_write,
+	[LWIS_IO_ENTRY_WRITE_BATCH] = op_write,
+	[LWIS_IO_ENTRY_MODIFY] = op_write,
+	[LWIS_IO_ENTRY_POLL] = op_poll,
+	[LWIS_IO_ENTRY_READ_ASSERT] = op_read_assert,
+	[LWIS_IO_ENTRY_READ_BATCH_TO_BUFFER] = op_read_to_buffer,
+	[LWIS_IO_ENTRY_CLOCK_SET] = op_clock_set,
+	[LWIS_IO_ENTRY_QOS_VOTE] = op_qos_vote,
+	[LWIS_IO_ENTRY_POLL_EVENT] = op_poll,
+};
+
+static size_t transaction_results_size(struct lwis_device *lwis_dev,
+				       struct lwis_transaction *transaction, int *num_entries)
+{
+	int i;
+	size_t read_buf_size = 0;
+	int read_entries = 0;
+	struct lwis_transaction_info *info = &transaction->info;
+	struct lwis_device *entry_dev;
+
+	for (i = 0; i < info->num_io_entries; ++i) {
+		struct lwis_io_entry *entry = &info->io_entries[i];
+		/* Group transactions read registers of other devices */
+		entry_dev = transaction->ops ? transaction->ops[i].lwis_dev : lwis_dev;
+		if (entry->type == LWIS_IO_ENTRY_READ) {
+			read_buf_size += entry_dev->native_value_bitwidth / 8;
+			read_entries++;
+		} else if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
+			read_buf_size += entry->rw_batch.size_in_bytes;
+			read_entries++;
+		} else if (entry->type == LWIS_IO_ENTRY_READ_BATCH_TO_BUFFER) {
+			read_buf_size += sizeof(struct lwis_io_result_buffer);
+			read_entries++;
+		}
+	}
+
+	// Event response payload consists of header, and address and
+	// offset pairs.
+	*num_entries = read_entries;
+	return read_entries * sizeof(struct lwis_io_result) + read_buf_size;
+}
+
+static bool is_run_continued(struct lwis_io_entry *prev, struct lwis_io_entry *entry,
+			     struct lwis_device *prev_dev, struct lwis_device *entry_dev)
+{
+	return entry_dev == prev_dev && entry->type == prev->type &&
+	       entry->rw.bid == prev->rw.bid && entry->rw.offset == prev->rw.offset + 1;
+}
+
+/* Turns runs of single-byte READs or WRITEs to consecutive offsets into one
+ * batch access. The head op of a run executes the whole run and produces the
+ * same results as the individual io_entries would, the other ops of the run
+ * become no-ops. */
+static int transaction_coalesce_ops(struct lwis_device *lwis_dev,
+				    struct lwis_transaction *transaction)
+{
+	int i;
+	int j;
+	int length;
+	struct lwis_io_entry *entries = transaction->info.io_entries;
+	struct lwis_transaction_op *ops = transaction->ops;
+	struct lwis_transaction_run *run;
+	struct lwis_device *entry_dev;
+
+	for (i = 0; i < transaction->info.num_io_entries; i += length) {
+		length = 1;
+		entry_dev = ops[i].lwis_dev;
+		if (!entry_dev->coalesce_io_entries || entry_dev->native_value_bitwidth != 8 ||
+		    (entries[i].type != LWIS_IO_ENTRY_READ &&
+		     entries[i].type != LWIS_IO_ENTRY_WRITE)) {
+			continue;
+		}
+		while (i + length < transaction->info.num_io_entries &&
+		       length < TRANSACTION_MAX_RUN_LENGTH &&
+		       is_run_continued(&entries[i + length - 1], &entries[i + length], entry_dev,
+					ops[i + length].lwis_dev)) {
+			length++;
+		}
+		if (length == 1) {
+			continue;
+		}
+
+		run = kzalloc(sizeof(struct lwis_transaction_run) +
+				      (entries[i].type == LWIS_IO_ENTRY_WRITE ? length : 0),
+			      GFP_KERNEL);
+		if (!run) {
+			dev_err(lwis_dev->dev, "Failed to allocate coalesced io_entry run\n");
+			return -ENOMEM;
+		}
+		run->bid = entries[i].rw.bid;
+		run->offset = entries[i].rw.offset;
+		run->length = length;
+		if (entries[i].type == LWIS_IO_ENTRY_WRITE) {
+			for (j = 0; j < length; ++j) {
+				run->values[j] = (uint8_t)entries[i + j].rw.val;
+			}
+		}
+		ops[i].handler =
+			entries[i].type == LWIS_IO_ENTRY_WRITE ? op_write_run : op_read_run;
+		ops[i].resolved = run;
+		ops[i].coalesced = true;
+		for (j = 1; j < length; ++j) {
+			ops[i + j].handler = op_coalesced;
+		}
+	}
+
+	return 0;
+}
+
+static bool is_vector_entry(struct lwis_io_entry *entry, struct lwis_transaction_op *op)
+{
+	/* Coalesced runs already execute as one access */
+	if (op->coalesced || op->handler == op_coalesced) {
+		return false;
+	}
+	return entry->type == LWIS_IO_ENTRY_READ || entry->type == LWIS_IO_ENTRY_WRITE ||
+	       entry->type == LWIS_IO_ENTRY_READ_BATCH || entry->type == LWIS_IO_ENTRY_WRITE_BATCH;
+}
+
+/* Hands sequences of plain register accesses to devices that can execute them
+ * as a single bus transaction, e.g. one combined i2c transfer. */
+static int transaction_vectorize_ops(struct lwis_device *lwis_dev,
+				     struct lwis_transaction *transaction)
+{
+	int i;
+	int j;
+	int length;
+	struct lwis_io_entry *entries = transaction->info.io_entries;
+	struct lwis_transaction_op *ops = transaction->ops;
+	struct lwis_transaction_vector *vector;
+	struct lwis_device *entry_dev;
+
+	for (i = 0; i < transaction->info.num_io_entries; i += length) {
+		length = 1;
+		entry_dev = ops[i].lwis_dev;
+		if (!entry_dev->vops.register_io_vector || !is_vector_entry(&entries[i], &ops[i])) {
+			continue;
+		}
+		while (i + length < transaction->info.num_io_entries &&
+		       length < TRANSACTION_MAX_VECTOR_LENGTH &&
+		       ops[i + length].lwis_dev == entry_dev &&
+		       is_vector_entry(&entries[i + length], &ops[i + length])) {
+			length++;
+		}
+		if (length == 1) {
+			continue;
+		}
+
+		vector = kzalloc(sizeof(struct lwis_transaction_vector), GFP_KERNEL);
+		if (!vector) {
+			dev_err(lwis_dev->dev, "Failed to allocate io_entry vector\n");
+			return -ENOMEM;
+		}
+		vector->length = length;
+		ops[i].handler = op_io_vector;
+		ops[i].resolved = vector;
+		ops[i].coalesced = true;
+		for (j = 1; j < length; ++j) {
+			ops[i + j].handler = op_coalesced;
+		}
+	}
+
+	return 0;
+}
+
+/* Resolves the destination of a READ_BATCH_TO_BUFFER. The op holds a
+ * reference to the mapping until the transaction is freed. */
+static int transaction_prepare_read_to_buffer(struct lwis_client *client,
+					      struct lwis_io_entry *entry,
+					      struct lwis_transaction_op *op)
+{
+	struct lwis_buffer_kernel_map *map;
+	struct lwis_io_entry_read_to_buffer *read = &entry->read_to_buffer;
+
+	map = lwis_buffer_kernel_map_get(client, read->buffer_fd);
+	if (IS_ERR(map)) {
+		return PTR_ERR(map);
+	}
+	if (read->buffer_offset > map->dma_buf->size ||
+	    read->size_in_bytes > map->dma_buf->size - read->buffer_offset) {
+		dev_err(client->lwis_dev->dev,
+			"Read of %zu bytes at %zu exceeds buffer fd %d of %zu bytes\n",
+			read->size_in_bytes, read->buffer_offset, read->buffer_fd,
+			map->dma_buf->size);
+		lwis_buffer_kernel_map_put(map);
+		return -EINVAL;
+	}
+	op->resolved = map;
+	return 0;
+}
+
+static int transaction_prepare_ops(struct lwis_client *client,
+				   struct lwis_transaction *transaction,
+				   struct lwis_device **entry_devs)
+{
+	int i;
+	int ret;
+	struct lwis_io_entry *entry;
+	struct lwis_transaction_op *op;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+	struct lwis_device *entry_dev;
+	struct lwis_transaction_info *info = &transaction->info;
+
+	transaction->ops = NULL;
+	transaction->iteration_pool = NULL;
+	transaction->parent = NULL;
+	transaction->replacement = NULL;
+	transaction->ready_timestamp_ns = 0;
+	transaction->block_mask = 0;
+	transaction->block_locks_only = false;
+
+	if (info->num_io_entries > 0) {
+		transaction->ops = lwis_allocator_allocate(
+			lwis_dev, sizeof(struct lwis_transaction_op) * info->num_io_entries);
+		if (!transaction->ops) {
+			dev_err(lwis_dev->dev, "Failed to allocate transaction ops\n");
+			return -ENOMEM;
+		}
+		memset(transaction->ops, 0,
+		       sizeof(struct lwis_transaction_op) * info->num_io_entries);
+	}
+
+	for (i = 0; i < info->num_io_entries; ++i) {
+		entry = &info->io_entries[i];
+		op = &transaction->ops[i];
+		entry_dev = entry_devs ? entry_devs[i] : lwis_dev;
+		if (entry->type < 0 || entry->type >= ARRAY_SIZE(op_handlers) ||
+		    !op_handlers[entry->type]) {
+			dev_err(lwis_dev->dev, "Unrecognized io_entry command %d at index %d\n",
+				entry->type, i);
+			ret = -EINVAL;
+			goto error_free_ops;
+		}
+		op->handler = op_handlers[entry->type];
+		op->resolved = NULL;
+		op->lwis_dev = entry_dev;
+		op->coalesced = false;
+
+		if (entry->type == LWIS_IO_ENTRY_POLL || entry->type == LWIS_IO_ENTRY_POLL_EVENT ||
+		    entry->type == LWIS_IO_ENTRY_READ_ASSERT) {
+			continue;
+		}
+		if (entry->type == LWIS_IO_ENTRY_CLOCK_SET ||
+		    entry->type == LWIS_IO_ENTRY_QOS_VOTE) {
+			/* Clock and QoS updates sleep, only the worker may run them */
+			if (info->run_in_event_context || info->run_at_real_time) {
+				dev_err(lwis_dev->dev,
+					"io_entry %d at index %d needs the transaction worker\n",
+					entry->type, i);
+				ret = -EINVAL;
+				goto error_free_ops;
+			}
+			/* Only the DPM device votes on behalf of other devices, as
+			 * LWIS_DPM_QOS_UPDATE does */
+			if (entry->type == LWIS_IO_ENTRY_QOS_VOTE &&
+			    entry_dev->type != DEVICE_TYPE_DPM &&
+			    entry->qos.device_id != entry_dev->id) {
+				dev_err(lwis_dev->dev,
+					"QoS vote at index %d for device %d instead of %s\n", i,
+					entry->qos.device_id, entry_dev->name);
+				ret = -EPERM;
+				goto error_free_ops;
+			}
+			continue;
+		}
+		if (!entry_dev->vops.register_io) {
+			dev_err(lwis_dev->dev, "Device %s does not support register io\n",
+				entry_dev->name);
+			ret = -EINVAL;
+			goto error_free_ops;
+		}
+		if (entry->type == LWIS_IO_ENTRY_READ_BATCH_TO_BUFFER) {
+			ret = transaction_prepare_read_to_buffer(client, entry, op);
+			if (ret) {
+				goto error_free_ops;
+			}
+			continue;
+		}
+		if (!entry_dev->vops.register_io_prepare || !entry_dev->vops.register_io_prepared) {
+			continue;
+		}
+		ret = entry_dev->vops.register_io_prepare(entry_dev, entry,
+							  entry_dev->native_value_bitwidth,
+							  &op->resolved);
+		if (ret == -EOPNOTSUPP) {
+			op->resolved = NULL;
+		} else if (ret) {
+			dev_err(lwis_dev->dev, "Invalid io_entry at index %d (%d)\n", i, ret);
+			goto error_free_ops;
+		}
+	}
+
+	if (info->num_io_entries > 1) {
+		ret = transaction_coalesce_ops(lwis_dev, transaction);
+		if (ret) {
+			goto error_free_ops;
+		}
+		ret = transaction_vectorize_ops(lwis_dev, transaction);
+		if (ret) {
+			goto error_free_ops;
+		}
+	}
+
+	/* Transactions on disjoint independent blocks may run concurrently on
+	 * different workers. Group transactions switch devices, they take the
+	 * locks of all independent blocks along with reg_rw_lock. */
+	if (entry_devs) {
+		transaction->block_mask = U64_MAX;
+	} else {
+		transaction->block_locks_only =
+			!lwis_io_entry_locks_get(lwis_dev, info->io_entries, info->num_io_entries,
+						 &transaction->block_mask);
+	}
+
+	return 0;
+
+error_free_ops:
+	transaction_ops_free(lwis_dev, transaction);
+	return ret;
+}
+
+int lwis_transaction_iterations_prepare(struct lwis_client *client,
+					struct lwis_transaction *transaction)
+{
+	size_t resp_size;
+	int num_entries;
+	struct lwis_transaction_info *info = &transaction->info;
+
+	/* Repeating transactions run off preallocated iterations, so that firing
+	 * them does not allocate in event context. */
+	if (info->trigger_event_id == LWIS_EVENT_ID_NONE ||
+	    info->trigger_event_counter != LWIS_EVENT_COUNTER_EVERY_TIME ||
+	    transaction->iteration_pool) {
+		return 0;
+	}
+	resp_size = sizeof(struct lwis_transaction_response_header) +
+		    transaction_results_size(client->lwis_dev, transaction, &num_entries);
+	return iteration_pool_create(client, transaction, resp_size);
+}
+
+int lwis_transaction_prepare(struct lwis_client *client, struct lwis_transaction *transaction)
+{
+	int ret = transaction_prepare_ops(client, transaction, /*entry_devs=*/NULL);
+
+	return ret ? ret : lwis_transaction_iterations_prepare(client, transaction);
+}
+
+int lwis_transaction_replacement_prepare(struct lwis_client *client,
+					 struct lwis_transaction *transaction)
+{
+	return transaction_prepare_ops(client, transaction, /*entry_devs=*/NULL);
+}
+
+int lwis_transaction_group_prepare(struct lwis_client *client,
+				   struct lwis_transaction *transaction,
+				   struct lwis_device **entry_devs)
+{
+	int ret;
+
+	/* Group transactions always execute on the transaction worker of the
+	 * submitting device, one program after the other. */
+	transaction->info.run_in_event_context = false;
+	transaction->info.run_at_real_time = false;
+	ret = transaction_prepare_ops(client, transaction, entry_devs);
+	return ret ? ret : lwis_transaction_iterations_prepare(client, transaction);
+}
+
+/* Starts the io_entries executed on lwis_dev. Use write memory barrier at the
+ * beginning of I/O entries if the access protocol allows it. */
+static void transaction_io_begin(struct lwis_device *lwis_dev,
+				 struct lwis_transaction *transaction, bool in_irq)
+{
+	if (lwis_dev->vops.register_io_barrier != NULL) {
+		lwis_dev->vops.register_io_barrier(lwis_dev,
+						   /*use_read_barrier=*/false,
+						   /*use_write_barrier=*/true);
+	}
+	if (!in_irq) {
+		lwis_io_entry_lock(lwis_dev, !transaction->block_locks_only,
+				   transaction->block_mask);
+	}
+}
+
+/* Ends the io_entries executed on lwis_dev. Use read memory barrier at the end
+ * of I/O entries if the access protocol allows it. */
+static void transaction_io_end(struct lwis_device *lwis_dev,
+			       struct lwis_transaction *transaction, bool in_irq)
+{
+	if (!in_irq) {
+		lwis_io_entry_unlock(lwis_dev, !transaction->block_locks_only,
+				     transaction->block_mask);
+	}
+	if (lwis_dev->vops.register_io_barrier != NULL) {
+		lwis_dev->vops.register_io_barrier(lwis_dev, /*use_read_barrier=*/true,
+						   /*use_write_barrier=*/false);
+	}
 }
 
 static int process_transaction(struct lwis_client *client, struct lwis_transaction *transaction,
-			       struct list_head *pending_events, bool in_irq, bool skip_err)
+			       struct list_head *pending_events, bool in_irq, bool skip_err,
+			       enum lwis_transaction_exec_type exec_type)
 {
 	int i;
 	int ret = 0;
 	struct lwis_io_entry *entry = NULL;
 	struct lwis_device *lwis_dev = client->lwis_dev;
+	struct lwis_device *io_dev;
 	struct lwis_transaction_info *info = &transaction->info;
 	struct lwis_transaction_response_header *resp = transaction->resp;
 	size_t resp_size;
 	uint8_t *read_buf;
-	struct lwis_io_result *io_result;
-	const int reg_value_bytewidth = lwis_dev->native_value_bitwidth / 8;
 	int64_t process_duration_ns = 0;
 	int64_t process_timestamp = ktime_to_ns(lwis_get_time());
+	int64_t capture_ns;
+	struct lwis_latency_histogram *latency_hist =
+		lwis_dev->debug_info.transaction_latency[exec_type];
 
 	LWIS_ATRACE_FUNC_BEGIN(lwis_dev);
+	trace_lwis_transaction_start(lwis_dev, info->id, info->num_io_entries,
+				     resp->results_size_bytes, 0);
 	resp_size = sizeof(struct lwis_transaction_response_header) + resp->results_size_bytes;
 	read_buf = (uint8_t *)resp + sizeof(struct lwis_transaction_response_header);
 	resp->completion_index = -1;
 
-	/* Use write memory barrier at the beginning of I/O entries if the access protocol
-	 * allows it */
-	if (lwis_dev->vops.register_io_barrier != NULL) {
-		lwis_dev->vops.register_io_barrier(lwis_dev,
-						   /*use_read_barrier=*/false,
-						   /*use_write_barrier=*/true);
-	}
-
-	if (!in_irq) {
-		mutex_lock(&lwis_dev->reg_rw_lock);
-	}
+	/* Group transactions switch devices between programs */
+	io_dev = info->num_io_entries > 0 ? transaction->ops[0].lwis_dev : lwis_dev;
+	transaction_io_begin(io_dev, transaction, in_irq);
 
 	for (i = 0; i < info->num_io_entries; ++i) {
 		entry = &info->io_entries[i];
-		if (entry->type == LWIS_IO_ENTRY_WRITE ||
-		    entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
-		    entry->type == LWIS_IO_ENTRY_MODIFY) {
-			ret = lwis_dev->vops.register_io(lwis_dev, entry,
-							 lwis_dev->native_value_bitwidth);
-			if (ret) {
-				resp->error_code = ret;
-				if (skip_err) {
-					dev_warn(lwis_dev->dev,
-						 "transaction type %d processing failed, skip this error and run the next command\n",
-						 entry->type);
-					continue;
-				}
-				break;
-			}
-		} else if (entry->type == LWIS_IO_ENTRY_READ) {
-			io_result = (struct lwis_io_result *)read_buf;
-			io_result->bid = entry->rw.bid;
-			io_result->offset = entry->rw.offset;
-			io_result->num_value_bytes = reg_value_bytewidth;
-			ret = lwis_dev->vops.register_io(lwis_dev, entry,
-							 lwis_dev->native_value_bitwidth);
-			if (ret) {
-				resp->error_code = ret;
-				if (skip_err) {
-					dev_warn(lwis_dev->dev,
-						 "transaction type %d processing failed, skip this error and run the next command\n",
-						 entry->type);
-					continue;
-				}
-				break;
-			}
-			memcpy(io_result->values, &entry->rw.val, reg_value_bytewidth);
-			read_buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
-		} else if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
-			io_result = (struct lwis_io_result *)read_buf;
-			io_result->bid = entry->rw_batch.bid;
-			io_result->offset = entry->rw_batch.offset;
-			io_result->num_value_bytes = entry->rw_batch.size_in_bytes;
-			entry->rw_batch.buf = io_result->values;
-			ret = lwis_dev->vops.register_io(lwis_dev, entry,
-							 lwis_dev->native_value_bitwidth);
-			if (ret) {
-				resp->error_code = ret;
-				if (skip_err) {
-					dev_warn(lwis_dev->dev,
-						 "transaction type %d processing failed, skip this error and run the next command\n",
-						 entry->type);
-					continue;
-				}
-				break;
-			}
-			read_buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
-		} else if (entry->type == LWIS_IO_ENTRY_POLL) {
-			ret = lwis_io_entry_poll(lwis_dev, entry, in_irq);
-			if (ret) {
-				resp->error_code = ret;
-				if (skip_err) {
-					dev_warn(lwis_dev->dev,
-						 "transaction type %d processing failed, skip this error and run the next command\n",
-						 entry->type);
-					continue;
-				}
-				break;
-			}
-		} else if (entry->type == LWIS_IO_ENTRY_READ_ASSERT) {
-			ret = lwis_io_entry_read_assert(lwis_dev, entry);
-			if (ret) {
-				resp->error_code = ret;
-				if (skip_err) {
-					dev_warn(lwis_dev->dev,
-						 "transaction type %d processing failed, skip this error and run the next command\n",
-						 entry->type);
-					continue;
-				}
-				break;
-			}
+		if (transaction->ops[i].lwis_dev != io_dev) {
+			transaction_io_end(io_dev, transaction, in_irq);
+			io_dev = transaction->ops[i].lwis_dev;
+			transaction_io_begin(io_dev, transaction, in_irq);
+		}
+		if (io_dev != lwis_dev && io_dev->enabled == 0) {
+			dev_err_ratelimited(lwis_dev->dev, "Device %s is disabled\n", io_dev->name);
+			ret = -EBADFD;
 		} else {
-			dev_err(lwis_dev->dev, "Unrecognized io_entry command\n");
-			resp->error_code = -EINVAL;
+			capture_ns = lwis_reg_capture_begin(io_dev);
+			ret = transaction->ops[i].handler(io_dev, entry, transaction->ops[i].resolved,
+							  &read_buf, in_irq);
+			lwis_reg_capture_end(io_dev, entry, LWIS_REG_CAPTURE_SOURCE_TRANSACTION,
+					     info->id, capture_ns, ret);
+		}
+		if (ret) {
+			resp->error_code = ret;
 			if (skip_err) {
 				dev_warn(lwis_dev->dev,
 					 "transaction type %d processing failed, skip this error and run the next command\n",
@@ -224,23 +1098,28 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 		resp->completion_index = i;
 	}
 
-	if (!in_irq) {
-		mutex_unlock(&lwis_dev->reg_rw_lock);
-	}
+	transaction_io_end(io_dev, transaction, in_irq);
 
 	process_duration_ns = ktime_to_ns(lwis_get_time() - process_timestamp);
 
-	/* Use read memory barrier at the end of I/O entries if the access protocol
-	 * allows it */
-	if (lwis_dev->vops.register_io_barrier != NULL) {
-		lwis_dev->vops.register_io_barrier(lwis_dev, /*use_read_barrier=*/true,
-						   /*use_write_barrier=*/false);
+	if (transaction->ready_timestamp_ns > 0) {
+		lwis_latency_histogram_record(&latency_hist[LWIS_TRANSACTION_LATENCY_TRIGGER_TO_START],
+					      process_timestamp - transaction->ready_timestamp_ns);
 	}
+	lwis_latency_histogram_record(&latency_hist[LWIS_TRANSACTION_LATENCY_START_TO_END],
+				      process_duration_ns);
 	if (pending_events) {
-		lwis_pending_event_push(pending_events,
-					resp->error_code ? info->emit_error_event_id :
-								 info->emit_success_event_id,
-					(void *)resp, resp_size);
+		if (resp->error_code) {
+			atomic64_inc(&client->stats.transactions_failed);
+		} else {
+			atomic64_inc(&client->stats.transactions_succeeded);
+		}
+		lwis_pending_event_push_tracked(
+			pending_events,
+			resp->error_code ? info->emit_error_event_id : info->emit_success_event_id,
+			(void *)resp, resp_size,
+			&latency_hist[LWIS_TRANSACTION_LATENCY_END_TO_DELIVERED],
+			process_timestamp + process_duration_ns);
 	} else {
 		/* No pending events indicates it's cleanup io_entries. */
 		if (resp->error_code) {
@@ -249,20 +1128,20 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 				resp->error_code, transaction->info.id, i, entry->type);
 		}
 	}
+	trace_lwis_transaction_finish(lwis_dev, info->id, info->num_io_entries,
+				      resp->results_size_bytes, resp->error_code);
 	save_transaction_to_history(client, info, process_timestamp, process_duration_ns);
-	if (info->trigger_event_counter == LWIS_EVENT_COUNTER_EVERY_TIME) {
-		/* Only clean the transaction struct for this iteration. The
-                 * I/O entries are not being freed. */
-		kfree(transaction->resp);
-		kfree(transaction);
-	} else {
-		lwis_transaction_free(lwis_dev, transaction);
+	if (info->deadline_ns > 0 && transaction->ready_timestamp_ns > 0 &&
+	    process_timestamp + process_duration_ns >
+		    transaction->ready_timestamp_ns + info->deadline_ns) {
+		atomic64_inc(&client->debug_info.transaction_deadline_misses);
 	}
+	lwis_transaction_free(lwis_dev, transaction);
 	LWIS_ATRACE_FUNC_END(lwis_dev);
 	return ret;
 }
 
-static void cancel_transaction(struct lwis_device *lwis_dev, struct lwis_transaction *transaction,
+static void cancel_transaction(struct lwis_client *client, struct lwis_transaction *transaction,
 			       int error_code, struct list_head *pending_events)
 {
 	struct lwis_transaction_info *info = &transaction->info;
@@ -277,30 +1156,66 @@ static void cancel_transaction(struct lwis_device *lwis_dev, struct lwis_transac
 		lwis_pending_event_push(pending_events, info->emit_error_event_id, &resp,
 					sizeof(resp));
 	}
-	lwis_transaction_free(lwis_dev, transaction);
+	atomic64_inc(&client->stats.transactions_cancelled);
+	lwis_transaction_free(client->lwis_dev, transaction);
+}
+
+static int64_t transaction_deadline(struct lwis_transaction *transaction)
+{
+	if (transaction->info.deadline_ns <= 0) {
+		return S64_MAX;
+	}
+	return transaction->ready_timestamp_ns + transaction->info.deadline_ns;
+}
+
+/* Returns the queued transaction to process next: the highest priority one,
+ * then the one with the earliest deadline, then the first one queued.
+ * Calling this function requires holding the client's transaction_lock. */
+static struct lwis_transaction *next_transaction_locked(struct list_head *transaction_queue)
+{
+	struct lwis_transaction *transaction;
+	struct lwis_transaction *next = NULL;
+
+	list_for_each_entry (transaction, transaction_queue, process_queue_node) {
+		if (!next || transaction->info.priority > next->info.priority ||
+		    (transaction->info.priority == next->info.priority &&
+		     transaction_deadline(transaction) < transaction_deadline(next))) {
+			next = transaction;
+		}
+	}
+	return next;
 }
 
 static void process_transactions_in_queue(struct lwis_client *client,
-					  struct list_head *transaction_queue, bool in_irq)
+					  struct list_head *transaction_queue, bool in_irq,
+					  enum lwis_transaction_exec_type exec_type)
 {
 	unsigned long flags;
 	struct lwis_transaction *transaction;
-	struct list_head *it_tran, *it_tran_tmp;
 	struct list_head pending_events;
 
 	INIT_LIST_HEAD(&pending_events);
 
 	spin_lock_irqsave(&client->transaction_lock, flags);
-	list_for_each_safe (it_tran, it_tran_tmp, transaction_queue) {
-		transaction = list_entry(it_tran, struct lwis_transaction, process_queue_node);
+	/* Pick the next transaction every time around, the lock is released while
+	 * processing and more urgent transactions may have been queued meanwhile. */
+	while (!list_empty(transaction_queue)) {
+		transaction = next_transaction_locked(transaction_queue);
 		list_del(&transaction->process_queue_node);
 		if (transaction->resp->error_code) {
-			cancel_transaction(client->lwis_dev, transaction,
-					   transaction->resp->error_code, &pending_events);
+			cancel_transaction(client, transaction, transaction->resp->error_code,
+					   &pending_events);
 		} else {
 			spin_unlock_irqrestore(&client->transaction_lock, flags);
 			process_transaction(client, transaction, &pending_events, in_irq,
-					    /*skip_err=*/false);
+					    /*skip_err=*/false, exec_type);
+			/* Bus io in the worker can take milliseconds per transaction,
+			 * deliver each completion as soon as its io is done instead of
+			 * holding it until the whole queue is drained. */
+			if (!in_irq) {
+				lwis_pending_events_emit(client->lwis_dev, &pending_events,
+							 in_irq);
+			}
 			spin_lock_irqsave(&client->transaction_lock, flags);
 		}
 	}
@@ -314,22 +1229,49 @@ static void transaction_tasklet_func(unsigned long data)
 	struct lwis_client *client = (struct lwis_client *)data;
 
 	process_transactions_in_queue(client, &client->transaction_process_queue_tasklet,
-				      /*in_irq=*/true);
+				      /*in_irq=*/true, LWIS_TRANSACTION_EXEC_REAL_TIME);
 }
 
 static void transaction_work_func(struct kthread_work *work)
 {
 	struct lwis_client *client = container_of(work, struct lwis_client, transaction_work);
-	process_transactions_in_queue(client, &client->transaction_process_queue, /*in_irq=*/false);
+	process_transactions_in_queue(client, &client->transaction_process_queue, /*in_irq=*/false,
+				      LWIS_TRANSACTION_EXEC_WORKER);
 }
 
 int lwis_transaction_init(struct lwis_client *client)
 {
+	struct kthread_worker *worker;
+
+	/* Entry types added since keep the io_entry stride of existing userspace */
+	BUILD_BUG_ON(sizeof(struct lwis_io_entry) !=
+		     offsetof(struct lwis_io_entry, read_assert) +
+			     sizeof(struct lwis_io_entry_read_assert));
+	BUILD_BUG_ON(sizeof(struct lwis_io_entry_read_to_buffer) >
+		     sizeof(struct lwis_io_entry_read_assert));
+	BUILD_BUG_ON(sizeof(struct lwis_io_entry_poll_event) >
+		     sizeof(struct lwis_io_entry_read_assert));
+	BUILD_BUG_ON(sizeof(struct lwis_io_entry_clk_set) >
+		     sizeof(struct lwis_io_entry_read_assert));
+	BUILD_BUG_ON(sizeof(struct lwis_io_entry_qos_vote) >
+		     sizeof(struct lwis_io_entry_read_assert));
+
 	spin_lock_init(&client->transaction_lock);
 	INIT_LIST_HEAD(&client->transaction_process_queue_tasklet);
 	tasklet_init(&client->transaction_tasklet, transaction_tasklet_func, (unsigned long)client);
 	INIT_LIST_HEAD(&client->transaction_process_queue);
 	kthread_init_work(&client->transaction_work, transaction_work_func);
+	client->transaction_worker = &client->lwis_dev->transaction_worker;
+	if (client->lwis_dev->transaction_worker_per_client &&
+	    client->lwis_dev->transaction_worker_thread) {
+		worker = lwis_create_client_transaction_worker(client->lwis_dev);
+		if (IS_ERR(worker)) {
+			dev_warn(client->lwis_dev->dev,
+				 "Falling back to the device transaction worker\n");
+		} else {
+			client->transaction_worker = worker;
+		}
+	}
 	client->transaction_counter = 0;
 	hash_init(client->transaction_list);
 	return 0;
@@ -338,6 +1280,8 @@ int lwis_transaction_init(struct lwis_client *client)
 int lwis_transaction_clear(struct lwis_client *client)
 {
 	int ret;
+	unsigned long flags;
+	struct kthread_worker *worker;
 
 	ret = lwis_transaction_client_flush(client);
 	if (ret) {
@@ -346,6 +1290,17 @@ int lwis_transaction_clear(struct lwis_client *client)
 		return ret;
 	}
 	tasklet_kill(&client->transaction_tasklet);
+
+	/* Anything queued from here on goes to the device worker */
+	spin_lock_irqsave(&client->transaction_lock, flags);
+	worker = client->transaction_worker;
+	client->transaction_worker = &client->lwis_dev->transaction_worker;
+	spin_unlock_irqrestore(&client->transaction_lock, flags);
+	if (worker != &client->lwis_dev->transaction_worker) {
+		kthread_destroy_worker(worker);
+		/* A work item is bound to the last worker it was queued on */
+		kthread_init_work(&client->transaction_work, transaction_work_func);
+	}
 	return 0;
 }
 
@@ -361,7 +1316,7 @@ static void cancel_all_transactions_in_queue_locked(struct lwis_client *client,
 			transaction =
 				list_entry(it_tran, struct lwis_transaction, process_queue_node);
 			list_del(&transaction->process_queue_node);
-			cancel_transaction(client->lwis_dev, transaction, -ECANCELED, NULL);
+			cancel_transaction(client, transaction, -ECANCELED, NULL);
 		}
 	}
 }
@@ -386,18 +1341,18 @@ int lwis_transaction_client_flush(struct lwis_client *client)
 		    LWIS_EVENT_ID_CLIENT_CLEANUP) {
 			continue;
 		}
+		counter_queue_flatten_locked(it_evt_list);
 		list_for_each_safe (it_tran, it_tran_tmp, &it_evt_list->list) {
 			transaction = list_entry(it_tran, struct lwis_transaction, event_list_node);
 			list_del(&transaction->event_list_node);
-			cancel_transaction(client->lwis_dev, transaction, -ECANCELED, NULL);
+			cancel_transaction(client, transaction, -ECANCELED, NULL);
 		}
-		hash_del(&it_evt_list->node);
-		kfree(it_evt_list);
+		event_list_free(client, it_evt_list);
 	}
 	spin_unlock_irqrestore(&client->transaction_lock, flags);
 
 	if (client->lwis_dev->transaction_worker_thread)
-		kthread_flush_worker(&client->lwis_dev->transaction_worker);
+		kthread_flush_worker(client->transaction_worker);
 
 	/* Wait for tasklet to complete in-progress transactions and disable. */
 	tasklet_disable(&client->transaction_tasklet);
@@ -455,20 +1410,20 @@ int lwis_transaction_client_cleanup(struct lwis_client *client)
 		return 0;
 	}
 
+	counter_queue_flatten_locked(it_evt_list);
 	list_for_each_safe (it_tran, it_tran_tmp, &it_evt_list->list) {
 		transaction = list_entry(it_tran, struct lwis_transaction, event_list_node);
 		list_del(&transaction->event_list_node);
 		if (transaction->resp->error_code || client->lwis_dev->enabled == 0) {
-			cancel_transaction(client->lwis_dev, transaction, -ECANCELED, NULL);
+			cancel_transaction(client, transaction, -ECANCELED, NULL);
 		} else {
 			spin_unlock_irqrestore(&client->transaction_lock, flags);
 			process_transaction(client, transaction, &pending_events, in_irq,
-					    /*skip_err=*/true);
+					    /*skip_err=*/true, LWIS_TRANSACTION_EXEC_WORKER);
 			spin_lock_irqsave(&client->transaction_lock, flags);
 		}
 	}
-	hash_del(&it_evt_list->node);
-	kfree(it_evt_list);
+	event_list_free(client, it_evt_list);
 
 	spin_unlock_irqrestore(&client->transaction_lock, flags);
 
@@ -487,7 +1442,7 @@ int lwis_transaction_client_cleanup(struct lwis_client *client)
 		if (event->event_info.payload_size <=
 			sizeof(struct lwis_transaction_response_header)) {
 			list_del(&event->node);
-			kfree(event);
+			lwis_pending_event_free(event);
 			continue;
 		}
 		resp = (struct lwis_transaction_response_header *)
@@ -505,7 +1460,7 @@ int lwis_transaction_client_cleanup(struct lwis_client *client)
 		}
 
 		list_del(&event->node);
-		kfree(event);
+		lwis_pending_event_free(event);
 	}
 
 	return 0;
@@ -581,43 +1536,28 @@ static int check_transaction_param_locked(struct lwis_client *client,
 static int prepare_response_locked(struct lwis_client *client, struct lwis_transaction *transaction)
 {
 	struct lwis_transaction_info *info = &transaction->info;
-	int i;
 	size_t resp_size;
-	size_t read_buf_size = 0;
+	size_t results_size;
 	int read_entries = 0;
-	const int reg_value_bytewidth = client->lwis_dev->native_value_bitwidth / 8;
 
 	info->id = client->transaction_counter;
 
-	for (i = 0; i < info->num_io_entries; ++i) {
-		struct lwis_io_entry *entry = &info->io_entries[i];
-		if (entry->type == LWIS_IO_ENTRY_READ) {
-			read_buf_size += reg_value_bytewidth;
-			read_entries++;
-		} else if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
-			read_buf_size += entry->rw_batch.size_in_bytes;
-			read_entries++;
-		}
-	}
-
-	// Event response payload consists of header, and address and
-	// offset pairs.
-	resp_size = sizeof(struct lwis_transaction_response_header) +
-		    read_entries * sizeof(struct lwis_io_result) + read_buf_size;
+	results_size = transaction_results_size(client->lwis_dev, transaction, &read_entries);
+	resp_size = sizeof(struct lwis_transaction_response_header) + results_size;
 	/* Revisit the use of GFP_ATOMIC here. Reason for this to be atomic is
 	 * because this function can be called by transaction_replace while
 	 * holding onto a spinlock. */
 	transaction->resp = kmalloc(resp_size, GFP_ATOMIC);
 	if (!transaction->resp) {
 		dev_err(client->lwis_dev->dev, "Cannot allocate transaction response\n");
+		lwis_client_stats_alloc_failure(client);
 		return -ENOMEM;
 	}
 	transaction->resp->id = info->id;
 	transaction->resp->error_code = 0;
 	transaction->resp->completion_index = 0;
 	transaction->resp->num_entries = read_entries;
-	transaction->resp->results_size_bytes =
-		read_entries * sizeof(struct lwis_io_result) + read_buf_size;
+	transaction->resp->results_size_bytes = results_size;
 	return 0;
 }
 
@@ -630,6 +1570,7 @@ static int queue_transaction_locked(struct lwis_client *client,
 
 	if (info->trigger_event_id == LWIS_EVENT_ID_NONE) {
 		/* Immediate trigger. */
+		transaction->ready_timestamp_ns = ktime_to_ns(lwis_get_time());
 		if (info->run_at_real_time) {
 			list_add_tail(&transaction->process_queue_node,
 				      &client->transaction_process_queue_tasklet);
@@ -637,7 +1578,7 @@ static int queue_transaction_locked(struct lwis_client *client,
 		} else {
 			list_add_tail(&transaction->process_queue_node,
 				      &client->transaction_process_queue);
-			kthread_queue_work(&client->lwis_dev->transaction_worker,
+			kthread_queue_work(client->transaction_worker,
 					   &client->transaction_work);
 		}
 	} else {
@@ -646,11 +1587,19 @@ static int queue_transaction_locked(struct lwis_client *client,
 		if (!event_list) {
 			dev_err(client->lwis_dev->dev, "Cannot create transaction event list\n");
 			kfree(transaction->resp);
+			transaction->resp = NULL;
 			return -EINVAL;
 		}
-		list_add_tail(&transaction->event_list_node, &event_list->list);
+		if (EXPLICIT_EVENT_COUNTER(info->trigger_event_counter)) {
+			counter_queue_insert_locked(event_list, transaction);
+		} else {
+			transaction->in_counter_queue = false;
+			list_add_tail(&transaction->event_list_node, &event_list->list);
+		}
 	}
 	info->submission_timestamp_ns = ktime_to_ns(ktime_get());
+	trace_lwis_transaction_queue(client->lwis_dev, info->id, info->num_io_entries,
+				     transaction->resp->results_size_bytes, 0);
 	client->transaction_counter++;
 	return 0;
 }
@@ -676,39 +1625,154 @@ int lwis_transaction_submit_locked(struct lwis_client *client, struct lwis_trans
 	return ret;
 }
 
+/* Calling this function requires holding the client's transaction_lock. */
+static void unqueue_transaction_locked(struct lwis_client *client,
+				       struct lwis_transaction *transaction)
+{
+	if (transaction->info.trigger_event_id == LWIS_EVENT_ID_NONE) {
+		list_del_init(&transaction->process_queue_node);
+	} else if (transaction->in_counter_queue) {
+		counter_queue_erase_locked(
+			event_list_find(client, transaction->info.trigger_event_id), transaction);
+	} else {
+		list_del_init(&transaction->event_list_node);
+	}
+	client->transaction_counter--;
+}
+
+int lwis_transaction_submit_batch_locked(struct lwis_client *client,
+					 struct lwis_transaction **transactions,
+					 int num_transactions, int32_t *error_codes)
+{
+	int i;
+	int ret = 0;
+
+	for (i = 0; i < num_transactions; ++i) {
+		error_codes[i] = -ECANCELED;
+	}
+
+	for (i = 0; i < num_transactions; ++i) {
+		ret = lwis_transaction_submit_locked(client, transactions[i]);
+		if (ret) {
+			error_codes[i] = ret;
+			break;
+		}
+		error_codes[i] = 0;
+	}
+	if (!ret) {
+		return 0;
+	}
+
+	/* Nothing has been processed yet as the transaction_lock is still held,
+	 * take back the transactions already queued in reverse order so that
+	 * transaction ids get reused. */
+	dev_err(client->lwis_dev->dev, "Failed to submit transaction %d of batch (%d)\n", i, ret);
+	while (--i >= 0) {
+		unqueue_transaction_locked(client, transactions[i]);
+		error_codes[i] = -ECANCELED;
+	}
+	return ret;
+}
+
 static struct lwis_transaction *
 new_repeating_transaction_iteration(struct lwis_client *client,
 				    struct lwis_transaction *transaction)
 {
-	struct lwis_transaction *new_instance;
-	uint8_t *resp_buf;
-
-	/* Construct a new instance for repeating transactions */
-	new_instance = kmalloc(sizeof(struct lwis_transaction), GFP_ATOMIC);
+	unsigned long flags;
+	struct lwis_transaction *new_instance = NULL;
+	struct lwis_transaction_iteration_pool *pool = transaction->iteration_pool;
+
+	/* Take a preallocated instance for this iteration */
+	spin_lock_irqsave(&pool->lock, flags);
+	if (!list_empty(&pool->free_list)) {
+		new_instance = list_first_entry(&pool->free_list, struct lwis_transaction,
+						process_queue_node);
+		list_del(&new_instance->process_queue_node);
+		pool->num_in_use++;
+		new_instance->generation = pool->generation;
+	}
+	spin_unlock_irqrestore(&pool->lock, flags);
 	if (!new_instance) {
-		dev_err(client->lwis_dev->dev,
-			"Failed to allocate repeating transaction instance\n");
 		return NULL;
 	}
+
 	memcpy(&new_instance->info, &transaction->info, sizeof(struct lwis_transaction_info));
+	new_instance->ops = transaction->ops;
+	new_instance->block_mask = transaction->block_mask;
+	new_instance->block_locks_only = transaction->block_locks_only;
+	memcpy(new_instance->resp, transaction->resp,
+	       sizeof(struct lwis_transaction_response_header));
+	INIT_LIST_HEAD(&new_instance->process_queue_node);
 
-	/* Allocate response buffer */
-	resp_buf = kmalloc(sizeof(struct lwis_transaction_response_header) +
-				   transaction->resp->results_size_bytes,
-			   GFP_ATOMIC);
-	if (!resp_buf) {
-		kfree(new_instance);
-		dev_err(client->lwis_dev->dev,
-			"Failed to allocate repeating transaction response\n");
-		return NULL;
+	return new_instance;
+}
+
+/* Swaps in the program armed by an in-place replace, between two iterations
+ * of the repeating transaction. Iterations in flight keep running the program
+ * swapped out, which is freed by the last of them. Calling this function
+ * requires holding the client's transaction_lock. */
+static void transaction_swap_replacement_locked(struct lwis_device *lwis_dev,
+						struct lwis_transaction *transaction)
+{
+	unsigned long flags;
+	int num_entries;
+	struct lwis_transaction *replacement = transaction->replacement;
+	struct lwis_transaction_iteration_pool *pool = transaction->iteration_pool;
+	struct lwis_transaction_info *info = &transaction->info;
+	struct lwis_transaction_info *new_info = &replacement->info;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	/* The program swapped out last time is still running */
+	if (pool->retired) {
+		spin_unlock_irqrestore(&pool->lock, flags);
+		return;
 	}
-	memcpy(resp_buf, transaction->resp, sizeof(struct lwis_transaction_response_header));
-	new_instance->resp = (struct lwis_transaction_response_header *)resp_buf;
+	swap(info->io_entries, new_info->io_entries);
+	swap(info->num_io_entries, new_info->num_io_entries);
+	swap(transaction->ops, replacement->ops);
+	swap(transaction->program, replacement->program);
+	swap(transaction->block_mask, replacement->block_mask);
+	swap(transaction->block_locks_only, replacement->block_locks_only);
+	info->run_in_event_context = new_info->run_in_event_context;
+	info->run_at_real_time = new_info->run_at_real_time;
+	info->emit_success_event_id = new_info->emit_success_event_id;
+	info->emit_error_event_id = new_info->emit_error_event_id;
+	info->priority = new_info->priority;
+	info->deadline_ns = new_info->deadline_ns;
+	info->program_handle = new_info->program_handle;
+	transaction->resp->results_size_bytes =
+		transaction_results_size(lwis_dev, transaction, &num_entries);
+	transaction->resp->num_entries = num_entries;
+	pool->generation++;
+	if (pool->num_in_use > 0) {
+		pool->retired = replacement;
+		pool->num_retired_in_use = pool->num_in_use;
+		replacement = NULL;
+	}
+	transaction->replacement = NULL;
+	spin_unlock_irqrestore(&pool->lock, flags);
 
-	INIT_LIST_HEAD(&new_instance->event_list_node);
-	INIT_LIST_HEAD(&new_instance->process_queue_node);
+	/* No iteration runs the program swapped out */
+	if (replacement) {
+		transaction_free_resources(lwis_dev, replacement);
+	}
+}
 
-	return new_instance;
+static void emit_iteration_exhausted(struct lwis_transaction *transaction,
+				     struct list_head *pending_events)
+{
+	struct lwis_transaction_info *info = &transaction->info;
+	struct lwis_transaction_response_header resp;
+	resp.id = info->id;
+	resp.error_code = -ENOBUFS;
+	resp.num_entries = 0;
+	resp.results_size_bytes = 0;
+	resp.completion_index = -1;
+
+	if (pending_events) {
+		lwis_pending_event_push(pending_events, info->emit_error_event_id, &resp,
+					sizeof(resp));
+	}
 }
 
 static void defer_transaction_locked(struct lwis_client *client,
@@ -720,6 +1784,10 @@ static void defer_transaction_locked(struct lwis_client *client,
 	if (del_event_list_node) {
 		list_del(&transaction->event_list_node);
 	}
+	transaction->ready_timestamp_ns = ktime_to_ns(lwis_get_time());
+	trace_lwis_transaction_queue(client->lwis_dev, transaction->info.id,
+				     transaction->info.num_io_entries,
+				     transaction->resp->results_size_bytes, 0);
 
 	/* I2C read/write cannot be executed in IRQ context */
 	if (in_irq && client->lwis_dev->type == DEVICE_TYPE_I2C) {
@@ -730,7 +1798,7 @@ static void defer_transaction_locked(struct lwis_client *client,
 	if (transaction->info.run_in_event_context) {
 		spin_unlock_irqrestore(&client->transaction_lock, flags);
 		process_transaction(client, transaction, pending_events, in_irq,
-				    /*skip_err=*/false);
+				    /*skip_err=*/false, LWIS_TRANSACTION_EXEC_EVENT_CONTEXT);
 		spin_lock_irqsave(&client->transaction_lock, flags);
 	} else if (transaction->info.run_at_real_time) {
 		list_add_tail(&transaction->process_queue_node,
@@ -755,10 +1823,13 @@ int lwis_transaction_event_trigger(struct lwis_client *client, int64_t event_id,
 	spin_lock_irqsave(&client->transaction_lock, flags);
 	event_list = event_list_find(client, event_id);
 	/* No event found, just return. */
-	if (event_list == NULL || list_empty(&event_list->list)) {
+	if (event_list == NULL || (list_empty(&event_list->list) &&
+				   RB_EMPTY_ROOT(&event_list->counter_queue.rb_root))) {
 		spin_unlock_irqrestore(&client->transaction_lock, flags);
 		return 0;
 	}
+	/* Only the transactions targeting this counter leave the counter queue */
+	counter_queue_pop_due_locked(event_list, event_counter);
 
 	/* Go through all transactions under the chosen event list. */
 	list_for_each_safe (it_tran, it_tran_tmp, &event_list->list) {
@@ -778,12 +1849,17 @@ int lwis_transaction_event_trigger(struct lwis_client *client, int64_t event_id,
 			defer_transaction_locked(client, transaction, pending_events, in_irq,
 						 /* del_event_list_node */ true);
 		} else if (trigger_counter == LWIS_EVENT_COUNTER_EVERY_TIME) {
+			if (transaction->replacement) {
+				transaction_swap_replacement_locked(client->lwis_dev, transaction);
+			}
 			new_instance = new_repeating_transaction_iteration(client, transaction);
 			if (!new_instance) {
-				transaction->resp->error_code = -ENOMEM;
-				list_add_tail(&transaction->process_queue_node,
-					      &client->transaction_process_queue);
-				list_del(&transaction->event_list_node);
+				/* All iterations are still in flight, report the skipped
+				 * iteration and keep the transaction armed. */
+				dev_warn_ratelimited(client->lwis_dev->dev,
+						     "Transaction %llu iterations exhausted\n",
+						     transaction->info.id);
+				emit_iteration_exhausted(transaction, pending_events);
 				continue;
 			}
 			defer_transaction_locked(client, new_instance, pending_events, in_irq,
@@ -796,7 +1872,7 @@ int lwis_transaction_event_trigger(struct lwis_client *client, int64_t event_id,
 		tasklet_schedule(&client->transaction_tasklet);
 	}
 	if (!list_empty(&client->transaction_process_queue)) {
-		kthread_queue_work(&client->lwis_dev->transaction_worker,
+		kthread_queue_work(client->transaction_worker,
 				   &client->transaction_work);
 	}
 
@@ -811,6 +1887,7 @@ static int cancel_waiting_transaction_locked(struct lwis_client *client, int64_t
 	int i;
 	struct hlist_node *tmp;
 	struct list_head *it_tran, *it_tran_tmp;
+	struct rb_node *it_node;
 	struct lwis_transaction_event_list *it_evt_list;
 	struct lwis_transaction *transaction;
 
@@ -822,6 +1899,18 @@ static int cancel_waiting_transaction_locked(struct lwis_client *client, int64_t
 				return 0;
 			}
 		}
+		for (it_node = rb_first_cached(&it_evt_list->counter_queue); it_node;
+		     it_node = rb_next(it_node)) {
+			transaction = rb_entry(it_node, struct lwis_transaction, counter_node);
+			if (transaction->info.id == id) {
+				transaction->resp->error_code = -ECANCELED;
+				/* Flushed on the next occurrence of the event, as
+				 * the transactions of the event list */
+				counter_queue_erase_locked(it_evt_list, transaction);
+				list_add_tail(&transaction->event_list_node, &it_evt_list->list);
+				return 0;
+			}
+		}
 	}
 	return -ENOENT;
 }
@@ -838,17 +1927,72 @@ int lwis_transaction_cancel(struct lwis_client *client, int64_t id)
 	return ret;
 }
 
-int lwis_transaction_replace_locked(struct lwis_client *client,
+/* Finds the repeating transaction of id that a replacement can be swapped into
+ * without a new response buffer. Calling this function requires holding the
+ * client's transaction_lock. */
+static struct lwis_transaction *
+find_in_place_replace_target_locked(struct lwis_client *client,
 				    struct lwis_transaction *transaction)
+{
+	struct lwis_transaction_event_list *event_list;
+	struct lwis_transaction *it_tran;
+	struct lwis_transaction_info *info = &transaction->info;
+	int num_entries;
+	size_t resp_size;
+
+	if (info->trigger_event_id == LWIS_EVENT_ID_NONE ||
+	    info->trigger_event_counter != LWIS_EVENT_COUNTER_EVERY_TIME) {
+		return NULL;
+	}
+	event_list = event_list_find(client, info->trigger_event_id);
+	if (!event_list) {
+		return NULL;
+	}
+	/* Repeating transactions never wait in the counter queue */
+	list_for_each_entry (it_tran, &event_list->list, event_list_node) {
+		if (it_tran->info.id != info->id) {
+			continue;
+		}
+		if (it_tran->info.trigger_event_counter != LWIS_EVENT_COUNTER_EVERY_TIME ||
+		    !it_tran->iteration_pool || it_tran->resp->error_code) {
+			return NULL;
+		}
+		resp_size = sizeof(struct lwis_transaction_response_header) +
+			    transaction_results_size(client->lwis_dev, transaction, &num_entries);
+		return resp_size <= it_tran->iteration_pool->resp_size ? it_tran : NULL;
+	}
+	return NULL;
+}
+
+int lwis_transaction_replace_locked(struct lwis_client *client,
+				    struct lwis_transaction *transaction,
+				    struct lwis_transaction **superseded)
 {
 	int ret;
+	struct lwis_transaction *target;
 
+	*superseded = NULL;
 	ret = check_transaction_param_locked(client, transaction,
 					     /*allow_counter_eq=*/false);
 	if (ret) {
 		return ret;
 	}
 
+	/* Replacing a repeating transaction keeps its iterations and response
+	 * buffers, the new program takes over at the next trigger. */
+	target = find_in_place_replace_target_locked(client, transaction);
+	if (target) {
+		*superseded = target->replacement;
+		target->replacement = transaction;
+		transaction->info.submission_timestamp_ns = ktime_to_ns(ktime_get());
+		return 0;
+	}
+	if (transaction->info.trigger_event_id != LWIS_EVENT_ID_NONE &&
+	    transaction->info.trigger_event_counter == LWIS_EVENT_COUNTER_EVERY_TIME &&
+	    !transaction->iteration_pool) {
+		return -EAGAIN;
+	}
+
 	ret = cancel_waiting_transaction_locked(client, transaction->info.id);
 	if (ret) {
 		return ret;
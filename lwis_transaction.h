@@ -11,23 +11,120 @@
 #ifndef LWIS_TRANSACTION_H_
 #define LWIS_TRANSACTION_H_
 
+#include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+
 #include "lwis_commands.h"
 
 /* LWIS forward declarations */
 struct lwis_device;
 struct lwis_client;
+struct lwis_io_program;
+
+/* Context a transaction executes in, latency histograms are kept per
+ * execution context */
+enum lwis_transaction_exec_type {
+	LWIS_TRANSACTION_EXEC_EVENT_CONTEXT,
+	LWIS_TRANSACTION_EXEC_REAL_TIME,
+	LWIS_TRANSACTION_EXEC_WORKER,
+	LWIS_TRANSACTION_EXEC_NUM_TYPES
+};
+
+/* Latency stages of a transaction */
+enum lwis_transaction_latency_stage {
+	/* From the trigger (or submission, if immediate) to execution start */
+	LWIS_TRANSACTION_LATENCY_TRIGGER_TO_START,
+	/* Executing the io_entries */
+	LWIS_TRANSACTION_LATENCY_START_TO_END,
+	/* From execution end to the completion event being emitted */
+	LWIS_TRANSACTION_LATENCY_END_TO_DELIVERED,
+	LWIS_TRANSACTION_LATENCY_NUM_STAGES
+};
+
+/* Handler executing one io_entry of a transaction. resolved is the register
+ * address resolved by vops.register_io_prepare, NULL if the device does not
+ * support it, or the coalesced run for the head of a run. Read handlers append
+ * their lwis_io_result at *read_buf.
+ */
+typedef int (*lwis_transaction_op_handler)(struct lwis_device *lwis_dev,
+					   struct lwis_io_entry *entry, void *resolved,
+					   uint8_t **read_buf, bool in_irq);
+
+/* Pre-decoded io_entry, built once when the transaction is constructed so
+ * that executing it does not need to decode or validate the entry again.
+ */
+struct lwis_transaction_op {
+	lwis_transaction_op_handler handler;
+	void *resolved;
+	/* Device the io_entry executes on, other than the client's device for
+	 * group transactions */
+	struct lwis_device *lwis_dev;
+	/* Head of a run of contiguous io_entries executed as one batch access or
+	 * bus transaction, resolved is then owned by the op */
+	bool coalesced;
+};
 
 /* Transaction entry. Each entry belongs to two queues:
  * 1) Event list: Transactions are sorted by event IDs. This is to search for
- *    the appropriate transactions to trigger.
+ *    the appropriate transactions to trigger. Transactions targeting an
+ *    explicit trigger event counter wait in the counter queue of the event
+ *    list instead, until that counter is reached.
  * 2) Process queue: When it's time to process, the transaction will be put
  *    into a queue.
  */
 struct lwis_transaction {
 	struct lwis_transaction_info info;
+	/* One op per io_entry in info.io_entries */
+	struct lwis_transaction_op *ops;
 	struct lwis_transaction_response_header *resp;
 	struct list_head event_list_node;
+	struct rb_node counter_node;
 	struct list_head process_queue_node;
+	/* Repeating transactions only: preallocated iterations */
+	struct lwis_transaction_iteration_pool *iteration_pool;
+	/* Iterations only: the repeating transaction this iteration belongs to */
+	struct lwis_transaction *parent;
+	/* Iterations only: generation of the program of the parent it runs */
+	uint32_t generation;
+	/* Repeating transactions only: program armed by an in-place replace,
+	 * swapped in at the next trigger */
+	struct lwis_transaction *replacement;
+	/* Time the transaction got triggered, its deadline counts from there */
+	int64_t ready_timestamp_ns;
+	/* io_entry program the io_entries were copied from, which owns their
+	 * write batch buffers. NULL if they were copied from userspace. */
+	struct lwis_io_program *program;
+	/* Independent register blocks touched, computed at submit. Without any
+	 * other block touched, reg_rw_lock is not taken. */
+	uint64_t block_mask;
+	bool block_locks_only;
+	/* Waiting in the counter queue through counter_node, rather than in the
+	 * list of the event list */
+	bool in_counter_queue;
+};
+
+/* Iterations of a repeating transaction, allocated together with their
+ * response buffers when the transaction is submitted, and reused every time
+ * the transaction is triggered. Free iterations are linked through their
+ * process_queue_node.
+ */
+struct lwis_transaction_iteration_pool {
+	spinlock_t lock;
+	struct list_head free_list;
+	int num_in_use;
+	/* Set once the repeating transaction is freed, the last iteration in
+	 * use then completes the free. */
+	bool released;
+	/* Size of the response buffer of each iteration */
+	size_t resp_size;
+	/* Bumped whenever a replacement program is swapped in */
+	uint32_t generation;
+	/* Holds the program swapped out by the last replace until the
+	 * num_retired_in_use iterations still running it are back. No other
+	 * replacement is swapped in meanwhile. */
+	struct lwis_transaction *retired;
+	int num_retired_in_use;
 };
 
 /* For debugging purposes, keeps track of the transaction information, as
@@ -41,7 +138,12 @@ struct lwis_transaction_history {
 
 struct lwis_transaction_event_list {
 	int64_t event_id;
+	/* Transactions triggered on the next or every occurrence, and the ones
+	 * whose trigger counter is due or was missed */
 	struct list_head list;
+	/* Transactions waiting for an explicit trigger counter, by counter then
+	 * submission order */
+	struct rb_root_cached counter_queue;
 	struct hlist_node node;
 };
 
@@ -57,11 +159,47 @@ int lwis_transaction_cancel(struct lwis_client *client, int64_t id);
 
 void lwis_transaction_free(struct lwis_device *lwis_dev, struct lwis_transaction *transaction);
 
+/* Allocates and frees the transaction struct itself, from a dedicated cache */
+struct lwis_transaction *lwis_transaction_alloc(gfp_t flags);
+void lwis_transaction_dealloc(struct lwis_transaction *transaction);
+
+int lwis_transaction_cache_init(void);
+void lwis_transaction_cache_deinit(void);
+
+/* Validates the io_entries of a newly constructed transaction and lowers
+ * them into transaction->ops. Must be called before submitting. */
+int lwis_transaction_prepare(struct lwis_client *client, struct lwis_transaction *transaction);
+/* Same as lwis_transaction_prepare for a group transaction, io_entries[i]
+ * executes on entry_devs[i]. All programs of the group run back to back on
+ * the transaction worker of the client's device. */
+int lwis_transaction_group_prepare(struct lwis_client *client,
+				   struct lwis_transaction *transaction,
+				   struct lwis_device **entry_devs);
+/* Same as lwis_transaction_prepare without the iterations of a repeating
+ * transaction, which a replacement swapped in place reuses. */
+int lwis_transaction_replacement_prepare(struct lwis_client *client,
+					 struct lwis_transaction *transaction);
+/* Preallocates the iterations of a repeating transaction, if not done yet */
+int lwis_transaction_iterations_prepare(struct lwis_client *client,
+					struct lwis_transaction *transaction);
+
 /* Expects lwis_client->transaction_lock to be acquired before calling
  * the following functions. */
 int lwis_transaction_submit_locked(struct lwis_client *client,
 				   struct lwis_transaction *transaction);
+/* Replacing a repeating transaction by another one on the same trigger event
+ * only arms it, the programs are swapped at the next trigger without a gap.
+ * A replacement armed earlier and not swapped in yet is returned in superseded,
+ * to be freed once the lock is released. Returns -EAGAIN if the replacement
+ * needs its own iterations, see lwis_transaction_iterations_prepare. */
 int lwis_transaction_replace_locked(struct lwis_client *client,
-				    struct lwis_transaction *transaction);
+				    struct lwis_transaction *transaction,
+				    struct lwis_transaction **superseded);
+/* Submits all transactions or none of them. error_codes receives one result
+ * per transaction, -ECANCELED for the ones rolled back because another
+ * transaction of the batch failed. */
+int lwis_transaction_submit_batch_locked(struct lwis_client *client,
+					 struct lwis_transaction **transactions,
+					 int num_transactions, int32_t *error_codes);
 
 #endif /* LWIS_TRANSACTION_H_ */
@@ -10,6 +10,8 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME "-util: " fmt
 
+#include <linux/math64.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <uapi/linux/sched/types.h>
 #include "lwis_util.h"
@@ -96,28 +98,124 @@ const char *lwis_device_type_to_string(int32_t type)
 	}
 }
 
-int lwis_create_kthread_workers(struct lwis_device *lwis_dev, const char *transaction_worker_name,
-				const char *periodic_io_worker_name)
+void lwis_init_kthread_workers(struct lwis_device *lwis_dev, const char *transaction_worker_name,
+			       const char *periodic_io_worker_name)
 {
+	kthread_init_worker(&lwis_dev->transaction_worker);
+	kthread_init_worker(&lwis_dev->periodic_io_worker);
+	lwis_dev->transaction_worker_name = transaction_worker_name;
+	lwis_dev->periodic_io_worker_name = periodic_io_worker_name;
+}
+
+static void stop_kthread_workers(struct lwis_device *lwis_dev)
+{
+	if (!IS_ERR_OR_NULL(lwis_dev->transaction_worker_thread)) {
+		kthread_stop(lwis_dev->transaction_worker_thread);
+	}
+	lwis_dev->transaction_worker_thread = NULL;
+	if (!IS_ERR_OR_NULL(lwis_dev->periodic_io_worker_thread)) {
+		kthread_stop(lwis_dev->periodic_io_worker_thread);
+	}
+	lwis_dev->periodic_io_worker_thread = NULL;
+	kthread_init_worker(&lwis_dev->transaction_worker);
+	kthread_init_worker(&lwis_dev->periodic_io_worker);
+}
+
+int lwis_create_kthread_workers(struct lwis_device *lwis_dev)
+{
+	int ret;
+
 	if (!lwis_dev) {
 		pr_err("lwis_create_kthread_workers: lwis_dev is NULL\n");
 		return -ENODEV;
 	}
 
-	kthread_init_worker(&lwis_dev->transaction_worker);
+	/* Already running, or a device type without workers */
+	if (lwis_dev->transaction_worker_thread || !lwis_dev->transaction_worker_name) {
+		return 0;
+	}
+
 	lwis_dev->transaction_worker_thread = kthread_run(kthread_worker_fn,
-			&lwis_dev->transaction_worker, transaction_worker_name);
+			&lwis_dev->transaction_worker, lwis_dev->transaction_worker_name);
 	if (IS_ERR(lwis_dev->transaction_worker_thread)) {
 		dev_err(lwis_dev->dev, "transaction kthread_run failed\n");
-		return -EINVAL;
+		ret = -EINVAL;
+		goto error_create;
 	}
 
-	kthread_init_worker(&lwis_dev->periodic_io_worker);
 	lwis_dev->periodic_io_worker_thread = kthread_run(kthread_worker_fn,
-			&lwis_dev->periodic_io_worker, periodic_io_worker_name);
+			&lwis_dev->periodic_io_worker, lwis_dev->periodic_io_worker_name);
 	if (IS_ERR(lwis_dev->periodic_io_worker_thread)) {
 		dev_err(lwis_dev->dev, "periodic_io kthread_run failed\n");
-		return -EINVAL;
+		ret = -EINVAL;
+		goto error_create;
+	}
+
+	if (lwis_dev->transaction_thread_priority != 0) {
+		ret = lwis_set_kthread_priority(lwis_dev, lwis_dev->transaction_worker_thread,
+						lwis_dev->transaction_thread_priority);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to set transaction kthread priority (%d)\n",
+				ret);
+			goto error_create;
+		}
+	}
+	if (lwis_dev->periodic_io_thread_priority != 0) {
+		ret = lwis_set_kthread_priority(lwis_dev, lwis_dev->periodic_io_worker_thread,
+						lwis_dev->periodic_io_thread_priority);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to set periodic io kthread priority (%d)\n",
+				ret);
+			goto error_create;
+		}
+	}
+
+	lwis_set_kthread_affinity(lwis_dev, lwis_dev->transaction_worker_thread,
+				  &lwis_dev->transaction_thread_cpus);
+	lwis_set_kthread_affinity(lwis_dev, lwis_dev->periodic_io_worker_thread,
+				  &lwis_dev->periodic_io_thread_cpus);
+
+	return 0;
+
+error_create:
+	stop_kthread_workers(lwis_dev);
+	return ret;
+}
+
+struct kthread_worker *lwis_create_client_transaction_worker(struct lwis_device *lwis_dev)
+{
+	struct kthread_worker *worker;
+
+	worker = kthread_create_worker(0, "lwis_trans_%s", lwis_dev->name);
+	if (IS_ERR(worker)) {
+		dev_err(lwis_dev->dev, "Failed to create client transaction worker (%ld)\n",
+			PTR_ERR(worker));
+		return worker;
+	}
+
+	if (lwis_dev->transaction_thread_priority != 0) {
+		lwis_set_kthread_priority(lwis_dev, worker->task,
+					  lwis_dev->transaction_thread_priority);
+	}
+	lwis_set_kthread_affinity(lwis_dev, worker->task, &lwis_dev->transaction_thread_cpus);
+
+	return worker;
+}
+
+int lwis_set_kthread_affinity(struct lwis_device *lwis_dev, struct task_struct *task,
+			      const struct cpumask *cpus)
+{
+	int ret;
+
+	if (cpumask_empty(cpus)) {
+		return 0;
+	}
+
+	ret = set_cpus_allowed_ptr(task, cpus);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to set kthread affinity to %*pbl (%d)",
+			cpumask_pr_args(cpus), ret);
+		return ret;
 	}
 
 	return 0;
@@ -152,4 +250,27 @@ int lwis_set_kthread_priority(struct lwis_device *lwis_dev, struct task_struct *
 	}
 
 	return 0;
-}
\ No newline at end of file
+}
+
+ktime_t lwis_counter_to_time(uint64_t counter, int counter_bits)
+{
+	const uint64_t mask = (counter_bits >= 64) ? U64_MAX : (1ULL << counter_bits) - 1;
+	uint64_t delta;
+	ktime_t now;
+	u32 rate = 0;
+
+#ifdef CONFIG_ARM64
+	rate = arch_timer_get_cntfrq();
+#endif
+	now = lwis_get_time();
+	if (rate == 0) {
+		return now;
+	}
+
+	delta = (lwis_counter_read() - counter) & mask;
+	/* A sample ahead of the counter is taken as now */
+	if (delta > (mask >> 1)) {
+		return now;
+	}
+	return ktime_sub_ns(now, mul_u64_u32_div(delta, NSEC_PER_SEC, rate));
+}
@@ -11,9 +11,17 @@
 #ifndef LWIS_UTIL_H_
 #define LWIS_UTIL_H_
 
+#include <linux/atomic.h>
+#include <linux/bitops.h>
+#include <linux/cpumask.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
 #include <linux/ktime.h>
 
+#ifdef CONFIG_ARM64
+#include <asm/arch_timer.h>
+#endif
+
 #include "lwis_commands.h"
 
 /* Forward declaration for lwis_device. This is needed for the function
@@ -65,10 +73,88 @@ static inline ktime_t lwis_get_time()
 }
 
 /*
- * lwis_create_kthread_workers: Creates kthread workers associated with this lwis device.
+ * lwis_counter_available: Whether the platform has a system counter that
+ * lwis_counter_read can sample.
+ */
+static inline bool lwis_counter_available(void)
+{
+#ifdef CONFIG_ARM64
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * lwis_counter_read: Samples the system counter, which is cheaper than
+ * lwis_get_time and also what hardware timestamp registers commonly latch.
+ * Returns 0 if there is no system counter.
+ */
+static inline uint64_t lwis_counter_read(void)
+{
+#ifdef CONFIG_ARM64
+	return __arch_counter_get_cntvct();
+#else
+	return 0;
+#endif
+}
+
+/*
+ * lwis_counter_to_time: Converts a system counter value sampled in the past,
+ * on a counter that wraps at counter_bits, into the lwis_get_time clock.
+ */
+ktime_t lwis_counter_to_time(uint64_t counter, int counter_bits);
+
+/*
+ * struct lwis_latency_histogram
+ * Latency histogram with log2 buckets, bucket i counts latencies in
+ * [2^i, 2^(i+1)) ns and the last bucket everything above. Updated without
+ * locks, so that it can be recorded from any context.
+ */
+#define LWIS_LATENCY_HISTOGRAM_NUM_BUCKETS 36
+struct lwis_latency_histogram {
+	atomic64_t buckets[LWIS_LATENCY_HISTOGRAM_NUM_BUCKETS];
+};
+
+/*
+ * lwis_latency_histogram_record: Counts one latency sample into the histogram.
+ */
+static inline void lwis_latency_histogram_record(struct lwis_latency_histogram *hist,
+						 int64_t latency_ns)
+{
+	int bucket = latency_ns > 0 ? fls64(latency_ns) - 1 : 0;
+
+	if (bucket >= LWIS_LATENCY_HISTOGRAM_NUM_BUCKETS) {
+		bucket = LWIS_LATENCY_HISTOGRAM_NUM_BUCKETS - 1;
+	}
+	atomic64_inc(&hist->buckets[bucket]);
+}
+
+/*
+ * lwis_latency_histogram_reset: Clears all the buckets of the histogram.
+ */
+static inline void lwis_latency_histogram_reset(struct lwis_latency_histogram *hist)
+{
+	int i;
+
+	for (i = 0; i < LWIS_LATENCY_HISTOGRAM_NUM_BUCKETS; ++i) {
+		atomic64_set(&hist->buckets[i], 0);
+	}
+}
+
+/*
+ * lwis_init_kthread_workers: Initializes the kthread workers associated with
+ * this lwis device, their threads are only created on first open.
  */
-int lwis_create_kthread_workers(struct lwis_device *lwis_dev, const char *transaction_worker_name,
-				const char *periodic_io_worker_name);
+void lwis_init_kthread_workers(struct lwis_device *lwis_dev, const char *transaction_worker_name,
+			       const char *periodic_io_worker_name);
+
+/*
+ * lwis_create_kthread_workers: Creates the threads of the kthread workers
+ * associated with this lwis device, if not running yet.
+ * lwis_dev->client_lock should be held before this function.
+ */
+int lwis_create_kthread_workers(struct lwis_device *lwis_dev);
 
 /*
  * lwis_set_kthread_priority: Set kthread priority.
@@ -76,4 +162,18 @@ int lwis_create_kthread_workers(struct lwis_device *lwis_dev, const char *transa
 int lwis_set_kthread_priority(struct lwis_device *lwis_dev, struct task_struct *task,
 			      u32 priority);
 
+/*
+ * lwis_set_kthread_affinity: Restrict kthread to cpus, does nothing if cpus
+ * is empty.
+ */
+int lwis_set_kthread_affinity(struct lwis_device *lwis_dev, struct task_struct *task,
+			      const struct cpumask *cpus);
+
+/*
+ * lwis_create_client_transaction_worker: Creates a transaction worker
+ * dedicated to one client, with the priority and affinity of the device
+ * transaction worker.
+ */
+struct kthread_worker *lwis_create_client_transaction_worker(struct lwis_device *lwis_dev);
+
 #endif // LWIS_UTIL_H_
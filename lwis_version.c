@@ -11,6 +11,7 @@
 #include <linux/kernel.h>
 #include <linux/string.h>
 
+#include "lwis_ioctl.h"
 #include "lwis_version.h"
 
 void lwis_get_feature_flags(char *buffer, size_t buffer_size)
@@ -30,5 +31,36 @@ void lwis_get_feature_flags(char *buffer, size_t buffer_size)
 	 */
 	strlcat(buffer, "core", buffer_size);
 
+	/* event-ring:
+	 * Events can be consumed from a ring mapped with mmap after LWIS_EVENT_RING_SETUP.
+	 */
+	strlcat(buffer, " event-ring", buffer_size);
+
+	/* event-queue-depth:
+	 * The event queue depth is set with LWIS_EVENT_QUEUE_DEPTH_SET and full queues follow the
+	 * LWIS_EVENT_CONTROL_FLAG_OVERFLOW_* policy of the event.
+	 */
+	strlcat(buffer, " event-queue-depth", buffer_size);
+
+	/* event-control-v2:
+	 * Event coalescing and decimation are configured through LWIS_EVENT_CONTROL_GET_V2 and
+	 * LWIS_EVENT_CONTROL_SET_V2 with struct lwis_event_control_v2.
+	 */
+	strlcat(buffer, " event-control-v2", buffer_size);
+
+	/* reg-io-replay:
+	 * Register accesses captured in the reg_io_capture debugfs file are replayed with
+	 * LWIS_REG_IO_REPLAY.
+	 */
+	strlcat(buffer, " reg-io-replay", buffer_size);
+
+	/* uring-cmd:
+	 * Transactions, register I/O, event dequeue and buffer enrollment can be
+	 * submitted as IORING_OP_URING_CMD, see struct lwis_uring_cmd.
+	 */
+	if (LWIS_URING_CMD_SUPPORTED) {
+		strlcat(buffer, " uring-cmd", buffer_size);
+	}
+
 	strlcat(buffer, "\n", buffer_size);
 }
\ No newline at end of file
@@ -84,6 +84,8 @@ static int lwis_iommu_fault_handler(struct iommu_fault *fault, void *param)
 	pr_err("\n");
 	lwis_debug_print_buffer_info(lwis_dev);
 	pr_err("\n");
+	lwis_debug_print_buffer_at(lwis_dev, fault->event.addr);
+	pr_err("\n");
 	pr_err("###############################################\n");
 
 	event_payload.fault_address = fault->event.addr;
@@ -0,0 +1,355 @@
+/*
+ * Google LWIS Userspace IOCTL Benchmark
+ *
+ * Copyright (c) 2021 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Measures the ioctl paths of a LWIS device from userspace and prints one
+ * summary line and a log2 latency histogram per measurement, in the same
+ * "<name> <key>=<value>..." form as the debugfs benchmark file.
+ *
+ * Build against the uapi header of this tree, e.g.:
+ *   $CC -O2 -static -I../.. -o lwis_bench lwis_bench.c
+ *
+ * Usage:
+ *   lwis_bench [-n iterations] [-e] [-b bid -o offset] /dev/lwis-<name>
+ *     -e  enable the device for the run, needed for register io and
+ *         transactions
+ *     -b, -o  register read by the register io and transaction benchmarks,
+ *         which are skipped without them
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lwis_commands.h"
+
+#define BENCH_FORMAT_VERSION 1
+#define BENCH_DEFAULT_ITERATIONS 1000
+#define BENCH_HIST_BUCKETS 40
+#define BENCH_MAX_REG_IO_ENTRIES 64
+#define BENCH_EVENT_PAYLOAD_SIZE 4096
+#define BENCH_EVENT_CODE 1
+
+struct bench_hist {
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+	uint64_t buckets[BENCH_HIST_BUCKETS];
+};
+
+static int iterations = BENCH_DEFAULT_ITERATIONS;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Bucket i counts samples in [2^i, 2^(i+1)) ns, bucket 0 also counts 0 */
+static void hist_record(struct bench_hist *hist, uint64_t ns)
+{
+	int bucket = 0;
+
+	while (bucket < BENCH_HIST_BUCKETS - 1 && (ns >> (bucket + 1)) != 0) {
+		bucket++;
+	}
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sum_ns += ns;
+	if (ns > hist->max_ns) {
+		hist->max_ns = ns;
+	}
+}
+
+/* Upper bound of the bucket holding the given percentile */
+static uint64_t hist_percentile(const struct bench_hist *hist, int percentile)
+{
+	int i;
+	uint64_t seen = 0;
+	uint64_t target = (hist->count * percentile + 99) / 100;
+
+	for (i = 0; i < BENCH_HIST_BUCKETS; ++i) {
+		seen += hist->buckets[i];
+		if (seen >= target) {
+			return 1ULL << (i + 1);
+		}
+	}
+	return hist->max_ns;
+}
+
+static void hist_print(const char *name, const char *param, uint64_t value,
+		       const struct bench_hist *hist)
+{
+	int i;
+
+	if (hist->count == 0) {
+		printf("%s %s=%llu count=0\n", name, param, (unsigned long long)value);
+		return;
+	}
+	printf("%s %s=%llu count=%llu mean_ns=%llu p50_ns=%llu p99_ns=%llu max_ns=%llu\n", name,
+	       param, (unsigned long long)value, (unsigned long long)hist->count,
+	       (unsigned long long)(hist->sum_ns / hist->count),
+	       (unsigned long long)hist_percentile(hist, 50),
+	       (unsigned long long)hist_percentile(hist, 99), (unsigned long long)hist->max_ns);
+	for (i = 0; i < BENCH_HIST_BUCKETS; ++i) {
+		if (hist->buckets[i] == 0) {
+			continue;
+		}
+		printf("%s_hist %s=%llu lo_ns=%llu hi_ns=%llu count=%llu\n", name, param,
+		       (unsigned long long)value, i == 0 ? 0ULL : 1ULL << i, 1ULL << (i + 1),
+		       (unsigned long long)hist->buckets[i]);
+	}
+}
+
+static void bench_reg_io(int fd, int32_t bid, uint64_t offset)
+{
+	int i, n;
+	uint64_t start;
+	struct bench_hist hist;
+	struct lwis_io_entry entries[BENCH_MAX_REG_IO_ENTRIES];
+	struct lwis_io_entries msg;
+
+	for (n = 1; n <= BENCH_MAX_REG_IO_ENTRIES; n *= 2) {
+		memset(&hist, 0, sizeof(hist));
+		memset(entries, 0, sizeof(entries));
+		for (i = 0; i < n; ++i) {
+			entries[i].type = LWIS_IO_ENTRY_READ;
+			entries[i].rw.bid = bid;
+			entries[i].rw.offset = offset;
+		}
+		msg.num_io_entries = n;
+		msg.io_entries = entries;
+		for (i = 0; i < iterations; ++i) {
+			start = now_ns();
+			if (ioctl(fd, LWIS_REG_IO, &msg) < 0) {
+				fprintf(stderr, "LWIS_REG_IO failed: %s\n", strerror(errno));
+				return;
+			}
+			hist_record(&hist, now_ns() - start);
+		}
+		hist_print("reg_io", "entries", n, &hist);
+	}
+}
+
+static int enable_event_queue(int fd, int64_t event_id)
+{
+	struct lwis_event_control control;
+	struct lwis_event_control_list list;
+
+	memset(&control, 0, sizeof(control));
+	control.event_id = event_id;
+	control.flags = LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE;
+	list.num_event_controls = 1;
+	list.event_controls = &control;
+	return ioctl(fd, LWIS_EVENT_CONTROL_SET, &list);
+}
+
+/* Submits immediate transactions, then dequeues the completion events they
+ * emit */
+static void bench_transactions(int fd, int32_t bid, uint64_t offset)
+{
+	int i;
+	uint64_t start;
+	uint64_t total_start;
+	struct bench_hist submit_hist;
+	struct bench_hist dequeue_hist;
+	struct lwis_io_entry entry;
+	struct lwis_transaction_info info;
+	struct lwis_event_info event;
+	static char payload[BENCH_EVENT_PAYLOAD_SIZE];
+	int64_t success_event_id = LWIS_TRANSACTION_EVENT_FLAG | BENCH_EVENT_CODE;
+	int64_t error_event_id = LWIS_TRANSACTION_FAILURE_EVENT_FLAG | BENCH_EVENT_CODE;
+	int submitted = 0;
+	int dequeued = 0;
+
+	if (enable_event_queue(fd, success_event_id) < 0 ||
+	    enable_event_queue(fd, error_event_id) < 0) {
+		fprintf(stderr, "LWIS_EVENT_CONTROL_SET failed: %s\n", strerror(errno));
+		return;
+	}
+
+	memset(&submit_hist, 0, sizeof(submit_hist));
+	memset(&entry, 0, sizeof(entry));
+	entry.type = LWIS_IO_ENTRY_READ;
+	entry.rw.bid = bid;
+	entry.rw.offset = offset;
+	total_start = now_ns();
+	for (i = 0; i < iterations; ++i) {
+		memset(&info, 0, sizeof(info));
+		info.trigger_event_id = LWIS_EVENT_ID_NONE;
+		info.num_io_entries = 1;
+		info.io_entries = &entry;
+		info.emit_success_event_id = success_event_id;
+		info.emit_error_event_id = error_event_id;
+		start = now_ns();
+		if (ioctl(fd, LWIS_TRANSACTION_SUBMIT, &info) < 0) {
+			fprintf(stderr, "LWIS_TRANSACTION_SUBMIT failed: %s\n", strerror(errno));
+			break;
+		}
+		hist_record(&submit_hist, now_ns() - start);
+		submitted++;
+	}
+	hist_print("transaction_submit", "entries", 1, &submit_hist);
+	printf("transaction_submit_rate entries=1 submitted=%d per_sec=%llu\n", submitted,
+	       (unsigned long long)(submitted * 1000000000ULL / (now_ns() - total_start + 1)));
+
+	memset(&dequeue_hist, 0, sizeof(dequeue_hist));
+	total_start = now_ns();
+	while (dequeued < submitted) {
+		memset(&event, 0, sizeof(event));
+		event.payload_buffer_size = sizeof(payload);
+		event.payload_buffer = payload;
+		start = now_ns();
+		if (ioctl(fd, LWIS_EVENT_DEQUEUE, &event) < 0) {
+			if (errno == ENOENT) {
+				/* The worker has not completed the transaction yet */
+				usleep(100);
+				continue;
+			}
+			fprintf(stderr, "LWIS_EVENT_DEQUEUE failed: %s\n", strerror(errno));
+			break;
+		}
+		hist_record(&dequeue_hist, now_ns() - start);
+		dequeued++;
+	}
+	hist_print("event_dequeue", "payload_buffer", sizeof(payload), &dequeue_hist);
+	printf("event_dequeue_rate dequeued=%d per_sec=%llu\n", dequeued,
+	       (unsigned long long)(dequeued * 1000000000ULL / (now_ns() - total_start + 1)));
+}
+
+static void bench_buffer_enroll(int fd)
+{
+	int i;
+	size_t size;
+	uint64_t start;
+	struct bench_hist enroll_hist;
+	struct bench_hist disenroll_hist;
+	struct lwis_alloc_buffer_info alloc_info;
+	struct lwis_buffer_info enroll_info;
+	struct lwis_enrolled_buffer_info disenroll_info;
+
+	for (size = 4096; size <= 16 * 1024 * 1024; size *= 4) {
+		memset(&alloc_info, 0, sizeof(alloc_info));
+		alloc_info.size = size;
+		if (ioctl(fd, LWIS_BUFFER_ALLOC, &alloc_info) < 0) {
+			fprintf(stderr, "LWIS_BUFFER_ALLOC of %zu bytes failed: %s\n", size,
+				strerror(errno));
+			return;
+		}
+
+		memset(&enroll_hist, 0, sizeof(enroll_hist));
+		memset(&disenroll_hist, 0, sizeof(disenroll_hist));
+		for (i = 0; i < iterations; ++i) {
+			memset(&enroll_info, 0, sizeof(enroll_info));
+			enroll_info.fd = alloc_info.dma_fd;
+			enroll_info.dma_read = true;
+			enroll_info.dma_write = true;
+			start = now_ns();
+			if (ioctl(fd, LWIS_BUFFER_ENROLL, &enroll_info) < 0) {
+				fprintf(stderr, "LWIS_BUFFER_ENROLL failed: %s\n", strerror(errno));
+				break;
+			}
+			hist_record(&enroll_hist, now_ns() - start);
+
+			disenroll_info.fd = alloc_info.dma_fd;
+			disenroll_info.dma_vaddr = enroll_info.dma_vaddr;
+			start = now_ns();
+			if (ioctl(fd, LWIS_BUFFER_DISENROLL, &disenroll_info) < 0) {
+				fprintf(stderr, "LWIS_BUFFER_DISENROLL failed: %s\n", strerror(errno));
+				break;
+			}
+			hist_record(&disenroll_hist, now_ns() - start);
+		}
+		hist_print("buffer_enroll", "size", size, &enroll_hist);
+		hist_print("buffer_disenroll", "size", size, &disenroll_hist);
+
+		ioctl(fd, LWIS_BUFFER_FREE, &alloc_info.dma_fd);
+		close(alloc_info.dma_fd);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	int fd;
+	bool enable = false;
+	bool has_reg = false;
+	int32_t bid = 0;
+	uint64_t offset = 0;
+	struct lwis_device_info info;
+
+	while ((opt = getopt(argc, argv, "n:eb:o:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = atoi(optarg);
+			break;
+		case 'e':
+			enable = true;
+			break;
+		case 'b':
+			bid = atoi(optarg);
+			has_reg = true;
+			break;
+		case 'o':
+			offset = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-n iterations] [-e] [-b bid -o offset] device\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc || iterations <= 0) {
+		fprintf(stderr, "Usage: %s [-n iterations] [-e] [-b bid -o offset] device\n",
+			argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDWR);
+	if (fd < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	memset(&info, 0, sizeof(info));
+	if (ioctl(fd, LWIS_GET_DEVICE_INFO, &info) < 0) {
+		fprintf(stderr, "LWIS_GET_DEVICE_INFO failed: %s\n", strerror(errno));
+		close(fd);
+		return 1;
+	}
+	printf("lwis_bench version=%d device=%s id=%d iterations=%d\n", BENCH_FORMAT_VERSION,
+	       info.name, info.id, iterations);
+
+	if (enable && ioctl(fd, LWIS_DEVICE_ENABLE) < 0) {
+		fprintf(stderr, "LWIS_DEVICE_ENABLE failed: %s\n", strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	if (has_reg) {
+		bench_reg_io(fd, bid, offset);
+		bench_transactions(fd, bid, offset);
+	}
+	bench_buffer_enroll(fd);
+
+	if (enable) {
+		ioctl(fd, LWIS_DEVICE_DISABLE);
+	}
+	close(fd);
+	return 0;
+}